@@ -515,11 +515,16 @@ static AppProto AppLayerProtoDetectPPGetProto(Flow *f, const uint8_t *buf, uint3
     const AppLayerProtoDetectProbingParserElement *pe1 = NULL;
     const AppLayerProtoDetectProbingParserElement *pe2 = NULL;
     AppProto alproto = ALPROTO_UNKNOWN;
+    /* the masks live in the cold part of the flow, which is only allocated
+     * if a parser rules itself out. Work on a copy. */
+    const FlowCold *fc = FlowColdGet(f);
+    uint32_t masks[2] = { fc->probing_parser_toserver_alproto_masks,
+        fc->probing_parser_toclient_alproto_masks };
     uint32_t *alproto_masks = NULL;
     uint32_t mask = 0;
     uint8_t idir = (flags & (STREAM_TOSERVER | STREAM_TOCLIENT));
     uint8_t dir = idir;
-    uint16_t dp = f->protodetect_dp ? f->protodetect_dp : FLOW_GET_DP(f);
+    uint16_t dp = fc->protodetect_dp ? fc->protodetect_dp : FLOW_GET_DP(f);
     uint16_t sp = FLOW_GET_SP(f);
     bool probe_is_found = false;
 
@@ -533,7 +538,7 @@ again_midstream:
     if (dir == STREAM_TOSERVER) {
         /* first try the destination port */
         pp_port_dp = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, dp);
-        alproto_masks = &f->probing_parser_toserver_alproto_masks;
+        alproto_masks = &masks[0];
         if (pp_port_dp != NULL) {
             SCLogDebug("toserver - Probing parser found for destination port %"PRIu16, dp);
 
@@ -558,7 +563,7 @@ again_midstream:
         if (dir == idir) {
             // do not update alproto_masks to let a chance to second packet
             // for instance when sending a junk packet to a DNS server
-            alproto_masks = &f->probing_parser_toclient_alproto_masks;
+            alproto_masks = &masks[1];
         }
         if (pp_port_dp != NULL) {
             SCLogDebug("toclient - Probing parser found for destination port %"PRIu16, dp);
@@ -645,6 +650,14 @@ noparsers:
         SCLogDebug("PP found %u, is reverse flow", alproto);
         *reverse_flow = true;
     }
+    if (masks[0] != fc->probing_parser_toserver_alproto_masks ||
+            masks[1] != fc->probing_parser_toclient_alproto_masks) {
+        FlowCold *wfc = FlowColdGetOrAlloc(f);
+        if (wfc != NULL) {
+            wfc->probing_parser_toserver_alproto_masks = masks[0];
+            wfc->probing_parser_toclient_alproto_masks = masks[1];
+        }
+    }
 
     SCLogDebug("%s, mask is now %08x",
             (idir == STREAM_TOSERVER) ? "toserver":"toclient", alproto_masks[0]);
@@ -1838,11 +1851,15 @@ bool AppLayerRequestProtocolChange(Flow *f, uint16_t dp, AppProto expect_proto)
         // we do not proceed the new protocol change
         return false;
     }
+    FlowCold *fc = FlowColdGetOrAlloc(f);
+    if (fc == NULL) {
+        return false;
+    }
     FlowSetChangeProtoFlag(f);
-    f->protodetect_dp = dp;
-    f->alproto_expect = expect_proto;
+    fc->protodetect_dp = dp;
+    fc->alproto_expect = expect_proto;
     DEBUG_VALIDATE_BUG_ON(f->alproto == ALPROTO_UNKNOWN);
-    f->alproto_orig = f->alproto;
+    fc->alproto_orig = f->alproto;
     // If one side is unknown yet, set it to the other known side
     if (f->alproto_ts == ALPROTO_UNKNOWN) {
         f->alproto_ts = f->alproto;
@@ -1874,8 +1891,10 @@ void AppLayerProtoDetectReset(Flow *f)
     FLOW_RESET_PP_DONE(f, STREAM_TOCLIENT);
     FLOW_RESET_PE_DONE(f, STREAM_TOSERVER);
     FLOW_RESET_PE_DONE(f, STREAM_TOCLIENT);
-    f->probing_parser_toserver_alproto_masks = 0;
-    f->probing_parser_toclient_alproto_masks = 0;
+    if (f->cold != NULL) {
+        f->cold->probing_parser_toserver_alproto_masks = 0;
+        f->cold->probing_parser_toclient_alproto_masks = 0;
+    }
 
     // Does not free the structures for the parser
     // keeps f->alstate for new state creation
@@ -31,6 +31,7 @@
 #include "app-layer-parser.h"
 #include "app-layer-expectation.h"
 #include "app-layer-detect-proto.h"
+#include "flow-util.h"
 
 #include "rust.h"
 
@@ -1036,7 +1037,12 @@ static AppLayerResult FTPDataParse(Flow *f, FtpDataState *ftpdata_state,
         ftpdata_state->file_len = data->file_len;
         data->file_name = NULL;
         data->file_len = 0;
-        f->parent_id = data->flow_id;
+        /* the expectation data is in the flow storage, so the cold part
+         * exists already */
+        FlowCold *fc = FlowColdGetOrAlloc(f);
+        if (fc != NULL) {
+            fc->parent_id = data->flow_id;
+        }
         ftpdata_state->command = data->cmd;
         switch (data->cmd) {
             case FTP_COMMAND_STOR:
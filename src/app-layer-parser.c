@@ -1348,7 +1348,7 @@ int AppLayerParserParse(ThreadVars *tv, AppLayerParserThreadCtx *alp_tctx, Flow
 
     alstate = f->alstate;
     if (alstate == NULL || FlowChangeProto(f)) {
-        f->alstate = alstate = p->StateAlloc(alstate, f->alproto_orig);
+        f->alstate = alstate = p->StateAlloc(alstate, FlowColdGet(f)->alproto_orig);
         if (alstate == NULL) {
             AppLayerIncAllocErrorCounter(tv, f);
             goto error;
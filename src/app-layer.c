@@ -711,7 +711,9 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx, Packet
             goto failure;
         }
     } else if (alproto != ALPROTO_UNKNOWN && FlowChangeProto(f)) {
-        SCLogDebug("protocol change, old %s", AppProtoToString(f->alproto_orig));
+        /* set up by AppLayerRequestProtocolChange */
+        const FlowCold *fc = FlowColdGet(f);
+        SCLogDebug("protocol change, old %s", AppProtoToString(fc->alproto_orig));
         void *alstate_orig = f->alstate;
         AppLayerParserState *alparser = f->alparser;
         // we delay AppLayerParserStateCleanup because we may need previous parser state
@@ -725,12 +727,12 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx, Packet
             DEBUG_VALIDATE_BUG_ON(alstate_orig != f->alstate);
             // not enough data, revert AppLayerProtoDetectReset to rerun detection
             f->alparser = alparser;
-            f->alproto = f->alproto_orig;
-            f->alproto_tc = f->alproto_orig;
-            f->alproto_ts = f->alproto_orig;
+            f->alproto = fc->alproto_orig;
+            f->alproto_tc = fc->alproto_orig;
+            f->alproto_ts = fc->alproto_orig;
         } else {
             FlowUnsetChangeProtoFlag(f);
-            AppLayerParserStateProtoCleanup(f->protomap, f->alproto_orig, alstate_orig, alparser);
+            AppLayerParserStateProtoCleanup(f->protomap, fc->alproto_orig, alstate_orig, alparser);
             if (alstate_orig == f->alstate) {
                 // we just freed it
                 f->alstate = NULL;
@@ -741,14 +743,14 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx, Packet
             goto failure;
         }
         SCLogDebug("protocol change, old %s, new %s",
-                AppProtoToString(f->alproto_orig), AppProtoToString(f->alproto));
+                AppProtoToString(fc->alproto_orig), AppProtoToString(f->alproto));
 
-        if (f->alproto_expect != ALPROTO_UNKNOWN && f->alproto != ALPROTO_UNKNOWN &&
-                f->alproto != f->alproto_expect) {
+        if (fc->alproto_expect != ALPROTO_UNKNOWN && f->alproto != ALPROTO_UNKNOWN &&
+                f->alproto != fc->alproto_expect) {
             AppLayerDecoderEventsSetEventRaw(&p->app_layer_events,
                                              APPLAYER_UNEXPECTED_PROTOCOL);
 
-            if (f->alproto_expect == ALPROTO_TLS && f->alproto != ALPROTO_TLS) {
+            if (fc->alproto_expect == ALPROTO_TLS && f->alproto != ALPROTO_TLS) {
                 AppLayerDecoderEventsSetEventRaw(&p->app_layer_events,
                         APPLAYER_NO_TLS_AFTER_STARTTLS);
 
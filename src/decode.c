@@ -67,6 +67,7 @@
 #include "util-print.h"
 #include "util-profiling.h"
 #include "util-validate.h"
+#include "util-arena.h"
 #include "action-globals.h"
 
 uint32_t default_packet_size = 0;
@@ -128,13 +129,28 @@ static int DecodeTunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const
     return TM_ECODE_OK;
 }
 
+static SCArena *packet_arena = NULL;
+
+/**
+ * \brief Setup the hugepage arena for packets, if enabled.
+ *
+ * Needs to run after the default packet size has been set.
+ */
+void PacketArenaInit(void)
+{
+    packet_arena = SCArenaCreate("packet", SIZE_OF_PACKET);
+}
+
 /**
  * \brief Return a malloced packet.
  */
 void PacketFree(Packet *p)
 {
     PacketDestructor(p);
-    SCFree(p);
+    if (SCArenaOwns(p))
+        SCArenaFree(packet_arena, p);
+    else
+        SCFree(p);
 }
 
 /**
@@ -172,9 +188,14 @@ void PacketUpdateEngineEventCounters(ThreadVars *tv,
  */
 Packet *PacketGetFromAlloc(void)
 {
-    Packet *p = SCCalloc(1, SIZE_OF_PACKET);
-    if (unlikely(p == NULL)) {
-        return NULL;
+    Packet *p = SCArenaAlloc(packet_arena);
+    if (p != NULL) {
+        memset(p, 0, SIZE_OF_PACKET);
+    } else {
+        p = SCCalloc(1, SIZE_OF_PACKET);
+        if (unlikely(p == NULL)) {
+            return NULL;
+        }
     }
     PacketInit(p);
     p->ReleasePacket = PacketFree;
@@ -588,6 +609,8 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_flow_spare_sync = StatsRegisterCounter("flow.wrk.spare_sync", tv);
     dtv->counter_flow_spare_sync_incomplete = StatsRegisterCounter("flow.wrk.spare_sync_incomplete", tv);
     dtv->counter_flow_spare_sync_empty = StatsRegisterCounter("flow.wrk.spare_sync_empty", tv);
+    dtv->counter_flow_spare_sync_remote =
+            StatsRegisterCounter("flow.wrk.spare_sync_remote", tv);
 
     dtv->counter_defrag_ipv4_fragments =
         StatsRegisterCounter("defrag.ipv4.fragments", tv);
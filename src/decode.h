@@ -747,6 +747,7 @@ typedef struct DecodeThreadVars_
     uint16_t counter_flow_spare_sync_empty;
     uint16_t counter_flow_spare_sync_incomplete;
     uint16_t counter_flow_spare_sync_avg;
+    uint16_t counter_flow_spare_sync_remote;
 
     uint16_t counter_engine_events[DECODE_EVENT_MAX];
 
@@ -828,6 +829,7 @@ void PacketDecodeFinalize(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p);
 void PacketUpdateEngineEventCounters(ThreadVars *tv,
         DecodeThreadVars *dtv, Packet *p);
 void PacketFree(Packet *p);
+void PacketArenaInit(void);
 void PacketFreeOrRelease(Packet *p);
 int PacketCallocExtPkt(Packet *p, int datalen);
 int PacketCopyData(Packet *p, const uint8_t *pktdata, uint32_t pktlen);
@@ -988,7 +990,9 @@ void DecodeUnregisterCounters(void);
 
 /** Flag to indicate that packet header or contents should not be inspected */
 #define PKT_NOPACKET_INSPECTION BIT_U32(0)
-// vacancy
+/** Packet is held by the stream engine to be inspected with later packets
+ *  of the flow, see stream.reassembly.inline-batch */
+#define PKT_STREAM_HELD BIT_U32(1)
 
 /** Flag to indicate that packet contents should not be inspected */
 #define PKT_NOPAYLOAD_INSPECTION BIT_U32(2)
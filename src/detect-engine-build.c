@@ -42,6 +42,9 @@
 #include "util-validate.h"
 #include "util-var-name.h"
 #include "util-conf.h"
+#include "util-print.h"
+#include "util-time.h"
+#include "util-mpm-hs-cache.h"
 
 void SigCleanSignatures(DetectEngineCtx *de_ctx)
 {
@@ -1973,9 +1976,45 @@ static int SigMatchPrepare(DetectEngineCtx *de_ctx)
  * \retval  0 On Success.
  * \retval -1 On failure.
  */
+/** stages of SigGroupBuild that are timed */
+enum SigGroupBuildStage {
+    BUILD_STAGE_FAST_PATTERN = 0,
+    BUILD_STAGE_1,
+    BUILD_STAGE_2,
+    BUILD_STAGE_3,
+    BUILD_STAGE_4,
+    BUILD_STAGE_MPM,
+    BUILD_STAGE_SIGMATCH,
+    BUILD_STAGE_MAX,
+};
+
+static const char *build_stage_names[BUILD_STAGE_MAX] = {
+    "fast-pattern", "stage1", "stage2", "stage3", "stage4", "mpm-prepare", "sigmatch-prepare",
+};
+
+/** \internal
+ *  \brief log the time spent in each stage of SigGroupBuild
+ *
+ *  \param ts BUILD_STAGE_MAX + 1 timestamps, ts[x] is the start of stage x
+ */
+static void SigGroupBuildReportTimes(const struct timeval *ts)
+{
+    char report[256] = "";
+    uint32_t offset = 0;
+    for (int i = 0; i < BUILD_STAGE_MAX; i++) {
+        const uint64_t msecs = TimeDifferenceMicros(ts[i], ts[i + 1]) / 1000;
+        PrintBufferData(report, &offset, (uint32_t)sizeof(report), "%s%s %" PRIu64 "ms",
+                i ? ", " : "", build_stage_names[i], msecs);
+    }
+    SCLogInfo("detection engine built in %" PRIu64 "ms: %s",
+            TimeDifferenceMicros(ts[0], ts[BUILD_STAGE_MAX]) / 1000, report);
+}
+
 int SigGroupBuild(DetectEngineCtx *de_ctx)
 {
     Signature *s = de_ctx->sig_list;
+    struct timeval stage_ts[BUILD_STAGE_MAX + 1];
+    gettimeofday(&stage_ts[BUILD_STAGE_FAST_PATTERN], NULL);
 
     /* Assign the unique order id of signatures after sorting,
      * so the IP Only engine process them in order too.  Also
@@ -1994,32 +2033,43 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
 
     SigInitStandardMpmFactoryContexts(de_ctx);
 
+    gettimeofday(&stage_ts[BUILD_STAGE_1], NULL);
     if (SigAddressPrepareStage1(de_ctx) != 0) {
         FatalError("initializing the detection engine failed");
     }
 
+    gettimeofday(&stage_ts[BUILD_STAGE_2], NULL);
     if (SigAddressPrepareStage2(de_ctx) != 0) {
         FatalError("initializing the detection engine failed");
     }
 
+    gettimeofday(&stage_ts[BUILD_STAGE_3], NULL);
     if (SigAddressPrepareStage3(de_ctx) != 0) {
         FatalError("initializing the detection engine failed");
     }
+    gettimeofday(&stage_ts[BUILD_STAGE_4], NULL);
     if (SigAddressPrepareStage4(de_ctx) != 0) {
         FatalError("initializing the detection engine failed");
     }
 
-    int r = DetectMpmPrepareBuiltinMpms(de_ctx);
-    r |= DetectMpmPrepareAppMpms(de_ctx);
-    r |= DetectMpmPreparePktMpms(de_ctx);
-    r |= DetectMpmPrepareFrameMpms(de_ctx);
-    if (r != 0) {
+    gettimeofday(&stage_ts[BUILD_STAGE_MPM], NULL);
+    if (DetectMpmPrepareAll(de_ctx) != 0) {
         FatalError("initializing the detection engine failed");
     }
 
+    gettimeofday(&stage_ts[BUILD_STAGE_SIGMATCH], NULL);
     if (SigMatchPrepare(de_ctx) != 0) {
         FatalError("initializing the detection engine failed");
     }
+    gettimeofday(&stage_ts[BUILD_STAGE_MAX], NULL);
+    SigGroupBuildReportTimes(stage_ts);
+
+#ifdef BUILD_HYPERSCAN
+    /* all databases of this engine are loaded or stored by now */
+    if (de_ctx->mpm_matcher == MPM_HS) {
+        MpmHSCachePrune();
+    }
+#endif
 
 #ifdef PROFILING
     SCProfilingKeywordInitCounters(de_ctx);
@@ -26,6 +26,7 @@
 #include "conf.h"
 #include "detect.h"
 #include "detect-parse.h"
+#include "detect-pcre.h"
 
 #include "runmodes.h"
 #include "threads.h"
@@ -43,6 +44,7 @@
 #include "util-detect.h"
 #include "util-threshold-config.h"
 #include "util-path.h"
+#include "util-cpu.h"
 
 #ifdef HAVE_GLOB_H
 #include <glob.h>
@@ -101,8 +103,51 @@ char *DetectLoadCompleteSigPath(const DetectEngineCtx *de_ctx, const char *sig_f
     return path;
 }
 
+/** rules read from a file, with the line they start at */
+typedef struct SigFileRules_ {
+    char **rules;
+    int *linenos;
+    uint32_t cnt;
+    uint32_t size;
+} SigFileRules;
+
+static int SigFileRulesAdd(SigFileRules *r, const char *rule, int lineno)
+{
+    if (r->cnt == r->size) {
+        const uint32_t size = r->size ? r->size * 2 : 256;
+        char **rules = SCRealloc(r->rules, size * sizeof(char *));
+        if (rules == NULL)
+            return -1;
+        r->rules = rules;
+        int *linenos = SCRealloc(r->linenos, size * sizeof(int));
+        if (linenos == NULL)
+            return -1;
+        r->linenos = linenos;
+        r->size = size;
+    }
+    r->rules[r->cnt] = SCStrdup(rule);
+    if (r->rules[r->cnt] == NULL)
+        return -1;
+    r->linenos[r->cnt] = lineno;
+    r->cnt++;
+    return 0;
+}
+
+static void SigFileRulesFree(SigFileRules *r)
+{
+    for (uint32_t i = 0; i < r->cnt; i++) {
+        SCFree(r->rules[i]);
+    }
+    SCFree(r->rules);
+    SCFree(r->linenos);
+}
+
 /**
  *  \brief Load a file with signatures
+ *
+ *  The whole file is read first, so that the regexes of its rules can be
+ *  compiled in parallel before the rules are parsed in file order.
+ *
  *  \param de_ctx Pointer to the detection engine context
  *  \param sig_file Filename to load signatures from
  *  \param goodsigs_tot Will store number of valid signatures in the file
@@ -117,6 +162,7 @@ static int DetectLoadSigFile(DetectEngineCtx *de_ctx, char *sig_file,
     char line[DETECT_MAX_RULE_SIZE] = "";
     size_t offset = 0;
     int lineno = 0, multiline = 0;
+    SigFileRules rules = { NULL, NULL, 0, 0 };
 
     (*goodsigs) = 0;
     (*badsigs) = 0;
@@ -159,18 +205,39 @@ static int DetectLoadSigFile(DetectEngineCtx *de_ctx, char *sig_file,
         /* Reset offset. */
         offset = 0;
 
+        if (SigFileRulesAdd(&rules, line, lineno - multiline) < 0) {
+            SCLogError("failed to read rule file %s: out of memory", sig_file);
+            fclose(fp);
+            SigFileRulesFree(&rules);
+            return -1;
+        }
+        multiline = 0;
+    }
+    fclose(fp);
+
+    DetectPcrePrecompileRules(de_ctx, (const char **)rules.rules, rules.cnt);
+
+    /* Only the regexes are compiled in parallel. SigInit registers buffer
+     * types, variable names and thread ctxs with the engine ctx and sets
+     * its sigerror fields, so parsing into per thread signature lists that
+     * are merged in file order would need all of those to become thread
+     * safe first. */
+    for (uint32_t i = 0; i < rules.cnt; i++) {
+        char *rule = rules.rules[i];
+        const int rule_line = rules.linenos[i];
+
         de_ctx->rule_file = sig_file;
-        de_ctx->rule_line = lineno - multiline;
+        de_ctx->rule_line = rule_line;
 
-        sig = DetectEngineAppendSig(de_ctx, line);
+        sig = DetectEngineAppendSig(de_ctx, rule);
         if (sig != NULL) {
             if (rule_engine_analysis_set || fp_engine_analysis_set) {
                 RetrieveFPForSig(de_ctx, sig);
                 if (fp_engine_analysis_set) {
-                    EngineAnalysisFP(de_ctx, sig, line);
+                    EngineAnalysisFP(de_ctx, sig, rule);
                 }
                 if (rule_engine_analysis_set) {
-                    EngineAnalysisRules(de_ctx, sig, line);
+                    EngineAnalysisRules(de_ctx, sig, rule);
                 }
             }
             SCLogDebug("signature %"PRIu32" loaded", sig->id);
@@ -179,27 +246,27 @@ static int DetectLoadSigFile(DetectEngineCtx *de_ctx, char *sig_file,
             if (!de_ctx->sigerror_silent) {
                 SCLogError("error parsing signature \"%s\" from "
                            "file %s at line %" PRId32 "",
-                        line, sig_file, lineno - multiline);
+                        rule, sig_file, rule_line);
 
-                if (!SigStringAppend(&de_ctx->sig_stat, sig_file, line, de_ctx->sigerror, (lineno - multiline))) {
+                if (!SigStringAppend(&de_ctx->sig_stat, sig_file, rule, de_ctx->sigerror, rule_line)) {
                     SCLogError("Error adding sig \"%s\" from "
                                "file %s at line %" PRId32 "",
-                            line, sig_file, lineno - multiline);
+                            rule, sig_file, rule_line);
                 }
                 if (de_ctx->sigerror) {
                     de_ctx->sigerror = NULL;
                 }
             }
             if (rule_engine_analysis_set) {
-                EngineAnalysisRulesFailure(de_ctx, line, sig_file, lineno - multiline);
+                EngineAnalysisRulesFailure(de_ctx, rule, sig_file, rule_line);
             }
             if (!de_ctx->sigerror_ok) {
                 bad++;
             }
         }
-        multiline = 0;
     }
-    fclose(fp);
+    DetectPcrePrecompiledFree(de_ctx);
+    SigFileRulesFree(&rules);
 
     *goodsigs = good;
     *badsigs = bad;
@@ -464,6 +531,79 @@ int DetectLoadersSync(void)
     return 0;
 }
 
+typedef struct DetectLoaderParallelCtx_ {
+    DetectParallelFunc Func;
+    void *ctx;
+    uint32_t cnt;
+    SC_ATOMIC_DECLARE(uint32_t, next);
+} DetectLoaderParallelCtx;
+
+/** \internal
+ *  \brief run work items until all are taken */
+static void DetectLoaderParallelWork(DetectLoaderParallelCtx *pctx)
+{
+    while (1) {
+        const uint32_t idx = SC_ATOMIC_ADD(pctx->next, 1);
+        if (idx >= pctx->cnt)
+            break;
+        pctx->Func(pctx->ctx, idx);
+    }
+}
+
+static void *DetectLoaderParallelThread(void *arg)
+{
+    DetectLoaderParallelWork((DetectLoaderParallelCtx *)arg);
+    return NULL;
+}
+
+/**
+ *  \brief run independent work items on a set of short lived threads
+ *
+ *  Unlike the loader tasks, this can be used while building an engine on
+ *  a loader thread. Func is called exactly once for each index, in no
+ *  particular order. The calling thread takes part and the function
+ *  returns when all items are done.
+ *
+ *  \param threads number of threads to use, 0 for one per cpu
+ *  \param cnt number of work items
+ *  \param Func function to call for each work item
+ *  \param ctx passed to Func
+ *
+ *  \retval threads number of threads that did the work
+ */
+uint32_t DetectLoaderParallelRun(
+        uint32_t threads, uint32_t cnt, DetectParallelFunc Func, void *ctx)
+{
+    DetectLoaderParallelCtx pctx = { .Func = Func, .ctx = ctx, .cnt = cnt };
+    SC_ATOMIC_INIT(pctx.next);
+
+    if (threads == 0)
+        threads = UtilCpuGetNumProcessorsOnline();
+    threads = MIN(threads, cnt);
+
+    pthread_t *tids = NULL;
+    uint32_t spawned = 0;
+    if (threads > 1) {
+        tids = SCCalloc(threads - 1, sizeof(pthread_t));
+        if (tids != NULL) {
+            for (; spawned < threads - 1; spawned++) {
+                const int rc =
+                        pthread_create(&tids[spawned], NULL, DetectLoaderParallelThread, &pctx);
+                if (rc != 0) {
+                    SCLogWarning("failed to create detect build thread: %s", strerror(rc));
+                    break;
+                }
+            }
+        }
+    }
+    DetectLoaderParallelWork(&pctx);
+    for (uint32_t i = 0; i < spawned; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    SCFree(tids);
+    return spawned + 1;
+}
+
 static void DetectLoaderInit(DetectLoaderControl *loader)
 {
     memset(loader, 0x00, sizeof(*loader));
@@ -50,6 +50,14 @@ typedef struct DetectLoaderControl_ {
 
 int DetectLoaderQueueTask(int loader_id, LoaderFunc Func, void *func_ctx, LoaderFreeFunc FreeFunc);
 int DetectLoadersSync(void);
+
+/**
+ * \param ctx function specific data
+ * \param idx index of the work item
+ */
+typedef void (*DetectParallelFunc)(void *ctx, uint32_t idx);
+uint32_t DetectLoaderParallelRun(
+        uint32_t threads, uint32_t cnt, DetectParallelFunc Func, void *ctx);
 void DetectLoadersInit(void);
 
 void TmThreadContinueDetectLoaderThreads(void);
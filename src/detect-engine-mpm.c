@@ -37,6 +37,7 @@
 #include "detect-engine-iponly.h"
 #include "detect-parse.h"
 #include "detect-engine-prefilter.h"
+#include "detect-engine-loader.h"
 #include "util-mpm.h"
 #include "util-memcmp.h"
 #include "util-memcpy.h"
@@ -74,6 +75,47 @@ const char *builtin_mpms[] = {
 
     NULL };
 
+/** list of mpm contexts to prepare when building the engine */
+typedef struct MpmPrepareList_ {
+    MpmCtx **ctxs;
+    uint32_t cnt;
+    uint32_t size;
+} MpmPrepareList;
+
+static int MpmPrepareListAppend(MpmPrepareList *list, MpmCtx *mpm_ctx)
+{
+    if (list->cnt == list->size) {
+        const uint32_t size = list->size ? list->size * 2 : 64;
+        MpmCtx **ctxs = SCRealloc(list->ctxs, size * sizeof(MpmCtx *));
+        if (ctxs == NULL)
+            return -1;
+        list->ctxs = ctxs;
+        list->size = size;
+    }
+    list->ctxs[list->cnt++] = mpm_ctx;
+    return 0;
+}
+
+/** \internal
+ *  \brief add a shared mpm context to the prepare list
+ *
+ *  Shared contexts can be used by more than one buffer, they are only
+ *  added once.
+ *
+ *  \retval 0 ok
+ *  \retval -1 memory allocation failure
+ */
+static int MpmPrepareListAdd(MpmPrepareList *list, MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx == NULL)
+        return 0;
+    for (uint32_t i = 0; i < list->cnt; i++) {
+        if (list->ctxs[i] == mpm_ctx)
+            return 0;
+    }
+    return MpmPrepareListAppend(list, mpm_ctx);
+}
+
 /* Registry for mpm keywords
  *
  * Keywords are registered at engine start up
@@ -255,10 +297,10 @@ void DetectMpmInitializeAppMpms(DetectEngineCtx *de_ctx)
 }
 
 /**
- *  \brief initialize mpm contexts for applayer buffers that are in
+ *  \brief collect mpm contexts for applayer buffers that are in
  *         "single or "shared" mode.
  */
-int DetectMpmPrepareAppMpms(DetectEngineCtx *de_ctx)
+static int DetectMpmCollectAppMpms(const DetectEngineCtx *de_ctx, MpmPrepareList *list)
 {
     int r = 0;
     const DetectBufferMpmRegistry *am = de_ctx->app_mpms_list;
@@ -270,7 +312,7 @@ int DetectMpmPrepareAppMpms(DetectEngineCtx *de_ctx)
             MpmCtx *mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, am->sgh_mpm_context, dir);
             if (mpm_ctx != NULL) {
                 if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-                    r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+                    r |= MpmPrepareListAdd(list, mpm_ctx);
                 }
             }
         }
@@ -482,12 +524,12 @@ void DetectMpmInitializeFrameMpms(DetectEngineCtx *de_ctx)
 }
 
 /**
- *  \brief initialize mpm contexts for applayer buffers that are in
+ *  \brief collect mpm contexts for applayer buffers that are in
  *         "single or "shared" mode.
  */
-int DetectMpmPrepareFrameMpms(DetectEngineCtx *de_ctx)
+static int DetectMpmCollectFrameMpms(const DetectEngineCtx *de_ctx, MpmPrepareList *list)
 {
-    SCLogDebug("preparing frame mpm");
+    SCLogDebug("collecting frame mpm");
     int r = 0;
     const DetectBufferMpmRegistry *am = de_ctx->frame_mpms_list;
     while (am != NULL) {
@@ -499,7 +541,7 @@ int DetectMpmPrepareFrameMpms(DetectEngineCtx *de_ctx)
             SCLogDebug("%s: %d mpm_Ctx %p", am->name, r, mpm_ctx);
             if (mpm_ctx != NULL) {
                 if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-                    r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+                    r |= MpmPrepareListAdd(list, mpm_ctx);
                     SCLogDebug("%s: %d", am->name, r);
                 }
             }
@@ -649,12 +691,12 @@ void DetectMpmInitializePktMpms(DetectEngineCtx *de_ctx)
 }
 
 /**
- *  \brief initialize mpm contexts for applayer buffers that are in
+ *  \brief collect mpm contexts for applayer buffers that are in
  *         "single or "shared" mode.
  */
-int DetectMpmPreparePktMpms(DetectEngineCtx *de_ctx)
+static int DetectMpmCollectPktMpms(const DetectEngineCtx *de_ctx, MpmPrepareList *list)
 {
-    SCLogDebug("preparing pkt mpm");
+    SCLogDebug("collecting pkt mpm");
     int r = 0;
     const DetectBufferMpmRegistry *am = de_ctx->pkt_mpms_list;
     while (am != NULL) {
@@ -664,7 +706,7 @@ int DetectMpmPreparePktMpms(DetectEngineCtx *de_ctx)
             MpmCtx *mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, am->sgh_mpm_context, 0);
             if (mpm_ctx != NULL) {
                 if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-                    r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+                    r |= MpmPrepareListAdd(list, mpm_ctx);
                     SCLogDebug("%s: %d", am->name, r);
                 }
             }
@@ -708,10 +750,10 @@ void DetectMpmInitializeBuiltinMpms(DetectEngineCtx *de_ctx)
 }
 
 /**
- *  \brief initialize mpm contexts for builtin buffers that are in
+ *  \brief collect mpm contexts for builtin buffers that are in
  *         "single or "shared" mode.
  */
-int DetectMpmPrepareBuiltinMpms(DetectEngineCtx *de_ctx)
+static int DetectMpmCollectBuiltinMpms(const DetectEngineCtx *de_ctx, MpmPrepareList *list)
 {
     int r = 0;
     MpmCtx *mpm_ctx = NULL;
@@ -719,40 +761,40 @@ int DetectMpmPrepareBuiltinMpms(DetectEngineCtx *de_ctx)
     if (de_ctx->sgh_mpm_context_proto_tcp_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            r |= MpmPrepareListAdd(list, mpm_ctx);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            r |= MpmPrepareListAdd(list, mpm_ctx);
         }
     }
 
     if (de_ctx->sgh_mpm_context_proto_udp_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            r |= MpmPrepareListAdd(list, mpm_ctx);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            r |= MpmPrepareListAdd(list, mpm_ctx);
         }
     }
 
     if (de_ctx->sgh_mpm_context_proto_other_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_other_packet, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            r |= MpmPrepareListAdd(list, mpm_ctx);
         }
     }
 
     if (de_ctx->sgh_mpm_context_stream != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 0);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            r |= MpmPrepareListAdd(list, mpm_ctx);
         }
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 1);
         if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            r |= mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
+            r |= MpmPrepareListAdd(list, mpm_ctx);
         }
     }
 
@@ -1567,6 +1609,10 @@ static void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
     }
 
     MpmInitCtx(ms->mpm_ctx, de_ctx->mpm_matcher);
+    if (de_ctx->incremental_stream_mpm &&
+            (ms->buffer == MPMB_TCP_STREAM_TS || ms->buffer == MPMB_TCP_STREAM_TC)) {
+        ms->mpm_ctx->flags |= MPMCTX_FLAGS_STREAMING;
+    }
 
     /* add the patterns */
     for (sig = 0; sig < (ms->sid_array_size * 8); sig++) {
@@ -1600,19 +1646,83 @@ static void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
         }
     }
 
+    /* unique contexts are prepared by DetectMpmPrepareAll */
     if (ms->mpm_ctx->pattern_cnt == 0) {
         MpmFactoryReClaimMpmCtx(de_ctx, ms->mpm_ctx);
         ms->mpm_ctx = NULL;
-    } else {
-        if (ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-            if (mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL) {
-                mpm_table[ms->mpm_ctx->mpm_type].Prepare(ms->mpm_ctx);
-            }
-        }
     }
 }
 
 
+typedef struct MpmPrepareWork_ {
+    const MpmPrepareList *list;
+    int *results;
+} MpmPrepareWork;
+
+static void MpmPrepareWorkItem(void *ctx, uint32_t idx)
+{
+    MpmPrepareWork *w = (MpmPrepareWork *)ctx;
+    MpmCtx *mpm_ctx = w->list->ctxs[idx];
+    if (mpm_table[mpm_ctx->mpm_type].Prepare != NULL) {
+        w->results[idx] = mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx);
+    }
+}
+
+/**
+ *  \brief prepare all mpm contexts of the engine
+ *
+ *  Prepares the shared contexts and the unique contexts of the mpm stores
+ *  created in stage 4. The contexts don't depend on each other, so they are
+ *  spread over "detect.build-threads" threads. Each context is prepared
+ *  exactly once, so the result doesn't depend on the order or the number
+ *  of threads.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int DetectMpmPrepareAll(DetectEngineCtx *de_ctx)
+{
+    MpmPrepareList list = { NULL, 0, 0 };
+    int r = DetectMpmCollectBuiltinMpms(de_ctx, &list);
+    r |= DetectMpmCollectAppMpms(de_ctx, &list);
+    r |= DetectMpmCollectPktMpms(de_ctx, &list);
+    r |= DetectMpmCollectFrameMpms(de_ctx, &list);
+
+    if (de_ctx->mpm_hash_table != NULL) {
+        for (HashListTableBucket *htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+                htb != NULL; htb = HashListTableGetListNext(htb)) {
+            const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+            if (ms == NULL || ms->mpm_ctx == NULL ||
+                    ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+                continue;
+            r |= MpmPrepareListAppend(&list, ms->mpm_ctx);
+        }
+    }
+    if (r != 0 || list.cnt == 0) {
+        SCFree(list.ctxs);
+        return r != 0 ? -1 : 0;
+    }
+
+    MpmPrepareWork work = { .list = &list };
+    work.results = SCCalloc(list.cnt, sizeof(int));
+    if (work.results == NULL) {
+        SCFree(list.ctxs);
+        return -1;
+    }
+
+    const uint32_t threads =
+            DetectLoaderParallelRun(de_ctx->build_threads, list.cnt, MpmPrepareWorkItem, &work);
+
+    for (uint32_t i = 0; i < list.cnt; i++) {
+        r |= work.results[i];
+    }
+    SCLogPerf("prepared %u mpm contexts using %u threads", list.cnt, threads);
+
+    SCFree(work.results);
+    SCFree(list.ctxs);
+    return r != 0 ? -1 : 0;
+}
+
 /** \brief Get MpmStore for a built-in buffer type
  *
  */
@@ -53,21 +53,214 @@
 struct StreamMpmData {
     DetectEngineThreadCtx *det_ctx;
     const MpmCtx *mpm_ctx;
+    TcpStream *stream;
 };
 
+/** max rule ids kept per stream for the incremental stream mpm */
+#define STREAM_MPM_MATCHES_MAX 1024
+
+/** \internal
+ *  \brief reset the incremental mpm state of a stream, e.g. after a rule
+ *         reload. The next chunk is scanned in full. */
+static void StreamMpmReset(TcpStream *stream, const MpmCtx *mpm_ctx, const uint32_t version)
+{
+    stream->raw_mpm_state = 0;
+    stream->raw_mpm_progress = 0;
+    stream->raw_mpm_matches_cnt = 0;
+    stream->raw_mpm_ctx = mpm_ctx;
+    stream->raw_mpm_de_version = version;
+}
+
+/** \internal
+ *  \brief add the rule ids that matched earlier in data that is still part
+ *         of the chunk to the pmq. Drop the ones the window slid past. */
+static void StreamMpmMatchesAdd(TcpStream *stream, PrefilterRuleStore *pmq, const uint64_t offset)
+{
+    uint16_t cnt = 0;
+    for (uint16_t i = 0; i < stream->raw_mpm_matches_cnt; i++) {
+        if (stream->raw_mpm_matches[i].re <= offset)
+            continue;
+        stream->raw_mpm_matches[cnt] = stream->raw_mpm_matches[i];
+        PrefilterAddSids(pmq, &stream->raw_mpm_matches[cnt].id, 1);
+        cnt++;
+    }
+    stream->raw_mpm_matches_cnt = cnt;
+}
+
+static bool StreamMpmMatchesGrow(TcpStream *stream)
+{
+    const uint16_t size = stream->raw_mpm_matches_size;
+    if (size >= STREAM_MPM_MATCHES_MAX)
+        return false;
+    const uint16_t new_size = size == 0 ? 8 : MIN(size * 2, STREAM_MPM_MATCHES_MAX);
+    const uint64_t grow = (uint64_t)(new_size - size) * sizeof(TcpStreamMpmMatch);
+    if (StreamTcpCheckMemcap(grow) == 0)
+        return false;
+    void *ptr = SCRealloc(stream->raw_mpm_matches, new_size * sizeof(TcpStreamMpmMatch));
+    if (ptr == NULL)
+        return false;
+    StreamTcpIncrMemuse(grow);
+    stream->raw_mpm_matches = ptr;
+    stream->raw_mpm_matches_size = new_size;
+    return true;
+}
+
+/** \internal
+ *  \brief remember the rule ids the scan added to the pmq from \a from on,
+ *         so they can be added again for the next chunks.
+ *  \param re absolute right edge of the scanned data
+ *  \retval false out of space */
+static bool StreamMpmMatchesStore(
+        TcpStream *stream, const PrefilterRuleStore *pmq, const uint32_t from, const uint64_t re)
+{
+    for (uint32_t i = from; i < pmq->rule_id_array_cnt; i++) {
+        const SigIntId id = pmq->rule_id_array[i];
+        uint16_t j = 0;
+        while (j < stream->raw_mpm_matches_cnt && stream->raw_mpm_matches[j].id != id)
+            j++;
+        if (j == stream->raw_mpm_matches_cnt) {
+            if (j == stream->raw_mpm_matches_size && !StreamMpmMatchesGrow(stream))
+                return false;
+            stream->raw_mpm_matches[j].id = id;
+            stream->raw_mpm_matches_cnt++;
+        }
+        stream->raw_mpm_matches[j].re = re;
+    }
+    return true;
+}
+
+/** \internal
+ *  \brief account a change of the size of the streaming mpm state of a
+ *         stream to the stream memcap */
+static void StreamMpmUpdateMemuse(const uint32_t old_size, const MpmStream *ms)
+{
+    const uint32_t new_size = ms != NULL ? ms->size : 0;
+    if (new_size > old_size)
+        StreamTcpIncrMemuse(new_size - old_size);
+    else if (new_size < old_size)
+        StreamTcpDecrMemuse(old_size - new_size);
+}
+
+/** \internal
+ *  \brief run the stream mpm on a raw stream chunk
+ *
+ *  Raw stream chunks overlap, esp in inline mode where each packet is
+ *  wrapped in data around it. In incremental mode the mpm state is kept
+ *  with the stream so that only the part of the chunk that wasn't scanned
+ *  before is scanned. If the mpm supports streaming search, only that part
+ *  is passed in and the mpm keeps the state in TcpStream::raw_mpm_stream.
+ *  Otherwise the scan continues where the last scan stopped and the data
+ *  before that is only used to verify matches that straddle the edge.
+ *
+ *  The rules of patterns found in earlier chunks are added to the pmq again
+ *  as long as the chunk still holds the data they were found in, so that
+ *  rules with more content matches are evaluated on the whole chunk. The
+ *  state is bound to the mpm ctx and detect engine version it was created
+ *  with, and reset if either changes.
+ */
 static int StreamMpmFunc(
-        void *cb_data, const uint8_t *data, const uint32_t data_len, const uint64_t _offset)
+        void *cb_data, const uint8_t *data, const uint32_t data_len, const uint64_t offset)
 {
     struct StreamMpmData *smd = cb_data;
-    if (data_len >= smd->mpm_ctx->minlen) {
+    DetectEngineThreadCtx *det_ctx = smd->det_ctx;
+    const MpmCtx *mpm_ctx = smd->mpm_ctx;
+    TcpStream *stream = smd->stream;
+
+    bool streaming = (mpm_ctx->flags & MPMCTX_FLAGS_STREAMING) &&
+                     mpm_table[mpm_ctx->mpm_type].StreamSearch != NULL;
+    const uint32_t ms_size = stream->raw_mpm_stream != NULL ? stream->raw_mpm_stream->size : 0;
+    if (streaming) {
+        const uint32_t need = MpmStreamStateSize(mpm_ctx);
+        if (need > ms_size && StreamTcpCheckMemcap(need - ms_size) == 0) {
+            /* no room for the stream state: scan the chunk in block mode.
+             * The next stream is started at the beginning of a chunk. */
+            SCLogDebug("stream memcap reached, stream mpm falls back to block mode");
+            MpmStreamFree(stream->raw_mpm_stream);
+            stream->raw_mpm_stream = NULL;
+            StreamMpmUpdateMemuse(ms_size, NULL);
+            stream->raw_mpm_progress = 0;
+            streaming = false;
+        }
+    }
+    const bool stateful = !streaming && det_ctx->de_ctx->incremental_stream_mpm &&
+                          mpm_table[mpm_ctx->mpm_type].SearchStateful != NULL;
+    if (streaming || stateful) {
+        if (stream->raw_mpm_ctx != mpm_ctx ||
+                stream->raw_mpm_de_version != det_ctx->de_ctx->version) {
+            StreamMpmReset(stream, mpm_ctx, det_ctx->de_ctx->version);
+        }
+        StreamMpmMatchesAdd(stream, &det_ctx->pmq, offset);
+    }
+
+    /* in streaming mode short data can still complete a match */
+    if (!streaming && data_len < mpm_ctx->minlen)
+        return 0;
+
+    const uint64_t data_re = offset + data_len;
+    const uint64_t progress = stream->raw_mpm_progress;
+    if (data_re > progress) {
+        StatsAddUI64(det_ctx->tv, det_ctx->counter_stream_mpm_bytes,
+                data_re - MAX(offset, progress));
+    }
+
+    uint32_t start = 0;
+    const uint32_t pmq_cnt = det_ctx->pmq.rule_id_array_cnt;
+    if (streaming) {
+        if (data_re <= progress) {
+            SCLogDebug("chunk %" PRIu64 "/%u already scanned", offset, data_len);
+            return 0;
+        }
+        /* on a gap the mpm starts a new stream */
+        if (offset < progress)
+            start = (uint32_t)(progress - offset);
+#ifdef DEBUG
+        det_ctx->stream_mpm_cnt++;
+        det_ctx->stream_mpm_size += data_len - start;
+#endif
+        (void)mpm_table[mpm_ctx->mpm_type].StreamSearch(mpm_ctx, &det_ctx->mtc, &det_ctx->pmq,
+                &stream->raw_mpm_stream, data + start, data_len - start, offset + start);
+        StreamMpmUpdateMemuse(ms_size, stream->raw_mpm_stream);
+    } else if (stateful) {
+        if (data_re <= progress) {
+            SCLogDebug("chunk %" PRIu64 "/%u already scanned", offset, data_len);
+            return 0;
+        }
+        uint32_t state = 0;
+        if (offset <= progress) {
+            /* continue from the last scan if the chunk has enough data
+             * before that point to verify straddling matches */
+            const uint32_t resume = (uint32_t)(progress - offset);
+            if (resume == 0 || resume + 1 >= mpm_ctx->maxlen) {
+                start = resume;
+                state = stream->raw_mpm_state;
+            }
+        }
 #ifdef DEBUG
-        smd->det_ctx->stream_mpm_cnt++;
-        smd->det_ctx->stream_mpm_size += data_len;
+        det_ctx->stream_mpm_cnt++;
+        det_ctx->stream_mpm_size += data_len - start;
 #endif
-        (void)mpm_table[smd->mpm_ctx->mpm_type].Search(
-                smd->mpm_ctx, &smd->det_ctx->mtc, &smd->det_ctx->pmq, data, data_len);
-        PREFILTER_PROFILING_ADD_BYTES(smd->det_ctx, data_len);
+        (void)mpm_table[mpm_ctx->mpm_type].SearchStateful(
+                mpm_ctx, &det_ctx->mtc, &det_ctx->pmq, data, data_len, start, &state);
+        stream->raw_mpm_state = state;
+    } else {
+#ifdef DEBUG
+        det_ctx->stream_mpm_cnt++;
+        det_ctx->stream_mpm_size += data_len;
+#endif
+        (void)mpm_table[mpm_ctx->mpm_type].Search(
+                mpm_ctx, &det_ctx->mtc, &det_ctx->pmq, data, data_len);
     }
+    if (data_re > progress)
+        stream->raw_mpm_progress = data_re;
+
+    /* without room to remember the matches, scan the next chunk in full */
+    if ((streaming || stateful) &&
+            !StreamMpmMatchesStore(stream, &det_ctx->pmq, pmq_cnt, data_re)) {
+        stream->raw_mpm_ctx = NULL;
+    }
+
+    StatsAddUI64(det_ctx->tv, det_ctx->counter_stream_mpm_bytes_scanned, data_len - start);
+    PREFILTER_PROFILING_ADD_BYTES(det_ctx, data_len - start);
     return 0;
 }
 
@@ -82,7 +275,9 @@ static void PrefilterPktStream(DetectEngineThreadCtx *det_ctx,
     if (p->flags & PKT_DETECT_HAS_STREAMDATA) {
         SCLogDebug("PRE det_ctx->raw_stream_progress %"PRIu64,
                 det_ctx->raw_stream_progress);
-        struct StreamMpmData stream_mpm_data = { det_ctx, mpm_ctx };
+        TcpSession *ssn = p->flow->protoctx;
+        struct StreamMpmData stream_mpm_data = { det_ctx, mpm_ctx,
+            PKT_IS_TOSERVER(p) ? &ssn->client : &ssn->server };
         StreamReassembleRaw(p->flow->protoctx, p,
                 StreamMpmFunc, &stream_mpm_data,
                 &det_ctx->raw_stream_progress,
@@ -1141,6 +1336,68 @@ static int PayloadTestSig34(void)
     PASS;
 }
 
+/** \test incremental stream mpm: rules of patterns found in earlier chunks
+ *        are evaluated as long as the chunk holds the data, and the state
+ *        is reset when the detect engine changes */
+static int PayloadTestStreamMpm01(void)
+{
+    ThreadVars tv;
+    DetectEngineCtx de_ctx;
+    DetectEngineThreadCtx det_ctx;
+    MpmCtx mpm_ctx;
+    TcpStream stream;
+    memset(&tv, 0, sizeof(tv));
+    memset(&de_ctx, 0, sizeof(de_ctx));
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(&mpm_ctx, 0, sizeof(mpm_ctx));
+    memset(&stream, 0, sizeof(stream));
+    de_ctx.incremental_stream_mpm = true;
+    de_ctx.version = 1;
+    det_ctx.tv = &tv;
+    det_ctx.de_ctx = &de_ctx;
+
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"wxyz", 4, 0, 0, 1, 1, 0);
+    FAIL_IF(mpm_table[MPM_AC].Prepare(&mpm_ctx) != 0);
+    FAIL_IF(PmqSetup(&det_ctx.pmq) != 0);
+    struct StreamMpmData smd = { &det_ctx, &mpm_ctx, &stream };
+
+    StreamMpmFunc(&smd, (const uint8_t *)"0123abcd", 8, 0);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array_cnt == 1);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array[0] == 0);
+    PmqReset(&det_ctx.pmq);
+
+    /* "abcd" isn't scanned again, but its rule is still a candidate */
+    StreamMpmFunc(&smd, (const uint8_t *)"abcdwxyz", 8, 4);
+    FAIL_IF_NOT(stream.raw_mpm_progress == 12);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array_cnt == 2);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array[0] == 0);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array[1] == 1);
+    PmqReset(&det_ctx.pmq);
+
+    /* window slid past "abcd" */
+    StreamMpmFunc(&smd, (const uint8_t *)"wxyz1234", 8, 8);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array_cnt == 1);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array[0] == 1);
+    FAIL_IF_NOT(stream.raw_mpm_matches_cnt == 1);
+    PmqReset(&det_ctx.pmq);
+
+    /* after a reload the chunk is scanned in full */
+    de_ctx.version = 2;
+    StreamMpmFunc(&smd, (const uint8_t *)"wxyz1234", 8, 8);
+    FAIL_IF_NOT(stream.raw_mpm_de_version == 2);
+    FAIL_IF_NOT(stream.raw_mpm_progress == 16);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array_cnt == 1);
+    FAIL_IF_NOT(det_ctx.pmq.rule_id_array[0] == 1);
+
+    SCFree(stream.raw_mpm_matches);
+    StreamTcpDecrMemuse((uint64_t)stream.raw_mpm_matches_size * sizeof(TcpStreamMpmMatch));
+    mpm_table[MPM_AC].DestroyCtx(&mpm_ctx);
+    PmqFree(&det_ctx.pmq);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void PayloadRegisterTests(void)
@@ -1182,6 +1439,8 @@ void PayloadRegisterTests(void)
     UtRegisterTest("PayloadTestSig32", PayloadTestSig32);
     UtRegisterTest("PayloadTestSig33", PayloadTestSig33);
     UtRegisterTest("PayloadTestSig34", PayloadTestSig34);
+
+    UtRegisterTest("PayloadTestStreamMpm01", PayloadTestStreamMpm01);
 #endif /* UNITTESTS */
 
     return;
@@ -89,6 +89,10 @@
 
 #include "reputation.h"
 
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
 #define DETECT_ENGINE_DEFAULT_INSPECTION_RECURSION_LIMIT 3000
 
 static int DetectEngineCtxLoadConf(DetectEngineCtx *);
@@ -2294,6 +2298,250 @@ static void InjectPackets(ThreadVars **detect_tvs,
     }
 }
 
+/** state of the memory tracking of the rule reload in progress */
+static struct {
+    bool active;
+    uint64_t peak;  /**< highest RSS sampled so far, in bytes */
+    uint64_t maxrss; /**< process lifetime max RSS when the reload started */
+} reload_mem;
+
+/** peak memory use of the last completed reload, in bytes */
+static SC_ATOMIC_DECLARE(uint64_t, reload_peak_memory);
+
+static uint64_t DetectEngineReloadPeakMemoryCounter(void)
+{
+    return SC_ATOMIC_GET(reload_peak_memory);
+}
+
+/**
+ * \brief Register the global detect engine counters.
+ */
+void DetectEngineRegisterGlobalCounters(void)
+{
+    StatsRegisterGlobalCounter("detect.reload.peak_memory", DetectEngineReloadPeakMemoryCounter);
+}
+
+/** \internal
+ *  \brief get the resident set size of the process
+ *
+ *  \retval rss in bytes or 0 if not supported on this platform */
+static uint64_t DetectEngineGetRss(void)
+{
+#if defined(__linux__)
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+        return 0;
+    unsigned long size = 0, resident = 0;
+    const int r = fscanf(fp, "%lu %lu", &size, &resident);
+    fclose(fp);
+    if (r != 2)
+        return 0;
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+/** \internal
+ *  \brief get the highest resident set size the process ever had
+ *
+ *  \retval maxrss in bytes or 0 if not supported on this platform */
+static uint64_t DetectEngineGetMaxRss(void)
+{
+#if defined(__linux__)
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+    /* reported in kilobytes */
+    return (uint64_t)ru.ru_maxrss * 1024;
+#else
+    return 0;
+#endif
+}
+
+static void DetectEngineReloadMemoryStart(void)
+{
+    reload_mem.active = true;
+    reload_mem.peak = DetectEngineGetRss();
+    reload_mem.maxrss = DetectEngineGetMaxRss();
+}
+
+/** \internal
+ *  \brief sample the memory use at a point in the reload where it
+ *         is likely to peak, e.g. when two engines are loaded */
+static void DetectEngineReloadMemorySample(void)
+{
+    if (!reload_mem.active)
+        return;
+    const uint64_t rss = DetectEngineGetRss();
+    if (rss > reload_mem.peak)
+        reload_mem.peak = rss;
+}
+
+/** \internal
+ *  \brief finish tracking and publish the peak to the stats
+ *
+ *  Sampling can miss short lived allocations, like the ones done while
+ *  compiling the patterns. If the lifetime max RSS of the process grew
+ *  during the reload, it was set by the reload and is the exact peak. */
+static void DetectEngineReloadMemoryEnd(void)
+{
+    if (!reload_mem.active)
+        return;
+    DetectEngineReloadMemorySample();
+    const uint64_t maxrss = DetectEngineGetMaxRss();
+    if (maxrss > reload_mem.maxrss && maxrss > reload_mem.peak)
+        reload_mem.peak = maxrss;
+    reload_mem.active = false;
+
+    SC_ATOMIC_SET(reload_peak_memory, reload_mem.peak);
+    if (reload_mem.peak > 0) {
+        SCLogInfo("rule reload peak memory use: %" PRIu64 " MiB", reload_mem.peak / (1024 * 1024));
+    }
+}
+
+/** \internal
+ *  \brief switch a detect thread to a new thread ctx for de_ctx
+ *
+ *  The old thread ctx of the thread is freed once the thread started
+ *  using the new one.
+ *
+ *  \retval 1 thread switched
+ *  \retval 0 thread ctx init failure, the thread keeps its old thread ctx
+ *  \retval -1 shutdown started, the detect threads have stopped
+ */
+static int DetectEngineReloadThreadSwap(DetectEngineCtx *de_ctx, ThreadVars **detect_tvs,
+        TmSlot **detect_slots, const uint32_t no_of_detect_tvs, const uint32_t idx)
+{
+    SCMutexLock(&tv_root_lock);
+    void *slot_data = SC_ATOMIC_GET(detect_slots[idx]->slot_data);
+    DetectEngineThreadCtx *old_det_ctx = FlowWorkerGetDetectCtxPtr(slot_data);
+    DetectEngineThreadCtx *new_det_ctx =
+            DetectEngineThreadCtxInitForReload(detect_tvs[idx], de_ctx, 1);
+    if (new_det_ctx == NULL) {
+        SCMutexUnlock(&tv_root_lock);
+        return 0;
+    }
+    SCLogDebug("swapping new det_ctx - %p with older one - %p", new_det_ctx, old_det_ctx);
+    FlowWorkerReplaceDetectCtx(slot_data, new_det_ctx);
+    SCMutexUnlock(&tv_root_lock);
+
+    DetectEngineReloadMemorySample();
+
+    InjectPackets(&detect_tvs[idx], &new_det_ctx, 1);
+
+    /* wait for the thread to switch, waking up capture if needed */
+    for (uint32_t waits = 1; SC_ATOMIC_GET(new_det_ctx->so_far_used_by_detect) != 1; waits++) {
+        if (suricata_ctl_flags != 0) {
+            /* shutting down: the old det_ctx can only be freed once
+             * the detect threads stopped working */
+            for (uint32_t t = 0; t < no_of_detect_tvs; t++) {
+                while (!TmThreadsCheckFlag(detect_tvs[t], THV_RUNNING_DONE)) {
+                    usleep(100);
+                }
+            }
+            DetectEngineThreadCtxDeinit(NULL, old_det_ctx);
+            return -1;
+        }
+        usleep(1000);
+        if (waits % 250 == 0) {
+            TmThreadsCaptureBreakLoop(detect_tvs[idx]);
+        }
+    }
+    SCLogDebug("new_det_ctx - %p used by detect engine, freeing old_det_ctx - %p", new_det_ctx,
+            old_det_ctx);
+    DetectEngineThreadCtxDeinit(NULL, old_det_ctx);
+    return 1;
+}
+
+/** \internal
+ *  \brief Update detect threads with new detect engine, one thread at a time
+ *
+ *  Unlike the default swap, the new thread context of a thread is only
+ *  created after the previous thread switched to its new context and its
+ *  old one was freed. This limits the extra memory needed for the swap to
+ *  a single thread context, at the cost of a slower reload during which
+ *  the threads run a mix of the old and new engines.
+ *
+ *  If a thread context can't be created, the threads that were already
+ *  switched are switched back to the old engine, so that all threads run
+ *  the same rules again. On shutdown the threads keep the context they
+ *  have, it's freed with the thread.
+ *
+ *  \retval -1 error
+ *  \retval 1 successful reload
+ */
+static int DetectEngineReloadThreadsStaged(
+        DetectEngineCtx *new_de_ctx, const uint32_t no_of_detect_tvs)
+{
+    ThreadVars *detect_tvs[no_of_detect_tvs];
+    TmSlot *detect_slots[no_of_detect_tvs];
+    uint32_t i = 0;
+
+    SCMutexLock(&tv_root_lock);
+    for (ThreadVars *tv = tv_root[TVT_PPT]; tv != NULL; tv = tv->next) {
+        if ((tv->tmm_flags & TM_FLAG_DETECT_TM) == 0) {
+            continue;
+        }
+        for (TmSlot *s = tv->tm_slots; s != NULL; s = s->slot_next) {
+            TmModule *tm = TmModuleGetById(s->tm_id);
+            if (!(tm->flags & TM_FLAG_DETECT_TM)) {
+                continue;
+            }
+            detect_tvs[i] = tv;
+            detect_slots[i] = s;
+            i++;
+            break;
+        }
+    }
+    SCMutexUnlock(&tv_root_lock);
+    BUG_ON(i != no_of_detect_tvs);
+
+    for (i = 0; i < no_of_detect_tvs; i++) {
+        if (suricata_ctl_flags != 0) {
+            return -1;
+        }
+        const int r = DetectEngineReloadThreadSwap(
+                new_de_ctx, detect_tvs, detect_slots, no_of_detect_tvs, i);
+        if (r < 0) {
+            return -1;
+        } else if (r == 0) {
+            break;
+        }
+    }
+    if (i == no_of_detect_tvs) {
+        /* hosts only in the old reputation data stay valid until all
+         * threads use the new engine */
+        SRepReloadComplete();
+        return 1;
+    }
+
+    /* thread i still runs the old engine and holds a reference to it */
+    const uint32_t swapped = i;
+    SCLogError("Detect engine thread init failure in staged live rule swap, "
+               "switching %u thread(s) back to the old rules",
+            swapped);
+    DetectEngineThreadCtx *det_ctx =
+            FlowWorkerGetDetectCtxPtr(SC_ATOMIC_GET(detect_slots[swapped]->slot_data));
+    DetectEngineCtx *old_de_ctx = det_ctx->de_ctx;
+    for (i = 0; i < swapped; i++) {
+        if (suricata_ctl_flags != 0) {
+            return -1;
+        }
+        const int r = DetectEngineReloadThreadSwap(
+                old_de_ctx, detect_tvs, detect_slots, no_of_detect_tvs, i);
+        if (r < 0) {
+            return -1;
+        } else if (r == 0) {
+            SCLogError("Detect engine thread init failure switching back to the old rules, "
+                       "%u of %u threads use the new rules until the next reload",
+                    swapped - i, no_of_detect_tvs);
+            return -1;
+        }
+    }
+    return -1;
+}
+
 /** \internal
  *  \brief Update detect threads with new detect engine
  *
@@ -2319,6 +2567,12 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
         return 0;
     }
 
+    int staged = 0;
+    (void)ConfGetBool("detect.reload-staged", &staged);
+    if (staged) {
+        return DetectEngineReloadThreadsStaged(new_de_ctx, no_of_detect_tvs);
+    }
+
     /* prepare swap structures */
     DetectEngineThreadCtx *old_det_ctx[no_of_detect_tvs];
     DetectEngineThreadCtx *new_det_ctx[no_of_detect_tvs];
@@ -2363,6 +2617,7 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
         }
     }
     BUG_ON(i != no_of_detect_tvs);
+    DetectEngineReloadMemorySample();
 
     /* atomically replace the det_ctx data */
     i = 0;
@@ -2832,6 +3087,24 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
             break;
     }
 
+    int incremental = 0;
+    (void)ConfGetBool("detect.incremental-stream-mpm", &incremental);
+    de_ctx->incremental_stream_mpm = incremental != 0;
+    SCLogConfig("detect.incremental-stream-mpm: %s",
+            de_ctx->incremental_stream_mpm ? "enabled" : "disabled");
+
+    const char *build_threads = NULL;
+    de_ctx->build_threads = 1;
+    if (ConfGet("detect.build-threads", &build_threads) == 1 && build_threads != NULL) {
+        if (strcmp(build_threads, "auto") == 0) {
+            de_ctx->build_threads = 0;
+        } else if (StringParseUint16(&de_ctx->build_threads, 10, 0, build_threads) < 0 ||
+                   de_ctx->build_threads == 0) {
+            SCLogWarning("invalid value for detect.build-threads: %s, using 1", build_threads);
+            de_ctx->build_threads = 1;
+        }
+    }
+
     intmax_t value = 0;
     if (ConfGetInt("detect.inspection-recursion-limit", &value) == 1)
     {
@@ -3325,6 +3598,9 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
     det_ctx->counter_alerts_overflow = StatsRegisterCounter("detect.alert_queue_overflow", tv);
     det_ctx->counter_alerts_suppressed = StatsRegisterCounter("detect.alerts_suppressed", tv);
+    det_ctx->counter_stream_mpm_bytes = StatsRegisterCounter("detect.stream_mpm_bytes", tv);
+    det_ctx->counter_stream_mpm_bytes_scanned =
+            StatsRegisterCounter("detect.stream_mpm_bytes_scanned", tv);
 #ifdef PROFILING
     det_ctx->counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     det_ctx->counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -3384,6 +3660,9 @@ DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
     det_ctx->counter_alerts_overflow = StatsRegisterCounter("detect.alert_queue_overflow", tv);
     det_ctx->counter_alerts_suppressed = StatsRegisterCounter("detect.alerts_suppressed", tv);
+    det_ctx->counter_stream_mpm_bytes = StatsRegisterCounter("detect.stream_mpm_bytes", tv);
+    det_ctx->counter_stream_mpm_bytes_scanned =
+            StatsRegisterCounter("detect.stream_mpm_bytes_scanned", tv);
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -4672,6 +4951,33 @@ void DetectEngineClearMaster(void)
     DetectEnginePruneFreeList();
 }
 
+/** \internal
+ *  \brief make the old engine the current one again after the threads
+ *         could not be switched to the new engine */
+static void DetectEngineReloadRestore(DetectEngineCtx *old_de_ctx, DetectEngineCtx *new_de_ctx)
+{
+    DetectEngineMasterCtx *master = &g_master_de_ctx;
+    SCMutexLock(&master->lock);
+
+    DetectEngineCtx *prev = NULL;
+    DetectEngineCtx *instance = master->free_list;
+    while (instance != NULL && instance != old_de_ctx) {
+        prev = instance;
+        instance = instance->next;
+    }
+    if (instance != NULL) {
+        if (prev == NULL) {
+            master->free_list = instance->next;
+        } else {
+            prev->next = instance->next;
+        }
+        (void)DetectEngineMoveToFreeListNoLock(master, new_de_ctx);
+        instance->next = master->list;
+        master->list = instance;
+    }
+    SCMutexUnlock(&master->lock);
+}
+
 static int reloads = 0;
 
 /** \brief Reload the detection engine
@@ -4733,32 +5039,50 @@ int DetectEngineReload(const SCInstance *suri)
         return -1;
     }
 
+    DetectEngineReloadMemoryStart();
+
     /* get new detection engine */
     new_de_ctx = DetectEngineCtxInitWithPrefix(prefix, old_de_ctx->tenant_id);
     if (new_de_ctx == NULL) {
         SCLogError("initializing detection engine "
                    "context failed.");
         DetectEngineDeReference(&old_de_ctx);
+        DetectEngineReloadMemoryEnd();
         return -1;
     }
     if (SigLoadSignatures(new_de_ctx,
                           suri->sig_file, suri->sig_file_exclusive) != 0) {
         DetectEngineCtxFree(new_de_ctx);
         DetectEngineDeReference(&old_de_ctx);
+        DetectEngineReloadMemoryEnd();
         return -1;
     }
     SCLogDebug("set up new_de_ctx %p", new_de_ctx);
+    /* both engines are fully loaded */
+    DetectEngineReloadMemorySample();
 
     /* add to master */
     DetectEngineAddToMaster(new_de_ctx);
 
-    /* move to old free list */
+    /* move to old free list. The threads keep it alive until they are
+     * switched, so the pointer stays valid until the free list is pruned. */
+    DetectEngineCtx *prev_de_ctx = old_de_ctx;
     DetectEngineMoveToFreeList(old_de_ctx);
     DetectEngineDeReference(&old_de_ctx);
 
     SCLogDebug("going to reload the threads to use new_de_ctx %p", new_de_ctx);
     /* update the threads */
-    DetectEngineReloadThreads(new_de_ctx);
+    if (DetectEngineReloadThreads(new_de_ctx) < 0) {
+        /* the threads run the old engine, make it the current one again.
+         * Datasets are not cleaned up as the old engine still uses them. */
+        if (suricata_ctl_flags == 0) {
+            DetectEngineReloadRestore(prev_de_ctx, new_de_ctx);
+        }
+        DetectEnginePruneFreeList();
+        DetectEngineReloadMemoryEnd();
+        SCLogError("rule reload failed");
+        return -1;
+    }
     SCLogDebug("threads now run new_de_ctx %p", new_de_ctx);
 
     /* walk free list, freeing the old_de_ctx */
@@ -4766,6 +5090,8 @@ int DetectEngineReload(const SCInstance *suri)
 
     DatasetPostReloadCleanup();
 
+    DetectEngineReloadMemoryEnd();
+
     DetectEngineBumpVersion();
 
     SCLogDebug("old_de_ctx should have been freed");
@@ -5115,6 +5441,105 @@ static int DetectEngineTest09(void)
     PASS;
 }
 
+
+typedef struct DetectEngineReloadTestWorkers_ {
+    void *fw[3];
+    SC_ATOMIC_DECLARE(bool, stop);
+} DetectEngineReloadTestWorkers;
+
+/** \internal
+ *  \brief stand in for the detect threads: use the thread ctx the flow
+ *         worker holds, like a detect thread does for each packet */
+static void *DetectEngineReloadTestWorkerLoop(void *data)
+{
+    DetectEngineReloadTestWorkers *w = data;
+    while (!SC_ATOMIC_GET(w->stop)) {
+        for (int i = 0; i < 3; i++) {
+            DetectEngineThreadCtx *det_ctx = FlowWorkerGetDetectCtxPtr(w->fw[i]);
+            (void)SC_ATOMIC_SET(det_ctx->so_far_used_by_detect, 1);
+        }
+        usleep(100);
+    }
+    return NULL;
+}
+
+/** \test staged reload switches all detect threads and frees the old engine */
+static int DetectEngineTest10(void)
+{
+    DetectEngineMasterCtx *master = &g_master_de_ctx;
+    ThreadVars tvs[3];
+    TmSlot slots[3];
+    DetectEngineReloadTestWorkers w;
+    memset(&tvs, 0, sizeof(tvs));
+    memset(&slots, 0, sizeof(slots));
+    memset(&w, 0, sizeof(w));
+    SC_ATOMIC_INIT(w.stop);
+
+    DetectEngineCtx *old_de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(old_de_ctx);
+    FAIL_IF_NULL(DetectEngineAppendSig(
+            old_de_ctx, "alert tcp any any -> any any (content:\"old\"; sid:1;)"));
+    SigGroupBuild(old_de_ctx);
+    DetectEngineAddToMaster(old_de_ctx);
+
+    for (int i = 0; i < 3; i++) {
+        tvs[i].tmm_flags = TM_FLAG_DETECT_TM;
+        tvs[i].tm_slots = &slots[i];
+        tvs[i].next = (i < 2) ? &tvs[i + 1] : NULL;
+        slots[i].tm_id = TMM_FLOWWORKER;
+        DetectEngineThreadCtx *det_ctx = DetectEngineThreadCtxInitForReload(&tvs[i], old_de_ctx, 0);
+        FAIL_IF_NULL(det_ctx);
+        w.fw[i] = FlowWorkerUTAlloc(det_ctx);
+        FAIL_IF_NULL(w.fw[i]);
+        SC_ATOMIC_INITPTR(slots[i].slot_data);
+        SC_ATOMIC_SET(slots[i].slot_data, w.fw[i]);
+    }
+    FAIL_IF_NOT(old_de_ctx->ref_cnt == 3);
+
+    SCMutexLock(&tv_root_lock);
+    ThreadVars *tv_root_ppt = tv_root[TVT_PPT];
+    tv_root[TVT_PPT] = &tvs[0];
+    SCMutexUnlock(&tv_root_lock);
+
+    pthread_t worker;
+    FAIL_IF(pthread_create(&worker, NULL, DetectEngineReloadTestWorkerLoop, &w) != 0);
+
+    DetectEngineCtx *new_de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(new_de_ctx);
+    FAIL_IF_NULL(DetectEngineAppendSig(
+            new_de_ctx, "alert tcp any any -> any any (content:\"new\"; sid:2;)"));
+    SigGroupBuild(new_de_ctx);
+    DetectEngineAddToMaster(new_de_ctx);
+    DetectEngineMoveToFreeList(old_de_ctx);
+
+    FAIL_IF_NOT(DetectEngineReloadThreadsStaged(new_de_ctx, 3) == 1);
+    for (int i = 0; i < 3; i++) {
+        DetectEngineThreadCtx *det_ctx = FlowWorkerGetDetectCtxPtr(w.fw[i]);
+        FAIL_IF_NOT(det_ctx->de_ctx == new_de_ctx);
+    }
+    FAIL_IF_NOT(new_de_ctx->ref_cnt == 3);
+    FAIL_IF_NOT(old_de_ctx->ref_cnt == 0);
+
+    DetectEnginePruneFreeList();
+    for (DetectEngineCtx *d = master->free_list; d != NULL; d = d->next) {
+        FAIL_IF(d == old_de_ctx);
+    }
+
+    SC_ATOMIC_SET(w.stop, true);
+    pthread_join(worker, NULL);
+
+    SCMutexLock(&tv_root_lock);
+    tv_root[TVT_PPT] = tv_root_ppt;
+    SCMutexUnlock(&tv_root_lock);
+
+    for (int i = 0; i < 3; i++) {
+        DetectEngineThreadCtxDeinit(NULL, FlowWorkerGetDetectCtxPtr(w.fw[i]));
+        FlowWorkerUTFree(w.fw[i]);
+    }
+    DetectEngineMoveToFreeList(new_de_ctx);
+    DetectEnginePruneFreeList();
+    PASS;
+}
 #endif
 
 void DetectEngineRegisterTests(void)
@@ -5126,6 +5551,7 @@ void DetectEngineRegisterTests(void)
     UtRegisterTest("DetectEngineTest04", DetectEngineTest04);
     UtRegisterTest("DetectEngineTest08", DetectEngineTest08);
     UtRegisterTest("DetectEngineTest09", DetectEngineTest09);
+    UtRegisterTest("DetectEngineTest10", DetectEngineTest10);
 #endif
     return;
 }
@@ -41,6 +41,7 @@
 #include "detect-engine-mpm.h"
 #include "detect-engine-state.h"
 #include "detect-engine-build.h"
+#include "detect-engine-loader.h"
 
 #include "util-var-name.h"
 #include "util-unittest-helper.h"
@@ -48,6 +49,7 @@
 #include "util-unittest.h"
 #include "util-print.h"
 #include "util-pool.h"
+#include "util-cpu.h"
 
 #include "conf.h"
 #include "app-layer.h"
@@ -346,6 +348,328 @@ static int DetectPcreHasUpperCase(const char *re)
     return 0;
 }
 
+/** \internal
+ *  \brief find the capture names in a pcre keyword value
+ *
+ *  \retval offset of the first "flow:" or "pkt:" or -1 if there are none
+ */
+static int DetectPcreCaptureNamesOffset(const char *regexstr)
+{
+    const char *fcap = strstr(regexstr, "flow:");
+    const char *pcap = strstr(regexstr, "pkt:");
+    if (fcap != NULL && pcap != NULL)
+        return (int)MIN((pcap - regexstr), (fcap - regexstr));
+    if (fcap != NULL)
+        return (int)(fcap - regexstr);
+    if (pcap != NULL)
+        return (int)(pcap - regexstr);
+    return -1;
+}
+
+/** \internal
+ *  \brief get the compile option for a regex modifier
+ *
+ *  \retval opt PCRE2 compile option or 0 if the modifier isn't one
+ */
+static int DetectPcreCompileOption(const char op)
+{
+    switch (op) {
+        case 'A':
+            return PCRE2_ANCHORED;
+        case 'E':
+            return PCRE2_DOLLAR_ENDONLY;
+        case 'G':
+            return PCRE2_UNGREEDY;
+        case 'i':
+            return PCRE2_CASELESS;
+        case 'm':
+            return PCRE2_MULTILINE;
+        case 's':
+            return PCRE2_DOTALL;
+        case 'x':
+            return PCRE2_EXTENDED;
+    }
+    return 0;
+}
+
+/** regex compiled before the rules of a file are parsed. Entries with the
+ *  same regex and options are chained to the one in the hash table. */
+typedef struct DetectPcrePrecompiled_ {
+    char *re;
+    int opts;
+    pcre2_code *code;
+    struct DetectPcrePrecompiled_ *next;
+} DetectPcrePrecompiled;
+
+static uint32_t DetectPcrePrecompiledHash(HashTable *ht, void *data, uint16_t datalen)
+{
+    const DetectPcrePrecompiled *p = data;
+    uint32_t hash = (uint32_t)p->opts;
+    for (const char *c = p->re; *c != '\0'; c++) {
+        hash = hash * 33 + (uint8_t)*c;
+    }
+    return hash % ht->array_size;
+}
+
+static char DetectPcrePrecompiledCompare(void *data1, uint16_t len1, void *data2, uint16_t len2)
+{
+    const DetectPcrePrecompiled *p1 = data1;
+    const DetectPcrePrecompiled *p2 = data2;
+    return p1->opts == p2->opts && strcmp(p1->re, p2->re) == 0;
+}
+
+static void DetectPcrePrecompiledListFree(DetectPcrePrecompiled *p)
+{
+    while (p != NULL) {
+        DetectPcrePrecompiled *next = p->next;
+        if (p->code != NULL)
+            pcre2_code_free(p->code);
+        SCFree(p->re);
+        SCFree(p);
+        p = next;
+    }
+}
+
+static void DetectPcrePrecompiledTableFree(void *data)
+{
+    DetectPcrePrecompiledListFree(data);
+}
+
+/** \internal
+ *  \brief compile a rule regex, retrying with auto capture if the regex
+ *         references a capture group */
+static pcre2_code *DetectPcreCompile(const char *re, int opts, int *en, PCRE2_SIZE *eo)
+{
+    pcre2_code *code = pcre2_compile((PCRE2_SPTR8)re, PCRE2_ZERO_TERMINATED, opts, en, eo, NULL);
+    if (code == NULL && *en == 115) { // reference to nonexistent subpattern
+        opts &= ~PCRE2_NO_AUTO_CAPTURE;
+        code = pcre2_compile((PCRE2_SPTR8)re, PCRE2_ZERO_TERMINATED, opts, en, eo, NULL);
+    }
+    return code;
+}
+
+/** \internal
+ *  \brief compile the regex of a pcre keyword value
+ *
+ *  Only the options that affect the compiled regex are considered. Values
+ *  with capture names are left to DetectPcreParse.
+ *
+ *  \retval p compiled regex or NULL if it wasn't compiled
+ */
+static DetectPcrePrecompiled *DetectPcrePrecompileValue(const char *regexstr)
+{
+    if (DetectPcreCaptureNamesOffset(regexstr) >= 0)
+        return NULL;
+
+    size_t slen = strlen(regexstr) + 1;
+    char re[slen];
+    char op_str[64] = "";
+
+    pcre2_match_data *match = pcre2_match_data_create_from_pattern(parse_regex->regex, NULL);
+    if (match == NULL)
+        return NULL;
+    int ret = pcre2_match(parse_regex->regex, (PCRE2_SPTR8)regexstr, slen, 0, 0, match, NULL);
+    if (ret <= 0 ||
+            pcre2_substring_copy_bynumber(match, 1, (PCRE2_UCHAR8 *)re, &slen) < 0) {
+        pcre2_match_data_free(match);
+        return NULL;
+    }
+    if (ret > 2) {
+        size_t copylen = sizeof(op_str);
+        if (pcre2_substring_copy_bynumber(match, 2, (PCRE2_UCHAR8 *)op_str, &copylen) < 0) {
+            pcre2_match_data_free(match);
+            return NULL;
+        }
+    }
+    pcre2_match_data_free(match);
+
+    int opts = PCRE2_NO_AUTO_CAPTURE;
+    for (const char *op = op_str; *op != '\0'; op++) {
+        opts |= DetectPcreCompileOption(*op);
+    }
+
+    int en;
+    PCRE2_SIZE eo;
+    pcre2_code *code = DetectPcreCompile(re, opts, &en, &eo);
+    if (code == NULL)
+        return NULL;
+#ifdef PCRE2_HAVE_JIT
+    if (pcre2_use_jit) {
+        (void)pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+    }
+#endif
+
+    DetectPcrePrecompiled *p = SCCalloc(1, sizeof(*p));
+    if (p == NULL) {
+        pcre2_code_free(code);
+        return NULL;
+    }
+    p->re = SCStrdup(re);
+    if (p->re == NULL) {
+        pcre2_code_free(code);
+        SCFree(p);
+        return NULL;
+    }
+    p->opts = opts;
+    p->code = code;
+    return p;
+}
+
+typedef struct DetectPcrePrecompileCtx_ {
+    const char **rules;
+    DetectPcrePrecompiled **results;
+} DetectPcrePrecompileCtx;
+
+/** \internal
+ *  \brief compile the pcre keywords of a rule
+ *
+ *  Splits the options the way SigParseOptions does, but only looks at the
+ *  "pcre" keywords. A rule that is formatted in a way this doesn't handle
+ *  only means its regexes are compiled by DetectPcreParse as usual.
+ */
+static void DetectPcrePrecompileRule(void *ctx, uint32_t idx)
+{
+    DetectPcrePrecompileCtx *pctx = ctx;
+    const char *opt = strchr(pctx->rules[idx], '(');
+    if (opt == NULL)
+        return;
+    opt++;
+
+    while (*opt != '\0') {
+        while (isblank(*opt))
+            opt++;
+        const char *optend = opt;
+        for (;;) {
+            optend = strchr(optend, ';');
+            if (optend == NULL)
+                return;
+            if (optend > opt && *(optend - 1) == '\\') {
+                optend++;
+            } else {
+                break;
+            }
+        }
+
+        const char *val = memchr(opt, ':', optend - opt);
+        if (val != NULL) {
+            const char *name_end = val;
+            while (name_end > opt && isblank(*(name_end - 1)))
+                name_end--;
+            val++;
+            if (name_end - opt == 4 && strncmp(opt, "pcre", 4) == 0) {
+                while (val < optend && (isblank(*val) || *val == '!'))
+                    val++;
+                const char *val_end = optend;
+                while (val_end > val && isblank(*(val_end - 1)))
+                    val_end--;
+                const size_t len = val_end - val;
+                if (len > 2 && val[0] == '"' && val[len - 1] == '"') {
+                    char value[len - 1];
+                    strlcpy(value, val + 1, len - 1);
+                    DetectPcrePrecompiled *p = DetectPcrePrecompileValue(value);
+                    if (p != NULL) {
+                        p->next = pctx->results[idx];
+                        pctx->results[idx] = p;
+                    }
+                }
+            }
+        }
+        opt = optend + 1;
+    }
+}
+
+/**
+ *  \brief compile the regexes of the pcre keywords of a set of rules
+ *
+ *  Compiling and JIT compiling the regexes is the most expensive part of
+ *  parsing a typical ruleset. The rules are parsed one by one as parsing
+ *  updates the detection engine, but the regexes don't depend on it. They
+ *  are compiled on "detect.build-threads" threads up front, and
+ *  DetectPcreParse then takes the compiled regex from the table instead of
+ *  compiling it. Rule errors are still reported by the rule parser.
+ *
+ *  \param rules the rules, in the format passed to DetectEngineAppendSig
+ *  \param cnt number of rules
+ */
+void DetectPcrePrecompileRules(DetectEngineCtx *de_ctx, const char **rules, uint32_t cnt)
+{
+    if (cnt == 0 || de_ctx->build_threads == 1 ||
+            (de_ctx->build_threads == 0 && UtilCpuGetNumProcessorsOnline() <= 1))
+        return;
+
+    DetectPcrePrecompiledFree(de_ctx);
+    de_ctx->pcre_precompiled = HashTableInit(4096, DetectPcrePrecompiledHash,
+            DetectPcrePrecompiledCompare, DetectPcrePrecompiledTableFree);
+    if (de_ctx->pcre_precompiled == NULL)
+        return;
+
+    DetectPcrePrecompileCtx pctx = { .rules = rules };
+    pctx.results = SCCalloc(cnt, sizeof(DetectPcrePrecompiled *));
+    if (pctx.results == NULL)
+        return;
+
+    DetectLoaderParallelRun(de_ctx->build_threads, cnt, DetectPcrePrecompileRule, &pctx);
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        DetectPcrePrecompiled *p = pctx.results[i];
+        while (p != NULL) {
+            DetectPcrePrecompiled *next = p->next;
+            p->next = NULL;
+            DetectPcrePrecompiled *head = HashTableLookup(de_ctx->pcre_precompiled, p, 0);
+            if (head != NULL) {
+                p->next = head->next;
+                head->next = p;
+            } else if (HashTableAdd(de_ctx->pcre_precompiled, p, 0) != 0) {
+                DetectPcrePrecompiledListFree(p);
+            }
+            p = next;
+        }
+    }
+    SCFree(pctx.results);
+}
+
+/**
+ *  \brief free the regexes that DetectPcrePrecompileRules compiled, but
+ *         that weren't used by a rule
+ */
+void DetectPcrePrecompiledFree(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->pcre_precompiled != NULL) {
+        HashTableFree(de_ctx->pcre_precompiled);
+        de_ctx->pcre_precompiled = NULL;
+    }
+}
+
+/** \internal
+ *  \brief take a regex compiled by DetectPcrePrecompileRules
+ *
+ *  \retval code compiled regex, owned by the caller, or NULL
+ */
+static pcre2_code *DetectPcrePrecompiledTake(DetectEngineCtx *de_ctx, const char *re, int opts)
+{
+    if (de_ctx->pcre_precompiled == NULL)
+        return NULL;
+
+    DetectPcrePrecompiled lookup = { .re = (char *)re, .opts = opts };
+    DetectPcrePrecompiled *head = HashTableLookup(de_ctx->pcre_precompiled, &lookup, 0);
+    if (head == NULL)
+        return NULL;
+
+    pcre2_code *code = NULL;
+    if (head->next != NULL) {
+        DetectPcrePrecompiled *p = head->next;
+        head->next = p->next;
+        code = p->code;
+        p->next = NULL;
+        p->code = NULL;
+        DetectPcrePrecompiledListFree(p);
+    } else {
+        code = head->code;
+        head->code = NULL;
+    }
+    return code;
+}
+
 static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx,
         const char *regexstr, int *sm_list, char *capture_names,
         size_t capture_names_size, bool negate, AppProto *alproto)
@@ -360,25 +684,12 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx,
     int check_host_header = 0;
     char op_str[64] = "";
 
-    int cut_capture = 0;
-    char *fcap = strstr(regexstr, "flow:");
-    char *pcap = strstr(regexstr, "pkt:");
+    const int cut_capture = DetectPcreCaptureNamesOffset(regexstr);
     /* take the size of the whole input as buffer size for the regex we will
      * extract below. Add 1 to please Coverity's alloc_strlen test. */
     size_t slen = strlen(regexstr) + 1;
-    if (fcap || pcap) {
+    if (cut_capture >= 0) {
         SCLogDebug("regexstr %s", regexstr);
-
-        if (fcap && !pcap)
-            cut_capture = fcap - regexstr;
-        else if (pcap && !fcap)
-            cut_capture = pcap - regexstr;
-        else {
-            BUG_ON(pcap == NULL); // added to assist cppcheck
-            BUG_ON(fcap == NULL);
-            cut_capture = MIN((pcap - regexstr), (fcap - regexstr));
-        }
-
         SCLogDebug("cut_capture %d", cut_capture);
 
         if (cut_capture > 1) {
@@ -446,31 +757,16 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx,
         while (*op) {
             SCLogDebug("regex option %c", *op);
 
-            switch (*op) {
-                case 'A':
-                    opts |= PCRE2_ANCHORED;
-                    break;
-                case 'E':
-                    opts |= PCRE2_DOLLAR_ENDONLY;
-                    break;
-                case 'G':
-                    opts |= PCRE2_UNGREEDY;
-                    break;
-
-                case 'i':
-                    opts |= PCRE2_CASELESS;
+            const int compile_opt = DetectPcreCompileOption(*op);
+            if (compile_opt != 0) {
+                opts |= compile_opt;
+                if (*op == 'i')
                     pd->flags |= DETECT_PCRE_CASELESS;
-                    break;
-                case 'm':
-                    opts |= PCRE2_MULTILINE;
-                    break;
-                case 's':
-                    opts |= PCRE2_DOTALL;
-                    break;
-                case 'x':
-                    opts |= PCRE2_EXTENDED;
-                    break;
+                op++;
+                continue;
+            }
 
+            switch (*op) {
                 case 'O':
                     pd->flags |= DETECT_PCRE_MATCH_LIMIT;
                     break;
@@ -641,12 +937,10 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx,
     if (capture_names == NULL || strlen(capture_names) == 0)
         opts |= PCRE2_NO_AUTO_CAPTURE;
 
-    pd->parse_regex.regex =
-            pcre2_compile((PCRE2_SPTR8)re, PCRE2_ZERO_TERMINATED, opts, &en, &eo2, NULL);
-    if (pd->parse_regex.regex == NULL && en == 115) { // reference to nonexistent subpattern
-        opts &= ~PCRE2_NO_AUTO_CAPTURE;
-        pd->parse_regex.regex =
-                pcre2_compile((PCRE2_SPTR8)re, PCRE2_ZERO_TERMINATED, opts, &en, &eo2, NULL);
+    pd->parse_regex.regex = DetectPcrePrecompiledTake(de_ctx, re, opts);
+    const bool precompiled = pd->parse_regex.regex != NULL;
+    if (!precompiled) {
+        pd->parse_regex.regex = DetectPcreCompile(re, opts, &en, &eo2);
     }
     if (pd->parse_regex.regex == NULL)  {
         PCRE2_UCHAR errbuffer[256];
@@ -658,7 +952,7 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx,
     }
 
 #ifdef PCRE2_HAVE_JIT
-    if (pcre2_use_jit) {
+    if (pcre2_use_jit && !precompiled) {
         ret = pcre2_jit_compile(pd->parse_regex.regex, PCRE2_JIT_COMPLETE);
         if (ret != 0) {
             /* warning, so we won't print the sig after this. Adding
@@ -2018,6 +2312,51 @@ static int DetectPcreParseCaptureTest(void)
     PASS;
 }
 
+/**
+ * \test DetectPcrePrecompileTest01 regexes compiled ahead are used by the
+ *       rule parser
+ */
+static int DetectPcrePrecompileTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->build_threads = 2;
+
+    const char *rules[] = {
+        "alert tcp any any -> any any (pcre:\"/abc/i\"; sid:1;)",
+        "alert tcp any any -> any any (content:\"x\"; pcre: !\"/abc/i\"; pcre:\"/d\\;ef/s\"; "
+        "sid:2;)",
+        "alert tcp any any -> any any (pcre:\"/xyz/7\"; sid:3;)",
+    };
+    DetectPcrePrecompileRules(de_ctx, rules, 3);
+    FAIL_IF_NULL(de_ctx->pcre_precompiled);
+
+    DetectPcrePrecompiled lookup = { .re = (char *)"abc",
+        .opts = PCRE2_CASELESS | PCRE2_NO_AUTO_CAPTURE };
+    DetectPcrePrecompiled *p = HashTableLookup(de_ctx->pcre_precompiled, &lookup, 0);
+    FAIL_IF_NULL(p);
+    FAIL_IF_NULL(p->code);
+    FAIL_IF_NULL(p->next);
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, rules[0]));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, rules[1]));
+    FAIL_IF_NOT_NULL(DetectEngineAppendSig(de_ctx, rules[2]));
+
+    /* both instances were taken */
+    FAIL_IF_NOT_NULL(p->code);
+    FAIL_IF_NOT_NULL(p->next);
+    lookup.re = (char *)"d\\;ef";
+    lookup.opts = PCRE2_DOTALL | PCRE2_NO_AUTO_CAPTURE;
+    p = HashTableLookup(de_ctx->pcre_precompiled, &lookup, 0);
+    FAIL_IF_NULL(p);
+    FAIL_IF_NOT_NULL(p->code);
+
+    DetectPcrePrecompiledFree(de_ctx);
+    FAIL_IF_NOT_NULL(de_ctx->pcre_precompiled);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 /**
  * \brief this function registers unit tests for DetectPcre
  */
@@ -2065,6 +2404,7 @@ static void DetectPcreRegisterTests(void)
 
     UtRegisterTest("DetectPcreParseHttpHost", DetectPcreParseHttpHost);
     UtRegisterTest("DetectPcreParseCaptureTest", DetectPcreParseCaptureTest);
+    UtRegisterTest("DetectPcrePrecompileTest01", DetectPcrePrecompileTest01);
 
 }
 #endif /* UNITTESTS */
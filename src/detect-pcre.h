@@ -59,6 +59,8 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *,
         Packet *, Flow *, const uint8_t *, uint32_t);
 
 void DetectPcreRegister (void);
+void DetectPcrePrecompileRules(DetectEngineCtx *de_ctx, const char **rules, uint32_t cnt);
+void DetectPcrePrecompiledFree(DetectEngineCtx *de_ctx);
 
 #endif /* __DETECT_PCRE_H__ */
 
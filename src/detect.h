@@ -877,6 +877,12 @@ typedef struct DetectEngineCtx_ {
     /* maximum recursion depth for content inspection */
     int inspection_recursion_limit;
 
+    /* scan each byte of the raw stream only once with the stream mpm */
+    bool incremental_stream_mpm;
+
+    /* threads used to prepare the mpm contexts, 0 ("auto") means one per cpu */
+    uint16_t build_threads;
+
     /* registration id for per thread ctx for the filemagic/file.magic keywords */
     int filemagic_thread_ctx_id;
 
@@ -976,6 +982,9 @@ typedef struct DetectEngineCtx_ {
     /** table to store metadata keys and values */
     HashTable *metadata_table;
 
+    /** regexes of the pcre keywords compiled ahead of the rule parsing */
+    HashTable *pcre_precompiled;
+
     /* hash tables with rule-time buffer registration. Start time registration
      * is in detect-engine.c::g_buffer_type_hash */
     HashListTable *buffer_type_hash_name;
@@ -1119,6 +1128,9 @@ typedef struct DetectEngineThreadCtx_ {
     uint16_t counter_alerts_overflow;
     /** id for suppressed alerts counter */
     uint16_t counter_alerts_suppressed;
+    /** raw stream bytes new to the stream mpm, and bytes it actually scanned */
+    uint16_t counter_stream_mpm_bytes;
+    uint16_t counter_stream_mpm_bytes_scanned;
 #ifdef PROFILING
     uint16_t counter_mpm_list;
     uint16_t counter_nonmpm_list;
@@ -56,11 +56,81 @@ extern TcpStreamCnf stream_config;
 
 
 FlowBucket *flow_hash;
+FlowBucketBlock *flow_hash_blocks;
 SC_ATOMIC_EXTERN(unsigned int, flow_prune_idx);
 SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv, const SCTime_t ts);
 
+/** \internal
+ *  \brief get the hash bucket for a hash value in a shard of the table
+ *
+ *  With flow.hash-shards set to 1 (default) this is the plain
+ *  'hash % hash_size' row lookup.
+ */
+static inline FlowBucket *FlowHashGetBucket(const uint32_t shard, const uint32_t hash)
+{
+    return &flow_hash[shard * flow_config.hash_shard_rows + (hash % flow_config.hash_shard_rows)];
+}
+
+/** \internal
+ *  \brief shard for flows set up from a FlowKey
+ *
+ *  Flows set up outside of a worker, like the ones the eBPF bypass code
+ *  restores from its maps, have no owning worker. They are put in the shard
+ *  picked by their hash, which workers check before they set up a new flow
+ *  in their own shard. See FlowGetKeyFlowFromHash().
+ */
+static inline uint32_t FlowHashKeyShard(const uint32_t hash)
+{
+    return hash % flow_config.hash_shards;
+}
+
+/** set once a flow was set up from a FlowKey */
+static SC_ATOMIC_DECLARE(uint32_t, flow_key_flows);
+
+/** hash shard used by the flow worker running in this thread, or
+ *  FLOW_HASH_SHARD_NONE for threads w/o a flow worker */
+#define FLOW_HASH_SHARD_NONE UINT32_MAX
+static thread_local uint32_t t_flow_hash_shard = FLOW_HASH_SHARD_NONE;
+
+/** \brief register the hash shard the flow worker in this thread uses
+ *
+ *  Enables the FlowPrefetch* calls in this thread. */
+void FlowHashSetThreadShard(const uint32_t shard)
+{
+    t_flow_hash_shard = shard;
+}
+
+/** \brief prefetch the hash row the flow of a packet will be looked up in
+ *
+ *  Meant to be called some time before the flow lookup of the packet, so that
+ *  the cache miss on the row overlaps with other work. Does nothing in threads
+ *  that don't run a flow worker, as the row would be pulled into the wrong
+ *  CPU's cache. */
+void FlowPrefetchBucket(const Packet *p)
+{
+    if (t_flow_hash_shard != FLOW_HASH_SHARD_NONE && (p->flags & PKT_WANTS_FLOW)) {
+        PREFETCH(FlowHashGetBucket(t_flow_hash_shard, p->flow_hash));
+    }
+}
+
+/** \brief prefetch the first flow in the hash row of a packet
+ *
+ *  Second stage after FlowPrefetchBucket: reads the row head, so it should only
+ *  be called once the row is expected to be in cache. The row is read w/o
+ *  the row lock, which is fine as a stale pointer is only used as a hint. */
+void FlowPrefetchHead(const Packet *p)
+{
+    if (t_flow_hash_shard != FLOW_HASH_SHARD_NONE && (p->flags & PKT_WANTS_FLOW)) {
+        const FlowBucket *fb = FlowHashGetBucket(t_flow_hash_shard, p->flow_hash);
+        const Flow *f = FLOW_HASH_LINK_GET(&fb->head);
+        if (f != NULL) {
+            PREFETCH(f);
+        }
+    }
+}
+
 /** \brief compare two raw ipv6 addrs
  *
  *  \note we don't care about the real ipv6 ip's, this is just
@@ -521,6 +591,9 @@ void FlowSetupPacket(Packet *p)
 {
     p->flags |= PKT_WANTS_FLOW;
     p->flow_hash = FlowGetHash(p);
+    /* in the workers runmode the rest of decoding runs before the flow
+     * lookup, so get the hash row loading in the meantime */
+    FlowPrefetchBucket(p);
 }
 
 static inline int FlowCompare(Flow *f, const Packet *p)
@@ -677,9 +750,23 @@ static Flow *FlowGetNew(ThreadVars *tv, FlowLookupStruct *fls, Packet *p)
     if (f == NULL) {
         f = FlowSpareSync(tv, fls, p, emerg);
     }
+    if (f == NULL && !(FLOW_CHECK_MEMCAP(sizeof(Flow)))) {
+        /* our node is out of spare flows and we can't alloc new ones: take
+         * flows from another NUMA node before going into emergency mode */
+        fls->spare_queue = FlowSpareGetFromPoolRemote();
+        f = FlowQueuePrivateGetFromTop(&fls->spare_queue);
+#ifdef UNITTESTS
+        if (tv != NULL && fls->dtv != NULL) {
+#endif
+            if (f != NULL)
+                StatsIncr(tv, fls->dtv->counter_flow_spare_sync_remote);
+#ifdef UNITTESTS
+        }
+#endif
+    }
     if (f == NULL) {
         /* If we reached the max memcap, we get a used flow */
-        if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
+        if (!(FLOW_CHECK_MEMCAP(sizeof(Flow)))) {
             /* declare state of emergency */
             if (!(SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)) {
                 SC_ATOMIC_OR(flow_flags, FLOW_EMERGENCY);
@@ -754,12 +841,12 @@ static Flow *TcpReuseReplace(ThreadVars *tv, FlowLookupStruct *fls, FlowBucket *
     }
 
     /* put at the start of the list */
-    f->next = fb->head;
-    fb->head = f;
+    FLOW_HASH_LINK_SET(&f->next, fb->head);
+    FLOW_HASH_LINK_SET(&fb->head, f);
 
     /* initialize and return */
     FlowInit(f, p);
-    f->flow_hash = hash;
+    FLOW_HASH_LINK_SET(&f->flow_hash, hash);
     f->fb = fb;
     FlowUpdateState(f, FLOW_STATE_NEW);
 
@@ -787,24 +874,22 @@ static inline void MoveToWorkQueue(ThreadVars *tv, FlowLookupStruct *fls,
 
     /* remove from hash... */
     if (prev_f) {
-        prev_f->next = f->next;
+        FLOW_HASH_LINK_SET(&prev_f->next, f->next);
     }
     if (f == fb->head) {
-        fb->head = f->next;
+        FLOW_HASH_LINK_SET(&fb->head, f->next);
     }
 
     if (f->proto != IPPROTO_TCP || FlowBelongsToUs(tv, f)) { // TODO thread_id[] direction
         f->fb = NULL;
-        f->next = NULL;
+        FLOW_HASH_LINK_SET(&f->next, NULL);
         FlowQueuePrivateAppendFlow(&fls->work_queue, f);
     } else {
         /* implied: TCP but our thread does not own it. So set it
          * aside for the Flow Manager to pick it up. */
-        f->next = fb->evicted;
+        FLOW_HASH_LINK_SET(&f->next, fb->evicted);
         fb->evicted = f;
-        if (SC_ATOMIC_GET(f->fb->next_ts) != 0) {
-            SC_ATOMIC_SET(f->fb->next_ts, 0);
-        }
+        FlowBucketResetNextTs(fb);
     }
 }
 
@@ -823,6 +908,90 @@ static inline bool FlowIsTimedOut(const Flow *f, const uint32_t sec, const bool
     return false;
 }
 
+/** max number of flows in a row that a lockless lookup will walk before
+ *  falling back to the locked path */
+#define FLOW_LOCKLESS_MAX_WALK 16
+
+/** \internal
+ *  \brief look up an existing flow w/o taking the hash row lock
+ *
+ *  The row is walked w/o the bucket lock, so a flow we look at may be
+ *  evicted, recycled or reused by another thread at the same time. The
+ *  row links and the flow hash are read with atomic loads, the rest of
+ *  the flow is only looked at after locking it. The fields that tell us
+ *  if the flow is still the active flow in our row (f::fb, f::flow_end_flags
+ *  and the flow header) are only updated while holding the flow lock, so
+ *  after locking we can validate the match.
+ *
+ *  Only the common case of finding an active flow is handled here.
+ *  Creating flows, timeouts and TCP port reuse are left to the locked
+ *  path in FlowGetFlowFromHash().
+ *
+ *  \note relies on flows not being freed while the workers run, so that
+ *        a flow we race with can still be safely read and locked. See
+ *        FlowFree().
+ *
+ *  \retval f *LOCKED* flow or NULL if the locked path needs to be used
+ */
+static Flow *FlowGetExistingFlowLockless(FlowBucket *fb, const Packet *p)
+{
+    uint32_t walked = 0;
+    for (Flow *f = FLOW_HASH_LINK_GET(&fb->head); f != NULL && walked < FLOW_LOCKLESS_MAX_WALK;
+            f = FLOW_HASH_LINK_GET(&f->next), walked++) {
+        if (FLOW_HASH_LINK_GET(&f->flow_hash) != p->flow_hash)
+            continue;
+
+        FLOWLOCK_WRLOCK(f);
+        if (f->fb != fb || (f->flow_end_flags & FLOW_END_FLAG_TIMEOUT)) {
+            FLOWLOCK_UNLOCK(f);
+            return NULL;
+        }
+        if (FlowCompare(f, p) == 0) {
+            /* same hash, different flow */
+            FLOWLOCK_UNLOCK(f);
+            continue;
+        }
+        const bool emerg = (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY) != 0;
+        if (FlowIsTimedOut(f, (uint32_t)SCTIME_SECS(p->ts), emerg) ||
+                TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1) {
+            FLOWLOCK_UNLOCK(f);
+            return NULL;
+        }
+        return f;
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief check if a worker has to look for a flow set up from a FlowKey
+ *         before setting up a new flow in its own shard */
+static inline bool FlowNeedsKeyShardLookup(const FlowLookupStruct *fls, const uint32_t hash)
+{
+    return flow_config.hash_shards > 1 && SC_ATOMIC_GET(flow_key_flows) != 0 &&
+           FlowHashKeyShard(hash) != fls->shard;
+}
+
+/** \internal
+ *  \brief look up a flow for a packet in the shard of flows that were set
+ *         up from a FlowKey
+ *
+ *  \retval f *LOCKED* flow or NULL
+ */
+static Flow *FlowGetKeyFlowFromHash(const Packet *p, const uint32_t hash)
+{
+    FlowBucket *fb = FlowHashGetBucket(FlowHashKeyShard(hash), hash);
+    FBLOCK_LOCK(fb);
+    for (Flow *f = fb->head; f != NULL; f = f->next) {
+        if (FlowCompare(f, p) != 0) {
+            FLOWLOCK_WRLOCK(f);
+            FBLOCK_UNLOCK(fb);
+            return f;
+        }
+    }
+    FBLOCK_UNLOCK(fb);
+    return NULL;
+}
+
 /** \brief Get Flow for packet
  *
  * Hash retrieval function for flows. Looks up the hash bucket containing the
@@ -844,15 +1013,36 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, FlowLookupStruct *fls, Packet *p, Flow
 {
     Flow *f = NULL;
 
-    /* get our hash bucket and lock it */
+    /* get our hash bucket */
     const uint32_t hash = p->flow_hash;
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+    FlowBucket *fb = FlowHashGetBucket(fls->shard, hash);
+
+    if (flow_config.lockless_lookup) {
+        f = FlowGetExistingFlowLockless(fb, p);
+        if (f != NULL) {
+            FlowReference(dest, f);
+            return f; /* return w/o releasing flow lock */
+        }
+    }
+
+    bool key_shard_checked = false;
+lookup:
     FBLOCK_LOCK(fb);
 
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
 
     /* see if the bucket already has a flow */
     if (fb->head == NULL) {
+        if (!key_shard_checked && FlowNeedsKeyShardLookup(fls, hash)) {
+            FBLOCK_UNLOCK(fb);
+            key_shard_checked = true;
+            f = FlowGetKeyFlowFromHash(p, hash);
+            if (f != NULL) {
+                FlowReference(dest, f);
+                return f; /* return w/o releasing flow lock */
+            }
+            goto lookup;
+        }
         f = FlowGetNew(tv, fls, p);
         if (f == NULL) {
             FBLOCK_UNLOCK(fb);
@@ -860,11 +1050,11 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, FlowLookupStruct *fls, Packet *p, Flow
         }
 
         /* flow is locked */
-        fb->head = f;
+        FLOW_HASH_LINK_SET(&fb->head, f);
 
         /* got one, now lock, initialize and return */
         FlowInit(f, p);
-        f->flow_hash = hash;
+        FLOW_HASH_LINK_SET(&f->flow_hash, hash);
         f->fb = fb;
         FlowUpdateState(f, FLOW_STATE_NEW);
 
@@ -916,6 +1106,16 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, FlowLookupStruct *fls, Packet *p, Flow
 
 flow_removed:
         if (next_f == NULL) {
+            if (!key_shard_checked && FlowNeedsKeyShardLookup(fls, hash)) {
+                FBLOCK_UNLOCK(fb);
+                key_shard_checked = true;
+                f = FlowGetKeyFlowFromHash(p, hash);
+                if (f != NULL) {
+                    FlowReference(dest, f);
+                    return f; /* return w/o releasing flow lock */
+                }
+                goto lookup;
+            }
             f = FlowGetNew(tv, fls, p);
             if (f == NULL) {
                 FBLOCK_UNLOCK(fb);
@@ -924,12 +1124,12 @@ flow_removed:
 
             /* flow is locked */
 
-            f->next = fb->head;
-            fb->head = f;
+            FLOW_HASH_LINK_SET(&f->next, fb->head);
+            FLOW_HASH_LINK_SET(&fb->head, f);
 
             /* initialize and return */
             FlowInit(f, p);
-            f->flow_hash = hash;
+            FLOW_HASH_LINK_SET(&f->flow_hash, hash);
             f->fb = fb;
             FlowUpdateState(f, FLOW_STATE_NEW);
             FlowReference(dest, f);
@@ -968,19 +1168,22 @@ static inline bool FlowCompareKey(Flow *f, FlowKey *key)
 Flow *FlowGetExistingFlowFromFlowId(int64_t flow_id)
 {
     uint32_t hash = flow_id & 0x0000FFFF;
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
-    FBLOCK_LOCK(fb);
-    SCLogDebug("fb %p fb->head %p", fb, fb->head);
-
-    for (Flow *f = fb->head; f != NULL; f = f->next) {
-        if (FlowGetId(f) == flow_id) {
-            /* found our flow, lock & return */
-            FLOWLOCK_WRLOCK(f);
-            FBLOCK_UNLOCK(fb);
-            return f;
+    /* we don't know which worker owns the flow, so check each shard */
+    for (uint32_t shard = 0; shard < flow_config.hash_shards; shard++) {
+        FlowBucket *fb = FlowHashGetBucket(shard, hash);
+        FBLOCK_LOCK(fb);
+        SCLogDebug("fb %p fb->head %p", fb, fb->head);
+
+        for (Flow *f = fb->head; f != NULL; f = f->next) {
+            if (FlowGetId(f) == flow_id) {
+                /* found our flow, lock & return */
+                FLOWLOCK_WRLOCK(f);
+                FBLOCK_UNLOCK(fb);
+                return f;
+            }
         }
+        FBLOCK_UNLOCK(fb);
     }
-    FBLOCK_UNLOCK(fb);
     return NULL;
 }
 
@@ -996,22 +1199,25 @@ Flow *FlowGetExistingFlowFromFlowId(int64_t flow_id)
  */
 static Flow *FlowGetExistingFlowFromHash(FlowKey *key, const uint32_t hash)
 {
-    /* get our hash bucket and lock it */
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
-    FBLOCK_LOCK(fb);
-    SCLogDebug("fb %p fb->head %p", fb, fb->head);
-
-    for (Flow *f = fb->head; f != NULL; f = f->next) {
-        /* see if this is the flow we are looking for */
-        if (FlowCompareKey(f, key)) {
-            /* found our flow, lock & return */
-            FLOWLOCK_WRLOCK(f);
-            FBLOCK_UNLOCK(fb);
-            return f;
+    /* we don't know which worker owns the flow, so check each shard */
+    for (uint32_t shard = 0; shard < flow_config.hash_shards; shard++) {
+        /* get our hash bucket and lock it */
+        FlowBucket *fb = FlowHashGetBucket(shard, hash);
+        FBLOCK_LOCK(fb);
+        SCLogDebug("fb %p fb->head %p", fb, fb->head);
+
+        for (Flow *f = fb->head; f != NULL; f = f->next) {
+            /* see if this is the flow we are looking for */
+            if (FlowCompareKey(f, key)) {
+                /* found our flow, lock & return */
+                FLOWLOCK_WRLOCK(f);
+                FBLOCK_UNLOCK(fb);
+                return f;
+            }
         }
-    }
 
-    FBLOCK_UNLOCK(fb);
+        FBLOCK_UNLOCK(fb);
+    }
     return NULL;
 }
 
@@ -1070,11 +1276,12 @@ Flow *FlowGetFromFlowKey(FlowKey *key, struct timespec *ttime, const uint32_t ha
     f->startts = SCTIME_FROM_TIMESPEC(ttime);
     f->lastts = f->startts;
 
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+    FlowBucket *fb = FlowHashGetBucket(FlowHashKeyShard(hash), hash);
+    SC_ATOMIC_SET(flow_key_flows, 1);
     FBLOCK_LOCK(fb);
     f->fb = fb;
-    f->next = fb->head;
-    fb->head = f;
+    FLOW_HASH_LINK_SET(&f->next, fb->head);
+    FLOW_HASH_LINK_SET(&fb->head, f);
     FLOWLOCK_WRLOCK(f);
     FBLOCK_UNLOCK(fb);
     return f;
@@ -1198,8 +1405,8 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv, const SCTime
         }
 
         /* remove from the hash */
-        fb->head = f->next;
-        f->next = NULL;
+        FLOW_HASH_LINK_SET(&fb->head, f->next);
+        FLOW_HASH_LINK_SET(&f->next, NULL);
         f->fb = NULL;
         FBLOCK_UNLOCK(fb);
 
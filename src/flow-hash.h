@@ -61,6 +61,21 @@ typedef struct FlowBucket_ {
     SC_ATOMIC_DECLARE(uint32_t, next_ts);
 } __attribute__((aligned(CLS))) FlowBucket;
 
+/** number of hash rows summarized by a single FlowBucketBlock */
+#define FLOW_BUCKET_BLOCK_ROWS 64
+/** FlowBucketBlock::next_ts value while the flow manager walks the block */
+#define FLOW_BUCKET_BLOCK_SCANNING 1
+
+/** \brief second level of the per row next_ts values
+ *
+ *  Holds the lowest next_ts of the FLOW_BUCKET_BLOCK_ROWS rows it covers, so
+ *  the flow manager can skip a block of rows that has nothing due without
+ *  looking at the individual rows. Cleared to 0 by workers whenever they
+ *  clear the next_ts of one of its rows. */
+typedef struct FlowBucketBlock_ {
+    SC_ATOMIC_DECLARE(uint32_t, next_ts);
+} FlowBucketBlock;
+
 #ifdef FBLOCK_SPIN
     #define FBLOCK_INIT(fb) SCSpinInit(&(fb)->s, 0)
     #define FBLOCK_DESTROY(fb) SCSpinDestroy(&(fb)->s)
@@ -84,6 +99,10 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, FlowLookupStruct *tctx, Packet *, Flow
 Flow *FlowGetFromFlowKey(FlowKey *key, struct timespec *ttime, const uint32_t hash);
 Flow *FlowGetExistingFlowFromFlowId(int64_t flow_id);
 uint32_t FlowKeyGetHash(FlowKey *flow_key);
+
+void FlowHashSetThreadShard(const uint32_t shard);
+void FlowPrefetchBucket(const Packet *p);
+void FlowPrefetchHead(const Packet *p);
 uint32_t FlowGetIpPairProtoHash(const Packet *p);
 
 /** \note f->fb must be locked */
@@ -93,12 +112,12 @@ static inline void RemoveFromHash(Flow *f, Flow *prev_f)
 
     /* remove from the hash */
     if (prev_f != NULL) {
-        prev_f->next = f->next;
+        FLOW_HASH_LINK_SET(&prev_f->next, f->next);
     } else {
-        fb->head = f->next;
+        FLOW_HASH_LINK_SET(&fb->head, f->next);
     }
 
-    f->next = NULL;
+    FLOW_HASH_LINK_SET(&f->next, NULL);
     f->fb = NULL;
 }
 
@@ -126,6 +126,7 @@ typedef struct FlowTimeoutCounters_ {
     uint32_t rows_skipped;
     uint32_t rows_empty;
     uint32_t rows_maxlen;
+    uint32_t blocks_skipped;
 
     uint32_t flows_checked;
     uint32_t flows_notimeout;
@@ -384,7 +385,7 @@ static void FlowManagerHashRowClearEvictedList(
     do {
         FLOWLOCK_WRLOCK(f);
         Flow *next_flow = f->next;
-        f->next = NULL;
+        FLOW_HASH_LINK_SET(&f->next, NULL);
         f->fb = NULL;
 
         FlowQueuePrivateAppendFlow(&td->aside_queue, f);
@@ -397,6 +398,10 @@ static void FlowManagerHashRowClearEvictedList(
 /**
  *  \brief time out flows from the hash
  *
+ *  Rows are walked per FlowBucketBlock. If the range covers a whole block
+ *  and the block's next_ts shows nothing is due, the rows of the block are
+ *  skipped w/o touching them.
+ *
  *  \param ts timestamp
  *  \param hash_min min hash index to consider
  *  \param hash_max max hash index to consider
@@ -412,6 +417,7 @@ static uint32_t FlowTimeoutHash(FlowManagerTimeoutThread *td, SCTime_t ts, const
     const uint32_t rows_checked = hash_max - hash_min;
     uint32_t rows_skipped = 0;
     uint32_t rows_empty = 0;
+    uint32_t blocks_skipped = 0;
 
 #if __WORDSIZE==64
 #define BITS 64
@@ -422,61 +428,98 @@ static uint32_t FlowTimeoutHash(FlowManagerTimeoutThread *td, SCTime_t ts, const
 #endif
 
     const uint32_t ts_secs = SCTIME_SECS(ts);
-    for (uint32_t idx = hash_min; idx < hash_max; idx+=BITS) {
-        TYPE check_bits = 0;
-        const uint32_t check = MIN(BITS, (hash_max - idx));
-        for (uint32_t i = 0; i < check; i++) {
-            FlowBucket *fb = &flow_hash[idx+i];
-            check_bits |= (TYPE)(SC_ATOMIC_LOAD_EXPLICIT(
-                                         fb->next_ts, SC_ATOMIC_MEMORY_ORDER_RELAXED) <= ts_secs)
-                          << (TYPE)i;
+    uint32_t block_min = hash_min;
+    while (block_min < hash_max) {
+        const uint32_t block_max =
+                MIN(hash_max, (block_min / FLOW_BUCKET_BLOCK_ROWS + 1) * FLOW_BUCKET_BLOCK_ROWS);
+
+        /* the block next_ts can only be used and updated if we walk all its rows */
+        FlowBucketBlock *fbb = NULL;
+        if (block_max - block_min == FLOW_BUCKET_BLOCK_ROWS) {
+            fbb = &flow_hash_blocks[block_min / FLOW_BUCKET_BLOCK_ROWS];
+            uint32_t block_next_ts = SC_ATOMIC_GET(fbb->next_ts);
+            /* in emergency mode flows time out before the block next_ts */
+            if (!emergency && block_next_ts > ts_secs) {
+                blocks_skipped++;
+                block_min = block_max;
+                continue;
+            }
+            /* flag the block as being walked. If a worker resets it while
+             * we're walking the rows, updating it below will fail and we
+             * will revisit the block next time. We're the only one setting
+             * the flag, so a plain store will do: a reset that happens
+             * before it is overwritten, but the worker reset the row first,
+             * so the walk below will see it. */
+            SC_ATOMIC_SET(fbb->next_ts, FLOW_BUCKET_BLOCK_SCANNING);
         }
-        if (check_bits == 0)
-            continue;
 
-        for (uint32_t i = 0; i < check; i++) {
-            FlowBucket *fb = &flow_hash[idx+i];
-            if ((check_bits & ((TYPE)1 << (TYPE)i)) != 0 && SC_ATOMIC_GET(fb->next_ts) <= ts_secs) {
-                FBLOCK_LOCK(fb);
-                Flow *evicted = NULL;
-                if (fb->evicted != NULL || fb->head != NULL) {
-                    if (fb->evicted != NULL) {
-                        /* transfer out of bucket so we can do additional work outside
-                         * of the bucket lock */
-                        evicted = fb->evicted;
-                        fb->evicted = NULL;
-                    }
-                    if (fb->head != NULL) {
-                        uint32_t next_ts = 0;
-                        FlowManagerHashRowTimeout(td, fb->head, ts, emergency, counters, &next_ts);
-
-                        if (SC_ATOMIC_GET(fb->next_ts) != next_ts)
-                            SC_ATOMIC_SET(fb->next_ts, next_ts);
-                    }
-                    if (fb->evicted == NULL && fb->head == NULL) {
+        for (uint32_t idx = block_min; idx < block_max; idx += BITS) {
+            TYPE check_bits = 0;
+            const uint32_t check = MIN(BITS, (block_max - idx));
+            for (uint32_t i = 0; i < check; i++) {
+                FlowBucket *fb = &flow_hash[idx+i];
+                check_bits |= (TYPE)(SC_ATOMIC_LOAD_EXPLICIT(
+                                             fb->next_ts, SC_ATOMIC_MEMORY_ORDER_RELAXED) <= ts_secs)
+                              << (TYPE)i;
+            }
+            if (check_bits == 0)
+                continue;
+
+            for (uint32_t i = 0; i < check; i++) {
+                FlowBucket *fb = &flow_hash[idx+i];
+                if ((check_bits & ((TYPE)1 << (TYPE)i)) != 0 && SC_ATOMIC_GET(fb->next_ts) <= ts_secs) {
+                    FBLOCK_LOCK(fb);
+                    Flow *evicted = NULL;
+                    if (fb->evicted != NULL || fb->head != NULL) {
+                        if (fb->evicted != NULL) {
+                            /* transfer out of bucket so we can do additional work outside
+                             * of the bucket lock */
+                            evicted = fb->evicted;
+                            fb->evicted = NULL;
+                        }
+                        if (fb->head != NULL) {
+                            uint32_t next_ts = 0;
+                            FlowManagerHashRowTimeout(td, fb->head, ts, emergency, counters, &next_ts);
+
+                            if (SC_ATOMIC_GET(fb->next_ts) != next_ts)
+                                SC_ATOMIC_SET(fb->next_ts, next_ts);
+                        }
+                        if (fb->evicted == NULL && fb->head == NULL) {
+                            SC_ATOMIC_SET(fb->next_ts, UINT_MAX);
+                        }
+                    } else {
                         SC_ATOMIC_SET(fb->next_ts, UINT_MAX);
+                        rows_empty++;
+                    }
+                    FBLOCK_UNLOCK(fb);
+                    /* processed evicted list */
+                    if (evicted) {
+                        FlowManagerHashRowClearEvictedList(td, evicted, ts, counters);
                     }
                 } else {
-                    SC_ATOMIC_SET(fb->next_ts, UINT_MAX);
-                    rows_empty++;
-                }
-                FBLOCK_UNLOCK(fb);
-                /* processed evicted list */
-                if (evicted) {
-                    FlowManagerHashRowClearEvictedList(td, evicted, ts, counters);
+                    rows_skipped++;
                 }
-            } else {
-                rows_skipped++;
+            }
+            if (td->aside_queue.len) {
+                cnt += ProcessAsideQueue(td, counters);
             }
         }
-        if (td->aside_queue.len) {
-            cnt += ProcessAsideQueue(td, counters);
+
+        if (fbb != NULL) {
+            uint32_t block_next_ts = UINT_MAX;
+            for (uint32_t idx = block_min; idx < block_max; idx++) {
+                block_next_ts = MIN(block_next_ts, SC_ATOMIC_GET(flow_hash[idx].next_ts));
+            }
+            uint32_t scanning = FLOW_BUCKET_BLOCK_SCANNING;
+            (void)SC_ATOMIC_CAS(&fbb->next_ts, scanning, block_next_ts);
         }
+        block_min = block_max;
     }
 
     counters->rows_checked += rows_checked;
     counters->rows_skipped += rows_skipped;
     counters->rows_empty += rows_empty;
+    counters->blocks_skipped += blocks_skipped;
 
     if (td->aside_queue.len) {
         cnt += ProcessAsideQueue(td, counters);
@@ -541,7 +584,7 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f, FlowQueuePrivate *recycle_q,
         } else {
             FlowBucket *fb = f->fb;
             fb->evicted = f->next;
-            f->next = NULL;
+            FLOW_HASH_LINK_SET(&f->next, NULL);
             f->fb = NULL;
         }
         f->flow_end_flags |= FLOW_END_FLAG_SHUTDOWN;
@@ -615,6 +658,7 @@ typedef struct FlowCounters_ {
     uint16_t flow_mgr_flows_aside_needs_work;
 
     uint16_t flow_mgr_rows_maxlen;
+    uint16_t flow_mgr_blocks_skipped;
 
     uint16_t flow_bypassed_cnt_clo;
     uint16_t flow_bypassed_pkts;
@@ -644,6 +688,7 @@ static void FlowCountersInit(ThreadVars *t, FlowCounters *fc)
     fc->flow_emerg_mode_over = StatsRegisterCounter("flow.emerg_mode_over", t);
 
     fc->flow_mgr_rows_maxlen = StatsRegisterMaxCounter("flow.mgr.rows_maxlen", t);
+    fc->flow_mgr_blocks_skipped = StatsRegisterCounter("flow.mgr.blocks_skipped", t);
     fc->flow_mgr_flows_checked = StatsRegisterCounter("flow.mgr.flows_checked", t);
     fc->flow_mgr_flows_notimeout = StatsRegisterCounter("flow.mgr.flows_notimeout", t);
     fc->flow_mgr_flows_timeout = StatsRegisterCounter("flow.mgr.flows_timeout", t);
@@ -674,6 +719,7 @@ static void FlowCountersUpdate(
     StatsAddUI64(th_v, ftd->cnt.flow_bypassed_bytes, (uint64_t)counters->bypassed_bytes);
 
     StatsSetUI64(th_v, ftd->cnt.flow_mgr_rows_maxlen, (uint64_t)counters->rows_maxlen);
+    StatsAddUI64(th_v, ftd->cnt.flow_mgr_blocks_skipped, (uint64_t)counters->blocks_skipped);
 }
 
 static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void **data)
@@ -958,6 +1004,7 @@ void FlowManagerThreadSpawn(void)
 
     SCLogConfig("using %u flow manager threads", flowmgr_number);
     StatsRegisterGlobalCounter("flow.memuse", FlowGetMemuse);
+    FlowSparePoolRegisterCounters();
 
     for (uint32_t u = 0; u < flowmgr_number; u++) {
         char name[TM_THREAD_NAME_MAX];
@@ -983,6 +1030,8 @@ typedef struct FlowRecyclerThreadData_ {
     uint16_t counter_flows;
     uint16_t counter_queue_avg;
     uint16_t counter_queue_max;
+    uint16_t counter_lag_avg;
+    uint16_t counter_lag_max;
 
     uint16_t counter_flow_active;
     uint16_t counter_tcp_active_sessions;
@@ -1004,6 +1053,8 @@ static TmEcode FlowRecyclerThreadInit(ThreadVars *t, const void *initdata, void
     ftd->counter_flows = StatsRegisterCounter("flow.recycler.recycled", t);
     ftd->counter_queue_avg = StatsRegisterAvgCounter("flow.recycler.queue_avg", t);
     ftd->counter_queue_max = StatsRegisterMaxCounter("flow.recycler.queue_max", t);
+    ftd->counter_lag_avg = StatsRegisterAvgCounter("flow.recycler.lag_avg", t);
+    ftd->counter_lag_max = StatsRegisterMaxCounter("flow.recycler.lag_max", t);
 
     ftd->counter_flow_active = StatsRegisterCounter("flow.active", t);
     ftd->counter_tcp_active_sessions = StatsRegisterCounter("tcp.active_sessions", t);
@@ -1026,10 +1077,15 @@ static TmEcode FlowRecyclerThreadDeinit(ThreadVars *t, void *data)
     return TM_ECODE_OK;
 }
 
-static void Recycler(ThreadVars *tv, FlowRecyclerThreadData *ftd, Flow *f)
+static void Recycler(ThreadVars *tv, FlowRecyclerThreadData *ftd, Flow *f, const uint32_t now)
 {
     FLOWLOCK_WRLOCK(f);
 
+    /* seconds between the flow timing out and it getting recycled */
+    const uint32_t lag = (f->timeout_at != 0 && now > f->timeout_at) ? now - f->timeout_at : 0;
+    StatsAddUI64(tv, ftd->counter_lag_avg, lag);
+    StatsSetUI64(tv, ftd->counter_lag_max, lag);
+
     (void)OutputFlowLog(tv, ftd->output_thread_data, f);
 
     FlowEndCountersUpdate(tv, &ftd->fec, f);
@@ -1044,6 +1100,28 @@ static void Recycler(ThreadVars *tv, FlowRecyclerThreadData *ftd, Flow *f)
 
 extern uint32_t flow_spare_pool_block_size;
 
+/** \internal
+ *  \brief get the next batch of flows to recycle
+ *
+ *  With a single recycler the whole queue is taken. With multiple
+ *  recyclers each takes a block at a time and wakes up another one if
+ *  flows are left, so that the work is spread over all of them. */
+static FlowQueuePrivate FlowRecyclerGetBatch(uint32_t *depth)
+{
+    if (flowrec_number == 1) {
+        FlowQueuePrivate list = FlowQueueExtractPrivate(&flow_recycle_q);
+        *depth = list.len;
+        return list;
+    }
+
+    FlowQueuePrivate list =
+            FlowQueueExtractPrivateMax(&flow_recycle_q, flow_spare_pool_block_size, depth);
+    if (*depth > list.len) {
+        FlowWakeupFlowRecyclerThread();
+    }
+    return list;
+}
+
 /** \brief Thread that manages timed out flows.
  *
  *  \param td ThreadVars cast to void ptr
@@ -1066,20 +1144,24 @@ static TmEcode FlowRecycler(ThreadVars *th_v, void *thread_data)
             TmThreadsUnsetFlag(th_v, THV_PAUSED);
         }
         SC_ATOMIC_ADD(flowrec_busy,1);
-        FlowQueuePrivate list = FlowQueueExtractPrivate(&flow_recycle_q);
+        uint32_t depth = 0;
+        FlowQueuePrivate list = FlowRecyclerGetBatch(&depth);
 
-        StatsAddUI64(th_v, ftd->counter_queue_avg, list.len);
-        StatsSetUI64(th_v, ftd->counter_queue_max, list.len);
+        StatsAddUI64(th_v, ftd->counter_queue_avg, depth);
+        StatsSetUI64(th_v, ftd->counter_queue_max, depth);
 
         const int bail = (TmThreadsCheckFlag(th_v, THV_KILL));
 
         /* Get the time */
         SCLogDebug("ts %" PRIdMAX "", (intmax_t)SCTIME_SECS(TimeGet()));
 
+        /* flows were left in the queue for the next batch */
+        const bool more = depth > list.len;
+        const uint32_t now = list.len ? (uint32_t)SCTIME_SECS(TimeGet()) : 0;
         uint64_t cnt = 0;
         Flow *f;
         while ((f = FlowQueuePrivateGetFromTop(&list)) != NULL) {
-            Recycler(th_v, ftd, f);
+            Recycler(th_v, ftd, f, now);
             cnt++;
 
             /* for every full sized block, add it to the spare pool */
@@ -1102,7 +1184,11 @@ static TmEcode FlowRecycler(ThreadVars *th_v, void *thread_data)
         }
 
         const bool emerg = (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY);
-        if (emerg || !time_is_live) {
+        if (more) {
+            /* we only took part of the queue, go get the next batch. If
+             * another recycler got it first the next run finds the queue
+             * empty and waits below. */
+        } else if (emerg || !time_is_live) {
             usleep(250);
         } else {
             struct timeval cond_tv;
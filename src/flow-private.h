@@ -93,8 +93,28 @@ extern FlowProtoFreeFunc flow_freefuncs[FLOW_PROTO_MAX];
 extern FlowQueue flow_recycle_q;
 
 extern FlowBucket *flow_hash;
+extern FlowBucketBlock *flow_hash_blocks;
 extern FlowConfig flow_config;
 
+/** \brief number of FlowBucketBlock's needed to cover the flow hash */
+static inline uint32_t FlowHashBlocks(void)
+{
+    return (flow_config.hash_size + FLOW_BUCKET_BLOCK_ROWS - 1) / FLOW_BUCKET_BLOCK_ROWS;
+}
+
+/** \brief reset the next_ts of a hash row so the flow manager revisits it
+ *
+ *  Also resets the next_ts of the block the row is part of. The block is
+ *  only written if needed, as it's shared by many rows. */
+static inline void FlowBucketResetNextTs(FlowBucket *fb)
+{
+    SC_ATOMIC_SET(fb->next_ts, 0);
+    FlowBucketBlock *fbb = &flow_hash_blocks[(fb - flow_hash) / FLOW_BUCKET_BLOCK_ROWS];
+    if (SC_ATOMIC_GET(fbb->next_ts) != 0) {
+        SC_ATOMIC_SET(fbb->next_ts, 0);
+    }
+}
+
 /** flow memuse counter (atomic), for enforcing memcap limit */
 SC_ATOMIC_EXTERN(uint64_t, flow_memuse);
 
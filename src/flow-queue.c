@@ -31,6 +31,7 @@
 #include "util-error.h"
 #include "util-debug.h"
 #include "util-print.h"
+#include "util-validate.h"
 
 FlowQueue *FlowQueueNew(void)
 {
@@ -148,6 +149,42 @@ FlowQueuePrivate FlowQueueExtractPrivate(FlowQueue *fq)
     return fqc;
 }
 
+/**
+ *  \brief extract at most \a max flows from the top of the queue
+ *
+ *  Lets multiple consumers share a queue in batches.
+ *
+ *  \param max max number of flows to extract, must be > 0
+ *  \param depth set to the queue length before the extraction
+ */
+FlowQueuePrivate FlowQueueExtractPrivateMax(FlowQueue *fq, const uint32_t max, uint32_t *depth)
+{
+    DEBUG_VALIDATE_BUG_ON(max == 0);
+
+    FQLOCK_LOCK(fq);
+    *depth = fq->qlen;
+    if (fq->qlen <= max) {
+        FlowQueuePrivate fqc = fq->priv;
+        fq->qtop = fq->qbot = NULL;
+        fq->qlen = 0;
+        FlowQueueAtomicSetEmpty(fq);
+        FQLOCK_UNLOCK(fq);
+        return fqc;
+    }
+
+    FlowQueuePrivate fqc = { fq->qtop, NULL, max };
+    Flow *f = fq->qtop;
+    for (uint32_t i = 1; i < max; i++) {
+        f = f->next;
+    }
+    fqc.bot = f;
+    fq->qtop = f->next;
+    fq->qlen -= max;
+    f->next = NULL;
+    FQLOCK_UNLOCK(fq);
+    return fqc;
+}
+
 Flow *FlowQueuePrivateGetFromTop(FlowQueuePrivate *fqc)
 {
     Flow *f = fqc->top;
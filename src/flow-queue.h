@@ -92,6 +92,7 @@ void FlowQueuePrivatePrependFlow(FlowQueuePrivate *fqc, Flow *f);
 void FlowQueueAppendPrivate(FlowQueue *fq, FlowQueuePrivate *fqp);
 void FlowQueuePrivateAppendPrivate(FlowQueuePrivate *dest, FlowQueuePrivate *src);
 FlowQueuePrivate FlowQueueExtractPrivate(FlowQueue *fq);
+FlowQueuePrivate FlowQueueExtractPrivateMax(FlowQueue *fq, const uint32_t max, uint32_t *depth);
 Flow *FlowQueuePrivateGetFromTop(FlowQueuePrivate *fqp);
 
 #endif /* __FLOW_QUEUE_H__ */
@@ -33,17 +33,75 @@
 #include "util-debug.h"
 #include "util-print.h"
 #include "util-validate.h"
+#include "util-affinity.h"
+#include "counters.h"
 
 typedef struct FlowSparePool {
     FlowQueuePrivate queue;
     struct FlowSparePool *next;
 } FlowSparePool;
 
+/** per NUMA node list of spare blocks */
+typedef struct FlowSparePoolNode {
+    FlowSparePool *pool;
+    uint32_t flow_cnt;
+    /** flows allocated for this node */
+    SC_ATOMIC_DECLARE(uint64_t, alloc_cnt);
+} FlowSparePoolNode;
+
 static uint32_t flow_spare_pool_flow_cnt = 0;
 uint32_t flow_spare_pool_block_size = 100;
-static FlowSparePool *flow_spare_pool = NULL;
+static FlowSparePoolNode flow_spare_pool_nodes[FLOW_SPARE_POOL_NODES_MAX];
+static uint16_t flow_spare_pool_node_cnt = 1;
 static SCMutex flow_spare_pool_m = SCMUTEX_INITIALIZER;
 
+/** node of the calling thread, looked up once per thread */
+static thread_local int t_flow_spare_pool_node = -1;
+
+/**
+ *  \brief get the spare pool node of the calling thread
+ *
+ *  The node is determined on first use, so worker threads should call
+ *  this only after their CPU affinity has been set up.
+ */
+uint16_t FlowSparePoolGetNode(void)
+{
+    if (unlikely(t_flow_spare_pool_node < 0)) {
+        t_flow_spare_pool_node = UtilAffinityGetNumaNode() % flow_spare_pool_node_cnt;
+    }
+    return (uint16_t)t_flow_spare_pool_node;
+}
+
+/** \brief have the calling thread allocate flows for another node
+ *
+ *  Used by the threads that fill the pools of all nodes.
+ *
+ *  \retval old node of the thread, to pass to FlowSparePoolResetAllocNode */
+static int FlowSparePoolSetAllocNode(const uint16_t node)
+{
+    const int old = t_flow_spare_pool_node;
+    t_flow_spare_pool_node = node;
+    /* have the kernel place the new flows on the node they're for,
+     * not on the node the calling thread runs on */
+    if (flow_spare_pool_node_cnt > 1)
+        UtilAffinitySetNumaPreferred(node);
+    return old;
+}
+
+static void FlowSparePoolResetAllocNode(const int old)
+{
+    t_flow_spare_pool_node = old;
+    if (flow_spare_pool_node_cnt > 1)
+        UtilAffinityResetNumaPreferred();
+}
+
+/** \brief account a flow allocation to a node, see FlowAlloc */
+void FlowSparePoolCountAlloc(const uint16_t node)
+{
+    DEBUG_VALIDATE_BUG_ON(node >= FLOW_SPARE_POOL_NODES_MAX);
+    (void)SC_ATOMIC_ADD(flow_spare_pool_nodes[node].alloc_cnt, 1);
+}
+
 uint32_t FlowSpareGetPoolSize(void)
 {
     uint32_t size;
@@ -53,6 +111,76 @@ uint32_t FlowSpareGetPoolSize(void)
     return size;
 }
 
+static uint32_t FlowSpareGetPoolNodeSize(const uint16_t node)
+{
+    uint32_t size;
+    SCMutexLock(&flow_spare_pool_m);
+    size = flow_spare_pool_nodes[node].flow_cnt;
+    SCMutexUnlock(&flow_spare_pool_m);
+    return size;
+}
+
+#define FLOW_SPARE_POOL_NODE_COUNTER(n)                                                            \
+    static uint64_t FlowSparePoolNode##n##Counter(void)                                            \
+    {                                                                                              \
+        return FlowSpareGetPoolNodeSize(n);                                                        \
+    }                                                                                              \
+    static uint64_t FlowSparePoolNode##n##AllocCounter(void)                                       \
+    {                                                                                              \
+        return SC_ATOMIC_GET(flow_spare_pool_nodes[n].alloc_cnt);                                  \
+    }
+FLOW_SPARE_POOL_NODE_COUNTER(0)
+FLOW_SPARE_POOL_NODE_COUNTER(1)
+FLOW_SPARE_POOL_NODE_COUNTER(2)
+FLOW_SPARE_POOL_NODE_COUNTER(3)
+FLOW_SPARE_POOL_NODE_COUNTER(4)
+FLOW_SPARE_POOL_NODE_COUNTER(5)
+FLOW_SPARE_POOL_NODE_COUNTER(6)
+FLOW_SPARE_POOL_NODE_COUNTER(7)
+
+static const struct {
+    const char *name;
+    uint64_t (*Func)(void);
+    const char *alloc_name;
+    uint64_t (*AllocFunc)(void);
+} flow_spare_pool_node_counters[FLOW_SPARE_POOL_NODES_MAX] = {
+    { "flow.spare_pool.node0", FlowSparePoolNode0Counter, "flow.alloc.node0",
+            FlowSparePoolNode0AllocCounter },
+    { "flow.spare_pool.node1", FlowSparePoolNode1Counter, "flow.alloc.node1",
+            FlowSparePoolNode1AllocCounter },
+    { "flow.spare_pool.node2", FlowSparePoolNode2Counter, "flow.alloc.node2",
+            FlowSparePoolNode2AllocCounter },
+    { "flow.spare_pool.node3", FlowSparePoolNode3Counter, "flow.alloc.node3",
+            FlowSparePoolNode3AllocCounter },
+    { "flow.spare_pool.node4", FlowSparePoolNode4Counter, "flow.alloc.node4",
+            FlowSparePoolNode4AllocCounter },
+    { "flow.spare_pool.node5", FlowSparePoolNode5Counter, "flow.alloc.node5",
+            FlowSparePoolNode5AllocCounter },
+    { "flow.spare_pool.node6", FlowSparePoolNode6Counter, "flow.alloc.node6",
+            FlowSparePoolNode6AllocCounter },
+    { "flow.spare_pool.node7", FlowSparePoolNode7Counter, "flow.alloc.node7",
+            FlowSparePoolNode7AllocCounter },
+};
+
+/** \brief register the per node spare pool counters
+ *
+ *  "flow.spare_pool.nodeN" is the current size of the node's pool,
+ *  "flow.alloc.nodeN" the number of flows allocated for the node so far.
+ *  Only done on NUMA systems, on single node systems "flow.spare"
+ *  covers the same. */
+void FlowSparePoolRegisterCounters(void)
+{
+    if (flow_spare_pool_node_cnt == 1)
+        return;
+
+    for (uint16_t n = 0; n < flow_spare_pool_node_cnt; n++) {
+        StatsRegisterGlobalCounter(
+                flow_spare_pool_node_counters[n].name, flow_spare_pool_node_counters[n].Func);
+        StatsRegisterGlobalCounter(flow_spare_pool_node_counters[n].alloc_name,
+                flow_spare_pool_node_counters[n].AllocFunc);
+    }
+}
+
 static FlowSparePool *FlowSpareGetPool(void)
 {
     FlowSparePool *p = SCCalloc(1, sizeof(*p));
@@ -61,7 +189,7 @@ static FlowSparePool *FlowSpareGetPool(void)
     return p;
 }
 
-static bool FlowSparePoolUpdateBlock(FlowSparePool *p)
+static bool FlowSparePoolUpdateBlock(FlowSparePool *p, const uint16_t node)
 {
     DEBUG_VALIDATE_BUG_ON(p == NULL);
 
@@ -70,6 +198,7 @@ static bool FlowSparePoolUpdateBlock(FlowSparePool *p)
         Flow *f = FlowAlloc();
         if (f == NULL)
             return false;
+        DEBUG_VALIDATE_BUG_ON(f->numa_node != node);
         FlowQueuePrivateAppendFlow(&p->queue, f);
     }
     return true;
@@ -99,68 +228,74 @@ static void Validate(FlowSparePool *top, const uint32_t target)
 
 void FlowSparePoolReturnFlow(Flow *f)
 {
+    DEBUG_VALIDATE_BUG_ON(f->numa_node >= flow_spare_pool_node_cnt);
+    FlowSparePoolNode *n = &flow_spare_pool_nodes[f->numa_node];
+
     SCMutexLock(&flow_spare_pool_m);
-    if (flow_spare_pool == NULL) {
-        flow_spare_pool = FlowSpareGetPool();
+    if (n->pool == NULL) {
+        n->pool = FlowSpareGetPool();
     }
-    DEBUG_VALIDATE_BUG_ON(flow_spare_pool == NULL);
+    DEBUG_VALIDATE_BUG_ON(n->pool == NULL);
 
     /* if the top is full, get a new block */
-    if (flow_spare_pool->queue.len >= flow_spare_pool_block_size) {
+    if (n->pool->queue.len >= flow_spare_pool_block_size) {
         FlowSparePool *p = FlowSpareGetPool();
         DEBUG_VALIDATE_BUG_ON(p == NULL);
-        p->next = flow_spare_pool;
-        flow_spare_pool = p;
+        p->next = n->pool;
+        n->pool = p;
     }
     /* add to the (possibly new) top */
-    FlowQueuePrivateAppendFlow(&flow_spare_pool->queue, f);
+    FlowQueuePrivateAppendFlow(&n->pool->queue, f);
+    n->flow_cnt++;
     flow_spare_pool_flow_cnt++;
 
     SCMutexUnlock(&flow_spare_pool_m);
 }
 
-void FlowSparePoolReturnFlows(FlowQueuePrivate *fqp)
+static void FlowSparePoolReturnFlowsToNode(FlowQueuePrivate *fqp, const uint16_t node)
 {
+    FlowSparePoolNode *n = &flow_spare_pool_nodes[node];
     FlowSparePool *p = FlowSpareGetPool();
     DEBUG_VALIDATE_BUG_ON(p == NULL);
     p->queue = *fqp;
 
     SCMutexLock(&flow_spare_pool_m);
     flow_spare_pool_flow_cnt += fqp->len;
-    if (flow_spare_pool != NULL) {
+    n->flow_cnt += fqp->len;
+    if (n->pool != NULL) {
         if (p->queue.len == flow_spare_pool_block_size) {
             /* full block insert */
 
-            if (flow_spare_pool->queue.len < flow_spare_pool_block_size) {
-                p->next = flow_spare_pool->next;
-                flow_spare_pool->next = p;
+            if (n->pool->queue.len < flow_spare_pool_block_size) {
+                p->next = n->pool->next;
+                n->pool->next = p;
                 p = NULL;
             } else {
-                p->next = flow_spare_pool;
-                flow_spare_pool = p;
+                p->next = n->pool;
+                n->pool = p;
                 p = NULL;
             }
         } else {
             /* incomplete block insert */
 
-            if (p->queue.len + flow_spare_pool->queue.len <= flow_spare_pool_block_size) {
-                FlowQueuePrivateAppendPrivate(&flow_spare_pool->queue, &p->queue);
+            if (p->queue.len + n->pool->queue.len <= flow_spare_pool_block_size) {
+                FlowQueuePrivateAppendPrivate(&n->pool->queue, &p->queue);
                 /* free 'p' outside of lock below */
             } else {
                 // put smallest first
-                if (p->queue.len < flow_spare_pool->queue.len) {
-                    p->next = flow_spare_pool;
-                    flow_spare_pool = p;
+                if (p->queue.len < n->pool->queue.len) {
+                    p->next = n->pool;
+                    n->pool = p;
                 } else {
-                    p->next = flow_spare_pool->next;
-                    flow_spare_pool->next = p;
+                    p->next = n->pool->next;
+                    n->pool->next = p;
                 }
                 p = NULL;
             }
         }
     } else {
-        p->next = flow_spare_pool;
-        flow_spare_pool = p;
+        p->next = n->pool;
+        n->pool = p;
         p = NULL;
     }
     SCMutexUnlock(&flow_spare_pool_m);
@@ -172,23 +307,48 @@ void FlowSparePoolReturnFlows(FlowQueuePrivate *fqp)
         SCFree(p);
 }
 
-FlowQueuePrivate FlowSpareGetFromPool(void)
+void FlowSparePoolReturnFlows(FlowQueuePrivate *fqp)
 {
+    if (flow_spare_pool_node_cnt == 1) {
+        FlowSparePoolReturnFlowsToNode(fqp, 0);
+        return;
+    }
+
+    /* flows can come from multiple nodes, e.g. when returned by the
+     * flow manager or recycler, so sort them by node first */
+    FlowQueuePrivate nq[FLOW_SPARE_POOL_NODES_MAX];
+    memset(&nq, 0, sizeof(nq));
+    Flow *f;
+    while ((f = FlowQueuePrivateGetFromTop(fqp)) != NULL) {
+        DEBUG_VALIDATE_BUG_ON(f->numa_node >= flow_spare_pool_node_cnt);
+        FlowQueuePrivateAppendFlow(&nq[f->numa_node], f);
+    }
+    for (uint16_t n = 0; n < flow_spare_pool_node_cnt; n++) {
+        if (nq[n].len > 0)
+            FlowSparePoolReturnFlowsToNode(&nq[n], n);
+    }
+}
+
+static FlowQueuePrivate FlowSpareGetFromPoolNode(const uint16_t node)
+{
+    FlowSparePoolNode *n = &flow_spare_pool_nodes[node];
+
     SCMutexLock(&flow_spare_pool_m);
-    if (flow_spare_pool == NULL || flow_spare_pool_flow_cnt == 0) {
+    if (n->pool == NULL || n->flow_cnt == 0) {
         SCMutexUnlock(&flow_spare_pool_m);
         FlowQueuePrivate empty = { NULL, NULL, 0 };
         return empty;
     }
 
     /* top if full or its the only block we have */
-    if (flow_spare_pool->queue.len >= flow_spare_pool_block_size || flow_spare_pool->next == NULL) {
-        FlowSparePool *p = flow_spare_pool;
-        flow_spare_pool = p->next;
-        DEBUG_VALIDATE_BUG_ON(flow_spare_pool_flow_cnt < p->queue.len);
+    if (n->pool->queue.len >= flow_spare_pool_block_size || n->pool->next == NULL) {
+        FlowSparePool *p = n->pool;
+        n->pool = p->next;
+        DEBUG_VALIDATE_BUG_ON(n->flow_cnt < p->queue.len);
+        n->flow_cnt -= p->queue.len;
         flow_spare_pool_flow_cnt -= p->queue.len;
 #ifdef FSP_VALIDATE
-        Validate(flow_spare_pool, flow_spare_pool_flow_cnt);
+        Validate(n->pool, n->flow_cnt);
 #endif
         SCMutexUnlock(&flow_spare_pool_m);
 
@@ -196,13 +356,14 @@ FlowQueuePrivate FlowSpareGetFromPool(void)
         SCFree(p);
         return ret;
     /* next should always be full if it exists */
-    } else if (flow_spare_pool->next != NULL) {
-        FlowSparePool *p = flow_spare_pool->next;
-        flow_spare_pool->next = p->next;
-        DEBUG_VALIDATE_BUG_ON(flow_spare_pool_flow_cnt < p->queue.len);
+    } else if (n->pool->next != NULL) {
+        FlowSparePool *p = n->pool->next;
+        n->pool->next = p->next;
+        DEBUG_VALIDATE_BUG_ON(n->flow_cnt < p->queue.len);
+        n->flow_cnt -= p->queue.len;
         flow_spare_pool_flow_cnt -= p->queue.len;
 #ifdef FSP_VALIDATE
-        Validate(flow_spare_pool, flow_spare_pool_flow_cnt);
+        Validate(n->pool, n->flow_cnt);
 #endif
         SCMutexUnlock(&flow_spare_pool_m);
 
@@ -216,10 +377,41 @@ FlowQueuePrivate FlowSpareGetFromPool(void)
     return empty;
 }
 
-void FlowSparePoolUpdate(uint32_t size)
+/** \brief get a block of flows from the calling thread's node */
+FlowQueuePrivate FlowSpareGetFromPool(void)
+{
+    return FlowSpareGetFromPoolNode(FlowSparePoolGetNode());
+}
+
+/** \brief get a block of flows from any node other than the calling
+ *         thread's node
+ *
+ *  Only meant to be used if the local node is empty and no new flows
+ *  can be allocated. */
+FlowQueuePrivate FlowSpareGetFromPoolRemote(void)
+{
+    const uint16_t local = FlowSparePoolGetNode();
+    for (uint16_t n = 0; n < flow_spare_pool_node_cnt; n++) {
+        if (n == local)
+            continue;
+        FlowQueuePrivate ret = FlowSpareGetFromPoolNode(n);
+        if (ret.len > 0)
+            return ret;
+    }
+    FlowQueuePrivate empty = { NULL, NULL, 0 };
+    return empty;
+}
+
+static void FlowSparePoolUpdateNode(const uint16_t node, const uint32_t target, const uint32_t size)
 {
-    const int64_t todo = (int64_t)flow_config.prealloc - (int64_t)size;
+    FlowSparePoolNode *n = &flow_spare_pool_nodes[node];
+    const int64_t todo = (int64_t)target - (int64_t)size;
     if (todo < 0) {
+        /* lockless lookups may still be reading flows we'd free here,
+         * FlowFree() would just return them to the pool */
+        if (flow_config.lockless_lookup)
+            return;
+
         uint32_t to_remove = (uint32_t)(todo * -1) / 10;
         while (to_remove) {
             if (to_remove < flow_spare_pool_block_size)
@@ -227,9 +419,10 @@ void FlowSparePoolUpdate(uint32_t size)
 
             FlowSparePool *p = NULL;
             SCMutexLock(&flow_spare_pool_m);
-            p = flow_spare_pool;
+            p = n->pool;
             if (p != NULL) {
-                flow_spare_pool = p->next;
+                n->pool = p->next;
+                n->flow_cnt -= p->queue.len;
                 flow_spare_pool_flow_cnt -= p->queue.len;
                 to_remove -= p->queue.len;
             }
@@ -241,6 +434,8 @@ void FlowSparePoolUpdate(uint32_t size)
                     FlowFree(f);
                 }
                 SCFree(p);
+            } else {
+                break;
             }
         }
     } else if (todo > 0) {
@@ -248,13 +443,15 @@ void FlowSparePoolUpdate(uint32_t size)
 
         uint32_t blocks = ((uint32_t)todo / flow_spare_pool_block_size) + 1;
 
+        const int old_node = FlowSparePoolSetAllocNode(node);
+
         uint32_t flow_cnt = 0;
         for (uint32_t cnt = 0; cnt < blocks; cnt++) {
             FlowSparePool *p = FlowSpareGetPool();
             if (p == NULL) {
                 break;
             }
-            const bool ok = FlowSparePoolUpdateBlock(p);
+            const bool ok = FlowSparePoolUpdateBlock(p, node);
             if (p->queue.len == 0) {
                 SCFree(p);
                 break;
@@ -269,42 +466,77 @@ void FlowSparePoolUpdate(uint32_t size)
             if (!ok)
                 break;
         }
+        FlowSparePoolResetAllocNode(old_node);
+
         if (head) {
             SCMutexLock(&flow_spare_pool_m);
-            if (flow_spare_pool == NULL) {
-                flow_spare_pool = head;
+            if (n->pool == NULL) {
+                n->pool = head;
             } else if (tail != NULL) {
                 /* since these are 'full' buckets we don't put them
                  * at the top but right after as the top is likely not
                  * full. */
-                tail->next = flow_spare_pool->next;
-                flow_spare_pool->next = head;
+                tail->next = n->pool->next;
+                n->pool->next = head;
             }
 
+            n->flow_cnt += flow_cnt;
             flow_spare_pool_flow_cnt += flow_cnt;
 #ifdef FSP_VALIDATE
-            Validate(flow_spare_pool, flow_spare_pool_flow_cnt);
+            Validate(n->pool, n->flow_cnt);
 #endif
             SCMutexUnlock(&flow_spare_pool_m);
         }
     }
 }
 
+/** \brief update the spare pool towards the prealloc setting
+ *
+ *  The prealloc is split evenly over the NUMA nodes.
+ *
+ *  \param size current size of the (total) pool */
+void FlowSparePoolUpdate(uint32_t size)
+{
+    if (flow_spare_pool_node_cnt == 1) {
+        FlowSparePoolUpdateNode(0, flow_config.prealloc, size);
+        return;
+    }
+
+    const uint32_t target = flow_config.prealloc / flow_spare_pool_node_cnt;
+    for (uint16_t n = 0; n < flow_spare_pool_node_cnt; n++) {
+        FlowSparePoolUpdateNode(n, target, FlowSpareGetPoolNodeSize(n));
+    }
+}
+
 void FlowSparePoolInit(void)
 {
+    flow_spare_pool_node_cnt = MIN(UtilAffinityGetNumaNodeCount(), FLOW_SPARE_POOL_NODES_MAX);
+    if (flow_spare_pool_node_cnt > 1) {
+        SCLogConfig("flow spare pool split over %u NUMA nodes", flow_spare_pool_node_cnt);
+    }
+    const uint32_t target = flow_config.prealloc / flow_spare_pool_node_cnt;
+
     SCMutexLock(&flow_spare_pool_m);
-    for (uint32_t cnt = 0; cnt < flow_config.prealloc; ) {
-        FlowSparePool *p = FlowSpareGetPool();
-        if (p == NULL) {
-            FatalError("failed to initialize flow pool");
-        }
-        FlowSparePoolUpdateBlock(p);
-        cnt += p->queue.len;
+    for (uint16_t node = 0; node < flow_spare_pool_node_cnt; node++) {
+        FlowSparePoolNode *n = &flow_spare_pool_nodes[node];
+
+        const int old_node = FlowSparePoolSetAllocNode(node);
 
-        /* prepend to list */
-        p->next = flow_spare_pool;
-        flow_spare_pool = p;
-        flow_spare_pool_flow_cnt = cnt;
+        for (uint32_t cnt = 0; cnt < target; ) {
+            FlowSparePool *p = FlowSpareGetPool();
+            if (p == NULL) {
+                FatalError("failed to initialize flow pool");
+            }
+            FlowSparePoolUpdateBlock(p, node);
+            cnt += p->queue.len;
+
+            /* prepend to list */
+            p->next = n->pool;
+            n->pool = p;
+            n->flow_cnt = cnt;
+        }
+        flow_spare_pool_flow_cnt += n->flow_cnt;
+        FlowSparePoolResetAllocNode(old_node);
     }
     SCMutexUnlock(&flow_spare_pool_m);
 }
@@ -312,18 +544,22 @@ void FlowSparePoolInit(void)
 void FlowSparePoolDestroy(void)
 {
     SCMutexLock(&flow_spare_pool_m);
-    for (FlowSparePool *p = flow_spare_pool; p != NULL; ) {
-        uint32_t cnt = 0;
-        Flow *f;
-        while ((f = FlowQueuePrivateGetFromTop(&p->queue))) {
-            FlowFree(f);
-            cnt++;
+    for (uint16_t node = 0; node < flow_spare_pool_node_cnt; node++) {
+        FlowSparePoolNode *n = &flow_spare_pool_nodes[node];
+        for (FlowSparePool *p = n->pool; p != NULL;) {
+            uint32_t cnt = 0;
+            Flow *f;
+            while ((f = FlowQueuePrivateGetFromTop(&p->queue))) {
+                FlowFree(f);
+                cnt++;
+            }
+            n->flow_cnt -= cnt;
+            flow_spare_pool_flow_cnt -= cnt;
+            FlowSparePool *next = p->next;
+            SCFree(p);
+            p = next;
         }
-        flow_spare_pool_flow_cnt -= cnt;
-        FlowSparePool *next = p->next;
-        SCFree(p);
-        p = next;
+        n->pool = NULL;
     }
-    flow_spare_pool = NULL;
     SCMutexUnlock(&flow_spare_pool_m);
 }
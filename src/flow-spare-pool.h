@@ -27,6 +27,9 @@
 #include "suricata-common.h"
 #include "flow.h"
 
+/** max number of NUMA nodes the spare pool is split over */
+#define FLOW_SPARE_POOL_NODES_MAX 8
+
 void FlowSparePoolInit(void);
 void FlowSparePoolDestroy(void);
 void FlowSparePoolUpdate(uint32_t size);
@@ -34,6 +37,10 @@ void FlowSparePoolUpdate(uint32_t size);
 uint32_t FlowSpareGetPoolSize(void);
 
 FlowQueuePrivate FlowSpareGetFromPool(void);
+FlowQueuePrivate FlowSpareGetFromPoolRemote(void);
+uint16_t FlowSparePoolGetNode(void);
+void FlowSparePoolCountAlloc(uint16_t node);
+void FlowSparePoolRegisterCounters(void);
 
 void FlowSparePoolReturnFlow(Flow *f);
 void FlowSparePoolReturnFlows(FlowQueuePrivate *fqp);
@@ -37,30 +37,45 @@ unsigned int FlowStorageSize(void)
     return StorageGetSize(STORAGE_FLOW);
 }
 
+/* the storage is part of the cold part of the flow, which is only
+ * allocated once something is stored */
+
 void *FlowGetStorageById(const Flow *f, FlowStorageId id)
 {
-    return StorageGetById(f->storage, STORAGE_FLOW, id.id);
+    if (f->cold == NULL)
+        return NULL;
+    return StorageGetById(f->cold->storage, STORAGE_FLOW, id.id);
 }
 
 int FlowSetStorageById(Flow *f, FlowStorageId id, void *ptr)
 {
-    return StorageSetById(f->storage, STORAGE_FLOW, id.id, ptr);
+    if (f->cold == NULL && ptr == NULL)
+        return 0;
+    FlowCold *fc = FlowColdGetOrAlloc(f);
+    if (fc == NULL)
+        return -1;
+    return StorageSetById(fc->storage, STORAGE_FLOW, id.id, ptr);
 }
 
 void *FlowAllocStorageById(Flow *f, FlowStorageId id)
 {
-    return StorageAllocByIdPrealloc(f->storage, STORAGE_FLOW, id.id);
+    FlowCold *fc = FlowColdGetOrAlloc(f);
+    if (fc == NULL)
+        return NULL;
+    return StorageAllocByIdPrealloc(fc->storage, STORAGE_FLOW, id.id);
 }
 
 void FlowFreeStorageById(Flow *f, FlowStorageId id)
 {
-    StorageFreeById(f->storage, STORAGE_FLOW, id.id);
+    if (f->cold == NULL)
+        return;
+    StorageFreeById(f->cold->storage, STORAGE_FLOW, id.id);
 }
 
 void FlowFreeStorage(Flow *f)
 {
-    if (FlowStorageSize() > 0)
-        StorageFreeAll(f->storage, STORAGE_FLOW);
+    if (FlowStorageSize() > 0 && f->cold != NULL)
+        StorageFreeAll(f->cold->storage, STORAGE_FLOW);
 }
 
 FlowStorageId FlowStorageRegister(const char *name, const unsigned int size,
@@ -29,6 +29,7 @@
 #include "flow.h"
 #include "flow-private.h"
 #include "flow-util.h"
+#include "flow-spare-pool.h"
 #include "flow-var.h"
 #include "app-layer.h"
 
@@ -43,6 +44,18 @@
 #include "decode-icmpv4.h"
 
 #include "util-validate.h"
+#include "util-arena.h"
+
+static SCArena *flow_arena = NULL;
+
+/** \brief Setup the hugepage arena for flows, if enabled.
+ *
+ *  Needs to run after the flow storage has been finalized.
+ */
+void FlowArenaInit(void)
+{
+    flow_arena = SCArenaCreate("flow", sizeof(Flow));
+}
 
 /** \brief allocate a flow
  *
@@ -54,7 +67,7 @@
 Flow *FlowAlloc(void)
 {
     Flow *f;
-    size_t size = sizeof(Flow) + FlowStorageSize();
+    size_t size = sizeof(Flow);
 
     if (!(FLOW_CHECK_MEMCAP(size))) {
         return NULL;
@@ -62,11 +75,19 @@ Flow *FlowAlloc(void)
 
     (void) SC_ATOMIC_ADD(flow_memuse, size);
 
-    f = SCCalloc(1, size);
-    if (unlikely(f == NULL)) {
-        (void)SC_ATOMIC_SUB(flow_memuse, size);
-        return NULL;
+    /* cache line aligned so that the layout of the hot fields at the
+     * start of Flow matches the cache lines */
+    f = SCArenaAlloc(flow_arena);
+    if (f == NULL) {
+        f = SCMallocAligned(size, CLS);
+        if (unlikely(f == NULL)) {
+            (void)SC_ATOMIC_SUB(flow_memuse, size);
+            return NULL;
+        }
     }
+    memset(f, 0, size);
+    f->numa_node = (uint8_t)FlowSparePoolGetNode();
+    FlowSparePoolCountAlloc(f->numa_node);
 
     /* coverity[missing_lock] */
     FLOW_INITIALIZE(f);
@@ -74,20 +95,92 @@ Flow *FlowAlloc(void)
 }
 
 
+/** number of threads that may look up flows w/o the hash row lock */
+static SC_ATOMIC_DECLARE(uint32_t, flow_lockless_readers);
+
+/**
+ *  \brief register a thread that does lockless flow lookups
+ *
+ *  As long as such threads exist, FlowFree() doesn't free flows.
+ */
+void FlowLocklessReaderRegister(void)
+{
+    (void)SC_ATOMIC_ADD(flow_lockless_readers, 1);
+}
+
+void FlowLocklessReaderDeregister(void)
+{
+    (void)SC_ATOMIC_SUB(flow_lockless_readers, 1);
+}
+
 /**
  *  \brief cleanup & free the memory of a flow
  *
+ *  With flow.lockless-lookup a worker may still be reading a flow that was
+ *  removed from the hash long ago, so while lockless readers are registered
+ *  the flow is returned to the spare pool instead.
+ *
  *  \param f flow to clear & destroy
  */
 void FlowFree(Flow *f)
 {
+    if (flow_config.lockless_lookup && SC_ATOMIC_GET(flow_lockless_readers) > 0) {
+        FlowSparePoolReturnFlow(f);
+        return;
+    }
+
     FLOW_DESTROY(f);
-    SCFree(f);
+    if (SCArenaOwns(f))
+        SCArenaFree(flow_arena, f);
+    else
+        SCFreeAligned(f);
 
-    size_t size = sizeof(Flow) + FlowStorageSize();
+    size_t size = sizeof(Flow);
     (void) SC_ATOMIC_SUB(flow_memuse, size);
 }
 
+const FlowCold flow_cold_empty = { 0 };
+
+/**
+ *  \brief get the cold part of a flow for updating it, allocating it first
+ *         if the flow doesn't have one yet
+ *
+ *  The memory is counted in the flow memuse, but not checked against the
+ *  memcap: the flow itself already fit in it.
+ *
+ *  \param f *LOCKED* flow
+ *
+ *  \retval fc cold part or NULL if it couldn't be allocated
+ */
+FlowCold *FlowColdGetOrAlloc(Flow *f)
+{
+    if (f->cold != NULL)
+        return f->cold;
+
+    const size_t size = sizeof(FlowCold) + FlowStorageSize();
+    FlowCold *fc = SCCalloc(1, size);
+    if (unlikely(fc == NULL))
+        return NULL;
+    (void)SC_ATOMIC_ADD(flow_memuse, size);
+    f->cold = fc;
+    return fc;
+}
+
+/**
+ *  \brief free the cold part of a flow, incl. what is left in its storage
+ */
+void FlowColdFree(Flow *f)
+{
+    FlowCold *fc = f->cold;
+    if (fc == NULL)
+        return;
+    if (FlowStorageSize() > 0)
+        StorageFreeAll(fc->storage, STORAGE_FLOW);
+    SCFree(fc);
+    f->cold = NULL;
+    (void)SC_ATOMIC_SUB(flow_memuse, sizeof(FlowCold) + FlowStorageSize());
+}
+
 /**
  *  \brief   Function to map the protocol to the defined FLOW_PROTO_* enumeration.
  *
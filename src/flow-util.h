@@ -44,15 +44,11 @@
         (f)->timeout_at = 0;                                                                       \
         (f)->timeout_policy = 0;                                                                   \
         (f)->vlan_idx = 0;                                                                         \
-        (f)->next = NULL;                                                                          \
+        FLOW_HASH_LINK_SET(&(f)->next, NULL);                                                      \
         (f)->flow_state = 0;                                                                       \
         (f)->tenant_id = 0;                                                                        \
-        (f)->parent_id = 0;                                                                        \
-        (f)->probing_parser_toserver_alproto_masks = 0;                                            \
-        (f)->probing_parser_toclient_alproto_masks = 0;                                            \
         (f)->flags = 0;                                                                            \
         (f)->file_flags = 0;                                                                       \
-        (f)->protodetect_dp = 0;                                                                   \
         SCTIME_INIT((f)->lastts);                                                                  \
         FLOWLOCK_INIT((f));                                                                        \
         (f)->protoctx = NULL;                                                                      \
@@ -60,8 +56,6 @@
         (f)->alproto = 0;                                                                          \
         (f)->alproto_ts = 0;                                                                       \
         (f)->alproto_tc = 0;                                                                       \
-        (f)->alproto_orig = 0;                                                                     \
-        (f)->alproto_expect = 0;                                                                   \
         (f)->de_ctx_version = 0;                                                                   \
         (f)->thread_id[0] = 0;                                                                     \
         (f)->thread_id[1] = 0;                                                                     \
@@ -70,6 +64,7 @@
         (f)->sgh_toserver = NULL;                                                                  \
         (f)->sgh_toclient = NULL;                                                                  \
         (f)->flowvar = NULL;                                                                       \
+        (f)->cold = NULL;                                                                          \
         RESET_COUNTERS((f));                                                                       \
     } while (0)
 
@@ -87,17 +82,13 @@
         (f)->livedev = NULL;                                                                       \
         (f)->vlan_idx = 0;                                                                         \
         (f)->ffr = 0;                                                                              \
-        (f)->next = NULL;                                                                          \
+        FLOW_HASH_LINK_SET(&(f)->next, NULL);                                                      \
         (f)->timeout_at = 0;                                                                       \
         (f)->timeout_policy = 0;                                                                   \
         (f)->flow_state = 0;                                                                       \
         (f)->tenant_id = 0;                                                                        \
-        (f)->parent_id = 0;                                                                        \
-        (f)->probing_parser_toserver_alproto_masks = 0;                                            \
-        (f)->probing_parser_toclient_alproto_masks = 0;                                            \
         (f)->flags = 0;                                                                            \
         (f)->file_flags = 0;                                                                       \
-        (f)->protodetect_dp = 0;                                                                   \
         SCTIME_INIT((f)->lastts);                                                                  \
         (f)->protoctx = NULL;                                                                      \
         (f)->flow_end_flags = 0;                                                                   \
@@ -106,8 +97,6 @@
         (f)->alproto = 0;                                                                          \
         (f)->alproto_ts = 0;                                                                       \
         (f)->alproto_tc = 0;                                                                       \
-        (f)->alproto_orig = 0;                                                                     \
-        (f)->alproto_expect = 0;                                                                   \
         (f)->de_ctx_version = 0;                                                                   \
         (f)->thread_id[0] = 0;                                                                     \
         (f)->thread_id[1] = 0;                                                                     \
@@ -115,6 +104,7 @@
         (f)->sgh_toclient = NULL;                                                                  \
         GenericVarFree((f)->flowvar);                                                              \
         (f)->flowvar = NULL;                                                                       \
+        FlowColdFree((f));                                                                         \
         RESET_COUNTERS((f));                                                                       \
     } while (0)
 
@@ -124,6 +114,7 @@
                                                                                                    \
         FLOWLOCK_DESTROY((f));                                                                     \
         GenericVarFree((f)->flowvar);                                                              \
+        FlowColdFree((f));                                                                         \
     } while (0)
 
 /** \brief check if a memory alloc would fit in the memcap
@@ -137,8 +128,13 @@
     ((((uint64_t)SC_ATOMIC_GET(flow_memuse) + (uint64_t)(size)) <=                                 \
             SC_ATOMIC_GET(flow_config.memcap)))
 
+void FlowArenaInit(void);
 Flow *FlowAlloc(void);
 void FlowFree(Flow *);
+FlowCold *FlowColdGetOrAlloc(Flow *f);
+void FlowColdFree(Flow *f);
+void FlowLocklessReaderRegister(void);
+void FlowLocklessReaderDeregister(void);
 uint8_t FlowGetProtoMapping(uint8_t);
 void FlowInit(Flow *, const Packet *);
 uint8_t FlowGetReverseProtoMapping(uint8_t rproto);
@@ -39,6 +39,8 @@
 #include "decode.h"
 #include "detect.h"
 #include "stream-tcp.h"
+#include "stream-tcp-inline.h"
+#include "stream.h"
 #include "app-layer.h"
 #include "detect-engine.h"
 #include "output.h"
@@ -49,8 +51,10 @@
 #include "util-validate.h"
 #include "util-time.h"
 #include "tmqh-packetpool.h"
+#include "tm-threads.h"
 
 #include "flow-util.h"
+#include "flow-private.h"
 #include "flow-manager.h"
 #include "flow-timeout.h"
 #include "flow-spare-pool.h"
@@ -85,6 +89,10 @@ typedef struct FlowWorkerThreadData_ {
     PacketQueueNoLock pq;
     FlowLookupStruct fls;
 
+    /** packets FlowWorker is called for, see FlowWorkerReleaseHeld */
+    Packet **cur_pkts;
+    uint16_t cur_cnt;
+
     struct {
         uint16_t flows_injected;
         uint16_t flows_injected_max;
@@ -96,8 +104,13 @@ typedef struct FlowWorkerThreadData_ {
 
 } FlowWorkerThreadData;
 
+/** counter to hand out flow hash shards to the flow worker threads */
+static SC_ATOMIC_DECLARE(uint32_t, flow_worker_cnt);
+
 static void FlowWorkerFlowTimeout(
         ThreadVars *tv, Packet *p, FlowWorkerThreadData *fw, void *detect_thread);
+static void FlowWorkerInlineBatchFlush(
+        ThreadVars *tv, FlowWorkerThreadData *fw, void *detect_thread, Flow *f);
 
 /**
  * \internal
@@ -165,6 +178,10 @@ static void CheckWorkQueue(ThreadVars *tv, FlowWorkerThreadData *fw, FlowTimeout
         f->flow_end_flags |= FLOW_END_FLAG_TIMEOUT; //TODO emerg
 
         if (f->proto == IPPROTO_TCP) {
+            /* inspect and pass on packets held for the flow */
+            if (f->protoctx != NULL && ((TcpSession *)f->protoctx)->inline_batch != NULL) {
+                FlowWorkerInlineBatchFlush(tv, fw, SC_ATOMIC_GET(fw->detect_thread), f);
+            }
             if (!(f->flags & (FLOW_TIMEOUT_REASSEMBLY_DONE | FLOW_ACTION_DROP)) &&
                     !FlowIsBypassed(f) && FlowForceReassemblyNeedReassembly(f) == 1 &&
                     f->ffr != 0) {
@@ -254,6 +271,9 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void *
     SC_ATOMIC_INITPTR(fw->detect_thread);
     SC_ATOMIC_SET(fw->detect_thread, NULL);
 
+    if (flow_config.lockless_lookup)
+        FlowLocklessReaderRegister();
+
     fw->local_bypass_pkts = StatsRegisterCounter("flow_bypassed.local_pkts", tv);
     fw->local_bypass_bytes = StatsRegisterCounter("flow_bypassed.local_bytes", tv);
     fw->both_bypass_pkts = StatsRegisterCounter("flow_bypassed.local_capture_pkts", tv);
@@ -265,6 +285,11 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void *
     fw->cnt.flows_injected = StatsRegisterCounter("flow.wrk.flows_injected", tv);
     fw->cnt.flows_injected_max = StatsRegisterMaxCounter("flow.wrk.flows_injected_max", tv);
 
+    /* each worker gets its own part of the flow hash, assuming the capture
+     * method keeps a flow on a single thread (RSS, cluster_flow) */
+    fw->fls.shard = SC_ATOMIC_ADD(flow_worker_cnt, 1) % flow_config.hash_shards;
+    FlowHashSetThreadShard(fw->fls.shard);
+
     fw->fls.dtv = fw->dtv = DecodeThreadVarsAlloc(tv);
     if (fw->dtv == NULL) {
         FlowWorkerThreadDeinit(tv, fw);
@@ -276,6 +301,14 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void *
         FlowWorkerThreadDeinit(tv, fw);
         return TM_ECODE_FAILED;
     }
+    /* held packets are passed on by the flow worker, so it has to run in
+     * the thread that captures them and sets their verdict */
+    if ((tv->tmm_flags & TM_FLAG_RECEIVE_TM) && tv->tmqh_out == TmqhOutputPacketpool) {
+        if (StreamTcpInlineBatchThreadInit(fw->stream_thread->ra_ctx) < 0) {
+            FlowWorkerThreadDeinit(tv, fw);
+            return TM_ECODE_FAILED;
+        }
+    }
 
     if (DetectEngineEnabled()) {
         /* setup DETECT */
@@ -315,6 +348,8 @@ static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
     DecodeThreadVarsFree(tv, fw->dtv);
 
     /* free TCP */
+    if (fw->stream_thread != NULL)
+        StreamTcpInlineBatchThreadDeinit(fw->stream_thread->ra_ctx);
     StreamTcpThreadDeinit(tv, (void *)fw->stream_thread);
 
     /* free DETECT */
@@ -331,6 +366,10 @@ static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
     /* free pq */
     BUG_ON(fw->pq.len);
 
+    /* if other workers still do lockless lookups, FlowFree hands the
+     * flows back to the pool */
+    if (flow_config.lockless_lookup)
+        FlowLocklessReaderDeregister();
     Flow *f;
     while ((f = FlowQueuePrivateGetFromTop(&fw->fls.spare_queue)) != NULL) {
         FlowFree(f);
@@ -530,6 +569,231 @@ static void PacketAppUpdate2FlowFlags(Packet *p)
     }
 }
 
+/** \internal
+ *  \brief pass on a packet that was held by the stream engine
+ *
+ *  Packets FlowWorker is called for are passed on by the caller once
+ *  FlowWorker is done with them. Packets held during an earlier call are
+ *  run through the rest of the pipeline here, which sets their verdict.
+ */
+static void FlowWorkerReleaseHeld(ThreadVars *tv, FlowWorkerThreadData *fw, Packet *x)
+{
+    DEBUG_VALIDATE_BUG_ON(x->flow != NULL);
+    DEBUG_VALIDATE_BUG_ON(x->flags & PKT_STREAM_HELD);
+
+    for (uint16_t i = 0; i < fw->cur_cnt; i++) {
+        if (fw->cur_pkts[i] == x)
+            return;
+    }
+
+    TmSlot *s = tv->tm_flowworker->slot_next;
+    if (s != NULL && TmThreadsSlotVarRun(tv, x, s) == TM_ECODE_FAILED) {
+        TmThreadsSlotProcessPktFail(tv, s, x);
+        return;
+    }
+    tv->tmqh_out(tv, x);
+}
+
+/** \internal
+ *  \brief pass on the packets held in the batch of a flow
+ *
+ *  The stream and app-layer data of the batch has been inspected with
+ *  \a p, so the held packets are only inspected by the packet level
+ *  rules. They follow the verdict of \a p.
+ *
+ *  \param p packet the batch was inspected with. Its flow is locked.
+ */
+static void FlowWorkerInlineBatchRelease(
+        ThreadVars *tv, FlowWorkerThreadData *fw, void *detect_thread, Packet *p)
+{
+    TcpReassemblyThreadCtx *ra_ctx = fw->stream_thread->ra_ctx;
+    TcpSession *ssn = p->flow->protoctx;
+
+    Packet *x;
+    while ((x = StreamTcpInlineBatchTakeFirst(ssn)) != NULL) {
+        FlowReference(&x->flow, p->flow);
+        x->flags &= ~PKT_STREAM_ADD;
+
+        if (detect_thread != NULL) {
+            FLOWWORKER_PROFILING_START(x, PROFILE_FLOWWORKER_DETECT);
+            Detect(tv, x, detect_thread);
+            FLOWWORKER_PROFILING_END(x, PROFILE_FLOWWORKER_DETECT);
+        }
+        if (PacketCheckAction(p, ACTION_DROP) && !PacketCheckAction(x, ACTION_DROP)) {
+            PacketDrop(x, ACTION_DROP, p->drop_reason);
+        }
+
+        OutputLoggerLog(tv, x, fw->output_thread);
+
+        FlowDeReference(&x->flow);
+        FlowWorkerReleaseHeld(tv, fw, x);
+    }
+    StreamTcpInlineBatchDetach(ra_ctx, ssn);
+    StatsIncr(tv, ra_ctx->counter_tcp_inline_batch_flushes);
+}
+
+/** \internal
+ *  \brief inspect the batch of a flow on its own
+ *
+ *  Used when the next packet of the flow doesn't continue the batch, when
+ *  the batch times out and when the flow ends. The newest held packet
+ *  passes the batch data to the app-layer and is inspected as if it had
+ *  not been held.
+ *
+ *  \param f locked flow
+ */
+static void FlowWorkerInlineBatchFlush(
+        ThreadVars *tv, FlowWorkerThreadData *fw, void *detect_thread, Flow *f)
+{
+    TcpReassemblyThreadCtx *ra_ctx = fw->stream_thread->ra_ctx;
+    TcpSession *ssn = f->protoctx;
+
+    Packet *p = StreamTcpInlineBatchTakeLast(ssn);
+    if (p == NULL) {
+        StreamTcpInlineBatchDetach(ra_ctx, ssn);
+        return;
+    }
+    FlowReference(&p->flow, f);
+
+    TcpStream *stream = PKT_IS_TOSERVER(p) ? &ssn->client : &ssn->server;
+    FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_STREAM);
+    if (StreamTcpReassembleAppLayer(tv, ra_ctx, ssn, stream, p, UPDATE_DIR_PACKET) < 0 &&
+            (stream_config.flags & STREAMTCP_INIT_FLAG_DROP_INVALID)) {
+        PacketDrop(p, ACTION_DROP, PKT_DROP_REASON_STREAM_ERROR);
+    }
+    FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_STREAM);
+    PacketAppUpdate2FlowFlags(p);
+
+    if (detect_thread != NULL) {
+        FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_DETECT);
+        Detect(tv, p, detect_thread);
+        FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_DETECT);
+    }
+    FlowWorkerInlineBatchRelease(tv, fw, detect_thread, p);
+
+    OutputLoggerLog(tv, p, fw->output_thread);
+
+    FramesPrune(f, p);
+    FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_TCPPRUNE);
+    StreamTcpPruneSession(f, STREAM_FLAGS_FOR_PACKET(p));
+    FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_TCPPRUNE);
+
+    const uint32_t app_updated = PKT_IS_TOSERVER(p) ? FLOW_TS_APP_UPDATED : FLOW_TC_APP_UPDATED;
+    if (f->flags & app_updated) {
+        AppLayerParserTransactionsCleanup(f, STREAM_FLAGS_FOR_PACKET(p));
+        f->flags &= ~app_updated;
+    }
+
+    FlowDeReference(&p->flow);
+    FlowWorkerReleaseHeld(tv, fw, p);
+}
+
+/** \internal
+ *  \brief handle the batch of the flow of a packet the stream engine is
+ *         done with
+ *
+ *  \param with_batch set to true if \a p continues the batch: its
+ *                    inspection covers the batch data and the held
+ *                    packets are passed on after it
+ *
+ *  \retval true packet is held
+ */
+static bool FlowWorkerInlineBatchUpdate(ThreadVars *tv, FlowWorkerThreadData *fw,
+        void *detect_thread, Packet *p, bool *with_batch)
+{
+    *with_batch = false;
+
+    TcpSession *ssn = p->flow->protoctx;
+    if (ssn == NULL || ssn->inline_batch == NULL)
+        return false;
+
+    TcpStream *stream = PKT_IS_TOSERVER(p) ? &ssn->client : &ssn->server;
+    if (p->flags & PKT_STREAM_HELD) {
+        if (!PacketCheckAction(p, ACTION_DROP) && !(p->flow->flags & FLOW_ACTION_DROP))
+            return true;
+
+        /* dropped after it was held: inspect the batch with it */
+        Packet *x = StreamTcpInlineBatchTakeLast(ssn);
+        DEBUG_VALIDATE_BUG_ON(x != p);
+        (void)x;
+        (void)StreamTcpReassembleAppLayer(
+                tv, fw->stream_thread->ra_ctx, ssn, stream, p, UPDATE_DIR_PACKET);
+        PacketAppUpdate2FlowFlags(p);
+        *with_batch = true;
+        return false;
+    }
+
+    const TcpInlineBatch *b = ssn->inline_batch;
+    if ((p->flags & PKT_STREAM_ADD) && b->dir == STREAM_FLAGS_FOR_PACKET(p) &&
+            STREAM_BASE_OFFSET(stream) + (TCP_GET_SEQ(p) - stream->base_seq) == b->right_edge) {
+        *with_batch = true;
+        return false;
+    }
+
+    FlowWorkerInlineBatchFlush(tv, fw, detect_thread, p->flow);
+    return false;
+}
+
+/** \internal
+ *  \brief inspect the batch of the flow before the stream engine handles a
+ *         packet that can't continue it
+ *
+ *  The app-layer has to get the held data before data in the other
+ *  direction and before the stream is closed.
+ */
+static void FlowWorkerInlineBatchCheck(
+        ThreadVars *tv, FlowWorkerThreadData *fw, void *detect_thread, Packet *p)
+{
+    const TcpSession *ssn = p->flow->protoctx;
+    if (ssn == NULL || ssn->inline_batch == NULL)
+        return;
+
+    if (PKT_IS_PSEUDOPKT(p) || ssn->inline_batch->dir != STREAM_FLAGS_FOR_PACKET(p) ||
+            (p->tcph->th_flags & (TH_SYN | TH_FIN | TH_RST))) {
+        FlowWorkerInlineBatchFlush(tv, fw, detect_thread, p->flow);
+    }
+}
+
+/** \internal
+ *  \brief inspect the batches that timed out
+ *
+ *  The packets of batches that were discarded are passed on with a drop
+ *  verdict. If packets are still held, the capture thread is asked to inject a
+ *  packet when it times out waiting for packets, so that held packets are
+ *  not stuck on an idle interface.
+ */
+static void FlowWorkerInlineBatchTimeout(
+        ThreadVars *tv, FlowWorkerThreadData *fw, void *detect_thread, Packet *p)
+{
+    TcpReassemblyThreadCtx *ra_ctx = fw->stream_thread->ra_ctx;
+    if (!StreamTcpInlineBatchPending(ra_ctx))
+        return;
+
+    const bool force = (p->pkt_src == PKT_SRC_SHUTDOWN_FLUSH);
+    const SCTime_t now = PKT_IS_PSEUDOPKT(p) ? TimeGet() : p->ts;
+    uint16_t iter = 0;
+    Flow *f;
+    while ((f = StreamTcpInlineBatchGetDue(ra_ctx, now, force, &iter)) != NULL) {
+        FLOWLOCK_WRLOCK(f);
+        /* the flow may have been cleared before we got the lock */
+        const TcpSession *ssn = f->protoctx;
+        if (f->proto == IPPROTO_TCP && ssn != NULL && ssn->inline_batch != NULL &&
+                ssn->inline_batch->f == f) {
+            StatsIncr(tv, ra_ctx->counter_tcp_inline_batch_timeouts);
+            FlowWorkerInlineBatchFlush(tv, fw, detect_thread, f);
+        }
+        FLOWLOCK_UNLOCK(f);
+    }
+
+    Packet *x;
+    while ((x = StreamTcpInlineBatchTakeDropped(ra_ctx)) != NULL) {
+        FlowWorkerReleaseHeld(tv, fw, x);
+    }
+
+    if (StreamTcpInlineBatchPending(ra_ctx) && !TmThreadsCheckFlag(tv, THV_CAPTURE_INJECT_PKT))
+        TmThreadsSetFlag(tv, THV_CAPTURE_INJECT_PKT);
+}
+
 static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
 {
     FlowWorkerThreadData *fw = data;
@@ -540,6 +804,14 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
 
     SCLogDebug("packet %"PRIu64, p->pcap_cnt);
 
+    /* not called from FlowWorkerBatch */
+    const bool single = (fw->cur_cnt == 0);
+    if (single) {
+        fw->cur_pkts = &p;
+        fw->cur_cnt = 1;
+    }
+    bool with_batch = false;
+
     /* update time */
     if (!(PKT_IS_PSEUDOPKT(p))) {
         TimeSetByThread(tv->id, p->ts);
@@ -584,9 +856,22 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
                 DisableDetectFlowFileFlags(p->flow);
             }
 
+            if (fw->stream_thread->ra_ctx->inline_batch != NULL) {
+                FlowWorkerInlineBatchCheck(tv, fw, detect_thread, p);
+            }
             FlowWorkerStreamTCPUpdate(tv, fw, p, detect_thread, false);
             PacketAppUpdate2FlowFlags(p);
 
+            if (fw->stream_thread->ra_ctx->inline_batch != NULL &&
+                    FlowWorkerInlineBatchUpdate(tv, fw, detect_thread, p, &with_batch)) {
+                /* held: inspected when the batch is */
+                PacketUpdateEngineEventCounters(tv, fw->dtv, p);
+                Flow *f = p->flow;
+                FlowDeReference(&p->flow);
+                FLOWLOCK_UNLOCK(f);
+                goto housekeeping;
+            }
+
             /* handle the app layer part of the UDP packet payload */
         } else if (p->proto == IPPROTO_UDP && !PacketCheckAction(p, ACTION_DROP)) {
             FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_APPLAYERUDP);
@@ -606,6 +891,9 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
         Detect(tv, p, detect_thread);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_DETECT);
     }
+    if (with_batch) {
+        FlowWorkerInlineBatchRelease(tv, fw, detect_thread, p);
+    }
 
     // Outputs.
     OutputLoggerLog(tv, p, fw->output_thread);
@@ -652,6 +940,11 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
             p->flow->flags &= ~(FLOW_TS_APP_UPDATED | FLOW_TC_APP_UPDATED);
         }
 
+        /* UDP and ICMP flows that are done can use the closed timeout */
+        if (p->proto != IPPROTO_TCP && flow_config.close_done_protomaps != 0) {
+            FlowCloseIfDone(p->flow);
+        }
+
         Flow *f = p->flow;
         FlowDeReference(&p->flow);
         FLOWLOCK_UNLOCK(f);
@@ -665,6 +958,14 @@ housekeeping:
     /* process local work queue */
     FlowWorkerProcessLocalFlows(tv, fw, p);
 
+    /* inspect held packets that timed out */
+    if (fw->stream_thread->ra_ctx->inline_batch != NULL) {
+        FlowWorkerInlineBatchTimeout(tv, fw, detect_thread, p);
+    }
+
+    if (single) {
+        fw->cur_cnt = 0;
+    }
     return TM_ECODE_OK;
 }
 
@@ -682,6 +983,25 @@ void *FlowWorkerGetDetectCtxPtr(void *flow_worker)
     return SC_ATOMIC_GET(fw->detect_thread);
 }
 
+#ifdef UNITTESTS
+/** \brief flow worker data that only holds a detect thread ctx, for
+ *         tests of the detect thread ctx swap */
+void *FlowWorkerUTAlloc(void *detect_ctx)
+{
+    FlowWorkerThreadData *fw = SCCalloc(1, sizeof(*fw));
+    if (fw == NULL)
+        return NULL;
+    SC_ATOMIC_INITPTR(fw->detect_thread);
+    SC_ATOMIC_SET(fw->detect_thread, detect_ctx);
+    return fw;
+}
+
+void FlowWorkerUTFree(void *flow_worker)
+{
+    SCFree(flow_worker);
+}
+#endif
+
 const char *ProfileFlowWorkerIdToString(enum ProfileFlowWorkerId fwi)
 {
     switch (fwi) {
@@ -711,6 +1031,35 @@ static void FlowWorkerExitPrintStats(ThreadVars *tv, void *data)
     OutputLoggerExitPrintStats(tv, fw->output_thread);
 }
 
+/** \brief process a burst of packets
+ *
+ *  The flows at the head of the hash rows of all packets are prefetched
+ *  before the first packet is processed. */
+static TmEcode FlowWorkerBatch(ThreadVars *tv, Packet **pkts, uint16_t cnt, void *data)
+{
+    FlowWorkerThreadData *fw = data;
+    TmEcode r = TM_ECODE_OK;
+
+    /* the hash rows were prefetched when the burst was decoded, so get
+     * all the row heads loading before the first lookup */
+    for (uint16_t i = 0; i < cnt; i++) {
+        FlowPrefetchHead(pkts[i]);
+    }
+
+    fw->cur_pkts = pkts;
+    fw->cur_cnt = cnt;
+    for (uint16_t i = 0; i < cnt; i++) {
+        Packet *p = pkts[i];
+        PACKET_PROFILING_TMM_START(p, TMM_FLOWWORKER);
+        r = FlowWorker(tv, p, data);
+        PACKET_PROFILING_TMM_END(p, TMM_FLOWWORKER);
+        if (unlikely(r == TM_ECODE_FAILED))
+            break;
+    }
+    fw->cur_cnt = 0;
+    return r;
+}
+
 static bool FlowWorkerIsBusy(ThreadVars *tv, void *flow_worker)
 {
     FlowWorkerThreadData *fw = flow_worker;
@@ -736,6 +1085,7 @@ void TmModuleFlowWorkerRegister (void)
     tmm_modules[TMM_FLOWWORKER].name = "FlowWorker";
     tmm_modules[TMM_FLOWWORKER].ThreadInit = FlowWorkerThreadInit;
     tmm_modules[TMM_FLOWWORKER].Func = FlowWorker;
+    tmm_modules[TMM_FLOWWORKER].FuncBatch = FlowWorkerBatch;
     tmm_modules[TMM_FLOWWORKER].ThreadBusy = FlowWorkerIsBusy;
     tmm_modules[TMM_FLOWWORKER].ThreadDeinit = FlowWorkerThreadDeinit;
     tmm_modules[TMM_FLOWWORKER].ThreadExitPrintStats = FlowWorkerExitPrintStats;
@@ -32,6 +32,10 @@ const char *ProfileFlowWorkerIdToString(enum ProfileFlowWorkerId fwi);
 
 void FlowWorkerReplaceDetectCtx(void *flow_worker, void *detect_ctx);
 void *FlowWorkerGetDetectCtxPtr(void *flow_worker);
+#ifdef UNITTESTS
+void *FlowWorkerUTAlloc(void *detect_ctx);
+void FlowWorkerUTFree(void *flow_worker);
+#endif
 
 void TmModuleFlowWorkerRegister (void);
 
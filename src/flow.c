@@ -285,8 +285,10 @@ void FlowSwap(Flow *f)
 {
     f->flags |= FLOW_DIR_REVERSED;
 
-    SWAP_VARS(uint32_t, f->probing_parser_toserver_alproto_masks,
-                   f->probing_parser_toclient_alproto_masks);
+    if (f->cold != NULL) {
+        SWAP_VARS(uint32_t, f->cold->probing_parser_toserver_alproto_masks,
+                f->cold->probing_parser_toclient_alproto_masks);
+    }
 
     FlowSwapFlags(f);
     FlowSwapFileFlags(f);
@@ -560,6 +562,7 @@ void FlowInitConfig(bool quiet)
     /* set defaults */
     flow_config.hash_rand   = (uint32_t)RandomGet();
     flow_config.hash_size   = FLOW_DEFAULT_HASHSIZE;
+    flow_config.hash_shards = 1;
     flow_config.prealloc    = FLOW_DEFAULT_PREALLOC;
     SC_ATOMIC_SET(flow_config.memcap, FLOW_DEFAULT_MEMCAP);
 
@@ -625,6 +628,35 @@ void FlowInitConfig(bool quiet)
         }
     }
 
+    if ((ConfGet("flow.hash-shards", &conf_val)) == 1) {
+        if (conf_val == NULL) {
+            FatalError("Invalid value for flow.hash-shards: NULL");
+        }
+
+        if (StringParseUint32(&configval, 10, strlen(conf_val), conf_val) > 0 &&
+                configval != 0 && configval <= flow_config.hash_size) {
+            flow_config.hash_shards = configval;
+        } else {
+            FatalError("Invalid value for flow.hash-shards. Must be a numeric value in the range "
+                       "1-%" PRIu32 " (flow.hash-size)",
+                    flow_config.hash_size);
+        }
+    }
+    flow_config.hash_shard_rows = flow_config.hash_size / flow_config.hash_shards;
+    if (!quiet && flow_config.hash_shards > 1) {
+        SCLogConfig("flow hash split into %" PRIu32 " shards of %" PRIu32 " rows",
+                flow_config.hash_shards, flow_config.hash_shard_rows);
+    }
+
+    int lockless_lookup = 0;
+    if (ConfGetBool("flow.lockless-lookup", &lockless_lookup) == 1 && lockless_lookup == 1) {
+        flow_config.lockless_lookup = true;
+    }
+    if (!quiet) {
+        SCLogConfig("flow lockless lookup: %s",
+                flow_config.lockless_lookup ? "enabled" : "disabled");
+    }
+
     flow_config.memcap_policy = ExceptionPolicyParse("flow.memcap-policy", false);
 
     SCLogDebug("Flow config from suricata.yaml: memcap: %"PRIu64", hash-size: "
@@ -655,12 +687,21 @@ void FlowInitConfig(bool quiet)
     }
     (void) SC_ATOMIC_ADD(flow_memuse, (flow_config.hash_size * sizeof(FlowBucket)));
 
+    /* next_ts summary per block of rows, all blocks start out as 'due' (0) */
+    const uint32_t blocks = FlowHashBlocks();
+    flow_hash_blocks = SCCalloc(blocks, sizeof(FlowBucketBlock));
+    if (unlikely(flow_hash_blocks == NULL)) {
+        FatalError("Fatal error encountered in FlowInitConfig. Exiting...");
+    }
+    (void)SC_ATOMIC_ADD(flow_memuse, (blocks * sizeof(FlowBucketBlock)));
+
     if (!quiet) {
         SCLogConfig("allocated %"PRIu64" bytes of memory for the flow hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
                   SC_ATOMIC_GET(flow_memuse), flow_config.hash_size,
                   (uintmax_t)sizeof(FlowBucket));
     }
+    FlowArenaInit();
     FlowSparePoolInit();
     if (!quiet) {
         SCLogConfig("flow memory usage: %"PRIu64" bytes, maximum: %"PRIu64,
@@ -669,7 +710,7 @@ void FlowInitConfig(bool quiet)
 
     FlowInitFlowProto();
 
-    uint32_t sz = sizeof(Flow) + FlowStorageSize();
+    uint32_t sz = sizeof(Flow);
     SCLogConfig("flow size %u, memcap allows for %" PRIu64 " flows. Per hash row in perfect "
                 "conditions %" PRIu64,
             sz, flow_memcap_copy / sz, (flow_memcap_copy / sz) / flow_config.hash_size);
@@ -728,6 +769,11 @@ void FlowShutdown(void)
         flow_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
+    if (flow_hash_blocks != NULL) {
+        SCFree(flow_hash_blocks);
+        flow_hash_blocks = NULL;
+        (void)SC_ATOMIC_SUB(flow_memuse, FlowHashBlocks() * sizeof(FlowBucketBlock));
+    }
     FlowQueueDestroy(&flow_recycle_q);
     FlowSparePoolDestroy();
     return;
@@ -934,10 +980,13 @@ void FlowInitFlowProto(void)
         if (proto != NULL) {
             new = ConfNodeLookupChildValue(proto, "new");
             established = ConfNodeLookupChildValue(proto, "established");
+            closed = ConfNodeLookupChildValue(proto, "closed");
             bypassed = ConfNodeLookupChildValue(proto, "bypassed");
             emergency_new = ConfNodeLookupChildValue(proto, "emergency-new");
             emergency_established = ConfNodeLookupChildValue(proto,
                 "emergency-established");
+            emergency_closed = ConfNodeLookupChildValue(proto,
+                "emergency-closed");
             emergency_bypassed = ConfNodeLookupChildValue(proto,
                 "emergency-bypassed");
 
@@ -952,6 +1001,15 @@ void FlowInitFlowProto(void)
 
                 flow_timeouts_normal[FLOW_PROTO_UDP].est_timeout = configval;
             }
+            /* UDP has no closed state of its own, so a closed timeout
+             * enables closing flows that are done. See FlowCloseIfDone. */
+            if (closed != NULL &&
+                StringParseUint32(&configval, 10, strlen(closed),
+                                        closed) > 0) {
+
+                flow_timeouts_normal[FLOW_PROTO_UDP].closed_timeout = configval;
+                flow_config.close_done_protomaps |= BIT_U8(FLOW_PROTO_UDP);
+            }
             if (bypassed != NULL &&
                     StringParseUint32(&configval, 10,
                                             strlen(bypassed),
@@ -972,6 +1030,13 @@ void FlowInitFlowProto(void)
 
                 flow_timeouts_emerg[FLOW_PROTO_UDP].est_timeout = configval;
             }
+            if (emergency_closed != NULL &&
+                StringParseUint32(&configval, 10,
+                                        strlen(emergency_closed),
+                                        emergency_closed) > 0) {
+
+                flow_timeouts_emerg[FLOW_PROTO_UDP].closed_timeout = configval;
+            }
             if (emergency_bypassed != NULL &&
                     StringParseUint32(&configval, 10,
                                             strlen(emergency_bypassed),
@@ -986,10 +1051,13 @@ void FlowInitFlowProto(void)
         if (proto != NULL) {
             new = ConfNodeLookupChildValue(proto, "new");
             established = ConfNodeLookupChildValue(proto, "established");
+            closed = ConfNodeLookupChildValue(proto, "closed");
             bypassed = ConfNodeLookupChildValue(proto, "bypassed");
             emergency_new = ConfNodeLookupChildValue(proto, "emergency-new");
             emergency_established = ConfNodeLookupChildValue(proto,
                 "emergency-established");
+            emergency_closed = ConfNodeLookupChildValue(proto,
+                "emergency-closed");
             emergency_bypassed = ConfNodeLookupChildValue(proto,
                 "emergency-bypassed");
 
@@ -1004,6 +1072,15 @@ void FlowInitFlowProto(void)
 
                 flow_timeouts_normal[FLOW_PROTO_ICMP].est_timeout = configval;
             }
+            /* ICMP has no closed state of its own, so a closed timeout
+             * enables closing flows that are done. See FlowCloseIfDone. */
+            if (closed != NULL &&
+                StringParseUint32(&configval, 10, strlen(closed),
+                                        closed) > 0) {
+
+                flow_timeouts_normal[FLOW_PROTO_ICMP].closed_timeout = configval;
+                flow_config.close_done_protomaps |= BIT_U8(FLOW_PROTO_ICMP);
+            }
             if (bypassed != NULL &&
                     StringParseUint32(&configval, 10,
                                             strlen(bypassed),
@@ -1024,6 +1101,13 @@ void FlowInitFlowProto(void)
 
                 flow_timeouts_emerg[FLOW_PROTO_ICMP].est_timeout = configval;
             }
+            if (emergency_closed != NULL &&
+                StringParseUint32(&configval, 10,
+                                        strlen(emergency_closed),
+                                        emergency_closed) > 0) {
+
+                flow_timeouts_emerg[FLOW_PROTO_ICMP].closed_timeout = configval;
+            }
             if (emergency_bypassed != NULL &&
                     StringParseUint32(&configval, 10,
                                             strlen(emergency_bypassed),
@@ -1198,12 +1282,39 @@ void FlowUpdateState(Flow *f, const enum FlowState s)
 #endif
         /* and reset the flow bucket next_ts value so that the flow manager
          * has to revisit this row */
-        SC_ATOMIC_SET(f->fb->next_ts, 0);
+        FlowBucketResetNextTs(f->fb);
 #ifdef UNITTESTS
     }
 #endif
 }
 
+/** \brief move a finished UDP or ICMP flow to the closed state
+ *
+ *  For protocols w/o a closed state of their own this is done if a closed
+ *  timeout is configured for them. A flow is finished if both sides have
+ *  been seen, the app-layer has no transactions left to inspect or log,
+ *  and no flowvars or flowbits are set on it. The flow then only stays
+ *  around for the (short) closed timeout, instead of the established
+ *  timeout. If another packet is seen the flow moves back to established.
+ *
+ *  \param f *LOCKED* flow
+ */
+void FlowCloseIfDone(Flow *f)
+{
+    if (!(flow_config.close_done_protomaps & BIT_U8(f->protomap)))
+        return;
+    if (f->flow_state != FLOW_STATE_ESTABLISHED || f->flowvar != NULL)
+        return;
+
+    if (f->alstate != NULL && f->alparser != NULL) {
+        const uint64_t tx_cnt = AppLayerParserGetTxCnt(f, f->alstate);
+        if (AppLayerParserGetTransactionActive(f, f->alparser, STREAM_TOSERVER) < tx_cnt ||
+                AppLayerParserGetTransactionActive(f, f->alparser, STREAM_TOCLIENT) < tx_cnt)
+            return;
+    }
+    FlowUpdateState(f, FLOW_STATE_CLOSED);
+}
+
 /**
  * \brief Get flow last time as individual values.
  *
@@ -1458,6 +1569,404 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test   Test lockless lookup of an existing flow and that a flow removed
+ *          from the hash is not returned by it.
+ */
+static int FlowTest10(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.lockless_lookup = true;
+
+    FlowLookupStruct fls;
+    memset(&fls, 0, sizeof(fls));
+
+    uint8_t payload[] = "Payload";
+    Packet *p = UTHBuildPacket(payload, sizeof(payload), IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    FlowHandlePacket(NULL, &fls, p);
+    Flow *f = p->flow;
+    FAIL_IF_NULL(f);
+    FLOWLOCK_UNLOCK(f);
+    FlowDeReference(&p->flow);
+
+    /* existing flow is found w/o the row lock */
+    FlowHandlePacket(NULL, &fls, p);
+    FAIL_IF(p->flow != f);
+    FLOWLOCK_UNLOCK(f);
+    FlowDeReference(&p->flow);
+
+    /* evict the flow like the flow manager would */
+    FlowBucket *fb = f->fb;
+    FBLOCK_LOCK(fb);
+    FLOWLOCK_WRLOCK(f);
+    f->flow_end_flags |= FLOW_END_FLAG_TIMEOUT;
+    RemoveFromHash(f, NULL);
+    FLOWLOCK_UNLOCK(f);
+    FBLOCK_UNLOCK(fb);
+
+    /* lookup now has to fall back to the locked path and set up a new flow */
+    FlowHandlePacket(NULL, &fls, p);
+    FAIL_IF_NULL(p->flow);
+    FAIL_IF(p->flow == f);
+    FLOWLOCK_UNLOCK(p->flow);
+    FlowDeReference(&p->flow);
+
+    FlowFree(f);
+    Flow *sf;
+    while ((sf = FlowQueuePrivateGetFromTop(&fls.spare_queue)) != NULL) {
+        FlowFree(sf);
+    }
+    UTHFreePacket(p);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  Test that workers only use their own flow hash shard.
+ */
+static int FlowTest11(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.hash_shards = 2;
+    flow_config.hash_shard_rows = flow_config.hash_size / 2;
+
+    FlowLookupStruct fls0, fls1;
+    memset(&fls0, 0, sizeof(fls0));
+    memset(&fls1, 0, sizeof(fls1));
+    fls1.shard = 1;
+
+    uint8_t payload[] = "Payload";
+    Packet *p = UTHBuildPacket(payload, sizeof(payload), IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    FlowHandlePacket(NULL, &fls0, p);
+    Flow *f0 = p->flow;
+    FAIL_IF_NULL(f0);
+    FAIL_IF(f0->fb >= &flow_hash[flow_config.hash_shard_rows]);
+    FLOWLOCK_UNLOCK(f0);
+    FlowDeReference(&p->flow);
+
+    /* same packet in another shard sets up its own flow */
+    FlowHandlePacket(NULL, &fls1, p);
+    Flow *f1 = p->flow;
+    FAIL_IF_NULL(f1);
+    FAIL_IF(f1 == f0);
+    FAIL_IF(f1->fb < &flow_hash[flow_config.hash_shard_rows]);
+    FLOWLOCK_UNLOCK(f1);
+    FlowDeReference(&p->flow);
+
+    /* and the first shard still finds the original */
+    FlowHandlePacket(NULL, &fls0, p);
+    FAIL_IF(p->flow != f0);
+    FLOWLOCK_UNLOCK(f0);
+    FlowDeReference(&p->flow);
+
+    Flow *sf;
+    while ((sf = FlowQueuePrivateGetFromTop(&fls0.spare_queue)) != NULL) {
+        FlowFree(sf);
+    }
+    while ((sf = FlowQueuePrivateGetFromTop(&fls1.spare_queue)) != NULL) {
+        FlowFree(sf);
+    }
+    UTHFreePacket(p);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  Test that the lookup and per packet fields of Flow are at the
+ *         start of the structure.
+ */
+static int FlowTest12(void)
+{
+#define FLOW_FIELD_END(field) (offsetof(Flow, field) + sizeof(((Flow *)NULL)->field))
+    /* first cache line: everything the hash lookup compares */
+    FAIL_IF(FLOW_FIELD_END(src) > CLS);
+    FAIL_IF(FLOW_FIELD_END(dst) > CLS);
+    FAIL_IF(FLOW_FIELD_END(dp) > CLS);
+    FAIL_IF(FLOW_FIELD_END(proto) > CLS);
+    FAIL_IF(FLOW_FIELD_END(recursion_level) > CLS);
+    FAIL_IF(FLOW_FIELD_END(vlan_id) > CLS);
+    FAIL_IF(FLOW_FIELD_END(timeout_at) > CLS);
+    FAIL_IF(FLOW_FIELD_END(thread_id) > CLS);
+    FAIL_IF(FLOW_FIELD_END(next) > CLS);
+    /* second cache line: updated for each packet */
+    FAIL_IF(FLOW_FIELD_END(livedev) > 2 * CLS);
+    FAIL_IF(FLOW_FIELD_END(fb) > 2 * CLS);
+    FAIL_IF(FLOW_FIELD_END(lastts) > 2 * CLS);
+    FAIL_IF(FLOW_FIELD_END(flags) > 2 * CLS);
+    FAIL_IF(FLOW_FIELD_END(flow_state) > 2 * CLS);
+    FAIL_IF(FLOW_FIELD_END(alproto) > 2 * CLS);
+    FAIL_IF(FLOW_FIELD_END(protoctx) > 2 * CLS);
+    FAIL_IF(FLOW_FIELD_END(todstpktcnt) > 2 * CLS);
+    FAIL_IF(FLOW_FIELD_END(tosrcpktcnt) > 2 * CLS);
+    /* rarely used fields come after the lock */
+#ifdef FLOWLOCK_RWLOCK
+    FAIL_IF(offsetof(Flow, startts) < FLOW_FIELD_END(r));
+    FAIL_IF(offsetof(Flow, flowvar) < FLOW_FIELD_END(r));
+    FAIL_IF(offsetof(Flow, cold) < FLOW_FIELD_END(r));
+#else
+    FAIL_IF(offsetof(Flow, startts) < FLOW_FIELD_END(m));
+    FAIL_IF(offsetof(Flow, flowvar) < FLOW_FIELD_END(m));
+    FAIL_IF(offsetof(Flow, cold) < FLOW_FIELD_END(m));
+#endif
+#undef FLOW_FIELD_END
+
+    /* flows are allocated cache line aligned */
+    FlowInitConfig(FLOW_QUIET);
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    FAIL_IF(((uintptr_t)f % CLS) != 0);
+    FlowFree(f);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  Test that the cold part of a flow is only allocated when one of
+ *         its fields is set, and is freed when the flow is recycled.
+ */
+static int FlowTest17(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    FAIL_IF_NOT_NULL(f->cold);
+    FAIL_IF(FlowColdGet(f)->alproto_orig != ALPROTO_UNKNOWN);
+    FAIL_IF(FlowColdGet(f)->parent_id != 0);
+
+    const uint64_t memuse = SC_ATOMIC_GET(flow_memuse);
+    FlowCold *fc = FlowColdGetOrAlloc(f);
+    FAIL_IF_NULL(fc);
+    FAIL_IF(FlowColdGetOrAlloc(f) != fc);
+    FAIL_IF(SC_ATOMIC_GET(flow_memuse) <= memuse);
+    fc->parent_id = 1;
+    FAIL_IF(FlowColdGet(f)->parent_id != 1);
+
+    FlowClearMemory(f, 0);
+    FAIL_IF_NOT_NULL(f->cold);
+    FAIL_IF(SC_ATOMIC_GET(flow_memuse) != memuse);
+    FAIL_IF(FlowColdGet(f)->parent_id != 0);
+
+    FlowFree(f);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  Test closing of finished UDP flows.
+ */
+static int FlowTest13(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+
+    Flow f;
+    memset(&f, 0, sizeof(f));
+    f.proto = IPPROTO_UDP;
+    f.protomap = FlowGetProtoMapping(IPPROTO_UDP);
+    FlowUpdateState(&f, FLOW_STATE_ESTABLISHED);
+
+    /* not enabled by default */
+    FlowCloseIfDone(&f);
+    FAIL_IF(f.flow_state != FLOW_STATE_ESTABLISHED);
+
+    flow_timeouts_normal[FLOW_PROTO_UDP].closed_timeout = 5;
+    flow_config.close_done_protomaps |= BIT_U8(FLOW_PROTO_UDP);
+
+    /* flowvars/flowbits keep the flow open */
+    GenericVar gv;
+    memset(&gv, 0, sizeof(gv));
+    f.flowvar = &gv;
+    FlowCloseIfDone(&f);
+    FAIL_IF(f.flow_state != FLOW_STATE_ESTABLISHED);
+    f.flowvar = NULL;
+
+    FlowCloseIfDone(&f);
+    FAIL_IF(f.flow_state != FLOW_STATE_CLOSED);
+    FAIL_IF(f.timeout_policy != 5);
+
+    /* TCP has its own closed state */
+    f.proto = IPPROTO_TCP;
+    f.protomap = FlowGetProtoMapping(IPPROTO_TCP);
+    FlowUpdateState(&f, FLOW_STATE_ESTABLISHED);
+    FlowCloseIfDone(&f);
+    FAIL_IF(f.flow_state != FLOW_STATE_ESTABLISHED);
+
+    flow_timeouts_normal[FLOW_PROTO_UDP].closed_timeout = 0;
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test  Test that flows are not freed while lockless readers exist.
+ */
+static int FlowTest14(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.lockless_lookup = true;
+
+    const uint32_t pool_size = FlowSpareGetPoolSize();
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+
+    /* returned to the pool */
+    FlowLocklessReaderRegister();
+    FlowFree(f);
+    FAIL_IF(FlowSpareGetPoolSize() != pool_size + 1);
+    FlowLocklessReaderDeregister();
+
+    /* no readers: freed again */
+    const uint64_t memuse = SC_ATOMIC_GET(flow_memuse);
+    FlowQueuePrivate q = FlowSpareGetFromPool();
+    f = FlowQueuePrivateGetFromTop(&q);
+    FAIL_IF_NULL(f);
+    FlowFree(f);
+    FAIL_IF(SC_ATOMIC_GET(flow_memuse) >= memuse);
+    FlowSparePoolReturnFlows(&q);
+
+    flow_config.lockless_lookup = false;
+    FlowShutdown();
+    PASS;
+}
+
+#ifdef PROFILING
+#define FLOW_BENCH_THREADS 4
+#define FLOW_BENCH_LOOKUPS 100000
+
+typedef struct FlowBenchThread_ {
+    FlowLookupStruct fls;
+    Packet *p;
+    uint32_t errors;
+} FlowBenchThread;
+
+static void *FlowBenchLookups(void *arg)
+{
+    FlowBenchThread *t = arg;
+    for (uint32_t i = 0; i < FLOW_BENCH_LOOKUPS; i++) {
+        FlowHandlePacket(NULL, &t->fls, t->p);
+        Flow *f = t->p->flow;
+        if (f == NULL) {
+            t->errors++;
+            continue;
+        }
+        FLOWLOCK_UNLOCK(f);
+        FlowDeReference(&t->p->flow);
+    }
+    return NULL;
+}
+#endif
+
+/**
+ *  \test  Benchmark the locked and lockless lookup of existing flows by
+ *          multiple threads in the same hash row. Only measures in
+ *          PROFILING builds.
+ */
+static int FlowTest15(void)
+{
+#ifdef PROFILING
+    FlowInitConfig(FLOW_QUIET);
+    /* all flows end up in the first row */
+    flow_config.hash_shard_rows = 1;
+
+    FlowBenchThread t[FLOW_BENCH_THREADS];
+    memset(&t, 0, sizeof(t));
+    uint8_t payload[] = "Payload";
+    for (int i = 0; i < FLOW_BENCH_THREADS; i++) {
+        t[i].p = UTHBuildPacket(payload, sizeof(payload), IPPROTO_UDP);
+        FAIL_IF_NULL(t[i].p);
+        t[i].p->sp = (Port)(1024 + i);
+        FlowSetupPacket(t[i].p);
+        /* set up the flow */
+        FlowHandlePacket(NULL, &t[i].fls, t[i].p);
+        FAIL_IF_NULL(t[i].p->flow);
+        FLOWLOCK_UNLOCK(t[i].p->flow);
+        FlowDeReference(&t[i].p->flow);
+    }
+
+    for (int mode = 0; mode < 2; mode++) {
+        flow_config.lockless_lookup = (mode == 1);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_t threads[FLOW_BENCH_THREADS];
+        for (int i = 0; i < FLOW_BENCH_THREADS; i++) {
+            FAIL_IF(pthread_create(&threads[i], NULL, FlowBenchLookups, &t[i]) != 0);
+        }
+        for (int i = 0; i < FLOW_BENCH_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+            FAIL_IF(t[i].errors != 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        const uint64_t ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+                            (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec;
+        printf("\n%s lookup\t%d threads\t%" PRIu64 " ns/lookup\n",
+                flow_config.lockless_lookup ? "lockless" : "locked", FLOW_BENCH_THREADS,
+                ns / ((uint64_t)FLOW_BENCH_THREADS * FLOW_BENCH_LOOKUPS));
+    }
+    flow_config.lockless_lookup = false;
+
+    for (int i = 0; i < FLOW_BENCH_THREADS; i++) {
+        Flow *sf;
+        while ((sf = FlowQueuePrivateGetFromTop(&t[i].fls.spare_queue)) != NULL) {
+            FlowFree(sf);
+        }
+        UTHFreePacket(t[i].p);
+    }
+    FlowShutdown();
+#endif
+    PASS;
+}
+
+/**
+ *  \test  Test that workers find flows set up from a FlowKey, like the
+ *         flows the eBPF bypass restores, in the key shard.
+ */
+static int FlowTest16(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.hash_shards = 2;
+    flow_config.hash_shard_rows = flow_config.hash_size / 2;
+
+    uint8_t payload[] = "Payload";
+    Packet *p = UTHBuildPacket(payload, sizeof(payload), IPPROTO_UDP);
+    FAIL_IF_NULL(p);
+
+    FlowKey key;
+    memset(&key, 0, sizeof(key));
+    key.src = p->src;
+    key.dst = p->dst;
+    key.sp = p->sp;
+    key.dp = p->dp;
+    key.proto = p->proto;
+    const uint32_t hash = FlowKeyGetHash(&key);
+    p->flow_hash = hash;
+
+    struct timespec ts = { .tv_sec = (time_t)SCTIME_SECS(p->ts), .tv_nsec = 0 };
+    Flow *f = FlowGetFromFlowKey(&key, &ts, hash);
+    FAIL_IF_NULL(f);
+    FLOWLOCK_UNLOCK(f);
+
+    /* a worker of the other shard finds it instead of setting up a new flow */
+    FlowLookupStruct fls;
+    memset(&fls, 0, sizeof(fls));
+    fls.shard = (hash % 2) == 0 ? 1 : 0;
+    FlowHandlePacket(NULL, &fls, p);
+    FAIL_IF(p->flow != f);
+    FLOWLOCK_UNLOCK(f);
+    FlowDeReference(&p->flow);
+
+    Flow *sf;
+    while ((sf = FlowQueuePrivateGetFromTop(&fls.spare_queue)) != NULL) {
+        FlowFree(sf);
+    }
+    UTHFreePacket(p);
+    FlowShutdown();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1475,6 +1984,14 @@ void FlowRegisterTests (void)
                    FlowTest08);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap",
                    FlowTest09);
+    UtRegisterTest("FlowTest10 -- Test lockless flow lookup", FlowTest10);
+    UtRegisterTest("FlowTest11 -- Test flow hash shards", FlowTest11);
+    UtRegisterTest("FlowTest12 -- Test Flow struct layout", FlowTest12);
+    UtRegisterTest("FlowTest13 -- Test closing finished UDP flows", FlowTest13);
+    UtRegisterTest("FlowTest14 -- Test flows are kept for lockless readers", FlowTest14);
+    UtRegisterTest("FlowTest15 -- Benchmark lockless flow lookup", FlowTest15);
+    UtRegisterTest("FlowTest16 -- Test flow hash shards with FlowKey flows", FlowTest16);
+    UtRegisterTest("FlowTest17 -- Test the cold part of Flow", FlowTest17);
 
     RegisterFlowStorageTests();
 #endif /* UNITTESTS */
@@ -281,10 +281,22 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 #define FLOW_RESET_PE_DONE(f, dir) (((dir) & STREAM_TOSERVER) ? ((f)->flags &= ~FLOW_TS_PE_ALPROTO_DETECT_DONE) : ((f)->flags &= ~FLOW_TC_PE_ALPROTO_DETECT_DONE))
 
 /* global flow config */
+/** Access to the links of the active list of a hash row (FlowBucket::head
+ *  and Flow::next) and to Flow::flow_hash. With flow.lockless-lookup these
+ *  are read w/o the row lock, so they are stored with release semantics
+ *  to make sure a flow is set up before it can be reached through the row,
+ *  and the lockless reads use acquire loads. */
+#define FLOW_HASH_LINK_GET(ptr)      __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define FLOW_HASH_LINK_SET(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+
 typedef struct FlowCnf_
 {
     uint32_t hash_rand;
     uint32_t hash_size;
+    /** number of per worker shards the hash is split into */
+    uint32_t hash_shards;
+    /** rows per shard: hash_size / hash_shards */
+    uint32_t hash_shard_rows;
     uint32_t prealloc;
 
     uint32_t timeout_new;
@@ -292,6 +304,12 @@ typedef struct FlowCnf_
 
     uint32_t emergency_recovery;
 
+    /** look up existing flows w/o taking the hash row lock */
+    bool lockless_lookup;
+
+    /** protomaps for which flows that are done move to the closed state */
+    uint8_t close_done_protomaps;
+
     enum ExceptionPolicy memcap_policy;
 
     SC_ATOMIC_DECLARE(uint64_t, memcap);
@@ -327,6 +345,35 @@ typedef uint16_t FlowThreadId;
 
 #include "util-storage.h"
 
+/**
+ *  \brief Rarely used part of a flow.
+ *
+ *  Protocol change and probing parser state, the parent flow id and the
+ *  flow storage (e.g. bypass data, tags, expectations). Most flows never
+ *  set any of these, so this part is only allocated when one of them is
+ *  set, see FlowColdGetOrAlloc. Read it through FlowColdGet.
+ */
+typedef struct FlowCold_ {
+    uint32_t probing_parser_toserver_alproto_masks;
+    uint32_t probing_parser_toclient_alproto_masks;
+
+    /** destination port to be used in protocol detection. This is meant
+     *  for use with STARTTLS and HTTP CONNECT detection */
+    uint16_t protodetect_dp; /**< 0 if not used */
+
+    /** original application level protocol. Used to indicate the previous
+       protocol when changing to another protocol , e.g. with STARTTLS. */
+    AppProto alproto_orig;
+    /** expected app protocol: used in protocol change/upgrade like in
+     *  STARTTLS. */
+    AppProto alproto_expect;
+
+    /* Parent flow id for protocol like ftp */
+    int64_t parent_id;
+
+    Storage storage[];
+} FlowCold;
+
 /**
  *  \brief Flow data structure.
  *
@@ -391,10 +438,19 @@ typedef struct Flow_
     /** Thread ID for the stream/detect portion of this flow */
     FlowThreadId thread_id[2];
 
-    struct Flow_ *next; /* (hash) list next */
+    /** (hash) list next. The active list of a hash row is also walked w/o
+     *  the row lock by the lockless lookup, see FLOW_HASH_LINK_SET. */
+    struct Flow_ *next;
+
+    /* end of the first cache line. What follows up to the lock are the
+     * fields that are touched for (almost) every packet. Keep rarely used
+     * fields out of here, FlowTest12 checks the layout. */
+
     /** Incoming interface */
     struct LiveDevice_ *livedev;
 
+    struct FlowBucket_ *fb;
+
     /** flow hash - the flow hash before hash table size mod. */
     uint32_t flow_hash;
 
@@ -407,36 +463,9 @@ typedef struct Flow_
      * flow lock or flow hash row lock. */
     SCTime_t lastts;
 
-    FlowStateType flow_state;
-
-    /** flow tenant id, used to setup flow timeout and stream pseudo
-     *  packets with the correct tenant id set */
-    uint32_t tenant_id;
-
-    uint32_t probing_parser_toserver_alproto_masks;
-    uint32_t probing_parser_toclient_alproto_masks;
-
     uint32_t flags;         /**< generic flags */
 
-    uint16_t file_flags;    /**< file tracking/extraction flags */
-
-    /** destination port to be used in protocol detection. This is meant
-     *  for use with STARTTLS and HTTP CONNECT detection */
-    uint16_t protodetect_dp; /**< 0 if not used */
-
-    /* Parent flow id for protocol like ftp */
-    int64_t parent_id;
-
-#ifdef FLOWLOCK_RWLOCK
-    SCRWLock r;
-#elif defined FLOWLOCK_MUTEX
-    SCMutex m;
-#else
-    #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
-#endif
-
-    /** protocol specific data pointer, e.g. for TcpSession */
-    void *protoctx;
+    FlowStateType flow_state;
 
     /** mapping to Flow's protocol specific protocols for timeouts
         and state and free functions. */
@@ -449,23 +478,21 @@ typedef struct Flow_
     AppProto alproto_ts;
     AppProto alproto_tc;
 
-    /** original application level protocol. Used to indicate the previous
-       protocol when changing to another protocol , e.g. with STARTTLS. */
-    AppProto alproto_orig;
-    /** expected app protocol: used in protocol change/upgrade like in
-     *  STARTTLS. */
-    AppProto alproto_expect;
+    /** protocol specific data pointer, e.g. for TcpSession */
+    void *protoctx;
 
-    /** detection engine ctx version used to inspect this flow. Set at initial
-     *  inspection. If it doesn't match the currently in use de_ctx, the
-     *  stored sgh ptrs are reset. */
-    uint32_t de_ctx_version;
+    uint32_t todstpktcnt;
+    uint32_t tosrcpktcnt;
+    uint64_t todstbytecnt;
+    uint64_t tosrcbytecnt;
 
-    /** ttl tracking */
-    uint8_t min_ttl_toserver;
-    uint8_t max_ttl_toserver;
-    uint8_t min_ttl_toclient;
-    uint8_t max_ttl_toclient;
+#ifdef FLOWLOCK_RWLOCK
+    SCRWLock r;
+#elif defined FLOWLOCK_MUTEX
+    SCMutex m;
+#else
+    #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
+#endif
 
     /** application level storage ptrs.
      *
@@ -480,21 +507,49 @@ typedef struct Flow_
      *  has been set. */
     const struct SigGroupHead_ *sgh_toserver;
 
+    /** detection engine ctx version used to inspect this flow. Set at initial
+     *  inspection. If it doesn't match the currently in use de_ctx, the
+     *  stored sgh ptrs are reset. */
+    uint32_t de_ctx_version;
+
+    /** ttl tracking */
+    uint8_t min_ttl_toserver;
+    uint8_t max_ttl_toserver;
+    uint8_t min_ttl_toclient;
+    uint8_t max_ttl_toclient;
+
+    uint16_t file_flags;    /**< file tracking/extraction flags */
+
+    /** NUMA node of the spare pool this flow belongs to. Set at alloc
+     *  time and kept over recycling. */
+    uint8_t numa_node;
+
+    /** flow tenant id, used to setup flow timeout and stream pseudo
+     *  packets with the correct tenant id set */
+    uint32_t tenant_id;
+
     /* pointer to the var list */
     GenericVar *flowvar;
 
-    struct FlowBucket_ *fb;
-
     SCTime_t startts;
 
-    uint32_t todstpktcnt;
-    uint32_t tosrcpktcnt;
-    uint64_t todstbytecnt;
-    uint64_t tosrcbytecnt;
-
-    Storage storage[];
+    /** rarely used fields, NULL until one of them is set */
+    FlowCold *cold;
 } Flow;
 
+/** all zero FlowCold, returned by FlowColdGet for flows w/o a cold part */
+extern const FlowCold flow_cold_empty;
+
+/**
+ *  \brief get the cold part of a flow for reading
+ *
+ *  \retval fc cold part, or an all zero one if the flow has none
+ */
+static inline const FlowCold *FlowColdGet(const Flow *f)
+{
+    return f->cold != NULL ? f->cold : &flow_cold_empty;
+}
+
 enum FlowState {
     FLOW_STATE_NEW = 0,
     FLOW_STATE_ESTABLISHED,
@@ -540,6 +595,8 @@ typedef struct FlowLookupStruct_ // TODO name
     DecodeThreadVars *dtv;
     FlowQueuePrivate work_queue;
     uint32_t emerg_spare_sync_stamp;
+    /** hash shard this thread inserts into and looks up from */
+    uint32_t shard;
 } FlowLookupStruct;
 
 /** \brief prepare packet for a life with flow
@@ -571,6 +628,7 @@ int FlowGetPacketDirection(const Flow *, const Packet *);
 void FlowCleanupAppLayer(Flow *);
 
 void FlowUpdateState(Flow *f, enum FlowState s);
+void FlowCloseIfDone(Flow *f);
 
 int FlowSetMemcap(uint64_t size);
 uint64_t FlowGetMemcap(void);
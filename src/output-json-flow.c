@@ -177,12 +177,13 @@ void EveAddAppProto(Flow *f, JsonBuilder *js)
     if (f->alproto_tc && f->alproto_tc != f->alproto) {
         jb_set_string(js, "app_proto_tc", AppProtoToString(f->alproto_tc));
     }
-    if (f->alproto_orig != f->alproto && f->alproto_orig != ALPROTO_UNKNOWN) {
-        jb_set_string(js, "app_proto_orig", AppProtoToString(f->alproto_orig));
+    const FlowCold *fc = FlowColdGet(f);
+    if (fc->alproto_orig != f->alproto && fc->alproto_orig != ALPROTO_UNKNOWN) {
+        jb_set_string(js, "app_proto_orig", AppProtoToString(fc->alproto_orig));
     }
-    if (f->alproto_expect != f->alproto && f->alproto_expect != ALPROTO_UNKNOWN) {
+    if (fc->alproto_expect != f->alproto && fc->alproto_expect != ALPROTO_UNKNOWN) {
         jb_set_string(js, "app_proto_expected",
-                AppProtoToString(f->alproto_expect));
+                AppProtoToString(fc->alproto_expect));
     }
 
 }
@@ -288,22 +289,27 @@ static void EveFlowLogJSON(OutputJsonThreadCtx *aft, JsonBuilder *jb, Flow *f)
         jb_open_object(jb, "tcp");
 
         TcpSession *ssn = f->protoctx;
+        /* flow that only saw a SYN, see stream.compact-syn */
+        const uint8_t syn_flags = ssn ? 0 : StreamTcpCompactSynFlags(f);
 
         char hexflags[3];
         snprintf(hexflags, sizeof(hexflags), "%02x",
-                ssn ? ssn->tcp_packet_flags : 0);
+                ssn ? ssn->tcp_packet_flags : syn_flags);
         jb_set_string(jb, "tcp_flags", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
-                ssn ? ssn->client.tcp_flags : 0);
+                ssn ? ssn->client.tcp_flags : syn_flags);
         jb_set_string(jb, "tcp_flags_ts", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->server.tcp_flags : 0);
         jb_set_string(jb, "tcp_flags_tc", hexflags);
 
-        EveTcpFlags(ssn ? ssn->tcp_packet_flags : 0, jb);
+        EveTcpFlags(ssn ? ssn->tcp_packet_flags : syn_flags, jb);
 
+        if (syn_flags != 0) {
+            jb_set_string(jb, "state", StreamTcpStateAsString(TCP_SYN_SENT));
+        }
         if (ssn) {
             const char *tcp_state = StreamTcpStateAsString(ssn->state);
             if (tcp_state != NULL)
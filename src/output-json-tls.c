@@ -478,9 +478,9 @@ static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p,
 
     /* print original application level protocol when it have been changed
        because of STARTTLS, HTTP CONNECT, or similar. */
-    if (f->alproto_orig != ALPROTO_UNKNOWN) {
-        jb_set_string(js, "from_proto",
-                AppLayerGetProtoName(f->alproto_orig));
+    const AppProto alproto_orig = FlowColdGet(f)->alproto_orig;
+    if (alproto_orig != ALPROTO_UNKNOWN) {
+        jb_set_string(js, "from_proto", AppLayerGetProtoName(alproto_orig));
     }
 
     /* Close the tls object. */
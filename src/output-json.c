@@ -712,8 +712,9 @@ void CreateEveFlowId(JsonBuilder *js, const Flow *f)
     }
     int64_t flow_id = FlowGetId(f);
     jb_set_uint(js, "flow_id", flow_id);
-    if (f->parent_id) {
-        jb_set_uint(js, "parent_id", f->parent_id);
+    const int64_t parent_id = FlowColdGet(f)->parent_id;
+    if (parent_id) {
+        jb_set_uint(js, "parent_id", parent_id);
     }
 }
 
@@ -260,6 +260,8 @@ void RunUnittests(int list_unittests, const char *regex_arg)
 
     HostBitInitCtx();
 
+    StreamTcpRegisterFlowStorage();
+
     StorageFinalize();
     /* test and initialize the unit testing subsystem */
     if (regex_arg == NULL){
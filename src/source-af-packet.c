@@ -959,7 +959,11 @@ static inline void AFPFlushBlock(struct tpacket_block_desc *pbd)
     pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
 }
 
-static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
+/** max number of packets from a block to run through the pipeline at once */
+#define AFP_V3_BATCH_SIZE 32
+
+static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd,
+        struct tpacket3_hdr *ppd, Packet **pkts, uint16_t *pkts_cnt)
 {
     Packet *p = PacketGetFromQueueOrAlloc();
     if (p == NULL) {
@@ -1009,8 +1013,13 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
         }
     }
 
-    if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        SCReturnInt(AFP_SURI_FAILURE);
+    pkts[(*pkts_cnt)++] = p;
+    if (*pkts_cnt == AFP_V3_BATCH_SIZE) {
+        const uint16_t cnt = *pkts_cnt;
+        *pkts_cnt = 0;
+        if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, pkts, cnt) != TM_ECODE_OK) {
+            SCReturnInt(AFP_SURI_FAILURE);
+        }
     }
 
     SCReturnInt(AFP_READ_OK);
@@ -1020,6 +1029,10 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
 {
     const int num_pkts = pbd->hdr.bh1.num_pkts;
     uint8_t *ppd = (uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt;
+    /* packets are run through the pipeline in batches, all before the
+     * block is handed back to the kernel */
+    Packet *pkts[AFP_V3_BATCH_SIZE];
+    uint16_t pkts_cnt = 0;
 
     for (int i = 0; i < num_pkts; ++i) {
         const struct sockaddr_ll *sll =
@@ -1028,7 +1041,7 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
             ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
             continue;
         }
-        int ret = AFPParsePacketV3(ptv, pbd, (struct tpacket3_hdr *)ppd);
+        int ret = AFPParsePacketV3(ptv, pbd, (struct tpacket3_hdr *)ppd, pkts, &pkts_cnt);
         switch (ret) {
             case AFP_READ_OK:
                 break;
@@ -1043,6 +1056,10 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
         }
         ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
     }
+    if (pkts_cnt > 0 &&
+            TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, pkts, pkts_cnt) != TM_ECODE_OK) {
+        SCReturnInt(AFP_SURI_FAILURE);
+    }
 
     SCReturnInt(AFP_READ_OK);
 }
@@ -1076,13 +1093,17 @@ static int AFPReadFromRingV3(AFPThreadVars *ptv)
         }
 
         int ret = AFPWalkBlock(ptv, pbd);
-        if (unlikely(ret != AFP_READ_OK)) {
+        if (unlikely(ret != AFP_READ_OK && ret != AFP_SURI_FAILURE)) {
             AFPFlushBlock(pbd);
             SCReturnInt(ret);
         }
 
         AFPFlushBlock(pbd);
         ptv->frame_offset = (ptv->frame_offset + 1) % ptv->req.v3.tp_block_nr;
+        /* block is consumed, report the pipeline failure */
+        if (unlikely(ret == AFP_SURI_FAILURE)) {
+            SCReturnInt(ret);
+        }
         /* return to maintenance task after one loop on the ring */
         if (ptv->frame_offset == 0) {
             SCReturnInt(AFP_READ_OK);
@@ -402,9 +402,12 @@ static TmEcode ReceiveDPDKLoop(ThreadVars *tv, void *data, void *slot)
         }
 
         ptv->pkts += (uint64_t)nb_rx;
+        Packet *pkts[BURST_SIZE];
+        uint16_t pkts_cnt = 0;
         for (uint16_t i = 0; i < nb_rx; i++) {
             p = PacketGetFromQueueOrAlloc();
             if (unlikely(p == NULL)) {
+                DPDKFreeMbufArray(ptv->received_mbufs, i + 1, i);
                 continue;
             }
             PKT_SET_SRC(p, PKT_SRC_WIRE);
@@ -461,11 +464,14 @@ static TmEcode ReceiveDPDKLoop(ThreadVars *tv, void *data, void *slot)
 
             PacketSetData(p, rte_pktmbuf_mtod(p->dpdk_v.mbuf, uint8_t *),
                     rte_pktmbuf_pkt_len(p->dpdk_v.mbuf));
-            if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-                TmqhOutputPacketpool(ptv->tv, p);
-                DPDKFreeMbufArray(ptv->received_mbufs, nb_rx - i - 1, i + 1);
-                SCReturnInt(EXIT_FAILURE);
-            }
+            pkts[pkts_cnt++] = p;
+        }
+
+        /* run the whole burst through the pipeline at once. On failure the
+         * packets, and so their mbufs, are returned by the batch function. */
+        if (pkts_cnt > 0 &&
+                TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, pkts, pkts_cnt) != TM_ECODE_OK) {
+            SCReturnInt(EXIT_FAILURE);
         }
 
         /* Trigger one dump of stats every second */
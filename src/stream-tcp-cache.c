@@ -24,11 +24,39 @@
 #include "suricata-common.h"
 #include "suricata.h"
 #include "stream-tcp-private.h"
+#include "stream-tcp.h"
 #include "stream-tcp-cache.h"
+#include "stream-tcp-reassemble.h"
+#include "counters.h"
 #include "util-debug.h"
+#include "util-streaming-buffer.h"
+#include "util-validate.h"
+
+/** buffer sizes used by the streaming buffer that are cached per thread:
+ *  the blocks, the regions and the region data of the default size */
+enum TcpBufferCacheClass {
+    TCP_BUF_CACHE_SBB = 0,
+    TCP_BUF_CACHE_REGION,
+    TCP_BUF_CACHE_DATA,
+    TCP_BUF_CACHE_CLASSES,
+};
+
+#define TCP_BUF_CACHE_SIZE 256
+#define TCP_BUF_CACHE_DATA_SIZE 64
+
+typedef struct TcpBufferCache {
+    size_t size;
+    uint32_t max;
+    uint32_t idx;
+    void *bufs[TCP_BUF_CACHE_SIZE];
+} TcpBufferCache;
 
 typedef struct TcpPoolCache {
     bool cache_enabled; /**< cache should only be enabled for worker threads */
+    uint64_t bufs_hit;
+    uint64_t bufs_miss;
+    TcpBufferCache bufs[TCP_BUF_CACHE_CLASSES];
+
     TcpSegment *segs_cache[64];
     uint32_t segs_cache_idx;
     uint32_t segs_returns_idx;
@@ -44,10 +72,100 @@ static thread_local TcpPoolCache tcp_pool_cache;
 extern PoolThread *ssn_pool;
 extern PoolThread *segment_thread_pool;
 
+/** segments returned to their pool through the returns list */
+static SC_ATOMIC_DECLARE(uint64_t, segs_deferred_returns);
+
+static uint64_t StreamTcpThreadCacheDeferredReturnsCounter(void)
+{
+    return SC_ATOMIC_GET(segs_deferred_returns);
+}
+
+void StreamTcpThreadCacheRegisterCounters(void)
+{
+    SC_ATOMIC_INIT(segs_deferred_returns);
+    StatsRegisterGlobalCounter(
+            "tcp.segment_deferred_returns", StreamTcpThreadCacheDeferredReturnsCounter);
+}
+
 /** \brief enable segment cache. Should only be done for worker threads */
 void StreamTcpThreadCacheEnable(void)
 {
     tcp_pool_cache.cache_enabled = true;
+
+    tcp_pool_cache.bufs[TCP_BUF_CACHE_SBB].size = sizeof(StreamingBufferBlock);
+    tcp_pool_cache.bufs[TCP_BUF_CACHE_SBB].max = TCP_BUF_CACHE_SIZE;
+    tcp_pool_cache.bufs[TCP_BUF_CACHE_REGION].size = sizeof(StreamingBufferRegion);
+    tcp_pool_cache.bufs[TCP_BUF_CACHE_REGION].max = TCP_BUF_CACHE_SIZE;
+    tcp_pool_cache.bufs[TCP_BUF_CACHE_DATA].size = stream_config.sbcnf.buf_size;
+    tcp_pool_cache.bufs[TCP_BUF_CACHE_DATA].max = TCP_BUF_CACHE_DATA_SIZE;
+}
+
+bool StreamTcpThreadCacheIsEnabled(void)
+{
+    return tcp_pool_cache.cache_enabled;
+}
+
+static inline TcpBufferCache *StreamTcpThreadCacheGetBufferClass(const size_t size)
+{
+    if (!tcp_pool_cache.cache_enabled)
+        return NULL;
+    /* exact sizes only: a buffer that was realloc'd to one of these sizes
+     * is at least that large, so it can be reused for it */
+    for (int i = 0; i < TCP_BUF_CACHE_CLASSES; i++) {
+        if (tcp_pool_cache.bufs[i].size == size)
+            return &tcp_pool_cache.bufs[i];
+    }
+    return NULL;
+}
+
+/** \brief get a zeroed buffer of \a size from the thread cache
+ *  \retval ptr buffer or NULL if the size is not cached or the cache is empty */
+void *StreamTcpThreadCacheGetBuffer(const size_t size)
+{
+    TcpBufferCache *c = StreamTcpThreadCacheGetBufferClass(size);
+    if (c == NULL)
+        return NULL;
+    if (c->idx == 0) {
+        tcp_pool_cache.bufs_miss++;
+        return NULL;
+    }
+    tcp_pool_cache.bufs_hit++;
+    void *ptr = c->bufs[--c->idx];
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+/** \brief return a buffer to the thread cache
+ *
+ *  A cached buffer stays accounted in the reassembly memuse until the
+ *  cache frees it.
+ *
+ *  \retval bool true if the cache took the buffer, false if the caller
+ *                has to free it */
+bool StreamTcpThreadCacheReturnBuffer(void *ptr, const size_t size)
+{
+    TcpBufferCache *c = StreamTcpThreadCacheGetBufferClass(size);
+    if (c == NULL || c->idx == c->max)
+        return false;
+    c->bufs[c->idx++] = ptr;
+    return true;
+}
+
+void StreamTcpThreadCacheGetBufferStats(uint64_t *hits, uint64_t *misses)
+{
+    *hits = tcp_pool_cache.bufs_hit;
+    *misses = tcp_pool_cache.bufs_miss;
+}
+
+/** \brief fill the empty segment cache with segments from our pool
+ *  \param segs segments to add
+ *  \param cnt number of segments, at most 64 */
+void StreamTcpThreadCacheFillSegments(TcpSegment **segs, const uint32_t cnt)
+{
+    DEBUG_VALIDATE_BUG_ON(tcp_pool_cache.segs_cache_idx + cnt > 64);
+    for (uint32_t i = 0; i < cnt; i++) {
+        tcp_pool_cache.segs_cache[tcp_pool_cache.segs_cache_idx++] = segs[i];
+    }
 }
 
 void StreamTcpThreadCacheReturnSegment(TcpSegment *seg)
@@ -83,6 +201,7 @@ void StreamTcpThreadCacheReturnSegment(TcpSegment *seg)
                 PoolThreadReturnRaw(segment_thread_pool, pool_id, ret_seg);
             }
             PoolThreadUnlock(segment_thread_pool, pool_id);
+            (void)SC_ATOMIC_ADD(segs_deferred_returns, tcp_pool_cache.segs_returns_idx);
             tcp_pool_cache.segs_returns_idx = 0;
         }
 
@@ -154,6 +273,16 @@ void StreamTcpThreadCacheCleanup(void)
         tcp_pool_cache.segs_returns_idx = 0;
     }
 
+    /* streaming buffer memory */
+    for (int c = 0; c < TCP_BUF_CACHE_CLASSES; c++) {
+        for (uint32_t i = 0; i < tcp_pool_cache.bufs[c].idx; i++) {
+            SCFree(tcp_pool_cache.bufs[c].bufs[i]);
+        }
+        StreamTcpReassembleDecrMemuse(
+                (uint64_t)tcp_pool_cache.bufs[c].idx * tcp_pool_cache.bufs[c].size);
+        tcp_pool_cache.bufs[c].idx = 0;
+    }
+
     /* sessions */
     SCLogDebug("tcp_pool_cache.ssns_cache_idx %u", tcp_pool_cache.ssns_cache_idx);
     for (uint32_t i = 0; i < tcp_pool_cache.ssns_cache_idx; i++) {
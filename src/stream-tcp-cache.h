@@ -26,7 +26,10 @@
 
 #include "stream-tcp-private.h"
 
+void StreamTcpThreadCacheRegisterCounters(void);
 void StreamTcpThreadCacheEnable(void);
+bool StreamTcpThreadCacheIsEnabled(void);
+void StreamTcpThreadCacheFillSegments(TcpSegment **segs, const uint32_t cnt);
 void StreamTcpThreadCacheReturnSegment(TcpSegment *seg);
 void StreamTcpThreadCacheReturnSession(TcpSession *ssn);
 void StreamTcpThreadCacheCleanup(void);
@@ -34,4 +37,8 @@ void StreamTcpThreadCacheCleanup(void);
 TcpSegment *StreamTcpThreadCacheGetSegment(void);
 TcpSession *StreamTcpThreadCacheGetSession(void);
 
+void *StreamTcpThreadCacheGetBuffer(const size_t size);
+bool StreamTcpThreadCacheReturnBuffer(void *ptr, const size_t size);
+void StreamTcpThreadCacheGetBufferStats(uint64_t *hits, uint64_t *misses);
+
 #endif /* __STREAM_TCP_CACHE_H__ */
@@ -24,9 +24,14 @@
  */
 
 #include "suricata-common.h"
+#include "action-globals.h"
 #include "decode.h"
+#include "packet.h"
+#include "stream-tcp.h"
 #include "stream-tcp-private.h"
+#include "stream-tcp-reassemble.h"
 #include "stream-tcp-inline.h"
+#include "rust.h"
 
 #include "util-memcmp.h"
 #include "util-print.h"
@@ -165,6 +170,312 @@ void StreamTcpInlineSegmentReplacePacket(const TcpStream *stream,
     }
 }
 
+/** max number of flows per thread that can have packets held at once */
+#define TCP_INLINE_BATCH_FLOWS 64
+
+/** per thread table of batches. Slots are only claimed and reclaimed by the
+ *  owning thread. */
+typedef struct TcpInlineBatchTable_ {
+    uint16_t active;   /**< slots in use */
+    uint16_t hint;     /**< where to start looking for a free slot */
+    uint16_t held;     /**< packets held by all batches */
+    uint16_t max_held; /**< limit to held, so the packet pool doesn't run dry */
+    SCTime_t next_due; /**< earliest time a batch may time out */
+    /** packets of discarded batches, to be released by the owning thread */
+    PacketQueueNoLock dropped;
+    TcpInlineBatch batches[TCP_INLINE_BATCH_FLOWS];
+} TcpInlineBatchTable;
+
+/**
+ *  \brief set up the batch table of a thread if inline batching is enabled
+ *
+ *  Only called for threads that own the verdict of their packets, see
+ *  FlowWorkerThreadInit.
+ */
+int StreamTcpInlineBatchThreadInit(TcpReassemblyThreadCtx *ra_ctx)
+{
+    if (!StreamTcpInlineMode() || stream_config.inline_batch_bytes == 0)
+        return 0;
+
+    extern uint16_t max_pending_packets;
+    TcpInlineBatchTable *t = SCCalloc(1, sizeof(TcpInlineBatchTable));
+    if (t == NULL)
+        return -1;
+    /* held packets come from the pool of the capture thread, which is this
+     * thread. Leave most of the pool for the packets that release them. */
+    t->max_held = max_pending_packets / 4;
+    ra_ctx->inline_batch = t;
+    return 0;
+}
+
+void StreamTcpInlineBatchThreadDeinit(TcpReassemblyThreadCtx *ra_ctx)
+{
+    if (ra_ctx->inline_batch != NULL) {
+        SCFree(ra_ctx->inline_batch);
+        ra_ctx->inline_batch = NULL;
+    }
+}
+
+/**
+ *  \brief check if a packet can be held in the batch of its flow
+ *
+ *  Only in order data of established sessions is held. Packets with
+ *  control flags, tunnel packets and packets that would fill the batch
+ *  up to the configured limits are inspected right away; the latter
+ *  inspect the batch with them.
+ *
+ *  Called before the packet data is added to the stream.
+ */
+bool StreamTcpInlineBatchCanHold(const TcpReassemblyThreadCtx *ra_ctx, const TcpSession *ssn,
+        const TcpStream *stream, const Packet *p)
+{
+    const TcpInlineBatchTable *t = ra_ctx->inline_batch;
+    if (t == NULL || t->held >= t->max_held)
+        return false;
+    if (ssn->state != TCP_ESTABLISHED || p->payload_len == 0 || PKT_IS_PSEUDOPKT(p) ||
+            IS_TUNNEL_PKT(p) || (p->tcph->th_flags & (TH_SYN | TH_FIN | TH_RST | TH_URG)))
+        return false;
+    if ((stream->flags & (STREAMTCP_STREAM_FLAG_DEPTH_REACHED |
+                                 STREAMTCP_STREAM_FLAG_NOREASSEMBLY)) ||
+            !(stream->flags & STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_COMPLETED))
+        return false;
+    if ((p->flow->flags & FLOW_ACTION_DROP) || PacketCheckAction(p, ACTION_DROP) ||
+            FlowChangeProto(p->flow))
+        return false;
+
+    /* in order data only: the packet has to start at the right edge of
+     * the stream data and there can't be data beyond it */
+    const uint64_t left_edge = STREAM_BASE_OFFSET(stream) + (TCP_GET_SEQ(p) - stream->base_seq);
+    if (!RB_EMPTY(&stream->sb.sbb_tree) || stream->sb.region.next != NULL ||
+            left_edge != StreamingBufferGetConsecutiveDataRightEdge(&stream->sb))
+        return false;
+
+    const uint8_t dir = PKT_IS_TOSERVER(p) ? STREAM_TOSERVER : STREAM_TOCLIENT;
+    const TcpInlineBatch *b = ssn->inline_batch;
+    if (b == NULL) {
+        return (t->active < TCP_INLINE_BATCH_FLOWS &&
+                p->payload_len < stream_config.inline_batch_bytes);
+    }
+    return (b->dir == dir && b->right_edge == left_edge &&
+            b->pq.len + 1 < stream_config.inline_batch_pkts &&
+            (b->right_edge - b->left_edge) + p->payload_len < stream_config.inline_batch_bytes);
+}
+
+/**
+ *  \brief add a packet to the batch of its flow
+ *
+ *  The data of the packet has been added to the stream, but the app-layer
+ *  has not been updated with it.
+ */
+void StreamTcpInlineBatchAdd(
+        TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn, const TcpStream *stream, Packet *p)
+{
+    TcpInlineBatchTable *t = ra_ctx->inline_batch;
+    TcpInlineBatch *b = ssn->inline_batch;
+    const uint64_t left_edge = STREAM_BASE_OFFSET(stream) + (TCP_GET_SEQ(p) - stream->base_seq);
+
+    if (b == NULL) {
+        DEBUG_VALIDATE_BUG_ON(t->active >= TCP_INLINE_BATCH_FLOWS);
+        for (uint16_t i = 0; i < TCP_INLINE_BATCH_FLOWS; i++) {
+            const uint16_t idx = (t->hint + i) % TCP_INLINE_BATCH_FLOWS;
+            if (!t->batches[idx].in_use) {
+                b = &t->batches[idx];
+                t->hint = (idx + 1) % TCP_INLINE_BATCH_FLOWS;
+                break;
+            }
+        }
+        DEBUG_VALIDATE_BUG_ON(b == NULL);
+        if (b == NULL) {
+            p->flags &= ~PKT_STREAM_HELD;
+            return;
+        }
+        memset(b, 0, sizeof(*b));
+        SC_ATOMIC_INIT(b->dropped);
+        b->in_use = true;
+        b->f = p->flow;
+        b->dir = PKT_IS_TOSERVER(p) ? STREAM_TOSERVER : STREAM_TOCLIENT;
+        b->first_ts = p->ts;
+        b->left_edge = b->right_edge = left_edge;
+        ssn->inline_batch = b;
+
+        const SCTime_t due = SCTIME_ADD_USECS(p->ts, stream_config.inline_batch_usecs);
+        if (t->active == 0 || SCTIME_CMP_LT(due, t->next_due))
+            t->next_due = due;
+        t->active++;
+    }
+    DEBUG_VALIDATE_BUG_ON(b->right_edge != left_edge);
+
+    PacketEnqueueNoLock(&b->pq, p);
+    b->right_edge = left_edge + p->payload_len;
+    b->pkts++;
+    t->held++;
+}
+
+/**
+ *  \brief take the newest packet out of the batch
+ *
+ *  Used to undo StreamTcpInlineBatchAdd for a packet that turned out to
+ *  need a verdict of its own, and to get the packet the batch is inspected
+ *  with. The batch edges are left alone so that the inspection of the
+ *  packet still covers all the held data.
+ */
+Packet *StreamTcpInlineBatchTakeLast(TcpSession *ssn)
+{
+    TcpInlineBatch *b = ssn->inline_batch;
+    if (b == NULL || b->pq.top == NULL)
+        return NULL;
+
+    Packet *p = b->pq.top;
+    b->pq.top = p->next;
+    if (b->pq.top != NULL)
+        b->pq.top->prev = NULL;
+    else
+        b->pq.bot = NULL;
+    b->pq.len--;
+    p->next = p->prev = NULL;
+    p->flags &= ~PKT_STREAM_HELD;
+    return p;
+}
+
+/**
+ *  \brief take the oldest packet out of the batch
+ */
+Packet *StreamTcpInlineBatchTakeFirst(TcpSession *ssn)
+{
+    TcpInlineBatch *b = ssn->inline_batch;
+    if (b == NULL)
+        return NULL;
+    Packet *p = PacketDequeueNoLock(&b->pq);
+    if (p != NULL)
+        p->flags &= ~PKT_STREAM_HELD;
+    return p;
+}
+
+static void BatchReclaim(TcpInlineBatchTable *t, TcpInlineBatch *b)
+{
+    DEBUG_VALIDATE_BUG_ON(t->active == 0 || t->held < b->pkts);
+    t->held -= b->pkts;
+    t->active--;
+    b->in_use = false;
+}
+
+/**
+ *  \brief detach the (empty) batch from the session
+ *
+ *  \param ra_ctx reassembly ctx of the thread owning the batch
+ */
+void StreamTcpInlineBatchDetach(TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn)
+{
+    TcpInlineBatch *b = ssn->inline_batch;
+    if (b == NULL)
+        return;
+    DEBUG_VALIDATE_BUG_ON(b->pq.len != 0);
+    b->f = NULL;
+    ssn->inline_batch = NULL;
+    if (ra_ctx->inline_batch != NULL)
+        BatchReclaim(ra_ctx->inline_batch, b);
+}
+
+/**
+ *  \brief drop the held packets of a session that is cleaned up
+ *
+ *  Normally the batch is inspected before this happens. If the session goes
+ *  away with packets still held, e.g. when the flow is evicted, the packets
+ *  are dropped as they have not been inspected.
+ *
+ *  This can be called from threads other than the one holding the packets,
+ *  like the flow manager and recycler, and by the owning thread while the
+ *  packets are part of the burst it processes. So the batch is only marked
+ *  here. The packets are released by the owning thread, see
+ *  StreamTcpInlineBatchGetDue and StreamTcpInlineBatchTakeDropped.
+ *
+ *  \param ssn session, its flow is locked
+ */
+void StreamTcpInlineBatchDiscard(TcpSession *ssn)
+{
+    TcpInlineBatch *b = ssn->inline_batch;
+    if (b == NULL)
+        return;
+    ssn->inline_batch = NULL;
+    SC_ATOMIC_SET(b->dropped, true);
+}
+
+/** \brief check if the thread holds packets */
+bool StreamTcpInlineBatchPending(const TcpReassemblyThreadCtx *ra_ctx)
+{
+    return (ra_ctx->inline_batch != NULL && ra_ctx->inline_batch->active != 0);
+}
+
+/**
+ *  \brief get the next flow with a batch that is due
+ *
+ *  Reclaims the slots of batches that were discarded on the way. Their
+ *  packets are flagged for drop and queued for
+ *  StreamTcpInlineBatchTakeDropped.
+ *
+ *  \param now current time
+ *  \param force return all flows with held packets, e.g. at shutdown
+ *  \param iter iterator, start with 0
+ *
+ *  \retval f flow to lock and flush, the caller has to check that the flow
+ *            still owns the batch after locking it
+ *  \retval NULL no (more) batches due
+ */
+Flow *StreamTcpInlineBatchGetDue(
+        TcpReassemblyThreadCtx *ra_ctx, const SCTime_t now, const bool force, uint16_t *iter)
+{
+    TcpInlineBatchTable *t = ra_ctx->inline_batch;
+    if (t == NULL || t->active == 0)
+        return NULL;
+    if (*iter == 0) {
+        if (!force && SCTIME_CMP_LT(now, t->next_due))
+            return NULL;
+        t->next_due = SCTIME_ADD_USECS(now, stream_config.inline_batch_usecs);
+    }
+
+    for (; *iter < TCP_INLINE_BATCH_FLOWS; (*iter)++) {
+        TcpInlineBatch *b = &t->batches[*iter];
+        if (!b->in_use)
+            continue;
+        if (SC_ATOMIC_GET(b->dropped)) {
+            Packet *p;
+            while ((p = PacketDequeueNoLock(&b->pq)) != NULL) {
+                PacketDrop(p, ACTION_DROP, PKT_DROP_REASON_STREAM_ERROR);
+                PacketEnqueueNoLock(&t->dropped, p);
+            }
+            b->f = NULL;
+            BatchReclaim(t, b);
+            continue;
+        }
+        const SCTime_t due = SCTIME_ADD_USECS(b->first_ts, stream_config.inline_batch_usecs);
+        if (force || SCTIME_CMP_GTE(now, due)) {
+            (*iter)++;
+            return b->f;
+        }
+        if (SCTIME_CMP_LT(due, t->next_due))
+            t->next_due = due;
+    }
+    return NULL;
+}
+
+/**
+ *  \brief get a packet of a discarded batch
+ *
+ *  The packet is flagged for drop. The caller passes it on like any other
+ *  held packet that is released.
+ *
+ *  \retval p packet, or NULL if there are no (more) packets to release
+ */
+Packet *StreamTcpInlineBatchTakeDropped(TcpReassemblyThreadCtx *ra_ctx)
+{
+    TcpInlineBatchTable *t = ra_ctx->inline_batch;
+    if (t == NULL || t->dropped.len == 0)
+        return NULL;
+    Packet *p = PacketDequeueNoLock(&t->dropped);
+    p->flags &= ~PKT_STREAM_HELD;
+    return p;
+}
+
 #ifdef UNITTESTS
 #include "tests/stream-tcp-inline.c"
 #endif
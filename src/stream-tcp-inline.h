@@ -25,12 +25,44 @@
 #define __STREAM_TCP_INLINE_H__
 
 #include "stream-tcp-private.h"
+#include "stream-tcp-reassemble.h"
+#include "packet-queue.h"
+
+/** packets of a flow held for inspection as a batch, see
+ *  stream.reassembly.inline-batch */
+typedef struct TcpInlineBatch_ {
+    PacketQueueNoLock pq; /**< held packets, the oldest at pq.bot */
+    Flow *f;              /**< flow owning the batch */
+    SCTime_t first_ts;    /**< time the oldest packet was held */
+    uint64_t left_edge;   /**< stream offset of the first held byte */
+    uint64_t right_edge;  /**< stream offset past the last held byte */
+    uint16_t pkts;        /**< packets added, for the per thread limit */
+    uint8_t dir;          /**< STREAM_TOSERVER or STREAM_TOCLIENT */
+    bool in_use;          /**< slot claimed, only updated by the owning thread */
+    /** set by StreamTcpInlineBatchDiscard, possibly from another thread */
+    SC_ATOMIC_DECLARE(bool, dropped);
+} TcpInlineBatch;
 
 int StreamTcpInlineSegmentCompare(const TcpStream *,
         const Packet *, const TcpSegment *);
 void StreamTcpInlineSegmentReplacePacket(const TcpStream *,
         Packet *, const TcpSegment *);
 
+int StreamTcpInlineBatchThreadInit(TcpReassemblyThreadCtx *ra_ctx);
+void StreamTcpInlineBatchThreadDeinit(TcpReassemblyThreadCtx *ra_ctx);
+bool StreamTcpInlineBatchCanHold(const TcpReassemblyThreadCtx *ra_ctx, const TcpSession *ssn,
+        const TcpStream *stream, const Packet *p);
+void StreamTcpInlineBatchAdd(
+        TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn, const TcpStream *stream, Packet *p);
+Packet *StreamTcpInlineBatchTakeLast(TcpSession *ssn);
+Packet *StreamTcpInlineBatchTakeFirst(TcpSession *ssn);
+void StreamTcpInlineBatchDetach(TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn);
+void StreamTcpInlineBatchDiscard(TcpSession *ssn);
+bool StreamTcpInlineBatchPending(const TcpReassemblyThreadCtx *ra_ctx);
+Flow *StreamTcpInlineBatchGetDue(
+        TcpReassemblyThreadCtx *ra_ctx, const SCTime_t now, const bool force, uint16_t *iter);
+Packet *StreamTcpInlineBatchTakeDropped(TcpReassemblyThreadCtx *ra_ctx);
+
 void StreamTcpInlineRegisterTests(void);
 
 #endif /* __STREAM_TCP_INLINE_H__ */
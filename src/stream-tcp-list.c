@@ -153,6 +153,23 @@ static inline bool CheckOverlap(struct TCPSEG *tree, TcpSegment *seg)
     return false;
 }
 
+/** \internal
+ *  \brief append segment as the new tail of the tree
+ *
+ *  Caller must make sure \a seg sorts after all segments in the tree. The
+ *  tail is found by following the right spine, so no compares are done.
+ */
+static inline void DoAppendSegment(TcpStream *stream, TcpSegment *seg)
+{
+    TcpSegment *tail = RB_ROOT(&stream->seg_tree);
+    while (RB_RIGHT(tail, rb) != NULL)
+        tail = RB_RIGHT(tail, rb);
+
+    RB_SET(seg, tail, rb);
+    RB_RIGHT(tail, rb) = seg;
+    TCPSEG_RB_INSERT_COLOR(&stream->seg_tree, seg);
+}
+
 /** \internal
  *  \brief insert the segment into the proper place in the tree
  *         don't worry about the data or overlaps
@@ -178,6 +195,17 @@ static int DoInsertSegment (TcpStream *stream, TcpSegment *seg, TcpSegment **dup
         return 0;
     }
 
+    /* fast track for in order data: all segments in the tree end at or
+     * before segs_right_edge, so a segment starting there can't overlap
+     * and sorts after all of them. */
+    if (likely(SEQ_EQ(seg->seq, stream->segs_right_edge))) {
+        SCLogDebug("in order seg %p seq %" PRIu32 ", len %" PRIu32 ", appending", seg, seg->seq,
+                TCP_SEG_LEN(seg));
+        DoAppendSegment(stream, seg);
+        stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
+        return 0;
+    }
+
     /* insert and then check if there was any overlap with other segments */
     TcpSegment *res = TCPSEG_RB_INSERT(&stream->seg_tree, seg);
     if (res) {
@@ -767,7 +795,8 @@ static inline uint64_t GetLeftEdgeForApp(Flow *f, TcpSession *ssn, TcpStream *st
     return o;
 }
 
-static inline uint64_t GetLeftEdge(Flow *f, TcpSession *ssn, TcpStream *stream)
+static inline uint64_t GetLeftEdgeDo(
+        Flow *f, TcpSession *ssn, TcpStream *stream, const bool trim)
 {
     uint64_t left_edge = 0;
     const bool use_app = !(ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED);
@@ -779,7 +808,7 @@ static inline uint64_t GetLeftEdge(Flow *f, TcpSession *ssn, TcpStream *stream)
     if (use_raw) {
         uint64_t raw_progress = STREAM_RAW_PROGRESS(stream);
 
-        if (StreamTcpInlineMode()) {
+        if (StreamTcpInlineMode() && !trim) {
             uint32_t chunk_size = (stream == &ssn->client) ?
                 stream_config.reassembly_toserver_chunk_size :
                 stream_config.reassembly_toclient_chunk_size;
@@ -792,7 +821,7 @@ static inline uint64_t GetLeftEdge(Flow *f, TcpSession *ssn, TcpStream *stream)
 
         /* apply min inspect depth: if it is set we need to keep data
          * before the raw progress. */
-        if (use_app && stream->min_inspect_depth && ssn->state < TCP_CLOSED) {
+        if (use_app && stream->min_inspect_depth && ssn->state < TCP_CLOSED && !trim) {
             if (raw_progress < stream->min_inspect_depth)
                 raw_progress = 0;
             else
@@ -873,6 +902,19 @@ static inline uint64_t GetLeftEdge(Flow *f, TcpSession *ssn, TcpStream *stream)
     return left_edge;
 }
 
+static inline uint64_t GetLeftEdge(Flow *f, TcpSession *ssn, TcpStream *stream)
+{
+    /* under memory pressure don't keep inspected data around */
+    const bool trim = stream_config.adaptive_threshold && StreamTcpReassembleTrimRetained(stream);
+    const uint64_t left_edge = GetLeftEdgeDo(f, ssn, stream, trim);
+    /* only count it if trimming released data that would have been kept */
+    if (trim && left_edge > STREAM_BASE_OFFSET(stream) &&
+            left_edge > GetLeftEdgeDo(f, ssn, stream, false)) {
+        StreamTcpReassembleCountTrimmed();
+    }
+    return left_edge;
+}
+
 static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
 {
     RB_REMOVE(TCPSEG, &stream->seg_tree, seg);
@@ -915,6 +957,7 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags)
         SCLogDebug("ssn %p / stream %p: reassembly depth reached, "
                  "STREAMTCP_STREAM_FLAG_NOREASSEMBLY set", ssn, stream);
         StreamTcpReturnStreamSegments(stream);
+        StreamTcpReassembleRecordBufferStats(&stream->sb);
         StreamingBufferClear(&stream->sb, &stream_config.sbcnf);
         return;
 
@@ -924,6 +967,7 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags)
                  "STREAMTCP_STREAM_FLAG_NOREASSEMBLY set", ssn, stream);
         stream->flags |= STREAMTCP_STREAM_FLAG_NOREASSEMBLY;
         StreamTcpReturnStreamSegments(stream);
+        StreamTcpReassembleRecordBufferStats(&stream->sb);
         StreamingBufferClear(&stream->sb, &stream_config.sbcnf);
         return;
     }
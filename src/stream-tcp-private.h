@@ -51,6 +51,15 @@ typedef struct StreamTcpSackRecord {
 
 int TcpSackCompare(struct StreamTcpSackRecord *a, struct StreamTcpSackRecord *b);
 
+/** SACK range in the scoreboard kept inside the TcpStream */
+typedef struct StreamTcpSackRange_ {
+    uint32_t le;    /**< left edge, host order */
+    uint32_t re;    /**< right edge, host order */
+} StreamTcpSackRange;
+
+/** max SACK ranges kept in TcpStream::sack_inline before using the tree */
+#define STREAM_SACK_INLINE_MAX 4
+
 /* red-black tree prototype for SACK records */
 RB_HEAD(TCPSACK, StreamTcpSackRecord);
 RB_PROTOTYPE(TCPSACK, StreamTcpSackRecord, rb, TcpSackCompare);
@@ -103,6 +112,12 @@ RB_PROTOTYPE(TCPSEG, TcpSegment, rb, TcpSegmentCompare);
 /* return true if we have seen data. */
 #define STREAM_HAS_SEEN_DATA(stream) StreamingBufferHasData(&(stream)->sb)
 
+/** rule id the incremental stream mpm found, see TcpStream::raw_mpm_matches */
+typedef struct TcpStreamMpmMatch_ {
+    SigIntId id;
+    uint64_t re; /**< absolute right edge of the data scanned when it matched */
+} TcpStreamMpmMatch;
+
 typedef struct TcpStream_ {
     uint16_t flags:12;              /**< Flag specific to the stream e.g. Timestamp */
     /* coccinelle: TcpStream:flags:STREAMTCP_STREAM_FLAG_ */
@@ -132,13 +147,27 @@ typedef struct TcpStream_ {
                                      *   remains available for inspection together with app layer buffers */
     uint32_t data_required;         /**< data required from STREAM_APP_PROGRESS before calling app-layer again */
 
+    uint32_t raw_mpm_state;         /**< mpm state at raw_mpm_progress for incremental stream mpm */
+    uint64_t raw_mpm_progress;      /**< absolute right edge of the raw stream data scanned by the mpm */
+    struct MpmStream_ *raw_mpm_stream; /**< streaming mpm state for incremental stream mpm */
+    const void *raw_mpm_ctx;        /**< mpm ctx the raw_mpm_* state belongs to */
+    uint32_t raw_mpm_de_version;    /**< version of the detect engine of raw_mpm_ctx */
+    uint16_t raw_mpm_matches_cnt;
+    uint16_t raw_mpm_matches_size;
+    TcpStreamMpmMatch *raw_mpm_matches; /**< rule ids matched by the incremental stream mpm
+                                         *   in data that may still be in the raw window */
+
     StreamingBuffer sb;
     struct TCPSEG seg_tree;         /**< red black tree of TCP segments. Data is stored in TcpStream::sb */
     uint32_t segs_right_edge;
 
     uint32_t sack_size;             /**< combined size of the SACK ranges currently in our tree. Updated
                                      *   at INSERT/REMOVE time. */
-    struct TCPSACK sack_tree;       /**< red back tree of TCP SACK records. */
+    uint8_t sack_inline_cnt;        /**< number of ranges in sack_inline */
+    StreamTcpSackRange sack_inline[STREAM_SACK_INLINE_MAX]; /**< sorted SACK ranges, used while
+                                                             *   sack_tree is empty */
+    struct TCPSACK sack_tree;       /**< red back tree of TCP SACK records. Used if there are
+                                     *   more ranges than fit in sack_inline. */
 } TcpStream;
 
 #define STREAM_BASE_OFFSET(stream)  ((stream)->sb.region.stream_offset)
@@ -294,6 +323,8 @@ typedef struct TcpSession_ {
     TcpStream server;
     TcpStream client;
     TcpStateQueue *queue;                   /**< list of SYN/ACK candidates */
+    /** packets held for inspection as a batch, see stream-tcp-inline.c */
+    struct TcpInlineBatch_ *inline_batch;
 } TcpSession;
 
 #define StreamTcpSetStreamFlagAppProtoDetectionCompleted(stream) \
@@ -45,6 +45,7 @@
 #include "util-unittest-helper.h"
 #include "util-byte.h"
 #include "util-device.h"
+#include "util-misc.h"
 
 #include "stream-tcp.h"
 #include "stream-tcp-private.h"
@@ -68,6 +69,7 @@
 #include "util-profiling.h"
 #include "util-validate.h"
 #include "util-exception-policy.h"
+#include "util-arena.h"
 
 #ifdef DEBUG
 static SCMutex segment_pool_memuse_mutex;
@@ -77,7 +79,12 @@ static uint64_t segment_pool_memcnt = 0;
 
 thread_local uint64_t t_pcapcnt = UINT64_MAX;
 
+/** number of segments to take from the pool at once when refilling the
+ *  per thread segment cache */
+#define SEGMENT_CACHE_REFILL 16
+
 PoolThread *segment_thread_pool = NULL;
+static SCArena *segment_arena = NULL;
 /* init only, protect initializing and growing pool */
 static SCMutex segment_thread_pool_mutex = SCMUTEX_INITIALIZER;
 
@@ -151,6 +158,164 @@ uint64_t StreamTcpReassembleMemuseGlobalCounter(void)
     return smemuse;
 }
 
+/* decisions of the adaptive memory policy */
+static SC_ATOMIC_DECLARE(uint64_t, ra_depth_reduced);
+static SC_ATOMIC_DECLARE(uint64_t, ra_trimmed);
+
+static uint64_t StreamTcpReassemblePressureCounter(void)
+{
+    return StreamTcpReassembleMemPressure();
+}
+
+static uint64_t StreamTcpReassembleDepthReducedCounter(void)
+{
+    return SC_ATOMIC_GET(ra_depth_reduced);
+}
+
+static uint64_t StreamTcpReassembleTrimmedCounter(void)
+{
+    return SC_ATOMIC_GET(ra_trimmed);
+}
+
+/* shape of the streaming buffers at the end of their life: the max number of
+ * concurrent regions and the number of region reallocs */
+#define SB_HIST_COUNTER(name)                                                                      \
+    static SC_ATOMIC_DECLARE(uint64_t, name);                                                      \
+    static uint64_t name##_counter(void)                                                           \
+    {                                                                                              \
+        return SC_ATOMIC_GET(name);                                                                \
+    }
+SB_HIST_COUNTER(sb_regions_1)
+SB_HIST_COUNTER(sb_regions_2_4)
+SB_HIST_COUNTER(sb_regions_5_8)
+SB_HIST_COUNTER(sb_regions_9_plus)
+SB_HIST_COUNTER(sb_reallocs_0)
+SB_HIST_COUNTER(sb_reallocs_1_4)
+SB_HIST_COUNTER(sb_reallocs_5_16)
+SB_HIST_COUNTER(sb_reallocs_17_plus)
+#undef SB_HIST_COUNTER
+
+static void StreamTcpReassembleRegisterBufferStats(void)
+{
+    SC_ATOMIC_INIT(sb_regions_1);
+    SC_ATOMIC_INIT(sb_regions_2_4);
+    SC_ATOMIC_INIT(sb_regions_5_8);
+    SC_ATOMIC_INIT(sb_regions_9_plus);
+    SC_ATOMIC_INIT(sb_reallocs_0);
+    SC_ATOMIC_INIT(sb_reallocs_1_4);
+    SC_ATOMIC_INIT(sb_reallocs_5_16);
+    SC_ATOMIC_INIT(sb_reallocs_17_plus);
+    StatsRegisterGlobalCounter("tcp.stream_regions.1", sb_regions_1_counter);
+    StatsRegisterGlobalCounter("tcp.stream_regions.2_4", sb_regions_2_4_counter);
+    StatsRegisterGlobalCounter("tcp.stream_regions.5_8", sb_regions_5_8_counter);
+    StatsRegisterGlobalCounter("tcp.stream_regions.9_plus", sb_regions_9_plus_counter);
+    StatsRegisterGlobalCounter("tcp.stream_reallocs.0", sb_reallocs_0_counter);
+    StatsRegisterGlobalCounter("tcp.stream_reallocs.1_4", sb_reallocs_1_4_counter);
+    StatsRegisterGlobalCounter("tcp.stream_reallocs.5_16", sb_reallocs_5_16_counter);
+    StatsRegisterGlobalCounter("tcp.stream_reallocs.17_plus", sb_reallocs_17_plus_counter);
+}
+
+/**
+ *  \brief account the region count and realloc count of a streaming buffer
+ *         in the histograms before it is cleared
+ *
+ *  Buffers that never held data are not counted.
+ */
+void StreamTcpReassembleRecordBufferStats(const StreamingBuffer *sb)
+{
+    if (sb->region.buf == NULL && sb->region.next == NULL && sb->reallocs == 0)
+        return;
+
+    if (sb->max_regions <= 1)
+        SC_ATOMIC_ADD(sb_regions_1, 1);
+    else if (sb->max_regions <= 4)
+        SC_ATOMIC_ADD(sb_regions_2_4, 1);
+    else if (sb->max_regions <= 8)
+        SC_ATOMIC_ADD(sb_regions_5_8, 1);
+    else
+        SC_ATOMIC_ADD(sb_regions_9_plus, 1);
+
+    if (sb->reallocs == 0)
+        SC_ATOMIC_ADD(sb_reallocs_0, 1);
+    else if (sb->reallocs <= 4)
+        SC_ATOMIC_ADD(sb_reallocs_1_4, 1);
+    else if (sb->reallocs <= 16)
+        SC_ATOMIC_ADD(sb_reallocs_5_16, 1);
+    else
+        SC_ATOMIC_ADD(sb_reallocs_17_plus, 1);
+}
+
+/**
+ *  \brief Get the reassembly memory pressure for the adaptive policy
+ *
+ *  \retval pressure 0 if memuse is below stream.reassembly.adaptive-threshold
+ *          percent of the memcap, growing linearly to 100 at the memcap
+ */
+uint32_t StreamTcpReassembleMemPressure(void)
+{
+    if (stream_config.adaptive_threshold == 0)
+        return 0;
+
+    const uint64_t memcap = SC_ATOMIC_GET(stream_config.reassembly_memcap);
+    if (memcap == 0)
+        return 0;
+    const uint64_t start = memcap / 100 * stream_config.adaptive_threshold;
+    const uint64_t memuse = SC_ATOMIC_GET(ra_memuse);
+    if (memuse <= start)
+        return 0;
+    if (memuse >= memcap)
+        return 100;
+    return (uint32_t)((memuse - start) * 100 / (memcap - start));
+}
+
+/** \internal
+ *  \brief get the depth to use for a session under the current memory pressure
+ *
+ *  The depth is lowered linearly from the session's depth to
+ *  stream.reassembly.adaptive-min-depth at the memcap. Unlimited depth is
+ *  left alone. */
+static inline uint32_t StreamTcpReassembleAdaptiveDepth(const uint32_t depth)
+{
+    if (depth <= stream_config.adaptive_min_depth)
+        return depth;
+    const uint32_t pressure = StreamTcpReassembleMemPressure();
+    if (pressure == 0)
+        return depth;
+    const uint32_t range = depth - stream_config.adaptive_min_depth;
+    return depth - (uint32_t)((uint64_t)range * pressure / 100);
+}
+
+/**
+ *  \brief Check if a stream should give up data it retains for inspection
+ *
+ *  Under memory pressure streams retaining more than a threshold drop the data
+ *  kept before the inspection progress. The threshold starts at
+ *  stream.reassembly.adaptive-min-depth and goes down to 0 at the memcap, so
+ *  the largest and longest lived flows are trimmed first.
+ *
+ *  The caller counts the trim with StreamTcpReassembleCountTrimmed if it
+ *  actually released data.
+ */
+bool StreamTcpReassembleTrimRetained(const TcpStream *stream)
+{
+    const uint32_t pressure = StreamTcpReassembleMemPressure();
+    if (pressure == 0)
+        return false;
+
+    const uint64_t retained =
+            StreamingBufferGetConsecutiveDataRightEdge(&stream->sb) - STREAM_BASE_OFFSET(stream);
+    const uint64_t threshold =
+            (uint64_t)stream_config.adaptive_min_depth * (100 - pressure) / 100;
+    if (retained < threshold)
+        return false;
+    return true;
+}
+
+void StreamTcpReassembleCountTrimmed(void)
+{
+    (void)SC_ATOMIC_ADD(ra_trimmed, 1);
+}
+
 /**
  * \brief  Function to Check the reassembly memory usage counter against the
  *         allowed max memory usage for TCP segments.
@@ -208,11 +373,16 @@ uint64_t StreamTcpReassembleGetMemcap(void)
 */
 static void *ReassembleCalloc(size_t n, size_t size)
 {
+    /* cached buffers are still accounted in memuse */
+    void *ptr = StreamTcpThreadCacheGetBuffer(n * size);
+    if (ptr != NULL)
+        return ptr;
+
     if (StreamTcpReassembleCheckMemcap(n * size) == 0) {
         sc_errno = SC_ELIMIT;
         return NULL;
     }
-    void *ptr = SCCalloc(n, size);
+    ptr = SCCalloc(n, size);
     if (ptr == NULL) {
         sc_errno = SC_ENOMEM;
         return NULL;
@@ -252,10 +422,22 @@ void *StreamTcpReassembleRealloc(void *optr, size_t orig_size, size_t size)
 */
 static void ReassembleFree(void *ptr, size_t size)
 {
+    /* memuse is released when the cache frees the buffer */
+    if (StreamTcpThreadCacheReturnBuffer(ptr, size))
+        return;
     SCFree(ptr);
     StreamTcpReassembleDecrMemuse(size);
 }
 
+/** \brief free a tcp segment pool entry */
+static void TcpSegmentPoolFree(void *ptr)
+{
+    if (SCArenaOwns(ptr))
+        SCArenaFree(segment_arena, ptr);
+    else
+        SCFree(ptr);
+}
+
 /** \brief alloc a tcp segment pool entry */
 static void *TcpSegmentPoolAlloc(void)
 {
@@ -266,15 +448,18 @@ static void *TcpSegmentPoolAlloc(void)
 
     TcpSegment *seg = NULL;
 
-    seg = SCMalloc(sizeof (TcpSegment));
-    if (unlikely(seg == NULL))
-        return NULL;
+    seg = SCArenaAlloc(segment_arena);
+    if (seg == NULL) {
+        seg = SCMalloc(sizeof(TcpSegment));
+        if (unlikely(seg == NULL))
+            return NULL;
+    }
 
     if (IsTcpSessionDumpingEnabled()) {
         uint32_t memuse =
                 sizeof(TcpSegmentPcapHdrStorage) + sizeof(uint8_t) * TCPSEG_PKT_HDR_DEFAULT_SIZE;
         if (StreamTcpReassembleCheckMemcap(sizeof(TcpSegment) + memuse) == 0) {
-            SCFree(seg);
+            TcpSegmentPoolFree(seg);
             return NULL;
         }
 
@@ -282,7 +467,7 @@ static void *TcpSegmentPoolAlloc(void)
         if (seg->pcap_hdr_storage == NULL) {
             SCLogError("Unable to allocate memory for "
                        "TcpSegmentPcapHdrStorage");
-            SCFree(seg);
+            TcpSegmentPoolFree(seg);
             return NULL;
         } else {
             seg->pcap_hdr_storage->alloclen = sizeof(uint8_t) * TCPSEG_PKT_HDR_DEFAULT_SIZE;
@@ -293,7 +478,7 @@ static void *TcpSegmentPoolAlloc(void)
                            "packet header data within "
                            "TcpSegmentPcapHdrStorage");
                 SCFree(seg->pcap_hdr_storage);
-                SCFree(seg);
+                TcpSegmentPoolFree(seg);
                 return NULL;
             }
         }
@@ -513,6 +698,90 @@ static int StreamTcpReassemblyConfig(bool quiet)
     if (!quiet)
         SCLogConfig("stream.reassembly \"max-regions\": %u", max_regions);
 
+    int zero_copy = 0;
+    (void)ConfGetBool("stream.reassembly.zero-copy", &zero_copy);
+    stream_config.zero_copy = zero_copy != 0;
+    if (stream_config.zero_copy && !StreamTcpInlineMode()) {
+        SCLogWarning("stream.reassembly.zero-copy only applies to inline mode");
+    }
+    if (!quiet)
+        SCLogConfig("stream.reassembly \"zero-copy\": %s",
+                stream_config.zero_copy ? "enabled" : "disabled");
+
+    int adaptive = 0;
+    (void)ConfGetBool("stream.reassembly.adaptive-depth", &adaptive);
+    if (adaptive) {
+        intmax_t threshold = 75;
+        if (ConfGetInt("stream.reassembly.adaptive-threshold", &threshold) == 1 &&
+                (threshold < 1 || threshold > 99)) {
+            SCLogError("stream.reassembly.adaptive-threshold %" PRIdMAX
+                       " is invalid: must be 1-99",
+                    threshold);
+            return -1;
+        }
+        stream_config.adaptive_threshold = (uint8_t)threshold;
+
+        stream_config.adaptive_min_depth = 64 * 1024;
+        const char *min_depth;
+        if (ConfGet("stream.reassembly.adaptive-min-depth", &min_depth) == 1 &&
+                ParseSizeStringU32(min_depth, &stream_config.adaptive_min_depth) < 0) {
+            SCLogError("stream.reassembly.adaptive-min-depth %s is invalid", min_depth);
+            return -1;
+        }
+        if (!quiet)
+            SCLogConfig("stream.reassembly \"adaptive-depth\": from %u%% of memcap, "
+                        "min depth %" PRIu32,
+                    stream_config.adaptive_threshold, stream_config.adaptive_min_depth);
+    } else {
+        stream_config.adaptive_threshold = 0;
+    }
+
+    int inline_batch = 0;
+    (void)ConfGetBool("stream.reassembly.inline-batch.enabled", &inline_batch);
+    stream_config.inline_batch_bytes = 0;
+    if (inline_batch && !StreamTcpInlineMode()) {
+        SCLogWarning("stream.reassembly.inline-batch only applies to inline mode");
+    } else if (inline_batch) {
+        uint32_t bytes = 16 * 1024;
+        const char *bytes_str;
+        if (ConfGet("stream.reassembly.inline-batch.bytes", &bytes_str) == 1 &&
+                (ParseSizeStringU32(bytes_str, &bytes) < 0 || bytes == 0)) {
+            SCLogError("stream.reassembly.inline-batch.bytes %s is invalid", bytes_str);
+            return -1;
+        }
+        intmax_t usecs = 500;
+        if (ConfGetInt("stream.reassembly.inline-batch.timeout", &usecs) == 1 &&
+                (usecs < 1 || usecs > 1000000)) {
+            SCLogError("stream.reassembly.inline-batch.timeout %" PRIdMAX
+                       " is invalid: must be 1-1000000 usec",
+                    usecs);
+            return -1;
+        }
+        intmax_t pkts = 32;
+        if (ConfGetInt("stream.reassembly.inline-batch.max-packets", &pkts) == 1 &&
+                (pkts < 2 || pkts > 1024)) {
+            SCLogError("stream.reassembly.inline-batch.max-packets %" PRIdMAX
+                       " is invalid: must be 2-1024",
+                    pkts);
+            return -1;
+        }
+        stream_config.inline_batch_bytes = bytes;
+        stream_config.inline_batch_usecs = (uint32_t)usecs;
+        stream_config.inline_batch_pkts = (uint16_t)pkts;
+        if (!quiet)
+            SCLogConfig("stream.reassembly \"inline-batch\": %" PRIu32 " bytes, %" PRIu32
+                        " usec, %u packets",
+                    stream_config.inline_batch_bytes, stream_config.inline_batch_usecs,
+                    stream_config.inline_batch_pkts);
+    }
+    /* held data is passed to the app-layer with its batch, never from the
+     * packet itself */
+    if (stream_config.zero_copy && stream_config.inline_batch_bytes != 0) {
+        SCLogError("stream.reassembly.zero-copy can't be used together with "
+                   "stream.reassembly.inline-batch");
+        return -1;
+    }
+
     stream_config.prealloc_segments = segment_prealloc;
     stream_config.sbcnf.buf_size = 2048;
     stream_config.sbcnf.max_regions = max_regions;
@@ -520,6 +789,7 @@ static int StreamTcpReassemblyConfig(bool quiet)
     stream_config.sbcnf.Calloc = ReassembleCalloc;
     stream_config.sbcnf.Realloc = StreamTcpReassembleRealloc;
     stream_config.sbcnf.Free = ReassembleFree;
+    stream_config.sbcnf.grow_geometric = true;
 
     return 0;
 }
@@ -532,11 +802,24 @@ int StreamTcpReassembleInit(bool quiet)
     if (StreamTcpReassemblyConfig(quiet) < 0)
         return -1;
 
+    segment_arena = SCArenaCreate("tcp-segment", sizeof(TcpSegment));
+
 #ifdef DEBUG
     SCMutexInit(&segment_pool_memuse_mutex, NULL);
 #endif
     StatsRegisterGlobalCounter("tcp.reassembly_memuse",
             StreamTcpReassembleMemuseGlobalCounter);
+    StreamTcpReassembleRegisterBufferStats();
+    if (stream_config.adaptive_threshold) {
+        SC_ATOMIC_INIT(ra_depth_reduced);
+        SC_ATOMIC_INIT(ra_trimmed);
+        StatsRegisterGlobalCounter(
+                "tcp.reassembly_pressure", StreamTcpReassemblePressureCounter);
+        StatsRegisterGlobalCounter(
+                "tcp.reassembly_depth_reduced", StreamTcpReassembleDepthReducedCounter);
+        StatsRegisterGlobalCounter("tcp.reassembly_trimmed", StreamTcpReassembleTrimmedCounter);
+    }
+    StreamTcpThreadCacheRegisterCounters();
     return 0;
 }
 
@@ -575,7 +858,7 @@ TcpReassemblyThreadCtx *StreamTcpReassembleInitThreadCtx(ThreadVars *tv)
                 sizeof(TcpSegment),
                 TcpSegmentPoolAlloc,
                 TcpSegmentPoolInit, NULL,
-                TcpSegmentPoolCleanup, NULL);
+                TcpSegmentPoolCleanup, TcpSegmentPoolFree);
         ra_ctx->segment_thread_pool_id = 0;
         SCLogDebug("pool size %d, thread segment_thread_pool_id %d",
                 PoolThreadSize(segment_thread_pool),
@@ -655,6 +938,9 @@ static uint32_t StreamTcpReassembleCheckDepth(TcpSession *ssn, TcpStream *stream
     if (ssn->reassembly_depth == 0) {
         SCReturnUInt(size);
     }
+    const uint32_t depth = stream_config.adaptive_threshold
+                                   ? StreamTcpReassembleAdaptiveDepth(ssn->reassembly_depth)
+                                   : ssn->reassembly_depth;
 
     /* if the final flag is set, we're not accepting anymore */
     if (stream->flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED) {
@@ -680,30 +966,34 @@ static uint32_t StreamTcpReassembleCheckDepth(TcpSession *ssn, TcpStream *stream
      * wraps as well */
     SCLogDebug("seq + size %u, base %u, seg_depth %"PRIu64" limit %u", (seq + size),
             stream->base_seq, seg_depth,
-            ssn->reassembly_depth);
+            depth);
 
-    if (seg_depth > (uint64_t)ssn->reassembly_depth) {
+    if (seg_depth > (uint64_t)depth) {
         SCLogDebug("STREAMTCP_STREAM_FLAG_DEPTH_REACHED");
         stream->flags |= STREAMTCP_STREAM_FLAG_DEPTH_REACHED;
+        if (depth < ssn->reassembly_depth)
+            (void)SC_ATOMIC_ADD(ra_depth_reduced, 1);
         SCReturnUInt(0);
     }
     SCLogDebug("NOT STREAMTCP_STREAM_FLAG_DEPTH_REACHED");
-    SCLogDebug("%"PRIu64" <= %u", seg_depth, ssn->reassembly_depth);
+    SCLogDebug("%"PRIu64" <= %u", seg_depth, depth);
 #if 0
     SCLogDebug("full depth not yet reached: %"PRIu64" <= %"PRIu32,
             (stream->base_seq_offset + stream->base_seq + size),
-            (stream->isn + ssn->reassembly_depth));
+            (stream->isn + depth));
 #endif
-    if (SEQ_GEQ(seq, stream->isn) && SEQ_LT(seq, (stream->isn + ssn->reassembly_depth))) {
+    if (SEQ_GEQ(seq, stream->isn) && SEQ_LT(seq, (stream->isn + depth))) {
         /* packet (partly?) fits the depth window */
 
-        if (SEQ_LEQ((seq + size),(stream->isn + 1 + ssn->reassembly_depth))) {
+        if (SEQ_LEQ((seq + size),(stream->isn + 1 + depth))) {
             /* complete fit */
             SCReturnUInt(size);
         } else {
             stream->flags |= STREAMTCP_STREAM_FLAG_DEPTH_REACHED;
+            if (depth < ssn->reassembly_depth)
+                (void)SC_ATOMIC_ADD(ra_depth_reduced, 1);
             /* partial fit, return only what fits */
-            uint32_t part = (stream->isn + 1 + ssn->reassembly_depth) - seq;
+            uint32_t part = (stream->isn + 1 + depth) - seq;
             DEBUG_VALIDATE_BUG_ON(part > size);
             if (part > size)
                 part = size;
@@ -738,6 +1028,9 @@ uint32_t StreamDataAvailableForProtoDetect(TcpStream *stream)
  *  or it wasn't added because of reassembly depth.
  *
  */
+static bool ReassembleZeroCopyAppLayer(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
+        TcpSession *ssn, TcpStream *stream, Packet *p, const uint32_t size);
+
 int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
                                 TcpSession *ssn, TcpStream *stream, Packet *p)
 {
@@ -782,6 +1075,15 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
     if (size > p->payload_len)
         size = p->payload_len;
 
+    /* held packets are passed to the app-layer with their batch. Zero-copy
+     * and inline-batch are rejected together at config time. */
+    DEBUG_VALIDATE_BUG_ON(stream_config.zero_copy && (p->flags & PKT_STREAM_HELD));
+    if (stream_config.zero_copy && !(p->flags & PKT_STREAM_HELD) &&
+            ReassembleZeroCopyAppLayer(tv, ra_ctx, ssn, stream, p, size)) {
+        SCLogDebug("ssn %p: %u bytes consumed by app-layer from the packet", ssn, size);
+        SCReturnInt(0);
+    }
+
     TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx);
     if (seg == NULL) {
         SCLogDebug("segment_pool is empty");
@@ -850,6 +1152,77 @@ static uint8_t StreamGetAppLayerFlags(TcpSession *ssn, TcpStream *stream,
     return flag;
 }
 
+/** \internal
+ *  \brief update the app-layer directly from the packet payload
+ *
+ *  In inline mode the app-layer is updated with the data of the current
+ *  packet. If all earlier data has been consumed and this packet continues
+ *  exactly where the app-layer is, the payload is passed to the parser
+ *  without copying it into the streaming buffer first. Only if the parser
+ *  consumes all of it the copy is skipped completely: the streaming buffer
+ *  then slides past the data. Raw reassembly, streaming loggers and frames
+ *  all need the data in the buffer, so with any of those active the regular
+ *  path is used.
+ *
+ *  If the parser was called, ra_ctx::app_zero_copy_done is set so that
+ *  the packet is not passed to the app-layer a second time. Whatever the
+ *  parser didn't consume is added to the stream and passed on with the
+ *  next data.
+ *
+ *  \retval true data consumed, no segment needs to be added
+ *  \retval false data needs to be added to the stream. The app-layer
+ *                progress may already have been updated for part of it.
+ */
+static bool ReassembleZeroCopyAppLayer(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
+        TcpSession *ssn, TcpStream *stream, Packet *p, const uint32_t size)
+{
+    if (!StreamTcpInlineMode() || stream_config.streaming_log_api || IsTcpSessionDumpingEnabled())
+        return false;
+    if (ssn->state != TCP_ESTABLISHED || (p->flags & PKT_PSEUDO_STREAM_END) ||
+            (p->tcph->th_flags & (TH_SYN | TH_FIN | TH_RST)))
+        return false;
+    if ((ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED) ||
+            (stream->flags & (STREAMTCP_STREAM_FLAG_DEPTH_REACHED |
+                                     STREAMTCP_STREAM_FLAG_NOREASSEMBLY)) ||
+            !(stream->flags & STREAMTCP_STREAM_FLAG_DISABLE_RAW) ||
+            !(stream->flags & STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_COMPLETED))
+        return false;
+    /* all earlier data must be consumed and pruned, and the packet needs
+     * to start at the app-layer progress */
+    if (size != p->payload_len || stream->data_required > 0 || stream->app_progress_rel != 0 ||
+            TCP_GET_SEQ(p) != stream->base_seq || !RB_EMPTY(&stream->seg_tree) ||
+            !RB_EMPTY(&stream->sb.sbb_tree) || stream->sb.region.next != NULL ||
+            stream->sb.region.buf_offset != 0)
+        return false;
+    if (AppLayerFramesGetContainer(p->flow) != NULL || FlowChangeProto(p->flow))
+        return false;
+
+    TcpStream *app_stream = stream;
+    (void)AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, &app_stream, p->payload, size,
+            StreamGetAppLayerFlags(ssn, stream, p), UPDATE_DIR_PACKET);
+    AppLayerProfilingStore(ra_ctx->app_tctx, p);
+    AppLayerFrameDump(p->flow);
+    ra_ctx->app_zero_copy_done = true;
+
+    /* partial consumption, or the parser started frames: keep the data */
+    if (app_stream != stream || stream->app_progress_rel != size ||
+            AppLayerFramesGetContainer(p->flow) != NULL) {
+        StatsIncr(tv, ra_ctx->counter_tcp_reass_zero_copy_fallback);
+        return false;
+    }
+
+    StreamingBufferSlideToOffset(
+            &stream->sb, &stream_config.sbcnf, STREAM_BASE_OFFSET(stream) + size);
+    stream->base_seq += size;
+    stream->segs_right_edge = stream->base_seq;
+    stream->app_progress_rel = 0;
+    stream->raw_progress_rel = 0;
+    stream->log_progress_rel = 0;
+
+    StatsIncr(tv, ra_ctx->counter_tcp_reass_zero_copy);
+    return true;
+}
+
 /**
  *  \brief Check the minimum size limits for reassembly.
  *
@@ -1605,6 +1978,19 @@ static int StreamReassembleRawInline(TcpSession *ssn, const Packet *p,
     SCLogDebug("packet_leftedge_abs %"PRIu64", rightedge %"PRIu64,
             packet_leftedge_abs, packet_rightedge_abs);
 
+    /* data of packets held in a batch with this packet is inspected
+     * through the window of this packet */
+    const TcpInlineBatch *b = ssn->inline_batch;
+    if (b != NULL && b->dir == (PKT_IS_TOSERVER(p) ? STREAM_TOSERVER : STREAM_TOCLIENT) &&
+            b->left_edge < packet_leftedge_abs) {
+        const uint64_t batch_size = packet_rightedge_abs - b->left_edge;
+        if (batch_size + (chunk_size / 3) > chunk_size) {
+            chunk_size = (uint32_t)batch_size + (chunk_size / 3);
+            SCLogDebug("batch of %" PRIu64 " bytes, so chunk_size adjusted to %u", batch_size,
+                    chunk_size);
+        }
+    }
+
     const uint8_t *mydata = NULL;
     uint32_t mydata_len = 0;
     uint64_t mydata_offset = 0;
@@ -1960,6 +2346,8 @@ int StreamTcpReassembleHandleSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
     SCLogDebug("ssn %p, stream %p, p %p, p->payload_len %"PRIu16"",
                 ssn, stream, p, p->payload_len);
 
+    ra_ctx->app_zero_copy_done = false;
+
     /* default IDS: update opposing side (triggered by ACK) */
     enum StreamUpdateDir dir = UPDATE_DIR_OPPOSING;
     /* inline and stream end and flow timeout packets trigger same dir handling */
@@ -2011,16 +2399,43 @@ int StreamTcpReassembleHandleSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
             (p->tcph->th_flags & TH_RST) == 0) {
         SCLogDebug("calling StreamTcpReassembleHandleSegmentHandleData");
 
+        /* in order data may be held to be inspected with later packets */
+        if (StreamTcpInlineBatchCanHold(ra_ctx, ssn, stream, p))
+            p->flags |= PKT_STREAM_HELD;
+
         if (StreamTcpReassembleHandleSegmentHandleData(tv, ra_ctx, ssn, stream, p) != 0) {
             SCLogDebug("StreamTcpReassembleHandleSegmentHandleData error");
+            p->flags &= ~PKT_STREAM_HELD;
             /* failure can only be because of memcap hit, so see if this should lead to a drop */
             ExceptionPolicyApply(
                     p, stream_config.reassembly_memcap_policy, PKT_DROP_REASON_STREAM_REASSEMBLY);
             SCReturnInt(-1);
         }
 
+        /* the cache keeps its own totals, copy them once per second */
+        if ((uint32_t)SCTIME_SECS(p->ts) != ra_ctx->buffer_cache_stats_ts) {
+            ra_ctx->buffer_cache_stats_ts = (uint32_t)SCTIME_SECS(p->ts);
+            uint64_t buf_hits, buf_misses;
+            StreamTcpThreadCacheGetBufferStats(&buf_hits, &buf_misses);
+            StatsSetUI64(tv, ra_ctx->counter_tcp_reass_buffer_from_cache, buf_hits);
+            StatsSetUI64(tv, ra_ctx->counter_tcp_reass_buffer_alloc, buf_misses);
+        }
+
         SCLogDebug("packet %"PRIu64" set PKT_STREAM_ADD", p->pcap_cnt);
         p->flags |= PKT_STREAM_ADD;
+
+        if (p->flags & PKT_STREAM_HELD) {
+            if (!(stream->flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED))
+                StreamTcpInlineBatchAdd(ra_ctx, ssn, stream, p);
+            else
+                p->flags &= ~PKT_STREAM_HELD;
+            if (p->flags & PKT_STREAM_HELD) {
+                /* app-layer is updated when the batch is inspected */
+                SCLogDebug("packet %" PRIu64 " held", p->pcap_cnt);
+                StatsIncr(tv, ra_ctx->counter_tcp_inline_batch_held);
+                SCReturnInt(0);
+            }
+        }
     } else {
         SCLogDebug("ssn %p / stream %p: not calling StreamTcpReassembleHandleSegmentHandleData:"
                    " p->payload_len %u, STREAMTCP_STREAM_FLAG_NOREASSEMBLY %s",
@@ -2047,7 +2462,11 @@ int StreamTcpReassembleHandleSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
 
     /* in stream inline mode even if we have no data we call the reassembly
      * functions to handle EOF */
-    if (dir == UPDATE_DIR_PACKET || dir == UPDATE_DIR_BOTH) {
+    if (ra_ctx->app_zero_copy_done) {
+        /* app-layer already had this packet's data, the rest is used with
+         * the next packet */
+        SCLogDebug("app-layer updated from the packet (zero-copy)");
+    } else if (dir == UPDATE_DIR_PACKET || dir == UPDATE_DIR_BOTH) {
         SCLogDebug("inline (%s) or PKT_PSEUDO_STREAM_END (%s)",
                 StreamTcpInlineMode()?"true":"false",
                 (p->flags & PKT_PSEUDO_STREAM_END) ?"true":"false");
@@ -2073,8 +2492,20 @@ TcpSegment *StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx)
         return seg;
     }
 
-    seg = (TcpSegment *)PoolThreadGetById(
-            segment_thread_pool, (uint16_t)ra_ctx->segment_thread_pool_id);
+    if (StreamTcpThreadCacheIsEnabled()) {
+        /* refill the empty thread cache so that the next segments don't
+         * each have to take the pool lock */
+        TcpSegment *segs[SEGMENT_CACHE_REFILL];
+        uint32_t cnt = PoolThreadGetBatchById(segment_thread_pool,
+                (uint16_t)ra_ctx->segment_thread_pool_id, (void **)segs, SEGMENT_CACHE_REFILL);
+        if (cnt > 0) {
+            StreamTcpThreadCacheFillSegments(&segs[1], cnt - 1);
+            seg = segs[0];
+        }
+    } else {
+        seg = (TcpSegment *)PoolThreadGetById(
+                segment_thread_pool, (uint16_t)ra_ctx->segment_thread_pool_id);
+    }
     SCLogDebug("seg we return is %p", seg);
     if (seg == NULL) {
         /* Increment the counter to show that we are not able to serve the
@@ -3298,6 +3729,114 @@ static int StreamTcpReassembleTest47 (void)
     PASS;
 }
 
+/**
+ *  \test   Test that the reassembly depth is lowered under memory pressure.
+ */
+static int StreamTcpReassembleTest48(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    TcpSession ssn;
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    uint8_t payload[100] = {0};
+    uint16_t payload_size = 100;
+
+    StreamTcpUTInit(&ra_ctx);
+    stream_config.reassembly_depth = 1000;
+    stream_config.adaptive_threshold = 50;
+    stream_config.adaptive_min_depth = 100;
+    SC_ATOMIC_INIT(ra_depth_reduced);
+
+    /* 95% of memcap: pressure 90, depth 1000 - 900 * 0.9 = 190 */
+    const uint64_t memcap = SC_ATOMIC_GET(stream_config.reassembly_memcap);
+    const uint64_t extra = memcap / 100 * 95 - SC_ATOMIC_GET(ra_memuse);
+    StreamTcpReassembleIncrMemuse(extra);
+    FAIL_IF_NOT(StreamTcpReassembleMemPressure() == 90);
+
+    StreamTcpUTSetupSession(&ssn);
+    ssn.reassembly_depth = 1000;
+    StreamTcpUTSetupStream(&ssn.server, 100);
+    StreamTcpUTSetupStream(&ssn.client, 100);
+
+    int r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 101, payload, payload_size);
+    FAIL_IF(r != 0);
+    FAIL_IF(ssn.client.flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED);
+
+    r = StreamTcpUTAddPayload(&tv, ra_ctx, &ssn, &ssn.client, 201, payload, payload_size);
+    FAIL_IF(r != 0);
+    FAIL_IF(!(ssn.client.flags & STREAMTCP_STREAM_FLAG_DEPTH_REACHED));
+    FAIL_IF_NOT(SC_ATOMIC_GET(ra_depth_reduced) == 1);
+
+    StreamTcpReassembleDecrMemuse(extra);
+    FAIL_IF_NOT(StreamTcpReassembleMemPressure() == 0);
+    stream_config.adaptive_threshold = 0;
+
+    StreamTcpUTClearStream(&ssn.server);
+    StreamTcpUTClearStream(&ssn.client);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
+/** \test trimming under memory pressure is only counted if it releases
+ *        data that would otherwise have been kept */
+static int StreamTcpReassembleTest49(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    TcpSession ssn;
+    ThreadVars tv;
+    Flow f;
+    memset(&tv, 0, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTInitInline();
+    stream_config.reassembly_toserver_chunk_size = 15;
+    stream_config.adaptive_threshold = 50;
+    stream_config.adaptive_min_depth = 100;
+    SC_ATOMIC_INIT(ra_trimmed);
+
+    /* 95% of memcap: pressure 90, trim streams retaining 10 bytes or more */
+    const uint64_t memcap = SC_ATOMIC_GET(stream_config.reassembly_memcap);
+    const uint64_t extra = memcap / 100 * 95 - SC_ATOMIC_GET(ra_memuse);
+    StreamTcpReassembleIncrMemuse(extra);
+    FAIL_IF_NOT(StreamTcpReassembleMemPressure() == 90);
+
+    StreamTcpUTSetupSession(&ssn);
+    ssn.flags |= STREAMTCP_FLAG_APP_LAYER_DISABLED;
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    ssn.client.flags |= STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_COMPLETED;
+    FLOW_INITIALIZE(&f);
+    f.protoctx = &ssn;
+
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client, 2, 'A', 10) == -1);
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client, 12, 'B', 10) == -1);
+    ssn.client.next_seq = 22;
+    ssn.client.last_ack = 22;
+
+    /* nothing inspected yet: trimming doesn't move the left edge */
+    StreamTcpPruneSession(&f, STREAM_TOSERVER);
+    FAIL_IF_NOT(STREAM_BASE_OFFSET(&ssn.client) == 0);
+    FAIL_IF_NOT(SC_ATOMIC_GET(ra_trimmed) == 0);
+
+    /* all inspected: the chunk overlap is released */
+    ssn.client.raw_progress_rel = 20;
+    StreamTcpPruneSession(&f, STREAM_TOSERVER);
+    FAIL_IF_NOT(STREAM_BASE_OFFSET(&ssn.client) == 20);
+    FAIL_IF_NOT(SC_ATOMIC_GET(ra_trimmed) == 1);
+
+    /* nothing retained anymore */
+    StreamTcpPruneSession(&f, STREAM_TOSERVER);
+    FAIL_IF_NOT(SC_ATOMIC_GET(ra_trimmed) == 1);
+
+    StreamTcpReassembleDecrMemuse(extra);
+    stream_config.adaptive_threshold = 0;
+
+    FLOW_DESTROY(&f);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
 /** \test 3 in order segments in inline reassembly */
 static int StreamTcpReassembleInlineTest01(void)
 {
@@ -3850,6 +4389,203 @@ end:
     return ret;
 }
 
+/** bytes the zero-copy test parser leaves unconsumed, and what it saw */
+static uint32_t zc_test_keep = 0;
+static uint32_t zc_test_calls = 0;
+static uint8_t zc_test_data[16];
+static uint32_t zc_test_data_len = 0;
+
+static AppLayerResult ZeroCopyTestParser(Flow *f, void *state, AppLayerParserState *pstate,
+        StreamSlice stream_slice, void *local_data)
+{
+    const uint32_t len = StreamSliceGetDataLen(&stream_slice);
+    zc_test_calls++;
+    zc_test_data_len = MIN(len, (uint32_t)sizeof(zc_test_data));
+    memcpy(zc_test_data, StreamSliceGetData(&stream_slice), zc_test_data_len);
+    if (zc_test_keep == 0 || zc_test_keep >= len)
+        return APP_LAYER_OK;
+    return APP_LAYER_INCOMPLETE(len - zc_test_keep, len);
+}
+
+static void *ZeroCopyTestStateAlloc(void *orig_state, AppProto proto_orig)
+{
+    return SCCalloc(1, sizeof(uint64_t));
+}
+
+static void ZeroCopyTestStateFree(void *s)
+{
+    SCFree(s);
+}
+
+static uint64_t ZeroCopyTestGetTxCnt(void *state)
+{
+    return 0;
+}
+
+static void *ZeroCopyTestGetTx(void *state, uint64_t tx_id)
+{
+    return NULL;
+}
+
+static void ZeroCopyTestTxFree(void *state, uint64_t tx_id)
+{
+}
+
+/** \internal
+ *  \brief set up an established inline session with the test parser for
+ *         the zero-copy tests */
+static Flow *ZeroCopyTestSetup(TcpSession *ssn)
+{
+    AppLayerParserBackupParserTable();
+    AppLayerParserRegisterParser(IPPROTO_TCP, ALPROTO_TEST, STREAM_TOSERVER, ZeroCopyTestParser);
+    AppLayerParserRegisterStateFuncs(
+            IPPROTO_TCP, ALPROTO_TEST, ZeroCopyTestStateAlloc, ZeroCopyTestStateFree);
+    AppLayerParserRegisterTxFreeFunc(IPPROTO_TCP, ALPROTO_TEST, ZeroCopyTestTxFree);
+    AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_TEST, ZeroCopyTestGetTx);
+    AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_TEST, ZeroCopyTestGetTxCnt);
+
+    StreamTcpUTInitInline();
+    stream_config.zero_copy = true;
+    StreamTcpUTSetupSession(ssn);
+    StreamTcpUTSetupStream(&ssn->client, 1);
+    StreamTcpUTSetupStream(&ssn->server, 1);
+    ssn->state = TCP_ESTABLISHED;
+    ssn->data_first_seen_dir = STREAM_TOSERVER;
+    ssn->client.flags |= STREAMTCP_STREAM_FLAG_DISABLE_RAW |
+                         STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_COMPLETED;
+
+    zc_test_keep = 0;
+    zc_test_calls = 0;
+    zc_test_data_len = 0;
+
+    Flow *f = UTHBuildFlow(AF_INET, "1.1.1.1", "2.2.2.2", 1024, 80);
+    if (f == NULL)
+        return NULL;
+    f->protoctx = ssn;
+    f->proto = IPPROTO_TCP;
+    f->protomap = FlowGetProtoMapping(IPPROTO_TCP);
+    f->alproto = f->alproto_ts = f->alproto_tc = ALPROTO_TEST;
+    return f;
+}
+
+static Packet *ZeroCopyTestPacket(Flow *f, uint8_t *payload, uint16_t len, uint32_t seq)
+{
+    Packet *p = UTHBuildPacketReal(payload, len, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    if (p == NULL)
+        return NULL;
+    p->tcph->th_seq = htonl(seq);
+    p->tcph->th_flags = TH_ACK | TH_PUSH;
+    p->flow = f;
+    p->flowflags = FLOW_PKT_TOSERVER;
+    return p;
+}
+
+/** \test zero-copy: data fully consumed by the parser is not added to the
+ *        stream, the buffer slides past it */
+static int StreamTcpReassembleZeroCopyTest01(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    Flow *f = ZeroCopyTestSetup(&ssn);
+    FAIL_IF_NULL(f);
+
+    uint8_t payload[] = "ABCDEFGH";
+    Packet *p = ZeroCopyTestPacket(f, payload, 8, 2);
+    FAIL_IF_NULL(p);
+
+    FAIL_IF(StreamTcpReassembleHandleSegment(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    FAIL_IF_NOT(ra_ctx->app_zero_copy_done);
+    /* parser saw the packet exactly once */
+    FAIL_IF_NOT(zc_test_calls == 1);
+    FAIL_IF_NOT(zc_test_data_len == 8);
+    FAIL_IF(memcmp(zc_test_data, "ABCDEFGH", 8) != 0);
+    /* nothing stored, stream moved past the data */
+    FAIL_IF_NOT(RB_EMPTY(&ssn.client.seg_tree));
+    FAIL_IF_NOT(ssn.client.base_seq == 10);
+    FAIL_IF_NOT(ssn.client.app_progress_rel == 0);
+    FAIL_IF_NOT(STREAM_BASE_OFFSET(&ssn.client) == 8);
+    FAIL_IF_NOT(STREAM_APP_PROGRESS(&ssn.client) == 8);
+
+    /* next in order packet is handled the same way */
+    uint8_t payload2[] = "IJKL";
+    Packet *p2 = ZeroCopyTestPacket(f, payload2, 4, 10);
+    FAIL_IF_NULL(p2);
+    FAIL_IF(StreamTcpReassembleHandleSegment(&tv, ra_ctx, &ssn, &ssn.client, p2) != 0);
+    FAIL_IF_NOT(zc_test_calls == 2);
+    FAIL_IF_NOT(zc_test_data_len == 4);
+    FAIL_IF(memcmp(zc_test_data, "IJKL", 4) != 0);
+    FAIL_IF_NOT(RB_EMPTY(&ssn.client.seg_tree));
+    FAIL_IF_NOT(STREAM_APP_PROGRESS(&ssn.client) == 12);
+
+    UTHFreePacket(p);
+    UTHFreePacket(p2);
+    StreamTcpUTClearSession(&ssn);
+    UTHFreeFlow(f);
+    AppLayerParserRestoreParserTable();
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
+/** \test zero-copy: data the parser doesn't consume is stored in the stream
+ *        and passed to the parser once, with the next packet */
+static int StreamTcpReassembleZeroCopyTest02(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    Flow *f = ZeroCopyTestSetup(&ssn);
+    FAIL_IF_NULL(f);
+
+    /* consume 4 of 8, ask for 8 from there */
+    zc_test_keep = 4;
+    uint8_t payload[] = "ABCDEFGH";
+    Packet *p = ZeroCopyTestPacket(f, payload, 8, 2);
+    FAIL_IF_NULL(p);
+
+    FAIL_IF(StreamTcpReassembleHandleSegment(&tv, ra_ctx, &ssn, &ssn.client, p) != 0);
+    FAIL_IF_NOT(ra_ctx->app_zero_copy_done);
+    /* the remainder isn't passed again for the same packet */
+    FAIL_IF_NOT(zc_test_calls == 1);
+    FAIL_IF_NOT(zc_test_data_len == 8);
+    FAIL_IF(RB_EMPTY(&ssn.client.seg_tree));
+    FAIL_IF_NOT(ssn.client.base_seq == 2);
+    FAIL_IF_NOT(STREAM_APP_PROGRESS(&ssn.client) == 4);
+    FAIL_IF_NOT(ssn.client.data_required == 8);
+
+    /* unconsumed data is served from the streaming buffer */
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    StreamingBufferGetDataAtOffset(&ssn.client.sb, &data, &data_len, 4);
+    FAIL_IF_NOT(data_len == 4);
+    FAIL_IF(memcmp(data, "EFGH", 4) != 0);
+
+    zc_test_keep = 0;
+    uint8_t payload2[] = "IJKL";
+    Packet *p2 = ZeroCopyTestPacket(f, payload2, 4, 10);
+    FAIL_IF_NULL(p2);
+    FAIL_IF(StreamTcpReassembleHandleSegment(&tv, ra_ctx, &ssn, &ssn.client, p2) != 0);
+    FAIL_IF(ra_ctx->app_zero_copy_done);
+    FAIL_IF_NOT(zc_test_calls == 2);
+    FAIL_IF_NOT(zc_test_data_len == 8);
+    FAIL_IF(memcmp(zc_test_data, "EFGHIJKL", 8) != 0);
+    FAIL_IF_NOT(STREAM_APP_PROGRESS(&ssn.client) == 12);
+
+    UTHFreePacket(p);
+    UTHFreePacket(p2);
+    StreamTcpUTClearSession(&ssn);
+    UTHFreeFlow(f);
+    AppLayerParserRestoreParserTable();
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
 #include "tests/stream-tcp-reassemble.c"
 #endif /* UNITTESTS */
 
@@ -3886,6 +4622,9 @@ void StreamTcpReassembleRegisterTests(void)
                    StreamTcpReassembleTest46);
     UtRegisterTest("StreamTcpReassembleTest47 -- TCP Sequence Wraparound Test",
                    StreamTcpReassembleTest47);
+    UtRegisterTest("StreamTcpReassembleTest48 -- Adaptive Depth Test",
+            StreamTcpReassembleTest48);
+    UtRegisterTest("StreamTcpReassembleTest49 -- Adaptive Trim Test", StreamTcpReassembleTest49);
 
     UtRegisterTest("StreamTcpReassembleInlineTest01 -- inline RAW ra",
                    StreamTcpReassembleInlineTest01);
@@ -3903,6 +4642,11 @@ void StreamTcpReassembleRegisterTests(void)
     UtRegisterTest("StreamTcpReassembleInlineTest10 -- inline APP ra 10",
                    StreamTcpReassembleInlineTest10);
 
+    UtRegisterTest("StreamTcpReassembleZeroCopyTest01 -- zero-copy full",
+            StreamTcpReassembleZeroCopyTest01);
+    UtRegisterTest("StreamTcpReassembleZeroCopyTest02 -- zero-copy partial",
+            StreamTcpReassembleZeroCopyTest02);
+
     UtRegisterTest("StreamTcpReassembleInsertTest01 -- insert with overlap",
                    StreamTcpReassembleInsertTest01);
     UtRegisterTest("StreamTcpReassembleInsertTest02 -- insert with overlap",
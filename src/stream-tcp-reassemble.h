@@ -67,6 +67,26 @@ typedef struct TcpReassemblyThreadCtx_ {
 
     uint16_t counter_tcp_segment_from_cache;
     uint16_t counter_tcp_segment_from_pool;
+    /** streaming buffer memory served from / missed by the thread cache */
+    uint16_t counter_tcp_reass_buffer_from_cache;
+    uint16_t counter_tcp_reass_buffer_alloc;
+    /** packet time (secs) the buffer cache counters were last updated */
+    uint32_t buffer_cache_stats_ts;
+    /** segments consumed by the app-layer without copy, and the ones that
+     *  still had to be copied after passing them to the app-layer */
+    uint16_t counter_tcp_reass_zero_copy;
+    uint16_t counter_tcp_reass_zero_copy_fallback;
+    /** set if the app-layer was updated from the current packet by
+     *  zero-copy, so it's not updated from the stream for it again */
+    bool app_zero_copy_done;
+
+    /** per thread table of flows with held packets, see
+     *  stream.reassembly.inline-batch. NULL if not used by the thread. */
+    struct TcpInlineBatchTable_ *inline_batch;
+    /** packets held, batches inspected and batches inspected on timeout */
+    uint16_t counter_tcp_inline_batch_held;
+    uint16_t counter_tcp_inline_batch_flushes;
+    uint16_t counter_tcp_inline_batch_timeouts;
 
     /** number of streams that stop reassembly because their depth is reached */
     uint16_t counter_tcp_stream_depth;
@@ -124,6 +144,10 @@ int StreamTcpReassembleSetMemcap(uint64_t size);
 uint64_t StreamTcpReassembleGetMemcap(void);
 int StreamTcpReassembleCheckMemcap(uint64_t size);
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void);
+uint32_t StreamTcpReassembleMemPressure(void);
+bool StreamTcpReassembleTrimRetained(const TcpStream *stream);
+void StreamTcpReassembleCountTrimmed(void);
+void StreamTcpReassembleRecordBufferStats(const StreamingBuffer *sb);
 
 void StreamTcpDisableAppLayer(Flow *f);
 int StreamTcpAppLayerIsDisabled(Flow *f);
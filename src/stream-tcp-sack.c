@@ -28,9 +28,14 @@
 #include "stream-tcp-private.h"
 #include "stream-tcp-sack.h"
 #include "util-unittest.h"
+#include "util-validate.h"
 
 RB_GENERATE(TCPSACK, StreamTcpSackRecord, rb, TcpSackCompare);
 
+/** max ranges to keep in TcpStream::sack_inline. Variable so the
+ *  benchmark can compare against the tree. */
+static uint8_t g_sack_inline_max = STREAM_SACK_INLINE_MAX;
+
 int TcpSackCompare(struct StreamTcpSackRecord *a, struct StreamTcpSackRecord *b)
 {
     if (SEQ_GT(a->le, b->le))
@@ -50,6 +55,9 @@ int TcpSackCompare(struct StreamTcpSackRecord *a, struct StreamTcpSackRecord *b)
 static void StreamTcpSackPrintList(TcpStream *stream)
 {
     SCLogDebug("size %u", stream->sack_size);
+    for (uint8_t i = 0; i < stream->sack_inline_cnt; i++) {
+        SCLogDebug("- inline %8u - %8u", stream->sack_inline[i].le, stream->sack_inline[i].re);
+    }
     StreamTcpSackRecord *rec = NULL;
     RB_FOREACH(rec, TCPSACK, &stream->sack_tree) {
         SCLogDebug("- record %8u - %8u", rec->le, rec->re);
@@ -204,6 +212,84 @@ static int Insert(TcpStream *stream, struct TCPSACK *tree, uint32_t le, uint32_t
     return 0;
 }
 
+/**
+ *  \internal
+ *  \brief insert a SACK range into the inline scoreboard
+ *
+ *  The ranges are kept sorted. Ranges overlapping or touching the new
+ *  range are merged into it, like in the tree.
+ *
+ *  \retval 0 ok
+ *  \retval 1 no space left, range not added
+ */
+static int InlineInsert(TcpStream *stream, uint32_t le, uint32_t re)
+{
+    StreamTcpSackRange *r = stream->sack_inline;
+    const uint8_t cnt = stream->sack_inline_cnt;
+
+    /* skip ranges entirely before the new one */
+    uint8_t i = 0;
+    while (i < cnt && SEQ_LT(r[i].re, le))
+        i++;
+
+    /* ranges [i, j) overlap or touch the new range */
+    uint8_t j = i;
+    uint32_t merged_size = 0;
+    while (j < cnt && SEQ_LEQ(r[j].le, re)) {
+        if (SEQ_LT(r[j].le, le))
+            le = r[j].le;
+        if (SEQ_GT(r[j].re, re))
+            re = r[j].re;
+        merged_size += (r[j].re - r[j].le);
+        j++;
+    }
+    if (i == j && cnt >= g_sack_inline_max)
+        return 1;
+
+    /* replace [i, j) with the new range */
+    if (j != i + 1)
+        memmove(&r[i + 1], &r[j], (cnt - j) * sizeof(*r));
+    r[i].le = le;
+    r[i].re = re;
+    stream->sack_inline_cnt = cnt - (j - i) + 1;
+    stream->sack_size = stream->sack_size - merged_size + (re - le);
+    return 0;
+}
+
+static void StreamTcpSackFreeTree(TcpStream *stream)
+{
+    StreamTcpSackRecord *rec = NULL, *safe = NULL;
+    RB_FOREACH_SAFE(rec, TCPSACK, &stream->sack_tree, safe) {
+        stream->sack_size -= (rec->re - rec->le);
+        TCPSACK_RB_REMOVE(&stream->sack_tree, rec);
+        StreamTcpSackRecordFree(rec);
+    }
+}
+
+/**
+ *  \internal
+ *  \brief move the inline ranges to the tree
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, inline ranges are unchanged
+ */
+static int InlineToTree(TcpStream *stream)
+{
+    const uint32_t size = stream->sack_size;
+    stream->sack_size = 0;
+    for (uint8_t i = 0; i < stream->sack_inline_cnt; i++) {
+        if (Insert(stream, &stream->sack_tree, stream->sack_inline[i].le,
+                    stream->sack_inline[i].re) < 0) {
+            StreamTcpSackFreeTree(stream);
+            stream->sack_size = size;
+            return -1;
+        }
+    }
+    DEBUG_VALIDATE_BUG_ON(stream->sack_size != size);
+    stream->sack_inline_cnt = 0;
+    return 0;
+}
+
 /**
  *  \brief insert a SACK range
  *
@@ -231,6 +317,14 @@ static int StreamTcpSackInsertRange(TcpStream *stream, uint32_t le, uint32_t re)
         SCReturnInt(0);
     }
 
+    /* use the inline ranges until they are full */
+    if (RB_EMPTY(&stream->sack_tree)) {
+        if (InlineInsert(stream, le, re) == 0)
+            SCReturnInt(0);
+        if (InlineToTree(stream) < 0)
+            SCReturnInt(-1);
+    }
+
     if (Insert(stream, &stream->sack_tree, le, re) < 0)
         SCReturnInt(-1);
 
@@ -367,6 +461,20 @@ bool StreamTcpSackPacketIsOutdated(TcpStream *stream, Packet *p)
             SCLogDebug("%p last_ack %u, left edge %u, right edge %u", sack_rec, stream->last_ack,
                     le, re);
 
+            if (RB_EMPTY(&stream->sack_tree)) {
+                for (uint8_t i = 0; i < stream->sack_inline_cnt; i++) {
+                    const StreamTcpSackRange *r = &stream->sack_inline[i];
+                    if (le >= r->le && re <= r->re) {
+                        SCLogDebug("SACK rec le:%u re:%u eclipsed by inline le:%u re:%u", le,
+                                re, r->le, r->re);
+                        sack_outdated++;
+                        break;
+                    }
+                }
+                sack_rec++;
+                continue;
+            }
+
             struct StreamTcpSackRecord lookup = { .le = le, .re = re };
             struct StreamTcpSackRecord *res = FindOverlap(&stream->sack_tree, &lookup);
             SCLogDebug("res %p", res);
@@ -398,10 +506,39 @@ bool StreamTcpSackPacketIsOutdated(TcpStream *stream, Packet *p)
     return false;
 }
 
+static void InlinePrune(TcpStream *stream)
+{
+    StreamTcpSackRange *r = stream->sack_inline;
+    uint8_t i = 0;
+    while (i < stream->sack_inline_cnt && SEQ_LT(r[i].re, stream->last_ack)) {
+        SCLogDebug("removing inline le %u re %u", r[i].le, r[i].re);
+        stream->sack_size -= (r[i].re - r[i].le);
+        i++;
+    }
+    if (i > 0) {
+        stream->sack_inline_cnt -= i;
+        memmove(&r[0], &r[i], stream->sack_inline_cnt * sizeof(*r));
+    }
+    if (stream->sack_inline_cnt > 0 && SEQ_LT(r[0].le, stream->last_ack)) {
+        SCLogDebug("adjusting inline record to le %u re %u", r[0].le, r[0].re);
+        /* last ack inside this record, update */
+        stream->sack_size -= (stream->last_ack - r[0].le);
+        r[0].le = stream->last_ack;
+    }
+}
+
 void StreamTcpSackPruneList(TcpStream *stream)
 {
     SCEnter();
 
+    if (RB_EMPTY(&stream->sack_tree)) {
+        InlinePrune(stream);
+#ifdef DEBUG
+        StreamTcpSackPrintList(stream);
+#endif
+        SCReturn;
+    }
+
     StreamTcpSackRecord *rec = NULL, *safe = NULL;
     RB_FOREACH_SAFE(rec, TCPSACK, &stream->sack_tree, safe) {
         if (SEQ_LT(rec->re, stream->last_ack)) {
@@ -437,12 +574,11 @@ void StreamTcpSackFreeList(TcpStream *stream)
 {
     SCEnter();
 
-    StreamTcpSackRecord *rec = NULL, *safe = NULL;
-    RB_FOREACH_SAFE(rec, TCPSACK, &stream->sack_tree, safe) {
-        stream->sack_size -= (rec->re - rec->le);
-        TCPSACK_RB_REMOVE(&stream->sack_tree, rec);
-        StreamTcpSackRecordFree(rec);
+    for (uint8_t i = 0; i < stream->sack_inline_cnt; i++) {
+        stream->sack_size -= (stream->sack_inline[i].re - stream->sack_inline[i].le);
     }
+    stream->sack_inline_cnt = 0;
+    StreamTcpSackFreeTree(stream);
 
     SCReturn;
 }
@@ -450,6 +586,21 @@ void StreamTcpSackFreeList(TcpStream *stream)
 
 #ifdef UNITTESTS
 
+/** \internal
+ *  \brief get the first SACK range from the inline ranges or the tree
+ *  \param tmp storage for the range if it is in the tree */
+static const StreamTcpSackRange *SackFirst(TcpStream *stream, StreamTcpSackRange *tmp)
+{
+    if (stream->sack_inline_cnt > 0)
+        return &stream->sack_inline[0];
+    const StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream->sack_tree);
+    if (rec == NULL)
+        return NULL;
+    tmp->le = rec->le;
+    tmp->re = rec->re;
+    return tmp;
+}
+
 /**
  *  \test   Test the insertion of SACK ranges.
  *
@@ -474,7 +625,9 @@ static int StreamTcpSackTest01 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
 
     FAIL_IF(rec->le != 1);
@@ -503,7 +656,9 @@ static int StreamTcpSackTest02 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
 
     FAIL_IF(rec->le != 1);
@@ -536,7 +691,9 @@ static int StreamTcpSackTest03 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
 
     FAIL_IF(rec->le != 5);
@@ -566,7 +723,9 @@ static int StreamTcpSackTest04 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
 
     FAIL_IF(rec->le != 0);
@@ -596,7 +755,9 @@ static int StreamTcpSackTest05 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
 
     FAIL_IF(rec->le != 0);
@@ -628,7 +789,9 @@ static int StreamTcpSackTest06 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
 
     FAIL_IF(rec->le != 0);
@@ -660,7 +823,9 @@ static int StreamTcpSackTest07 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
     FAIL_IF(rec->le != 0);
     FAIL_IF(rec->re != 40);
@@ -695,7 +860,9 @@ static int StreamTcpSackTest08 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
     FAIL_IF(rec->le != 0);
     FAIL_IF(rec->re != 40);
@@ -731,7 +898,9 @@ static int StreamTcpSackTest09 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
     FAIL_IF(rec->le != 0);
     FAIL_IF(rec->re != 40);
@@ -766,7 +935,9 @@ static int StreamTcpSackTest10 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
     FAIL_IF(rec->le != 100);
     FAIL_IF(rec->re != 140);
@@ -801,7 +972,9 @@ static int StreamTcpSackTest11 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
     FAIL_IF(rec->le != 100);
     FAIL_IF(rec->re != 140);
@@ -836,7 +1009,9 @@ static int StreamTcpSackTest12 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    StreamTcpSackRecord *rec = RB_MIN(TCPSACK, &stream.sack_tree);
+    StreamTcpSackRange first;
+
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
     FAIL_IF_NULL(rec);
     FAIL_IF(rec->le != 100);
     FAIL_IF(rec->re != 1000);
@@ -903,6 +1078,146 @@ static int StreamTcpSackTest14 (void) {
     PASS;
 }
 
+/**
+ *  \test   Test merging of inline ranges.
+ */
+static int StreamTcpSackTest15(void)
+{
+    TcpStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.window = 100;
+
+    StreamTcpSackInsertRange(&stream, 10, 20);
+    StreamTcpSackInsertRange(&stream, 50, 60);
+    StreamTcpSackInsertRange(&stream, 30, 40);
+    FAIL_IF_NOT(stream.sack_inline_cnt == 3);
+    FAIL_IF_NOT(stream.sack_inline[1].le == 30);
+    FAIL_IF_NOT(StreamTcpSackedSize(&stream) == 30);
+
+    StreamTcpSackInsertRange(&stream, 15, 55);
+    FAIL_IF_NOT(stream.sack_inline_cnt == 1);
+    FAIL_IF_NOT(stream.sack_inline[0].le == 10);
+    FAIL_IF_NOT(stream.sack_inline[0].re == 60);
+    FAIL_IF_NOT(StreamTcpSackedSize(&stream) == 50);
+    FAIL_IF_NOT(RB_EMPTY(&stream.sack_tree));
+
+    StreamTcpSackFreeList(&stream);
+    FAIL_IF_NOT(StreamTcpSackedSize(&stream) == 0);
+    PASS;
+}
+
+/**
+ *  \test   Test switching to the tree when the inline ranges are full, and
+ *          back once the tree is pruned.
+ */
+static int StreamTcpSackTest16(void)
+{
+    TcpStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.window = 1000;
+
+    for (int i = 0; i < STREAM_SACK_INLINE_MAX + 2; i++) {
+        StreamTcpSackInsertRange(&stream, 100 + (20 * i), 110 + (20 * i));
+    }
+    FAIL_IF_NOT(stream.sack_inline_cnt == 0);
+    FAIL_IF(RB_EMPTY(&stream.sack_tree));
+    FAIL_IF_NOT(StreamTcpSackedSize(&stream) == (STREAM_SACK_INLINE_MAX + 2) * 10);
+
+    StreamTcpSackRange first;
+    const StreamTcpSackRange *rec = SackFirst(&stream, &first);
+    FAIL_IF_NULL(rec);
+    FAIL_IF(rec->le != 100);
+    FAIL_IF(rec->re != 110);
+
+    stream.last_ack = 1000;
+    StreamTcpSackPruneList(&stream);
+    FAIL_IF_NOT(RB_EMPTY(&stream.sack_tree));
+    FAIL_IF_NOT(StreamTcpSackedSize(&stream) == 0);
+
+    StreamTcpSackInsertRange(&stream, 1100, 1200);
+    FAIL_IF_NOT(stream.sack_inline_cnt == 1);
+    FAIL_IF_NOT(StreamTcpSackedSize(&stream) == 100);
+
+    StreamTcpSackFreeList(&stream);
+    PASS;
+}
+
+#ifdef PROFILING
+#include "util-cpu.h"
+
+#define SACK_BENCH_ROUNDS 10000
+#define SACK_BENCH_FLIGHT 32
+#define SACK_BENCH_MSS    1000
+
+/** \internal
+ *  \brief replay SACKs for flights of SACK_BENCH_FLIGHT segments where
+ *          every 'loss_every'th segment is lost. The receiver SACKs the
+ *          block each segment lands in, then the retransmissions fill
+ *          the holes and the whole flight is ACK'd.
+ *  \param inline_max max inline ranges, 0 to only use the tree
+ *  \retval ticks average ticks per flight */
+static uint64_t SackBench(const uint8_t inline_max, const uint32_t loss_every)
+{
+    TcpStream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.window = SACK_BENCH_FLIGHT * SACK_BENCH_MSS;
+    const uint8_t saved = g_sack_inline_max;
+    g_sack_inline_max = inline_max;
+
+    uint32_t seq = 1;
+    const uint64_t ticks_start = UtilCpuGetTicks();
+    for (uint32_t r = 0; r < SACK_BENCH_ROUNDS; r++) {
+        stream.last_ack = seq;
+        uint32_t block_le = 0;
+        bool in_block = false;
+        /* first segment of the flight is always lost */
+        for (uint32_t i = 1; i < SACK_BENCH_FLIGHT; i++) {
+            const uint32_t le = seq + i * SACK_BENCH_MSS;
+            if (i % loss_every == 0) {
+                in_block = false;
+                continue;
+            }
+            if (!in_block) {
+                block_le = le;
+                in_block = true;
+            }
+            (void)StreamTcpSackInsertRange(&stream, block_le, le + SACK_BENCH_MSS);
+        }
+        seq += (SACK_BENCH_FLIGHT + 1) * SACK_BENCH_MSS;
+        stream.last_ack = seq;
+        StreamTcpSackPruneList(&stream);
+    }
+    const uint64_t ticks = UtilCpuGetTicks() - ticks_start;
+
+    StreamTcpSackFreeList(&stream);
+    g_sack_inline_max = saved;
+    return ticks / SACK_BENCH_ROUNDS;
+}
+#endif
+
+/**
+ *  \test   Compare the inline ranges with the tree on lossy flights.
+ *          Only measures in PROFILING builds.
+ */
+static int StreamTcpSackPerfTest01(void)
+{
+#ifdef PROFILING
+    /* 4 holes per flight: fits inline */
+    const uint64_t inline_light = SackBench(STREAM_SACK_INLINE_MAX, 8);
+    const uint64_t tree_light = SackBench(0, 8);
+    /* 8 holes per flight: inline falls back to the tree */
+    const uint64_t inline_heavy = SackBench(STREAM_SACK_INLINE_MAX, 4);
+    const uint64_t tree_heavy = SackBench(0, 4);
+
+    printf("\n");
+    printf("sack 1/8 loss inline\t%" PRIu64 " ticks/flight\n", inline_light);
+    printf("sack 1/8 loss tree\t%" PRIu64 " ticks/flight\n", tree_light);
+    printf("sack 1/4 loss inline\t%" PRIu64 " ticks/flight\n", inline_heavy);
+    printf("sack 1/4 loss tree\t%" PRIu64 " ticks/flight\n", tree_heavy);
+#endif
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void StreamTcpSackRegisterTests (void)
@@ -926,5 +1241,8 @@ void StreamTcpSackRegisterTests (void)
                    StreamTcpSackTest13);
     UtRegisterTest("StreamTcpSackTest14 -- Insertion out of window",
                    StreamTcpSackTest14);
+    UtRegisterTest("StreamTcpSackTest15 -- Inline merge", StreamTcpSackTest15);
+    UtRegisterTest("StreamTcpSackTest16 -- Inline to tree", StreamTcpSackTest16);
+    UtRegisterTest("StreamTcpSackPerfTest01 -- Inline vs tree", StreamTcpSackPerfTest01);
 #endif
 }
@@ -34,6 +34,7 @@
 
 #include "flow.h"
 #include "flow-util.h"
+#include "flow-storage.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -44,6 +45,7 @@
 
 #include "util-pool.h"
 #include "util-pool-thread.h"
+#include "util-arena.h"
 #include "util-checksum.h"
 #include "util-unittest.h"
 #include "util-print.h"
@@ -76,6 +78,7 @@
 #include "util-random.h"
 #include "util-exception-policy.h"
 #include "util-time.h"
+#include "util-mpm.h"
 
 #include "source-pcap-file.h"
 #include "action-globals.h"
@@ -102,11 +105,15 @@ static int StreamTcpValidateRst(TcpSession * , Packet *);
 static inline int StreamTcpValidateAck(TcpSession *ssn, TcpStream *, Packet *);
 static int StreamTcpStateDispatch(
         ThreadVars *tv, Packet *p, StreamTcpThread *stt, TcpSession *ssn, const uint8_t state);
+static void StreamTcpPacketSetState(Packet *p, TcpSession *ssn, uint8_t state);
 
 extern thread_local uint64_t t_pcapcnt;
 extern int g_detect_disabled;
 
 PoolThread *ssn_pool = NULL;
+static SCArena *ssn_arena = NULL;
+/** flow storage holding the TcpSynState of flows that only saw a SYN */
+static FlowStorageId g_tcp_syn_storage_id = { .id = -1 };
 static SCMutex ssn_pool_mutex = SCMUTEX_INITIALIZER; /**< init only, protect initializing and growing pool */
 #ifdef DEBUG
 static uint64_t ssn_pool_cnt = 0; /** counts ssns, protected by ssn_pool_mutex */
@@ -200,7 +207,21 @@ void StreamTcpStreamCleanup(TcpStream *stream)
     if (stream != NULL) {
         StreamTcpSackFreeList(stream);
         StreamTcpReturnStreamSegments(stream);
+        StreamTcpReassembleRecordBufferStats(&stream->sb);
         StreamingBufferClear(&stream->sb, &stream_config.sbcnf);
+        if (stream->raw_mpm_stream != NULL) {
+            StreamTcpDecrMemuse(stream->raw_mpm_stream->size);
+            MpmStreamFree(stream->raw_mpm_stream);
+            stream->raw_mpm_stream = NULL;
+        }
+        if (stream->raw_mpm_matches != NULL) {
+            SCFree(stream->raw_mpm_matches);
+            StreamTcpDecrMemuse(
+                    (uint64_t)stream->raw_mpm_matches_size * sizeof(TcpStreamMpmMatch));
+            stream->raw_mpm_matches = NULL;
+            stream->raw_mpm_matches_size = 0;
+            stream->raw_mpm_matches_cnt = 0;
+        }
     }
 }
 
@@ -229,6 +250,7 @@ void StreamTcpSessionCleanup(TcpSession *ssn)
     if (ssn == NULL)
         return;
 
+    StreamTcpInlineBatchDiscard(ssn);
     StreamTcpStreamCleanup(&ssn->client);
     StreamTcpStreamCleanup(&ssn->server);
     StreamTcp3wsFreeQueue(ssn);
@@ -299,13 +321,25 @@ static void *StreamTcpSessionPoolAlloc(void)
     if (StreamTcpCheckMemcap((uint32_t)sizeof(TcpSession)) == 0)
         return NULL;
 
-    ptr = SCMalloc(sizeof(TcpSession));
-    if (unlikely(ptr == NULL))
-        return NULL;
+    ptr = SCArenaAlloc(ssn_arena);
+    if (ptr == NULL) {
+        ptr = SCMalloc(sizeof(TcpSession));
+        if (unlikely(ptr == NULL))
+            return NULL;
+    }
 
     return ptr;
 }
 
+/** \brief Stream free function for the Pool */
+static void StreamTcpSessionPoolFree(void *ptr)
+{
+    if (SCArenaOwns(ptr))
+        SCArenaFree(ssn_arena, ptr);
+    else
+        SCFree(ptr);
+}
+
 static int StreamTcpSessionPoolInit(void *data, void* initdata)
 {
     memset(data, 0, sizeof(TcpSession));
@@ -428,6 +462,15 @@ void StreamTcpInitConfig(bool quiet)
         SCLogConfig("stream \"async-oneside\": %s", stream_config.async_oneside ? "enabled" : "disabled");
     }
 
+    /* the storage is registered before the config is set up, see
+     * StreamTcpRegisterFlowStorage */
+    int compact_syn = 0;
+    (void)ConfGetBool("stream.compact-syn", &compact_syn);
+    stream_config.compact_syn = (compact_syn && g_tcp_syn_storage_id.id != -1);
+    if (!quiet) {
+        SCLogConfig("stream \"compact-syn\": %s", stream_config.compact_syn ? "enabled" : "disabled");
+    }
+
     int csum = 0;
 
     if ((ConfGetBool("stream.checksum-validation", &csum)) == 1) {
@@ -670,6 +713,8 @@ void StreamTcpInitConfig(bool quiet)
      * values. */
     FlowSetProtoFreeFunc(IPPROTO_TCP, StreamTcpSessionClear);
 
+    ssn_arena = SCArenaCreate("tcp-session", sizeof(TcpSession));
+
 #ifdef UNITTESTS
     if (RunmodeIsUnittests()) {
         SCMutexLock(&ssn_pool_mutex);
@@ -680,7 +725,7 @@ void StreamTcpInitConfig(bool quiet)
                     sizeof(TcpSession),
                     StreamTcpSessionPoolAlloc,
                     StreamTcpSessionPoolInit, NULL,
-                    StreamTcpSessionPoolCleanup, NULL);
+                    StreamTcpSessionPoolCleanup, StreamTcpSessionPoolFree);
         }
         SCMutexUnlock(&ssn_pool_mutex);
     }
@@ -773,6 +818,177 @@ static TcpSession *StreamTcpNewSession(ThreadVars *tv, StreamTcpThread *stt, Pac
     return ssn;
 }
 
+#define TCP_SYN_STATE_TS     BIT_U8(0)
+#define TCP_SYN_STATE_WSCALE BIT_U8(1)
+#define TCP_SYN_STATE_SACKOK BIT_U8(2)
+
+/** Compact state for a flow that has seen only a SYN. Scans and SYN
+ *  floods mostly consist of these, so they don't get a TcpSession with
+ *  its streams until the next packet of the flow shows up. */
+typedef struct TcpSynState_ {
+    uint32_t isn;
+    uint32_t tsval;
+    uint32_t ts_secs; /**< time of the SYN, for last_pkt_ts */
+    uint16_t window;
+    uint8_t wscale;
+    uint8_t flags;     /**< TCP_SYN_STATE_* */
+    uint8_t tcp_flags; /**< tcp flags seen so far */
+} TcpSynState;
+
+static void StreamTcpSynStateFree(void *ptr)
+{
+    SCFree(ptr);
+    StreamTcpDecrMemuse((uint64_t)sizeof(TcpSynState));
+}
+
+/** \brief register the flow storage for the compact SYN state
+ *
+ *  Storage has to be registered before StorageFinalize, which runs
+ *  before StreamTcpInitConfig, so stream.compact-syn is read here.
+ *  The unittests always register it so tests can enable the option.
+ */
+void StreamTcpRegisterFlowStorage(void)
+{
+    int compact_syn = 0;
+    if ((ConfGetBool("stream.compact-syn", &compact_syn) == 1 && compact_syn) ||
+            RunmodeIsUnittests()) {
+        g_tcp_syn_storage_id =
+                FlowStorageRegister("tcp-syn", sizeof(void *), NULL, StreamTcpSynStateFree);
+    }
+}
+
+/** \brief get the tcp flags of a flow kept in the compact SYN state
+ *
+ *  \retval flags tcp flags seen or 0 if the flow has no compact state
+ */
+uint8_t StreamTcpCompactSynFlags(const Flow *f)
+{
+    if (!stream_config.compact_syn)
+        return 0;
+    const TcpSynState *syn = FlowGetStorageById(f, g_tcp_syn_storage_id);
+    return syn ? syn->tcp_flags : 0;
+}
+
+/** \internal
+ *  \brief keep a plain SYN in the compact state instead of a session
+ *
+ *  Only a toserver SYN without data is handled here, anything else
+ *  still gets a full session right away.
+ *
+ *  \retval true SYN stored, no session is set up
+ *  \retval false a full session is needed
+ */
+static bool StreamTcpSynStateStore(ThreadVars *tv, StreamTcpThread *stt, Packet *p)
+{
+    if (!stream_config.compact_syn || p->payload_len > 0 || TCP_HAS_TFO(p) ||
+            PKT_IS_PSEUDOPKT(p) || !PKT_IS_TOSERVER(p))
+        return false;
+
+    TcpSynState *syn = FlowGetStorageById(p->flow, g_tcp_syn_storage_id);
+    if (syn == NULL) {
+        /* let the session setup apply the memcap policy */
+        if (StreamTcpCheckMemcap((uint64_t)sizeof(TcpSynState)) == 0)
+            return false;
+        syn = SCMalloc(sizeof(TcpSynState));
+        if (unlikely(syn == NULL))
+            return false;
+        StreamTcpIncrMemuse((uint64_t)sizeof(TcpSynState));
+        FlowSetStorageById(p->flow, g_tcp_syn_storage_id, syn);
+        StatsIncr(tv, stt->counter_tcp_syn_compact);
+    }
+    memset(syn, 0, sizeof(*syn));
+
+    syn->isn = TCP_GET_SEQ(p);
+    syn->window = TCP_GET_WINDOW(p);
+    syn->tcp_flags = p->tcph->th_flags;
+    if (TCP_HAS_TS(p)) {
+        syn->flags |= TCP_SYN_STATE_TS;
+        syn->tsval = TCP_GET_TSVAL(p);
+        syn->ts_secs = (uint32_t)SCTIME_SECS(p->ts);
+    }
+    if (TCP_HAS_WSCALE(p)) {
+        syn->flags |= TCP_SYN_STATE_WSCALE;
+        syn->wscale = TCP_GET_WSCALE(p);
+    }
+    if (TCP_GET_SACKOK(p) == 1) {
+        syn->flags |= TCP_SYN_STATE_SACKOK;
+    }
+    SCLogDebug("flow %p: SYN isn %u kept in compact state", p->flow, syn->isn);
+    return true;
+}
+
+/** \internal
+ *  \brief set up the full session for a flow in the compact SYN state
+ *
+ *  The session is put in the state StreamTcpPacketStateNone would have
+ *  left it in for the SYN, so the current packet is handled by the
+ *  TCP_SYN_SENT logic. The compact state is released.
+ *
+ *  \retval ssn session or NULL if the memcap was hit
+ */
+static TcpSession *StreamTcpSynStatePromote(
+        ThreadVars *tv, StreamTcpThread *stt, Packet *p, const TcpSynState *syn)
+{
+    TcpSession *ssn = StreamTcpNewSession(tv, stt, p, stt->ssn_pool_id);
+    if (ssn == NULL) {
+        StatsIncr(tv, stt->counter_tcp_ssn_memcap);
+        FlowFreeStorageById(p->flow, g_tcp_syn_storage_id);
+        return NULL;
+    }
+    StatsIncr(tv, stt->counter_tcp_sessions);
+    StatsIncr(tv, stt->counter_tcp_active_sessions);
+    StatsIncr(tv, stt->counter_tcp_syn_promoted);
+
+    /* flags of the current packet are added by the caller */
+    ssn->tcp_packet_flags = syn->tcp_flags;
+    ssn->client.tcp_flags = syn->tcp_flags;
+    ssn->server.tcp_flags = 0;
+
+    StreamTcpPacketSetState(p, ssn, TCP_SYN_SENT);
+    if (stream_config.async_oneside) {
+        ssn->flags |= STREAMTCP_FLAG_ASYNC;
+    }
+
+    ssn->client.isn = syn->isn;
+    STREAMTCP_SET_RA_BASE_SEQ(&ssn->client, ssn->client.isn);
+    ssn->client.next_seq = ssn->client.isn + 1;
+
+    if (syn->flags & TCP_SYN_STATE_TS) {
+        ssn->client.last_ts = syn->tsval;
+        if (ssn->client.last_ts == 0)
+            ssn->client.flags |= STREAMTCP_STREAM_FLAG_ZERO_TIMESTAMP;
+        ssn->client.last_pkt_ts = syn->ts_secs;
+        ssn->client.flags |= STREAMTCP_STREAM_FLAG_TIMESTAMP;
+    }
+
+    ssn->server.window = syn->window;
+    if (syn->flags & TCP_SYN_STATE_WSCALE) {
+        ssn->flags |= STREAMTCP_FLAG_SERVER_WSCALE;
+        ssn->server.wscale = syn->wscale;
+    }
+    if (syn->flags & TCP_SYN_STATE_SACKOK) {
+        ssn->flags |= STREAMTCP_FLAG_CLIENT_SACKOK;
+    }
+
+    SCLogDebug("ssn %p: promoted from compact SYN state, isn %u", ssn, ssn->client.isn);
+    FlowFreeStorageById(p->flow, g_tcp_syn_storage_id);
+    return ssn;
+}
+
+/** \internal
+ *  \brief compress the streaming mpm state of a stream that is expected
+ *         to be idle */
+static void StreamTcpStreamCompressMpm(TcpStream *stream)
+{
+    MpmStream *ms = stream->raw_mpm_stream;
+    if (ms == NULL)
+        return;
+    const uint32_t size = ms->size;
+    MpmStreamCompress(ms);
+    if (ms->size < size)
+        StreamTcpDecrMemuse(size - ms->size);
+}
+
 static void StreamTcpPacketSetState(Packet *p, TcpSession *ssn,
                                            uint8_t state)
 {
@@ -783,6 +999,12 @@ static void StreamTcpPacketSetState(Packet *p, TcpSession *ssn,
     ssn->state = state;
     STREAM_PKT_FLAG_SET(p, STREAM_PKT_FLAG_STATE_UPDATE);
 
+    /* a closing session will likely see little data until it times out */
+    if (ssn->pstate <= TCP_ESTABLISHED && ssn->state > TCP_ESTABLISHED) {
+        StreamTcpStreamCompressMpm(&ssn->client);
+        StreamTcpStreamCompressMpm(&ssn->server);
+    }
+
     /* update the flow state */
     switch(ssn->state) {
         case TCP_ESTABLISHED:
@@ -1157,6 +1379,9 @@ static int StreamTcpPacketStateNone(
         return 0;
 
     } else if (p->tcph->th_flags & TH_SYN) {
+        if (ssn == NULL && StreamTcpSynStateStore(tv, stt, p)) {
+            return 0;
+        }
         if (ssn == NULL) {
             ssn = StreamTcpNewSession(tv, stt, p, stt->ssn_pool_id);
             if (ssn == NULL) {
@@ -5320,6 +5545,16 @@ int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
 
     TcpSession *ssn = (TcpSession *)p->flow->protoctx;
 
+    /* flow only saw a SYN so far, set up the session for it now */
+    if (ssn == NULL && stream_config.compact_syn && !PKT_IS_PSEUDOPKT(p)) {
+        const TcpSynState *syn = FlowGetStorageById(p->flow, g_tcp_syn_storage_id);
+        if (syn != NULL) {
+            ssn = StreamTcpSynStatePromote(tv, stt, p, syn);
+            if (ssn == NULL)
+                goto error;
+        }
+    }
+
     /* track TCP flags */
     if (ssn != NULL) {
         ssn->tcp_packet_flags |= p->tcph->th_flags;
@@ -5680,6 +5915,11 @@ static int TcpSessionReuseDoneEnoughSynAck(const Packet *p, const Flow *f, const
  *  \retval bool true if ssn can be reused, false if not */
 static int TcpSessionReuseDoneEnough(const Packet *p, const Flow *f, const TcpSession *ssn)
 {
+    /* a flow in the compact SYN state is in TCP_SYN_SENT, never reuse it */
+    if (ssn == NULL && StreamTcpCompactSynFlags(f) != 0) {
+        return 0;
+    }
+
     if ((p->tcph->th_flags & (TH_SYN | TH_ACK)) == TH_SYN) {
         return TcpSessionReuseDoneEnoughSyn(p, f, ssn);
     }
@@ -5767,6 +6007,8 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->counter_tcp_pseudo_failed = StatsRegisterCounter("tcp.pseudo_failed", tv);
     stt->counter_tcp_invalid_checksum = StatsRegisterCounter("tcp.invalid_checksum", tv);
     stt->counter_tcp_midstream_pickups = StatsRegisterCounter("tcp.midstream_pickups", tv);
+    stt->counter_tcp_syn_compact = StatsRegisterCounter("tcp.syn_compact", tv);
+    stt->counter_tcp_syn_promoted = StatsRegisterCounter("tcp.syn_promoted", tv);
     stt->counter_tcp_wrong_thread = StatsRegisterCounter("tcp.pkt_on_wrong_thread", tv);
     stt->counter_tcp_ack_unseen_data = StatsRegisterCounter("tcp.ack_unseen_data", tv);
 
@@ -5779,6 +6021,19 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->ra_ctx->counter_tcp_segment_from_cache =
             StatsRegisterCounter("tcp.segment_from_cache", tv);
     stt->ra_ctx->counter_tcp_segment_from_pool = StatsRegisterCounter("tcp.segment_from_pool", tv);
+    stt->ra_ctx->counter_tcp_reass_buffer_from_cache =
+            StatsRegisterCounter("tcp.reassembly_buffer_from_cache", tv);
+    stt->ra_ctx->counter_tcp_reass_buffer_alloc =
+            StatsRegisterCounter("tcp.reassembly_buffer_alloc", tv);
+    stt->ra_ctx->counter_tcp_reass_zero_copy =
+            StatsRegisterCounter("tcp.reassembly_zero_copy", tv);
+    stt->ra_ctx->counter_tcp_reass_zero_copy_fallback =
+            StatsRegisterCounter("tcp.reassembly_zero_copy_fallback", tv);
+    stt->ra_ctx->counter_tcp_inline_batch_held = StatsRegisterCounter("tcp.inline_batch_held", tv);
+    stt->ra_ctx->counter_tcp_inline_batch_flushes =
+            StatsRegisterCounter("tcp.inline_batch_flushes", tv);
+    stt->ra_ctx->counter_tcp_inline_batch_timeouts =
+            StatsRegisterCounter("tcp.inline_batch_timeouts", tv);
     stt->ra_ctx->counter_tcp_stream_depth = StatsRegisterCounter("tcp.stream_depth_reached", tv);
     stt->ra_ctx->counter_tcp_reass_gap = StatsRegisterCounter("tcp.reassembly_gap", tv);
     stt->ra_ctx->counter_tcp_reass_overlap = StatsRegisterCounter("tcp.overlap", tv);
@@ -5798,7 +6053,7 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
                 sizeof(TcpSession),
                 StreamTcpSessionPoolAlloc,
                 StreamTcpSessionPoolInit, NULL,
-                StreamTcpSessionPoolCleanup, NULL);
+                StreamTcpSessionPoolCleanup, StreamTcpSessionPoolFree);
         stt->ssn_pool_id = 0;
         SCLogDebug("pool size %d, thread ssn_pool_id %d", PoolThreadSize(ssn_pool), stt->ssn_pool_id);
     } else {
@@ -58,10 +58,20 @@ typedef struct TcpStreamCnf_ {
     uint32_t prealloc_segments; /**< segments to prealloc per stream thread */
     bool midstream;
     bool async_oneside;
+    bool compact_syn; /**< keep SYN only flows in a compact state, no TcpSession */
     bool streaming_log_api;
+    bool zero_copy; /**< pass in order data from the packet to the app-layer */
     uint8_t max_syn_queued;
 
     uint32_t reassembly_depth;  /**< Depth until when we reassemble the stream */
+    /** adaptive policy: % of the reassembly memcap where it starts, 0 if disabled */
+    uint8_t adaptive_threshold;
+    uint32_t adaptive_min_depth; /**< adaptive policy: depth at the reassembly memcap */
+
+    /** inline batching: max bytes held per flow, 0 if disabled */
+    uint32_t inline_batch_bytes;
+    uint32_t inline_batch_usecs; /**< inline batching: max time a packet is held */
+    uint16_t inline_batch_pkts;  /**< inline batching: max packets held per flow */
 
     uint16_t reassembly_toserver_chunk_size;
     uint16_t reassembly_toclient_chunk_size;
@@ -93,6 +103,10 @@ typedef struct StreamTcpThread_ {
     uint16_t counter_tcp_invalid_checksum;
     /** midstream pickups */
     uint16_t counter_tcp_midstream_pickups;
+    /** SYNs kept in the compact state */
+    uint16_t counter_tcp_syn_compact;
+    /** compact SYN states turned into a full session */
+    uint16_t counter_tcp_syn_promoted;
     /** wrong thread */
     uint16_t counter_tcp_wrong_thread;
     /** ack for unseen data */
@@ -106,6 +120,8 @@ extern TcpStreamCnf stream_config;
 void StreamTcpInitConfig(bool);
 void StreamTcpFreeConfig(bool);
 void StreamTcpRegisterTests (void);
+void StreamTcpRegisterFlowStorage(void);
+uint8_t StreamTcpCompactSynFlags(const Flow *f);
 
 void StreamTcpSessionPktFree (Packet *);
 
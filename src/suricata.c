@@ -117,6 +117,7 @@
 #include "tmqh-packetpool.h"
 #include "tm-queuehandlers.h"
 
+#include "util-arena.h"
 #include "util-byte.h"
 #include "util-conf.h"
 #include "util-coredump-config.h"
@@ -133,6 +134,7 @@
 #include "util-macset.h"
 #include "util-misc.h"
 #include "util-mpm-hs.h"
+#include "util-mpm-hs-cache.h"
 #include "util-path.h"
 #include "util-pidfile.h"
 #include "util-plugin.h"
@@ -388,6 +390,7 @@ static void GlobalsDestroy(SCInstance *suri)
     TmqhCleanup();
     TmModuleRunDeInit();
     ParseSizeDeinit();
+    SCArenaDestroy();
 
 #ifdef HAVE_DPDK
     DPDKCleanupEAL();
@@ -2207,6 +2210,8 @@ void PreRunInit(const int runmode)
         return;
 
     StatsInit();
+    SCArenaInit();
+    PacketArenaInit();
 #ifdef PROFILE_RULES
     SCProfilingRulesGlobalInit();
 #endif
@@ -2222,9 +2227,13 @@ void PreRunInit(const int runmode)
     FlowInitConfig(FLOW_QUIET);
     IPPairInitConfig(FLOW_QUIET);
     StreamTcpInitConfig(STREAM_VERBOSE);
+#ifdef BUILD_HYPERSCAN
+    MpmHSCacheInit();
+#endif
     AppLayerParserPostStreamSetup();
     AppLayerRegisterGlobalCounters();
     OutputFilestoreRegisterGlobalCounters();
+    DetectEngineRegisterGlobalCounters();
 }
 
 /* tasks we need to run before packets start flowing,
@@ -2668,6 +2677,7 @@ int PostConfLoadedSetup(SCInstance *suri)
     RegisterFlowBypassInfo();
 
     MacSetRegisterFlowStorage();
+    StreamTcpRegisterFlowStorage();
 
     LiveDeviceFinalize(); // must be after EBPF extension registration
 
@@ -183,6 +183,126 @@ static int StreamTcpInlineTest08(void)
     INLINE_END;
 }
 
+#define BATCH_ADD(rseq, seg, seglen, hold)                                                         \
+    p = UTHBuildPacketReal(                                                                        \
+            (uint8_t *)(seg), (seglen), IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);              \
+    FAIL_IF(p == NULL);                                                                            \
+    p->flow = &f;                                                                                  \
+    p->flowflags |= FLOW_PKT_TOSERVER;                                                             \
+    p->ts = ts;                                                                                    \
+    p->tcph->th_seq = htonl(stream->isn + (rseq));                                                 \
+    p->tcph->th_ack = htonl(31);                                                                   \
+    p->tcph->th_flags = TH_ACK;                                                                    \
+    FAIL_IF(StreamTcpInlineBatchCanHold(ra_ctx, &ssn, stream, p) != (hold));                       \
+    FAIL_IF(StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn, stream, p) < 0);         \
+    if ((hold)) {                                                                                  \
+        p->flags |= PKT_STREAM_HELD;                                                               \
+        StreamTcpInlineBatchAdd(ra_ctx, &ssn, stream, p);                                          \
+        FAIL_IF_NOT(p->flags & PKT_STREAM_HELD);                                                   \
+    }
+
+/** \test batch of held packets */
+static int StreamTcpInlineTest09(void)
+{
+    INLINE_START(0);
+    Flow f;
+    memset(&f, 0, sizeof(f));
+    SCTime_t ts = SCTIME_FROM_SECS(1);
+    ssn.state = TCP_ESTABLISHED;
+    stream->flags |= STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_COMPLETED;
+    stream_config.inline_batch_bytes = 32;
+    stream_config.inline_batch_usecs = 500;
+    stream_config.inline_batch_pkts = 4;
+    FAIL_IF(StreamTcpInlineBatchThreadInit(ra_ctx) < 0);
+    FAIL_IF_NULL(ra_ctx->inline_batch);
+    ra_ctx->inline_batch->max_held = 8;
+
+    BATCH_ADD(1, "AAAAAAAAAA", 10, true);
+    Packet *p1 = p;
+    BATCH_ADD(11, "BBBBBBBBBB", 10, true);
+    Packet *p2 = p;
+    TcpInlineBatch *b = ssn.inline_batch;
+    FAIL_IF_NULL(b);
+    FAIL_IF_NOT(b->pq.len == 2 && b->left_edge == 0 && b->right_edge == 20);
+    FAIL_IF_NOT(b->f == &f && b->dir == STREAM_TOSERVER);
+
+    /* gap, and data beyond the byte limit: inspected right away */
+    BATCH_ADD(31, "DDDDD", 5, false);
+    UTHFreePacket(p);
+    BATCH_ADD(21, "CCCCCCCCCCCC", 12, false);
+    UTHFreePacket(p);
+
+    /* not due yet, then due */
+    uint16_t iter = 0;
+    FAIL_IF_NOT_NULL(StreamTcpInlineBatchGetDue(ra_ctx, SCTIME_ADD_USECS(ts, 100), false, &iter));
+    iter = 0;
+    FAIL_IF_NOT(StreamTcpInlineBatchGetDue(ra_ctx, SCTIME_ADD_USECS(ts, 500), false, &iter) == &f);
+    FAIL_IF_NOT_NULL(StreamTcpInlineBatchGetDue(ra_ctx, SCTIME_ADD_USECS(ts, 500), false, &iter));
+
+    FAIL_IF_NOT(StreamTcpInlineBatchTakeLast(&ssn) == p2);
+    FAIL_IF(p2->flags & PKT_STREAM_HELD);
+    FAIL_IF_NOT(StreamTcpInlineBatchTakeFirst(&ssn) == p1);
+    FAIL_IF(p1->flags & PKT_STREAM_HELD);
+    FAIL_IF_NOT_NULL(StreamTcpInlineBatchTakeFirst(&ssn));
+    StreamTcpInlineBatchDetach(ra_ctx, &ssn);
+    FAIL_IF_NOT_NULL(ssn.inline_batch);
+    FAIL_IF_NOT(ra_ctx->inline_batch->active == 0 && ra_ctx->inline_batch->held == 0);
+    FAIL_IF(StreamTcpInlineBatchPending(ra_ctx));
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+
+    StreamTcpInlineBatchThreadDeinit(ra_ctx);
+    stream_config.inline_batch_bytes = 0;
+    INLINE_END;
+}
+
+/** \test discarded batch is released by the owning thread */
+static int StreamTcpInlineTest10(void)
+{
+    INLINE_START(0);
+    Flow f;
+    memset(&f, 0, sizeof(f));
+    SCTime_t ts = SCTIME_FROM_SECS(1);
+    ssn.state = TCP_ESTABLISHED;
+    stream->flags |= STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_COMPLETED;
+    stream_config.inline_batch_bytes = 32;
+    stream_config.inline_batch_usecs = 500;
+    stream_config.inline_batch_pkts = 4;
+    FAIL_IF(StreamTcpInlineBatchThreadInit(ra_ctx) < 0);
+    FAIL_IF_NULL(ra_ctx->inline_batch);
+    ra_ctx->inline_batch->max_held = 8;
+
+    BATCH_ADD(1, "AAAAAAAAAA", 10, true);
+    Packet *p1 = p;
+    BATCH_ADD(11, "BBBBBBBBBB", 10, true);
+    Packet *p2 = p;
+    TcpInlineBatch *b = ssn.inline_batch;
+    FAIL_IF_NULL(b);
+
+    /* only marked: the packets stay held until the owner gets to them */
+    StreamTcpInlineBatchDiscard(&ssn);
+    FAIL_IF_NOT_NULL(ssn.inline_batch);
+    FAIL_IF_NOT(b->f == &f && b->pq.len == 2);
+    FAIL_IF_NOT(p1->flags & PKT_STREAM_HELD);
+    FAIL_IF(PacketCheckAction(p1, ACTION_DROP));
+    FAIL_IF_NOT_NULL(StreamTcpInlineBatchTakeDropped(ra_ctx));
+
+    uint16_t iter = 0;
+    FAIL_IF_NOT_NULL(StreamTcpInlineBatchGetDue(ra_ctx, SCTIME_ADD_USECS(ts, 500), false, &iter));
+    FAIL_IF(StreamTcpInlineBatchPending(ra_ctx));
+    FAIL_IF_NOT(StreamTcpInlineBatchTakeDropped(ra_ctx) == p1);
+    FAIL_IF_NOT(StreamTcpInlineBatchTakeDropped(ra_ctx) == p2);
+    FAIL_IF_NOT_NULL(StreamTcpInlineBatchTakeDropped(ra_ctx));
+    FAIL_IF((p1->flags | p2->flags) & PKT_STREAM_HELD);
+    FAIL_IF_NOT(PacketCheckAction(p1, ACTION_DROP) && PacketCheckAction(p2, ACTION_DROP));
+    UTHFreePacket(p1);
+    UTHFreePacket(p2);
+
+    StreamTcpInlineBatchThreadDeinit(ra_ctx);
+    stream_config.inline_batch_bytes = 0;
+    INLINE_END;
+}
+
 void StreamTcpInlineRegisterTests(void)
 {
     UtRegisterTest("StreamTcpInlineTest01", StreamTcpInlineTest01);
@@ -193,4 +313,6 @@ void StreamTcpInlineRegisterTests(void)
     UtRegisterTest("StreamTcpInlineTest06", StreamTcpInlineTest06);
     UtRegisterTest("StreamTcpInlineTest07", StreamTcpInlineTest07);
     UtRegisterTest("StreamTcpInlineTest08", StreamTcpInlineTest08);
+    UtRegisterTest("StreamTcpInlineTest09", StreamTcpInlineTest09);
+    UtRegisterTest("StreamTcpInlineTest10", StreamTcpInlineTest10);
 }
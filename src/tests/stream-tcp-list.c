@@ -25,6 +25,7 @@
 #include "../util-streaming-buffer.h"
 #include "../util-print.h"
 #include "../util-unittest.h"
+#include "../util-unittest-helper.h"
 
 static int VALIDATE(TcpStream *stream, uint8_t *data, uint32_t data_len)
 {
@@ -707,6 +708,126 @@ static int StreamTcpReassembleTest32(void)
     OVERLAP_END;
 }
 
+/** \test in order segments take the append fast path, out of order ones
+ *        go through the regular insert. Tree must stay sorted. */
+static int StreamTcpReassembleTest33(void)
+{
+    OVERLAP_START(0, OS_POLICY_BSD);
+    OVERLAP_STEP(1, "AAA", 3, "AAA", 3);
+    OVERLAP_STEP(4, "BBB", 3, "AAABBB", 6);
+    OVERLAP_STEP(10, "DDD", 3, "AAABBB\0\0\0DDD", 12);
+    OVERLAP_STEP(7, "CCC", 3, "AAABBBCCCDDD", 12);
+    OVERLAP_STEP(13, "EEE", 3, "AAABBBCCCDDDEEE", 15);
+    OVERLAP_STEP(16, "FFF", 3, "AAABBBCCCDDDEEEFFF", 18);
+
+    uint32_t cnt = 0;
+    uint32_t next_seq = stream->isn + 1;
+    TcpSegment *seg;
+    RB_FOREACH (seg, TCPSEG, &stream->seg_tree) {
+        FAIL_IF_NOT(seg->seq == next_seq);
+        next_seq = SEG_SEQ_RIGHT_EDGE(seg);
+        cnt++;
+    }
+    FAIL_IF_NOT(cnt == 6);
+    FAIL_IF_NOT(stream->segs_right_edge == stream->isn + 19);
+    OVERLAP_END;
+}
+
+#ifdef PROFILING
+#include "../util-cpu.h"
+
+#define INSERT_BENCH_SEGS   1024
+#define INSERT_BENCH_SEGLEN 100
+
+enum InsertBenchMode {
+    INSERT_BENCH_IN_ORDER,
+    INSERT_BENCH_REORDERED,
+    INSERT_BENCH_OVERLAP,
+};
+
+/** \internal
+ *  \brief time inserting INSERT_BENCH_SEGS segments into a stream
+ *  \param ticks set to the average ticks spent per segment
+ *  \retval bool true on success */
+static bool InsertBench(enum InsertBenchMode mode, uint64_t *ticks)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    TcpSession ssn;
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 0);
+    TcpStream *stream = &ssn.client;
+    stream->os_policy = OS_POLICY_BSD;
+
+    static Packet *pkts[INSERT_BENCH_SEGS];
+    static TcpSegment *segs[INSERT_BENCH_SEGS];
+    uint8_t payload[INSERT_BENCH_SEGLEN];
+    memset(payload, 'A', sizeof(payload));
+
+    for (uint32_t i = 0; i < INSERT_BENCH_SEGS; i++) {
+        uint32_t rseq;
+        switch (mode) {
+            case INSERT_BENCH_IN_ORDER:
+                rseq = 1 + i * INSERT_BENCH_SEGLEN;
+                break;
+            case INSERT_BENCH_REORDERED:
+                /* swap each pair of segments */
+                rseq = 1 + (i ^ 1) * INSERT_BENCH_SEGLEN;
+                break;
+            default:
+                /* each segment overlaps half of the previous one */
+                rseq = 1 + i * (INSERT_BENCH_SEGLEN / 2);
+                break;
+        }
+        pkts[i] = UTHBuildPacketReal(
+                payload, sizeof(payload), IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+        segs[i] = StreamTcpGetSegment(&tv, ra_ctx);
+        if (pkts[i] == NULL || segs[i] == NULL)
+            return false;
+        pkts[i]->tcph->th_seq = htonl(stream->isn + rseq);
+        segs[i]->seq = stream->isn + rseq;
+        TCP_SEG_LEN(segs[i]) = INSERT_BENCH_SEGLEN;
+    }
+
+    bool ok = true;
+    uint64_t ticks_start = UtilCpuGetTicks();
+    for (uint32_t i = 0; i < INSERT_BENCH_SEGS; i++) {
+        if (StreamTcpReassembleInsertSegment(&tv, ra_ctx, stream, segs[i], pkts[i],
+                    TCP_GET_SEQ(pkts[i]), pkts[i]->payload, pkts[i]->payload_len) < 0)
+            ok = false;
+    }
+    uint64_t ticks_end = UtilCpuGetTicks();
+    *ticks = (ticks_end - ticks_start) / INSERT_BENCH_SEGS;
+
+    for (uint32_t i = 0; i < INSERT_BENCH_SEGS; i++) {
+        UTHFreePacket(pkts[i]);
+    }
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    return ok;
+}
+#endif
+
+/** \test insert cost per segment for in order, reordered and overlapping
+ *        segments. Only measures in PROFILING builds. */
+static int StreamTcpReassembleInsertPerfTest01(void)
+{
+#ifdef PROFILING
+    uint64_t in_order = 0, reordered = 0, overlap = 0;
+    FAIL_IF_NOT(InsertBench(INSERT_BENCH_IN_ORDER, &in_order));
+    FAIL_IF_NOT(InsertBench(INSERT_BENCH_REORDERED, &reordered));
+    FAIL_IF_NOT(InsertBench(INSERT_BENCH_OVERLAP, &overlap));
+
+    printf("\n");
+    printf("segment insert in order (%d)\t%" PRIu64 " ticks/seg\n", INSERT_BENCH_SEGS, in_order);
+    printf("segment insert reordered (%d)\t%" PRIu64 " ticks/seg\n", INSERT_BENCH_SEGS, reordered);
+    printf("segment insert overlap (%d)\t%" PRIu64 " ticks/seg\n", INSERT_BENCH_SEGS, overlap);
+#endif
+    PASS;
+}
+
 void StreamTcpListRegisterTests(void)
 {
     UtRegisterTest("StreamTcpReassembleTest01 -- BSD policy",
@@ -728,5 +849,8 @@ void StreamTcpListRegisterTests(void)
             StreamTcpReassembleTest31);
     UtRegisterTest("StreamTcpReassembleTest32",
             StreamTcpReassembleTest32);
+    UtRegisterTest("StreamTcpReassembleTest33 -- in order append",
+            StreamTcpReassembleTest33);
+    UtRegisterTest("StreamTcpReassembleInsertPerfTest01", StreamTcpReassembleInsertPerfTest01);
 
 }
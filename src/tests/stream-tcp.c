@@ -3398,6 +3398,206 @@ end:
     return ret;
 }
 
+/** \internal
+ *  \brief set up a flow with flow storage and enable the compact SYN state
+ */
+static Flow *StreamTcpCompactSynSetup(StreamTcpThread *stt, const char *prealloc)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("stream.compact-syn", "yes");
+    if (prealloc != NULL)
+        ConfSet("stream.prealloc-sessions", prealloc);
+    StreamTcpUTInit(&stt->ra_ctx);
+
+    Flow *f = FlowAlloc();
+    if (f != NULL)
+        f->proto = IPPROTO_TCP;
+    return f;
+}
+
+static void StreamTcpCompactSynTeardown(StreamTcpThread *stt, Flow *f)
+{
+    StreamTcpSessionClear(f->protoctx);
+    f->protoctx = NULL;
+    FlowFreeStorage(f);
+    FlowFree(f);
+    StreamTcpUTDeinit(stt->ra_ctx);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+}
+
+/** \test compact SYN state: the SYN doesn't set up a session, the SYN/ACK
+ *        promotes the flow to a full session in TCP_SYN_RECV */
+static int StreamTcpTest46(void)
+{
+    ThreadVars tv;
+    StreamTcpThread stt;
+    TCPHdr tcph;
+    PacketQueueNoLock pq;
+    memset(&pq, 0, sizeof(PacketQueueNoLock));
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&stt, 0, sizeof(StreamTcpThread));
+    memset(&tcph, 0, sizeof(TCPHdr));
+
+    Flow *f = StreamTcpCompactSynSetup(&stt, NULL);
+    FAIL_IF_NULL(f);
+    FAIL_IF_NOT(stream_config.compact_syn);
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    p->flow = f;
+    p->tcph = &tcph;
+    tcph.th_win = htons(5480);
+    const uint64_t memuse = SC_ATOMIC_GET(st_memuse);
+
+    /* SYN */
+    tcph.th_flags = TH_SYN;
+    tcph.th_seq = htonl(100);
+    p->flowflags = FLOW_PKT_TOSERVER;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    FAIL_IF_NOT_NULL(f->protoctx);
+    const TcpSynState *syn = FlowGetStorageById(f, g_tcp_syn_storage_id);
+    FAIL_IF_NULL(syn);
+    FAIL_IF_NOT(syn->isn == 100);
+    FAIL_IF_NOT(StreamTcpCompactSynFlags(f) == TH_SYN);
+    FAIL_IF_NOT(SC_ATOMIC_GET(st_memuse) == memuse + sizeof(TcpSynState));
+
+    /* SYN/ACK */
+    tcph.th_seq = htonl(500);
+    tcph.th_ack = htonl(101);
+    tcph.th_flags = TH_SYN | TH_ACK;
+    p->flowflags = FLOW_PKT_TOCLIENT;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    TcpSession *ssn = f->protoctx;
+    FAIL_IF_NULL(ssn);
+    FAIL_IF_NOT(ssn->state == TCP_SYN_RECV);
+    FAIL_IF_NOT(ssn->client.isn == 100);
+    FAIL_IF_NOT(ssn->server.isn == 500);
+    FAIL_IF_NOT(ssn->client.tcp_flags == TH_SYN);
+    FAIL_IF_NOT(ssn->server.tcp_flags == (TH_SYN | TH_ACK));
+    FAIL_IF_NOT_NULL(FlowGetStorageById(f, g_tcp_syn_storage_id));
+    FAIL_IF_NOT(SC_ATOMIC_GET(st_memuse) == memuse);
+
+    /* ACK */
+    tcph.th_seq = htonl(101);
+    tcph.th_ack = htonl(501);
+    tcph.th_flags = TH_ACK;
+    p->flowflags = FLOW_PKT_TOSERVER;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    FAIL_IF_NOT(ssn->state == TCP_ESTABLISHED);
+
+    SCFree(p);
+    StreamTcpCompactSynTeardown(&stt, f);
+    PASS;
+}
+
+/** \test compact SYN state: a SYN retransmission with a new ISN updates
+ *        the compact state and still doesn't set up a session */
+static int StreamTcpTest47(void)
+{
+    ThreadVars tv;
+    StreamTcpThread stt;
+    TCPHdr tcph;
+    PacketQueueNoLock pq;
+    memset(&pq, 0, sizeof(PacketQueueNoLock));
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&stt, 0, sizeof(StreamTcpThread));
+    memset(&tcph, 0, sizeof(TCPHdr));
+
+    Flow *f = StreamTcpCompactSynSetup(&stt, NULL);
+    FAIL_IF_NULL(f);
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    p->flow = f;
+    p->tcph = &tcph;
+    tcph.th_win = htons(5480);
+    const uint64_t memuse = SC_ATOMIC_GET(st_memuse);
+
+    /* SYN */
+    tcph.th_flags = TH_SYN;
+    tcph.th_seq = htonl(100);
+    p->flowflags = FLOW_PKT_TOSERVER;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    FAIL_IF_NOT_NULL(f->protoctx);
+
+    /* SYN retransmission, new ISN */
+    tcph.th_seq = htonl(200);
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    FAIL_IF_NOT_NULL(f->protoctx);
+    const TcpSynState *syn = FlowGetStorageById(f, g_tcp_syn_storage_id);
+    FAIL_IF_NULL(syn);
+    FAIL_IF_NOT(syn->isn == 200);
+    /* the state is reused, not allocated again */
+    FAIL_IF_NOT(SC_ATOMIC_GET(st_memuse) == memuse + sizeof(TcpSynState));
+
+    /* SYN/ACK for the retransmitted SYN */
+    tcph.th_seq = htonl(500);
+    tcph.th_ack = htonl(201);
+    tcph.th_flags = TH_SYN | TH_ACK;
+    p->flowflags = FLOW_PKT_TOCLIENT;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    TcpSession *ssn = f->protoctx;
+    FAIL_IF_NULL(ssn);
+    FAIL_IF_NOT(ssn->state == TCP_SYN_RECV);
+    FAIL_IF_NOT(ssn->client.isn == 200);
+    FAIL_IF_NOT_NULL(FlowGetStorageById(f, g_tcp_syn_storage_id));
+
+    SCFree(p);
+    StreamTcpCompactSynTeardown(&stt, f);
+    PASS;
+}
+
+/** \test compact SYN state: the memcap is hit when the SYN/ACK promotes
+ *        the flow, the compact state is released and no session is set up */
+static int StreamTcpTest48(void)
+{
+    ThreadVars tv;
+    StreamTcpThread stt;
+    TCPHdr tcph;
+    PacketQueueNoLock pq;
+    memset(&pq, 0, sizeof(PacketQueueNoLock));
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&stt, 0, sizeof(StreamTcpThread));
+    memset(&tcph, 0, sizeof(TCPHdr));
+
+    /* no preallocated sessions, so getting one checks the memcap */
+    Flow *f = StreamTcpCompactSynSetup(&stt, "0");
+    FAIL_IF_NULL(f);
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    p->flow = f;
+    p->tcph = &tcph;
+    tcph.th_win = htons(5480);
+    const uint64_t memuse = SC_ATOMIC_GET(st_memuse);
+
+    /* SYN */
+    tcph.th_flags = TH_SYN;
+    tcph.th_seq = htonl(100);
+    p->flowflags = FLOW_PKT_TOSERVER;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    FAIL_IF_NOT_NULL(f->protoctx);
+    FAIL_IF_NULL(FlowGetStorageById(f, g_tcp_syn_storage_id));
+
+    /* leave no room for the session */
+    const uint64_t memcap = StreamTcpGetMemcap();
+    FAIL_IF_NOT(StreamTcpSetMemcap(SC_ATOMIC_GET(st_memuse) + 1) == 1);
+
+    /* SYN/ACK */
+    tcph.th_seq = htonl(500);
+    tcph.th_ack = htonl(101);
+    tcph.th_flags = TH_SYN | TH_ACK;
+    p->flowflags = FLOW_PKT_TOCLIENT;
+    FAIL_IF_NOT(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    FAIL_IF_NOT_NULL(f->protoctx);
+    FAIL_IF_NOT_NULL(FlowGetStorageById(f, g_tcp_syn_storage_id));
+    FAIL_IF_NOT(SC_ATOMIC_GET(st_memuse) == memuse);
+
+    FAIL_IF_NOT(StreamTcpSetMemcap(memcap) == 1);
+    SCFree(p);
+    StreamTcpCompactSynTeardown(&stt, f);
+    PASS;
+}
+
 void StreamTcpRegisterTests(void)
 {
     UtRegisterTest("StreamTcpTest01 -- TCP session allocation", StreamTcpTest01);
@@ -3455,6 +3655,9 @@ void StreamTcpRegisterTests(void)
     UtRegisterTest("StreamTcpTest43 -- SYN/ACK queue", StreamTcpTest43);
     UtRegisterTest("StreamTcpTest44 -- SYN/ACK queue", StreamTcpTest44);
     UtRegisterTest("StreamTcpTest45 -- SYN/ACK queue", StreamTcpTest45);
+    UtRegisterTest("StreamTcpTest46 -- compact SYN promotion", StreamTcpTest46);
+    UtRegisterTest("StreamTcpTest47 -- compact SYN retransmission", StreamTcpTest47);
+    UtRegisterTest("StreamTcpTest48 -- compact SYN promotion memcap", StreamTcpTest48);
 
     /* set up the reassembly tests as well */
     StreamTcpReassembleRegisterTests();
@@ -51,6 +51,10 @@ typedef struct TmModule_ {
     /** the packet processing function */
     TmEcode (*Func)(ThreadVars *, Packet *, void *);
 
+    /** optional function to process a burst of packets at once. If not
+     *  set, Func is called for each packet of the burst. */
+    TmEcode (*FuncBatch)(ThreadVars *, Packet **, uint16_t, void *);
+
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
     /** terminates the capture loop in PktAcqLoop */
@@ -148,6 +148,84 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p, TmSlot *slot)
                 return TM_ECODE_FAILED;
             }
         }
+        /* held by the stream engine: the rest of the slots are run when
+         * the packet is released by the flow worker */
+        if (p->flags & PKT_STREAM_HELD)
+            break;
+    }
+
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief Run a burst of packets through the slots.
+ *
+ * Each slot processes all packets before the next slot is run, so that
+ * the module code and data stays in the caches. Slots without a burst
+ * function get the packets one by one. Pseudo packets created by a
+ * decoder are run through the rest of the pipeline before the packet
+ * that created them, like in TmThreadsSlotVarRun: the burst is split
+ * at each such packet.
+ */
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *tv, Packet **pkts, uint16_t cnt, TmSlot *slot)
+{
+    for (TmSlot *s = slot; s != NULL; s = s->slot_next) {
+        void *slot_data = SC_ATOMIC_GET(s->slot_data);
+        TmEcode r = TM_ECODE_OK;
+
+        if (s->tm_flags & TM_FLAG_DECODE_TM) {
+            uint16_t start = 0;
+            for (uint16_t i = 0; i < cnt; i++) {
+                Packet *p = pkts[i];
+                PACKET_PROFILING_TMM_START(p, s->tm_id);
+                r = s->SlotFunc(tv, p, slot_data);
+                PACKET_PROFILING_TMM_END(p, s->tm_id);
+                if (unlikely(r == TM_ECODE_FAILED)) {
+                    TmThreadsSlotProcessPktFail(tv, s, NULL);
+                    return TM_ECODE_FAILED;
+                }
+                if (tv->decode_pq.top == NULL)
+                    continue;
+
+                /* packets before this one go first, then the pseudo
+                 * packets, then this packet with the rest of the burst */
+                if (i > start && TmThreadsSlotVarRunBatch(tv, &pkts[start], i - start,
+                                         s->slot_next) != TM_ECODE_OK) {
+                    return TM_ECODE_FAILED;
+                }
+                if (TmThreadsProcessDecodePseudoPackets(tv, &tv->decode_pq, s->slot_next) !=
+                        TM_ECODE_OK) {
+                    return TM_ECODE_FAILED;
+                }
+                start = i;
+            }
+            if (start == 0)
+                continue;
+            return TmThreadsSlotVarRunBatch(tv, &pkts[start], cnt - start, s->slot_next);
+        }
+
+        if (s->SlotFuncBatch != NULL) {
+            r = s->SlotFuncBatch(tv, pkts, cnt, slot_data);
+        } else {
+            for (uint16_t i = 0; i < cnt; i++) {
+                Packet *p = pkts[i];
+                if (p->flags & PKT_STREAM_HELD)
+                    continue;
+                PACKET_PROFILING_TMM_START(p, s->tm_id);
+                r = s->SlotFunc(tv, p, slot_data);
+                PACKET_PROFILING_TMM_END(p, s->tm_id);
+                DEBUG_VALIDATE_BUG_ON(p->flow != NULL);
+                if (unlikely(r == TM_ECODE_FAILED))
+                    break;
+            }
+        }
+
+        /* handle error */
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            /* Encountered error.  Return packets to packetpool and return */
+            TmThreadsSlotProcessPktFail(tv, s, NULL);
+            return TM_ECODE_FAILED;
+        }
     }
 
     return TM_ECODE_OK;
@@ -375,13 +453,16 @@ static void *TmThreadsSlotVar(void *td)
     TmEcode r = TM_ECODE_OK;
 
     CaptureStatsSetup(tv);
-    PacketPoolInit();//Empty();
 
     SCSetThreadName(tv->name);
 
     if (tv->thread_setup_flags != 0)
         TmThreadSetupOptions(tv);
 
+    /* after setting the CPU affinity, so that the packets are allocated
+     * on the NUMA node of the CPU this thread runs on */
+    PacketPoolInit();//Empty();
+
     /* Drop the capabilities for this thread */
     SCDropCaps(tv);
 
@@ -649,6 +730,7 @@ void TmSlotSetFuncAppend(ThreadVars *tv, TmModule *tm, const void *data)
     slot->slot_initdata = data;
     if (tm->Func) {
         slot->SlotFunc = tm->Func;
+        slot->SlotFuncBatch = tm->FuncBatch;
     } else if (tm->PktAcqLoop) {
         slot->PktAcqLoop = tm->PktAcqLoop;
         if (tm->PktAcqBreakLoop) {
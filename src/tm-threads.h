@@ -57,6 +57,9 @@ typedef struct TmSlot_ {
         TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
         TmEcode (*Management)(ThreadVars *, void *);
     };
+    /** optional burst version of SlotFunc, see TmModule::FuncBatch */
+    TmEcode (*SlotFuncBatch)(ThreadVars *, Packet **, uint16_t, void *);
+
     /** linked list of slots, used when a pipeline has multiple slots
      *  in a single thread. */
     struct TmSlot_ *slot_next;
@@ -120,6 +123,7 @@ void TmThreadsUnsetFlag(ThreadVars *, uint32_t);
 void TmThreadWaitForFlag(ThreadVars *, uint32_t);
 
 TmEcode TmThreadsSlotVarRun (ThreadVars *tv, Packet *p, TmSlot *slot);
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *tv, Packet **pkts, uint16_t cnt, TmSlot *slot);
 
 void TmThreadDisablePacketThreads(void);
 void TmThreadDisableReceiveThreads(void);
@@ -210,6 +214,37 @@ static inline TmEcode TmThreadsSlotProcessPkt(ThreadVars *tv, TmSlot *s, Packet
     return TM_ECODE_OK;
 }
 
+/**
+ *  \brief Process a burst of packets through the rest of the functions
+ *         (if any) and queue them.
+ *
+ *  Each slot handles the whole burst before the next slot is run.
+ */
+static inline TmEcode TmThreadsSlotProcessPktBatch(
+        ThreadVars *tv, TmSlot *s, Packet **pkts, const uint16_t cnt)
+{
+    if (s != NULL) {
+        TmEcode r = TmThreadsSlotVarRunBatch(tv, pkts, cnt, s);
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            for (uint16_t i = 0; i < cnt; i++) {
+                /* held packets are still owned by their flow */
+                if (pkts[i]->flags & PKT_STREAM_HELD)
+                    continue;
+                TmThreadsSlotProcessPktFail(tv, s, pkts[i]);
+            }
+            return TM_ECODE_FAILED;
+        }
+    }
+
+    for (uint16_t i = 0; i < cnt; i++) {
+        tv->tmqh_out(tv, pkts[i]);
+    }
+
+    TmThreadsHandleInjectedPackets(tv);
+
+    return TM_ECODE_OK;
+}
+
 /** \brief inject packet if THV_CAPTURE_INJECT_PKT is set
  *  Allow caller to supply their own packet
  *
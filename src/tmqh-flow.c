@@ -96,7 +96,7 @@ void TmqhFlowPrintAutofpHandler(void)
 #undef PRINT_IF_FUNC
 }
 
-/* same as 'simple' */
+/* same as 'simple', but prefetches for the flow lookup */
 Packet *TmqhInputFlow(ThreadVars *tv)
 {
     PacketQueue *q = tv->inq->pq;
@@ -111,6 +111,16 @@ Packet *TmqhInputFlow(ThreadVars *tv)
 
     if (q->len > 0) {
         Packet *p = PacketDequeue(q);
+        /* software pipeline the flow lookups of the packets waiting in the
+         * queue: the next packet's hash row should be in cache by now, so
+         * prefetch its first flow, and start loading the row of the one
+         * after it. */
+        if (q->bot != NULL) {
+            FlowPrefetchHead(q->bot);
+            if (q->bot->prev != NULL) {
+                FlowPrefetchBucket(q->bot->prev);
+            }
+        }
         SCMutexUnlock(&q->mutex_q);
         return p;
     } else {
@@ -337,6 +337,11 @@ void TmqhOutputPacketpool(ThreadVars *t, Packet *p)
     SCEnter();
     SCLogDebug("Packet %p, p->root %p, alloced %s", p, p->root, BOOL2STR(p->pool == NULL));
 
+    /* packet held by the stream engine, it's released by the flow worker */
+    if (p->flags & PKT_STREAM_HELD) {
+        SCReturn;
+    }
+
     if (IS_TUNNEL_PKT(p)) {
         SCLogDebug("Packet %p is a tunnel packet: %s",
             p,p->root ? "upper layer" : "tunnel root");
@@ -31,6 +31,10 @@
 #include "util-byte.h"
 #include "util-debug.h"
 
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
 ThreadsAffinityType thread_affinity[MAX_CPU_SET] = {
     {
         .name = "receive-cpu-set",
@@ -362,3 +366,67 @@ void UtilAffinityCpusExclude(ThreadsAffinityType *mod_taf, ThreadsAffinityType *
     SCMutexUnlock(&mod_taf->taf_mutex);
 }
 #endif /* HAVE_DPDK */
+
+/**
+ * \brief Return the number of NUMA nodes in the system
+ *
+ * \retval nodes number of nodes, 1 if NUMA support is not available
+ */
+uint16_t UtilAffinityGetNumaNodeCount(void)
+{
+#if defined(HAVE_LIBNUMA) && defined(__linux__)
+    if (numa_available() != -1) {
+        const int max = numa_max_node();
+        if (max > 0)
+            return (uint16_t)(max + 1);
+    }
+#endif
+    return 1;
+}
+
+/**
+ * \brief Return the NUMA node of the CPU the calling thread runs on
+ *
+ * Meant to be called after the thread's CPU affinity has been set up.
+ *
+ * \retval node NUMA node, 0 if NUMA support is not available
+ */
+uint16_t UtilAffinityGetNumaNode(void)
+{
+#if defined(HAVE_LIBNUMA) && defined(__linux__)
+    if (numa_available() != -1) {
+        const int cpu = sched_getcpu();
+        if (cpu >= 0) {
+            const int node = numa_node_of_cpu(cpu);
+            if (node >= 0)
+                return (uint16_t)node;
+        }
+    }
+#endif
+    return 0;
+}
+
+/**
+ * \brief Have the calling thread's allocations prefer a NUMA node
+ *
+ * Used to allocate memory on behalf of threads running on another node.
+ * Undo with UtilAffinityResetNumaPreferred().
+ */
+void UtilAffinitySetNumaPreferred(uint16_t node)
+{
+#if defined(HAVE_LIBNUMA) && defined(__linux__)
+    if (numa_available() != -1)
+        numa_set_preferred((int)node);
+#endif
+}
+
+/**
+ * \brief Restore the default local allocation policy
+ */
+void UtilAffinityResetNumaPreferred(void)
+{
+#if defined(HAVE_LIBNUMA) && defined(__linux__)
+    if (numa_available() != -1)
+        numa_set_localalloc();
+#endif
+}
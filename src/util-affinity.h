@@ -93,6 +93,11 @@ uint16_t UtilAffinityCpusOverlap(ThreadsAffinityType *taf1, ThreadsAffinityType
 void UtilAffinityCpusExclude(ThreadsAffinityType *mod_taf, ThreadsAffinityType *static_taf);
 #endif /* HAVE_DPDK */
 
+uint16_t UtilAffinityGetNumaNodeCount(void);
+uint16_t UtilAffinityGetNumaNode(void);
+void UtilAffinitySetNumaPreferred(uint16_t node);
+void UtilAffinityResetNumaPreferred(void);
+
 void BuildCpusetWithCallback(const char *name, ConfNode *node,
                              void (*Callback)(int i, void * data),
                              void *data);
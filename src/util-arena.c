@@ -0,0 +1,367 @@
+/* Copyright (C) 2024 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hugepage backed arena for fixed size objects.
+ *
+ * At init a single range of virtual memory is reserved. It is backed on
+ * demand by 2MB or 1GB hugepages, or if no hugepages are available, by
+ * regular pages with a transparent hugepage hint. Each object type gets
+ * its own SCArena that carves slabs out of this range and keeps a free
+ * list of returned objects. Memory is never given back to the OS until
+ * shutdown.
+ *
+ * Callers keep doing their own memcap accounting. If the arena is
+ * disabled or exhausted SCArenaAlloc returns NULL and the caller is
+ * expected to fall back to regular allocation. SCArenaOwns tells both
+ * apart at free time.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-arena.h"
+#include "util-debug.h"
+#include "util-misc.h"
+#include "util-validate.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#ifdef MAP_HUGETLB
+#define ARENA_SUPPORTED 1
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+#endif
+
+#define ARENA_PAGE_SIZE_2MB (2UL * 1024 * 1024)
+#define ARENA_PAGE_SIZE_1GB (1024UL * 1024 * 1024)
+/** size of the blocks handed to the per type arenas. Divides both
+ *  page sizes. */
+#define ARENA_SLAB_SIZE     (256UL * 1024)
+#define ARENA_DEFAULT_SIZE  (1024UL * 1024 * 1024)
+#define ARENA_MAX           8
+
+struct SCArena_ {
+    const char *name;
+    size_t obj_size;
+    SCMutex m;
+    /** objects returned to the arena, linked through their first bytes */
+    void *free_list;
+    /** unused part of the current slab */
+    uint8_t *cur;
+    uint8_t *end;
+};
+
+static struct {
+    bool enabled;
+    size_t page_size;
+    /** mapping as returned by mmap, for munmap at shutdown */
+    void *map;
+    size_t map_len;
+    /** page aligned usable range */
+    uint8_t *start;
+    uint8_t *stop;
+    /** end of the part backed by memory */
+    uint8_t *mapped;
+    /** start of the part not handed out as slabs yet */
+    uint8_t *bump;
+    SCMutex m;
+    SCArena arenas[ARENA_MAX];
+    uint32_t arena_cnt;
+} arena_ctx = { .m = SCMUTEX_INITIALIZER };
+
+static SC_ATOMIC_DECLARE(uint64_t, arena_hugepages);
+static SC_ATOMIC_DECLARE(uint64_t, arena_thp);
+static SC_ATOMIC_DECLARE(uint64_t, arena_fallbacks);
+
+static uint64_t ArenaHugepagesCounter(void)
+{
+    return SC_ATOMIC_GET(arena_hugepages);
+}
+
+static uint64_t ArenaThpCounter(void)
+{
+    return SC_ATOMIC_GET(arena_thp);
+}
+
+static uint64_t ArenaFallbacksCounter(void)
+{
+    return SC_ATOMIC_GET(arena_fallbacks);
+}
+
+/**
+ * \brief Setup the arena from the "hugepage-arena" config section.
+ *
+ * Safe to call multiple times, only the first call has effect.
+ */
+void SCArenaInit(void)
+{
+    if (arena_ctx.enabled)
+        return;
+
+    int enabled = 0;
+    if (ConfGetBool("hugepage-arena.enabled", &enabled) != 1 || !enabled)
+        return;
+
+#ifdef ARENA_SUPPORTED
+    uint64_t size = ARENA_DEFAULT_SIZE;
+    const char *str = NULL;
+    if (ConfGet("hugepage-arena.size", &str) == 1 && str != NULL) {
+        if (ParseSizeStringU64(str, &size) < 0 || size == 0) {
+            FatalError("invalid value for hugepage-arena.size: %s", str);
+        }
+    }
+    size_t page_size = ARENA_PAGE_SIZE_2MB;
+    if (ConfGet("hugepage-arena.page-size", &str) == 1 && str != NULL) {
+        if (strcasecmp(str, "2mb") == 0) {
+            page_size = ARENA_PAGE_SIZE_2MB;
+        } else if (strcasecmp(str, "1gb") == 0) {
+            page_size = ARENA_PAGE_SIZE_1GB;
+        } else {
+            FatalError("invalid value for hugepage-arena.page-size: %s "
+                       "(expected 2mb or 1gb)",
+                    str);
+        }
+    }
+    /* round up to whole pages */
+    size = ((size + page_size - 1) / page_size) * page_size;
+
+    /* reserve address space only, with room to align to the page size */
+    const size_t map_len = size + page_size;
+    void *map = mmap(NULL, map_len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        SCLogWarning("hugepage-arena: reserving %" PRIu64 " bytes failed: %s", (uint64_t)size,
+                strerror(errno));
+        return;
+    }
+
+    arena_ctx.page_size = page_size;
+    arena_ctx.map = map;
+    arena_ctx.map_len = map_len;
+    arena_ctx.start = (uint8_t *)(((uintptr_t)map + page_size - 1) & ~(uintptr_t)(page_size - 1));
+    arena_ctx.stop = arena_ctx.start + size;
+    arena_ctx.mapped = arena_ctx.start;
+    arena_ctx.bump = arena_ctx.start;
+    arena_ctx.enabled = true;
+
+    SC_ATOMIC_INIT(arena_hugepages);
+    SC_ATOMIC_INIT(arena_thp);
+    SC_ATOMIC_INIT(arena_fallbacks);
+    StatsRegisterGlobalCounter("memory.arena.hugepages", ArenaHugepagesCounter);
+    StatsRegisterGlobalCounter("memory.arena.thp", ArenaThpCounter);
+    StatsRegisterGlobalCounter("memory.arena.fallbacks", ArenaFallbacksCounter);
+
+    SCLogConfig("hugepage-arena: reserved %" PRIu64 " bytes using %s pages", (uint64_t)size,
+            page_size == ARENA_PAGE_SIZE_1GB ? "1gb" : "2mb");
+#else
+    SCLogWarning("hugepage-arena is not supported on this platform");
+#endif
+}
+
+void SCArenaDestroy(void)
+{
+#ifdef ARENA_SUPPORTED
+    if (!arena_ctx.enabled)
+        return;
+
+    for (uint32_t i = 0; i < arena_ctx.arena_cnt; i++) {
+        SCMutexDestroy(&arena_ctx.arenas[i].m);
+    }
+    munmap(arena_ctx.map, arena_ctx.map_len);
+    memset(&arena_ctx.arenas, 0, sizeof(arena_ctx.arenas));
+    arena_ctx.arena_cnt = 0;
+    arena_ctx.start = arena_ctx.stop = NULL;
+    arena_ctx.enabled = false;
+#endif
+}
+
+/**
+ * \brief Get an arena for objects of a type.
+ *
+ * Arenas are looked up by name, so calling this again for the same
+ * type, e.g. after a reinit in unix socket mode, returns the same
+ * arena with its free list intact.
+ *
+ * \param name static string naming the object type
+ * \param obj_size size of the objects, rounded up to the cache line size
+ *
+ * \retval a arena or NULL if the arena is disabled or can't hold the
+ *           objects, in which case the caller uses the regular allocator
+ */
+SCArena *SCArenaCreate(const char *name, size_t obj_size)
+{
+    if (!arena_ctx.enabled)
+        return NULL;
+
+    obj_size = ((obj_size + CLS - 1) / CLS) * CLS;
+    /* object sizes depend on the config, e.g. the flow storage in use */
+    if (obj_size > ARENA_SLAB_SIZE) {
+        SCLogWarning("arena: %s objects of %" PRIuMAX " bytes don't fit a slab, "
+                     "using the regular allocator for them",
+                name, (uintmax_t)obj_size);
+        return NULL;
+    }
+
+    SCArena *a = NULL;
+    SCMutexLock(&arena_ctx.m);
+    for (uint32_t i = 0; i < arena_ctx.arena_cnt; i++) {
+        if (strcmp(arena_ctx.arenas[i].name, name) == 0) {
+            a = &arena_ctx.arenas[i];
+            if (a->obj_size != obj_size) {
+                /* objects already in the arena have the old size */
+                SCLogWarning("arena: %s object size changed from %" PRIuMAX " to %" PRIuMAX
+                             " bytes, using the regular allocator for them",
+                        name, (uintmax_t)a->obj_size, (uintmax_t)obj_size);
+                SCMutexUnlock(&arena_ctx.m);
+                return NULL;
+            }
+            break;
+        }
+    }
+    if (a == NULL && arena_ctx.arena_cnt < ARENA_MAX) {
+        a = &arena_ctx.arenas[arena_ctx.arena_cnt++];
+        a->name = name;
+        a->obj_size = obj_size;
+        SCMutexInit(&a->m, NULL);
+        SCLogDebug("arena %s created for objects of %" PRIuMAX " bytes", name, (uintmax_t)obj_size);
+    }
+    SCMutexUnlock(&arena_ctx.m);
+    return a;
+}
+
+#ifdef ARENA_SUPPORTED
+/** \internal
+ *  \brief back the next page of the reserved range with memory
+ *
+ *  Hugetlb pages are tried first. If the pool of hugepages is empty
+ *  regular memory is mapped and the kernel is asked to use transparent
+ *  hugepages for it.
+ *
+ *  \note arena_ctx.m must be held */
+static bool ArenaMapPage(void)
+{
+    if (arena_ctx.mapped + arena_ctx.page_size > arena_ctx.stop)
+        return false;
+
+    const int huge_flag =
+            arena_ctx.page_size == ARENA_PAGE_SIZE_1GB ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+    void *ptr = mmap(arena_ctx.mapped, arena_ctx.page_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB | huge_flag, -1, 0);
+    if (ptr != MAP_FAILED) {
+        (void)SC_ATOMIC_ADD(arena_hugepages, arena_ctx.page_size);
+    } else {
+        /* a failed MAP_FIXED mmap may leave a hole in the reservation,
+         * so map over it again instead of just changing the protection */
+        ptr = mmap(arena_ctx.mapped, arena_ctx.page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (ptr == MAP_FAILED)
+            return false;
+#ifdef MADV_HUGEPAGE
+        (void)madvise(ptr, arena_ctx.page_size, MADV_HUGEPAGE);
+#endif
+        (void)SC_ATOMIC_ADD(arena_thp, arena_ctx.page_size);
+    }
+    arena_ctx.mapped += arena_ctx.page_size;
+    return true;
+}
+#endif
+
+/** \internal
+ *  \brief get a new slab for an arena */
+static uint8_t *ArenaGetSlab(void)
+{
+    uint8_t *slab = NULL;
+#ifdef ARENA_SUPPORTED
+    SCMutexLock(&arena_ctx.m);
+    if (arena_ctx.bump + ARENA_SLAB_SIZE <= arena_ctx.mapped || ArenaMapPage()) {
+        slab = arena_ctx.bump;
+        arena_ctx.bump += ARENA_SLAB_SIZE;
+    }
+    SCMutexUnlock(&arena_ctx.m);
+#endif
+    return slab;
+}
+
+/**
+ * \brief Get an object from the arena.
+ *
+ * The memory is not cleared.
+ *
+ * \retval ptr object or NULL if the arena is disabled or out of space
+ */
+void *SCArenaAlloc(SCArena *a)
+{
+    if (a == NULL)
+        return NULL;
+
+    void *ptr = NULL;
+    SCMutexLock(&a->m);
+    if (a->free_list != NULL) {
+        ptr = a->free_list;
+        a->free_list = *(void **)ptr;
+    } else {
+        if (a->cur + a->obj_size > a->end) {
+            /* the tail of the old slab is lost, it's smaller than an object */
+            uint8_t *slab = ArenaGetSlab();
+            if (slab != NULL) {
+                a->cur = slab;
+                a->end = slab + ARENA_SLAB_SIZE;
+            }
+        }
+        if (a->cur + a->obj_size <= a->end) {
+            ptr = a->cur;
+            a->cur += a->obj_size;
+        }
+    }
+    SCMutexUnlock(&a->m);
+
+    if (ptr == NULL)
+        (void)SC_ATOMIC_ADD(arena_fallbacks, 1);
+    return ptr;
+}
+
+/**
+ * \brief Return an object to its arena.
+ */
+void SCArenaFree(SCArena *a, void *ptr)
+{
+    DEBUG_VALIDATE_BUG_ON(!SCArenaOwns(ptr));
+
+    SCMutexLock(&a->m);
+    *(void **)ptr = a->free_list;
+    a->free_list = ptr;
+    SCMutexUnlock(&a->m);
+}
+
+/**
+ * \brief Check if memory was handed out by the arena.
+ */
+bool SCArenaOwns(const void *ptr)
+{
+    const uint8_t *p = ptr;
+    return (p >= arena_ctx.start && p < arena_ctx.stop);
+}
@@ -0,0 +1,37 @@
+/* Copyright (C) 2024 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hugepage backed arena for fixed size objects.
+ */
+
+#ifndef __UTIL_ARENA_H__
+#define __UTIL_ARENA_H__
+
+typedef struct SCArena_ SCArena;
+
+void SCArenaInit(void);
+void SCArenaDestroy(void);
+
+SCArena *SCArenaCreate(const char *name, size_t obj_size);
+void *SCArenaAlloc(SCArena *a);
+void SCArenaFree(SCArena *a, void *ptr);
+bool SCArenaOwns(const void *ptr);
+
+#endif /* __UTIL_ARENA_H__ */
@@ -28,6 +28,7 @@
 #include "util-landlock.h"
 #include "util-mem.h"
 #include "util-path.h"
+#include "util-mpm-hs-cache.h"
 
 #ifndef HAVE_LINUX_LANDLOCK_H
 
@@ -244,6 +245,13 @@ void LandlockSandboxing(SCInstance *suri)
             LandlockSandboxingWritePath(ruleset, LOCAL_STATE_DIR "/run/suricata/");
         }
     }
+#ifdef BUILD_HYPERSCAN
+    const char *cache_path = MpmHSCachePath();
+    if (cache_path != NULL && stat(cache_path, &sb) == 0) {
+        LandlockSandboxingAddRule(
+                ruleset, cache_path, _LANDLOCK_SURI_ACCESS_FS_WRITE | _LANDLOCK_ACCESS_FS_READ);
+    }
+#endif
     if (!suri->sig_file_exclusive) {
         const char *rule_path;
         if (ConfGet("default-rule-path", &rule_path) == 1 && rule_path) {
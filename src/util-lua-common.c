@@ -476,8 +476,8 @@ static int LuaCallbackAppLayerProtoFlow(lua_State *luastate)
     r = LuaCallbackAppLayerProtoPushToStackFromFlow(luastate, f->alproto);
     r += LuaCallbackAppLayerProtoPushToStackFromFlow(luastate, f->alproto_ts);
     r += LuaCallbackAppLayerProtoPushToStackFromFlow(luastate, f->alproto_tc);
-    r += LuaCallbackAppLayerProtoPushToStackFromFlow(luastate, f->alproto_orig);
-    r += LuaCallbackAppLayerProtoPushToStackFromFlow(luastate, f->alproto_expect);
+    r += LuaCallbackAppLayerProtoPushToStackFromFlow(luastate, FlowColdGet(f)->alproto_orig);
+    r += LuaCallbackAppLayerProtoPushToStackFromFlow(luastate, FlowColdGet(f)->alproto_expect);
 
     return r;
 }
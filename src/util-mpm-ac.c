@@ -71,6 +71,9 @@ int SCACAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCACPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen);
+uint32_t SCACSearchStateful(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen, uint32_t start,
+        uint32_t *state);
 void SCACPrintInfo(MpmCtx *mpm_ctx);
 void SCACRegisterTests(void);
 
@@ -932,8 +935,8 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
  *
  * \retval matches Match count: counts unique matches per pattern.
  */
-uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
-                    PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen)
+static inline uint32_t SCACSearchDo(const MpmCtx *mpm_ctx, PrefilterRuleStore *pmq,
+        const uint8_t *buf, const uint32_t buflen, const uint32_t start, uint32_t *state_io)
 {
     const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
     uint32_t i = 0;
@@ -941,16 +944,15 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
 
     /* \todo tried loop unrolling with register var, with no perf increase.  Need
      * to dig deeper */
-    /* \todo Change it for stateful MPM.  Supply the state using mpm_thread_ctx */
     const SCACPatternList *pid_pat_list = ctx->pid_pat_list;
 
     uint8_t bitarray[ctx->pattern_id_bitarray_size];
     memset(bitarray, 0, ctx->pattern_id_bitarray_size);
 
     if (ctx->state_count < 32767) {
-        register SC_AC_STATE_TYPE_U16 state = 0;
+        register SC_AC_STATE_TYPE_U16 state = (SC_AC_STATE_TYPE_U16)*state_io;
         SC_AC_STATE_TYPE_U16 (*state_table_u16)[256] = ctx->state_table_u16;
-        for (i = 0; i < buflen; i++) {
+        for (i = start; i < buflen; i++) {
             state = state_table_u16[state & 0x7FFF][u8_tolower(buf[i])];
             if (state & 0x8000) {
                 uint32_t no_of_entries = ctx->output_table[state & 0x7FFF].no_of_entries;
@@ -998,10 +1000,12 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
             }
         } /* for (i = 0; i < buflen; i++) */
 
+        *state_io = state;
+
     } else {
-        register SC_AC_STATE_TYPE_U32 state = 0;
+        register SC_AC_STATE_TYPE_U32 state = *state_io;
         SC_AC_STATE_TYPE_U32 (*state_table_u32)[256] = ctx->state_table_u32;
-        for (i = 0; i < buflen; i++) {
+        for (i = start; i < buflen; i++) {
             state = state_table_u32[state & 0x00FFFFFF][u8_tolower(buf[i])];
             if (state & 0xFF000000) {
                 uint32_t no_of_entries = ctx->output_table[state & 0x00FFFFFF].no_of_entries;
@@ -1048,11 +1052,46 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                 }
             }
         } /* for (i = 0; i < buflen; i++) */
+        *state_io = state;
     }
 
     return matches;
 }
 
+uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                    PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen)
+{
+    uint32_t state = 0;
+    return SCACSearchDo(mpm_ctx, pmq, buf, buflen, 0, &state);
+}
+
+/**
+ * \brief Stateful aho corasick search, to continue a search on data that
+ *        follows data that was searched earlier.
+ *
+ * Scanning starts at \a start with the automaton in \a state. The bytes
+ * before \a start are only used to verify case sensitive matches and
+ * pattern offsets, so the caller should make sure at least maxlen - 1 of
+ * the earlier bytes are included in \a buf.
+ *
+ * \param start  offset in \a buf to start scanning at
+ * \param state  in: state after scanning the data before \a start, 0 to
+ *               start fresh. out: state after scanning \a buf.
+ *
+ * \retval matches Match count: counts unique matches per pattern.
+ */
+uint32_t SCACSearchStateful(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen, uint32_t start,
+        uint32_t *state)
+{
+    const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    const uint32_t mask = ctx->state_count < 32767 ? 0x7FFF : 0x00FFFFFF;
+    /* the state may come from an older version of this ctx */
+    if ((*state & mask) >= ctx->state_count)
+        *state = 0;
+    return SCACSearchDo(mpm_ctx, pmq, buf, buflen, start, state);
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1138,6 +1177,7 @@ void MpmACRegister(void)
     mpm_table[MPM_AC].AddPatternNocase = SCACAddPatternCI;
     mpm_table[MPM_AC].Prepare = SCACPreparePatterns;
     mpm_table[MPM_AC].Search = SCACSearch;
+    mpm_table[MPM_AC].SearchStateful = SCACSearchStateful;
     mpm_table[MPM_AC].PrintCtx = SCACPrintInfo;
     mpm_table[MPM_AC].RegisterUnittests = SCACRegisterTests;
 
@@ -2121,6 +2161,48 @@ end:
     return result;
 }
 
+/** \test stateful search continuing on the next chunk of data, with
+ *        matches straddling the chunk edge */
+static int SCACTest30(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"wxyz", 4, 0, 0, 1, 0, 0);
+    PmqSetup(&pmq);
+    SCACPreparePatterns(&mpm_ctx);
+
+    /* first chunk ends in the middle of both patterns */
+    uint32_t state = 0;
+    const char *buf1 = "0123456ab";
+    uint32_t cnt = SCACSearchStateful(
+            &mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf1, strlen(buf1), 0, &state);
+    FAIL_IF_NOT(cnt == 0);
+
+    /* next chunk overlaps the first: scanning starts after the old data */
+    const char *buf2 = "3456abcd";
+    cnt = SCACSearchStateful(
+            &mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf2, strlen(buf2), 6, &state);
+    FAIL_IF_NOT(cnt == 1);
+
+    /* case insensitive pattern straddling the edge, no lookback */
+    state = 0;
+    cnt = SCACSearchStateful(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)"xxWX", 4, 0, &state);
+    FAIL_IF_NOT(cnt == 0);
+    cnt = SCACSearchStateful(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)"WXyZ", 4, 2, &state);
+    FAIL_IF_NOT(cnt == 1);
+
+    SCACDestroyCtx(&mpm_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCACRegisterTests(void)
@@ -2156,6 +2238,7 @@ void SCACRegisterTests(void)
     UtRegisterTest("SCACTest27", SCACTest27);
     UtRegisterTest("SCACTest28", SCACTest28);
     UtRegisterTest("SCACTest29", SCACTest29);
+    UtRegisterTest("SCACTest30", SCACTest30);
 #endif
 
     return;
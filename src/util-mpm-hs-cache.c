@@ -0,0 +1,559 @@
+/* Copyright (C) 2024 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * On disk cache of compiled Hyperscan databases.
+ *
+ * Compiling the databases of a large ruleset can take a large part of the
+ * startup and reload time. The serialized databases are stored in a directory,
+ * one file per database, named after a key computed by the caller from
+ * everything that goes into the compiler: the patterns with their flags
+ * and extended parameters, the mode, the Hyperscan version and the
+ * features of the CPU the database is built for.
+ *
+ * Files that are loaded have their modification time updated, so that
+ * entries not used for longer than the configured max age can be pruned.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-debug.h"
+#include "util-path.h"
+#include "util-time.h"
+#include "util-mpm-hs-cache.h"
+
+#ifdef BUILD_HYPERSCAN
+
+#include <utime.h>
+
+/** bump when the layout of the cache files changes */
+#define HS_CACHE_VERSION "v1"
+#define HS_CACHE_SUFFIX  "_" HS_CACHE_VERSION ".hs"
+
+#define HS_CACHE_DEFAULT_MAX_AGE (7 * 24 * 60 * 60)
+
+static struct {
+    SCMutex m;
+    bool configured;
+    bool enabled;
+    /** directory was created or found to exist */
+    bool dir_ready;
+    char path[PATH_MAX];
+    uint64_t max_age; /**< seconds, 0 means entries are never pruned */
+} hs_cache = { .m = SCMUTEX_INITIALIZER };
+
+static SC_ATOMIC_DECLARE(uint64_t, hs_cache_hits);
+static SC_ATOMIC_DECLARE(uint64_t, hs_cache_misses);
+
+static uint64_t HSCacheHitsCounter(void)
+{
+    return SC_ATOMIC_GET(hs_cache_hits);
+}
+
+static uint64_t HSCacheMissesCounter(void)
+{
+    return SC_ATOMIC_GET(hs_cache_misses);
+}
+
+/** \internal
+ *  \brief read the "detect.sgh-mpm-caching" settings
+ *
+ *  \note hs_cache.m must be held */
+static void HSCacheConfigure(void)
+{
+    if (hs_cache.configured)
+        return;
+    hs_cache.configured = true;
+
+    int enabled = 0;
+    if (ConfGetBool("detect.sgh-mpm-caching", &enabled) != 1 || !enabled)
+        return;
+
+    const char *path = NULL;
+    if (ConfGet("detect.sgh-mpm-caching-path", &path) != 1 || path == NULL || *path == '\0') {
+        path = SGH_CACHE_DIR;
+    }
+    if (strlcpy(hs_cache.path, path, sizeof(hs_cache.path)) >= sizeof(hs_cache.path)) {
+        SCLogWarning("detect.sgh-mpm-caching-path too long, caching disabled");
+        return;
+    }
+
+    hs_cache.max_age = HS_CACHE_DEFAULT_MAX_AGE;
+    const char *age = NULL;
+    if (ConfGet("detect.sgh-mpm-caching-max-age", &age) == 1 && age != NULL) {
+        if (strcmp(age, "0") == 0) {
+            hs_cache.max_age = 0;
+        } else {
+            hs_cache.max_age = SCParseTimeSizeString(age);
+            if (hs_cache.max_age == 0) {
+                FatalError("invalid value for detect.sgh-mpm-caching-max-age: %s", age);
+            }
+        }
+    }
+
+    hs_cache.enabled = true;
+    SCLogConfig("hyperscan database cache in %s, max age %" PRIu64 "s", hs_cache.path,
+            hs_cache.max_age);
+}
+
+/**
+ * \brief Setup the cache and its counters.
+ *
+ * Safe to call multiple times.
+ */
+void MpmHSCacheInit(void)
+{
+    SCMutexLock(&hs_cache.m);
+    HSCacheConfigure();
+    const bool enabled = hs_cache.enabled;
+    SCMutexUnlock(&hs_cache.m);
+
+    if (enabled) {
+        StatsRegisterGlobalCounter("detect.mpm_cache.hits", HSCacheHitsCounter);
+        StatsRegisterGlobalCounter("detect.mpm_cache.misses", HSCacheMissesCounter);
+    }
+}
+
+bool MpmHSCacheEnabled(void)
+{
+    SCMutexLock(&hs_cache.m);
+    HSCacheConfigure();
+    const bool enabled = hs_cache.enabled;
+    SCMutexUnlock(&hs_cache.m);
+    return enabled;
+}
+
+/**
+ * \brief Get the cache directory.
+ *
+ * \retval path directory or NULL if caching is disabled
+ */
+const char *MpmHSCachePath(void)
+{
+    return MpmHSCacheEnabled() ? hs_cache.path : NULL;
+}
+
+static int HSCacheFilePath(char *out, size_t out_len, const char *key)
+{
+    char fname[HS_CACHE_KEY_LEN + sizeof(HS_CACHE_SUFFIX)];
+    snprintf(fname, sizeof(fname), "%s%s", key, HS_CACHE_SUFFIX);
+    return PathMerge(out, out_len, hs_cache.path, fname);
+}
+
+/**
+ * \brief Load a database from the cache.
+ *
+ * \param key cache key of the database
+ *
+ * \retval db database or NULL if it is not in the cache or can't be used
+ */
+hs_database_t *MpmHSCacheLoad(const char *key)
+{
+    char path[PATH_MAX];
+    if (HSCacheFilePath(path, sizeof(path), key) < 0)
+        goto miss;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        goto miss;
+
+    hs_database_t *db = NULL;
+    char *bytes = NULL;
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size <= 0) {
+        goto error;
+    }
+    bytes = SCMalloc((size_t)st.st_size);
+    if (bytes == NULL)
+        goto error;
+    if (fread(bytes, 1, (size_t)st.st_size, fp) != (size_t)st.st_size) {
+        goto error;
+    }
+    /* fails for databases built by another Hyperscan version or for
+     * a platform this CPU doesn't support */
+    hs_error_t err = hs_deserialize_database(bytes, (size_t)st.st_size, &db);
+    if (err != HS_SUCCESS) {
+        SCLogDebug("can't deserialize %s: error %d", path, err);
+        db = NULL;
+        goto error;
+    }
+    SCFree(bytes);
+    fclose(fp);
+
+    /* keep used entries from being pruned */
+    (void)utime(path, NULL);
+
+    SCLogDebug("loaded database from %s", path);
+    (void)SC_ATOMIC_ADD(hs_cache_hits, 1);
+    return db;
+
+error:
+    SCFree(bytes);
+    fclose(fp);
+miss:
+    (void)SC_ATOMIC_ADD(hs_cache_misses, 1);
+    return NULL;
+}
+
+/**
+ * \brief Store a database in the cache.
+ *
+ * The file is written under a unique temporary name and renamed, so that
+ * other threads or instances sharing the directory never see a partial
+ * file and never write to the same temporary file.
+ *
+ * \param key cache key of the database
+ * \param db compiled database
+ */
+void MpmHSCacheSave(const char *key, const hs_database_t *db)
+{
+    SCMutexLock(&hs_cache.m);
+    if (!hs_cache.dir_ready) {
+        if (SCCreateDirectoryTree(hs_cache.path, true) != 0) {
+            SCLogWarning("failed to create the hyperscan cache directory %s", hs_cache.path);
+            SCMutexUnlock(&hs_cache.m);
+            return;
+        }
+        hs_cache.dir_ready = true;
+    }
+    SCMutexUnlock(&hs_cache.m);
+
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 8];
+    if (HSCacheFilePath(path, sizeof(path), key) < 0)
+        return;
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+    char *bytes = NULL;
+    size_t len = 0;
+    if (hs_serialize_database(db, &bytes, &len) != HS_SUCCESS) {
+        SCLogWarning("failed to serialize hyperscan database");
+        return;
+    }
+
+    const int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        SCLogWarning("failed to create a temporary file for %s: %s", path, strerror(errno));
+        SCFree(bytes);
+        return;
+    }
+    /* mkstemp creates the file readable by the owner only */
+    (void)fchmod(fd, 0644);
+    FILE *fp = fdopen(fd, "wb");
+    if (fp == NULL) {
+        SCLogWarning("failed to open %s: %s", tmp_path, strerror(errno));
+        close(fd);
+        (void)unlink(tmp_path);
+        SCFree(bytes);
+        return;
+    }
+    const bool written = (fwrite(bytes, 1, len, fp) == len);
+    if (fclose(fp) != 0 || !written || rename(tmp_path, path) != 0) {
+        SCLogWarning("failed to write %s: %s", path, strerror(errno));
+        (void)unlink(tmp_path);
+    } else {
+        SCLogDebug("stored database in %s", path);
+    }
+    SCFree(bytes);
+}
+
+/**
+ * \brief Remove cache entries that weren't used for longer than the max age.
+ */
+void MpmHSCachePrune(void)
+{
+    SCMutexLock(&hs_cache.m);
+    HSCacheConfigure();
+    if (!hs_cache.enabled || hs_cache.max_age == 0) {
+        SCMutexUnlock(&hs_cache.m);
+        return;
+    }
+
+    DIR *dir = opendir(hs_cache.path);
+    if (dir == NULL) {
+        SCMutexUnlock(&hs_cache.m);
+        return;
+    }
+
+    const time_t now = time(NULL);
+    uint32_t pruned = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        /* also matches temporary files left behind by a crash */
+        if (strstr(de->d_name, HS_CACHE_SUFFIX) == NULL)
+            continue;
+
+        char path[PATH_MAX];
+        if (PathMerge(path, sizeof(path), hs_cache.path, de->d_name) < 0)
+            continue;
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        if (now > st.st_mtime && (uint64_t)(now - st.st_mtime) > hs_cache.max_age) {
+            if (unlink(path) == 0)
+                pruned++;
+        }
+    }
+    closedir(dir);
+    SCMutexUnlock(&hs_cache.m);
+
+    if (pruned > 0) {
+        SCLogInfo("removed %u stale hyperscan cache entries from %s", pruned, hs_cache.path);
+    }
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+#define HS_CACHE_TEST_KEY1 "00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff"
+#define HS_CACHE_TEST_KEY2 "ffeeddccbbaa99887766554433221100ffeeddccbbaa99887766554433221100"
+
+/** \internal
+ *  \brief point the cache at a new temporary directory */
+static bool HSCacheTestSetup(char *dir, uint64_t max_age)
+{
+    if (mkdtemp(dir) == NULL)
+        return false;
+
+    SCMutexLock(&hs_cache.m);
+    hs_cache.configured = true;
+    hs_cache.enabled = true;
+    hs_cache.dir_ready = false;
+    strlcpy(hs_cache.path, dir, sizeof(hs_cache.path));
+    hs_cache.max_age = max_age;
+    SCMutexUnlock(&hs_cache.m);
+    return true;
+}
+
+/** \internal
+ *  \brief remove the temporary directory and reset the cache settings */
+static void HSCacheTestTeardown(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d != NULL) {
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            char path[PATH_MAX];
+            if (de->d_name[0] == '.')
+                continue;
+            if (PathMerge(path, sizeof(path), dir, de->d_name) == 0)
+                (void)unlink(path);
+        }
+        closedir(d);
+    }
+    (void)rmdir(dir);
+
+    SCMutexLock(&hs_cache.m);
+    memset(hs_cache.path, 0, sizeof(hs_cache.path));
+    hs_cache.configured = false;
+    hs_cache.enabled = false;
+    hs_cache.dir_ready = false;
+    SCMutexUnlock(&hs_cache.m);
+}
+
+static hs_database_t *HSCacheTestCompile(const char *pattern)
+{
+    hs_database_t *db = NULL;
+    hs_compile_error_t *compile_err = NULL;
+    if (hs_compile(pattern, HS_FLAG_SINGLEMATCH, HS_MODE_BLOCK, NULL, &db, &compile_err) !=
+            HS_SUCCESS) {
+        hs_free_compile_error(compile_err);
+        return NULL;
+    }
+    return db;
+}
+
+static int HSCacheTestMatch(unsigned int id, unsigned long long from, unsigned long long to,
+        unsigned int flags, void *ctx)
+{
+    *(int *)ctx = 1;
+    return 0;
+}
+
+static bool HSCacheTestWrite(const char *key, const char *data, size_t len)
+{
+    char path[PATH_MAX];
+    if (HSCacheFilePath(path, sizeof(path), key) < 0)
+        return false;
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return false;
+    const bool written = (fwrite(data, 1, len, fp) == len);
+    return (fclose(fp) == 0 && written);
+}
+
+static bool HSCacheTestAge(const char *name, time_t age)
+{
+    char path[PATH_MAX];
+    if (PathMerge(path, sizeof(path), hs_cache.path, name) < 0)
+        return false;
+    const time_t t = time(NULL) - age;
+    struct utimbuf times = { .actime = t, .modtime = t };
+    return (utime(path, &times) == 0);
+}
+
+static bool HSCacheTestExists(const char *name)
+{
+    char path[PATH_MAX];
+    if (PathMerge(path, sizeof(path), hs_cache.path, name) < 0)
+        return false;
+    struct stat st;
+    return (stat(path, &st) == 0);
+}
+
+/** \test a stored database is loaded back and still matches */
+static int HSCacheTest01(void)
+{
+    char dir[] = "/tmp/suricata-hs-cache-XXXXXX";
+    FAIL_IF_NOT(HSCacheTestSetup(dir, 0));
+    hs_database_t *db = HSCacheTestCompile("abc");
+    FAIL_IF_NULL(db);
+
+    const uint64_t hits = SC_ATOMIC_GET(hs_cache_hits);
+    const uint64_t misses = SC_ATOMIC_GET(hs_cache_misses);
+    FAIL_IF_NOT_NULL(MpmHSCacheLoad(HS_CACHE_TEST_KEY1));
+    FAIL_IF_NOT(SC_ATOMIC_GET(hs_cache_misses) == misses + 1);
+
+    MpmHSCacheSave(HS_CACHE_TEST_KEY1, db);
+    hs_database_t *cached = MpmHSCacheLoad(HS_CACHE_TEST_KEY1);
+    FAIL_IF_NULL(cached);
+    FAIL_IF_NOT(SC_ATOMIC_GET(hs_cache_hits) == hits + 1);
+
+    size_t size = 0;
+    size_t cached_size = 0;
+    FAIL_IF(hs_database_size(db, &size) != HS_SUCCESS);
+    FAIL_IF(hs_database_size(cached, &cached_size) != HS_SUCCESS);
+    FAIL_IF_NOT(size == cached_size);
+
+    hs_scratch_t *scratch = NULL;
+    FAIL_IF(hs_alloc_scratch(cached, &scratch) != HS_SUCCESS);
+    int matched = 0;
+    FAIL_IF(hs_scan(cached, "xxabcxx", 7, 0, scratch, HSCacheTestMatch, &matched) !=
+            HS_SUCCESS);
+    FAIL_IF_NOT(matched);
+
+    hs_free_scratch(scratch);
+    hs_free_database(cached);
+    hs_free_database(db);
+    HSCacheTestTeardown(dir);
+    PASS;
+}
+
+/** \test empty, garbage and truncated files are counted as misses */
+static int HSCacheTest02(void)
+{
+    char dir[] = "/tmp/suricata-hs-cache-XXXXXX";
+    FAIL_IF_NOT(HSCacheTestSetup(dir, 0));
+    const uint64_t hits = SC_ATOMIC_GET(hs_cache_hits);
+    const uint64_t misses = SC_ATOMIC_GET(hs_cache_misses);
+
+    FAIL_IF_NOT(HSCacheTestWrite(HS_CACHE_TEST_KEY1, "", 0));
+    FAIL_IF_NOT_NULL(MpmHSCacheLoad(HS_CACHE_TEST_KEY1));
+
+    const char garbage[] = "not a hyperscan database";
+    FAIL_IF_NOT(HSCacheTestWrite(HS_CACHE_TEST_KEY1, garbage, sizeof(garbage)));
+    FAIL_IF_NOT_NULL(MpmHSCacheLoad(HS_CACHE_TEST_KEY1));
+
+    hs_database_t *db = HSCacheTestCompile("abc");
+    FAIL_IF_NULL(db);
+    char *bytes = NULL;
+    size_t len = 0;
+    FAIL_IF(hs_serialize_database(db, &bytes, &len) != HS_SUCCESS);
+    FAIL_IF_NOT(HSCacheTestWrite(HS_CACHE_TEST_KEY1, bytes, len / 2));
+    FAIL_IF_NOT_NULL(MpmHSCacheLoad(HS_CACHE_TEST_KEY1));
+
+    FAIL_IF_NOT(SC_ATOMIC_GET(hs_cache_hits) == hits);
+    FAIL_IF_NOT(SC_ATOMIC_GET(hs_cache_misses) == misses + 3);
+
+    /* a good file for the key replaces the bad one */
+    MpmHSCacheSave(HS_CACHE_TEST_KEY1, db);
+    hs_database_t *cached = MpmHSCacheLoad(HS_CACHE_TEST_KEY1);
+    FAIL_IF_NULL(cached);
+
+    hs_free_database(cached);
+    SCFree(bytes);
+    hs_free_database(db);
+    HSCacheTestTeardown(dir);
+    PASS;
+}
+
+/** \test prune removes entries and temporary files older than the max
+ *        age, recently used entries and unrelated files are kept */
+static int HSCacheTest03(void)
+{
+    char dir[] = "/tmp/suricata-hs-cache-XXXXXX";
+    FAIL_IF_NOT(HSCacheTestSetup(dir, 60));
+    hs_database_t *db = HSCacheTestCompile("abc");
+    FAIL_IF_NULL(db);
+
+    MpmHSCacheSave(HS_CACHE_TEST_KEY1, db);
+    MpmHSCacheSave(HS_CACHE_TEST_KEY2, db);
+    const char *old = HS_CACHE_TEST_KEY1 HS_CACHE_SUFFIX;
+    const char *used = HS_CACHE_TEST_KEY2 HS_CACHE_SUFFIX;
+    const char *tmp = HS_CACHE_TEST_KEY2 HS_CACHE_SUFFIX ".a1B2c3";
+    const char *other = "unrelated";
+    FAIL_IF_NOT(HSCacheTestExists(old));
+    FAIL_IF_NOT(HSCacheTestExists(used));
+
+    char path[PATH_MAX];
+    FAIL_IF(PathMerge(path, sizeof(path), dir, tmp) < 0);
+    FILE *fp = fopen(path, "wb");
+    FAIL_IF_NULL(fp);
+    fclose(fp);
+    FAIL_IF(PathMerge(path, sizeof(path), dir, other) < 0);
+    fp = fopen(path, "wb");
+    FAIL_IF_NULL(fp);
+    fclose(fp);
+
+    FAIL_IF_NOT(HSCacheTestAge(old, 3600));
+    FAIL_IF_NOT(HSCacheTestAge(used, 3600));
+    FAIL_IF_NOT(HSCacheTestAge(tmp, 3600));
+    FAIL_IF_NOT(HSCacheTestAge(other, 3600));
+
+    /* loading refreshes the entry */
+    hs_database_t *cached = MpmHSCacheLoad(HS_CACHE_TEST_KEY2);
+    FAIL_IF_NULL(cached);
+
+    MpmHSCachePrune();
+    FAIL_IF(HSCacheTestExists(old));
+    FAIL_IF(HSCacheTestExists(tmp));
+    FAIL_IF_NOT(HSCacheTestExists(used));
+    FAIL_IF_NOT(HSCacheTestExists(other));
+
+    hs_free_database(cached);
+    hs_free_database(db);
+    HSCacheTestTeardown(dir);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void MpmHSCacheRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HSCacheTest01", HSCacheTest01);
+    UtRegisterTest("HSCacheTest02", HSCacheTest02);
+    UtRegisterTest("HSCacheTest03", HSCacheTest03);
+#endif
+}
+
+#endif /* BUILD_HYPERSCAN */
@@ -0,0 +1,44 @@
+/* Copyright (C) 2024 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * On disk cache of compiled Hyperscan databases.
+ */
+
+#ifndef __UTIL_MPM_HS_CACHE_H__
+#define __UTIL_MPM_HS_CACHE_H__
+
+#ifdef BUILD_HYPERSCAN
+
+#include <hs.h>
+
+/** length of a cache key: hex encoded sha256 plus the terminating NUL */
+#define HS_CACHE_KEY_LEN 65
+
+void MpmHSCacheInit(void);
+bool MpmHSCacheEnabled(void);
+const char *MpmHSCachePath(void);
+hs_database_t *MpmHSCacheLoad(const char *key);
+void MpmHSCacheSave(const char *key, const hs_database_t *db);
+void MpmHSCachePrune(void);
+void MpmHSCacheRegisterTests(void);
+
+#endif /* BUILD_HYPERSCAN */
+
+#endif /* __UTIL_MPM_HS_CACHE_H__ */
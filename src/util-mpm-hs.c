@@ -38,10 +38,12 @@
 #include "util-unittest-helper.h"
 #include "util-memcmp.h"
 #include "util-mpm-hs.h"
+#include "util-mpm-hs-cache.h"
 #include "util-memcpy.h"
 #include "util-hash.h"
 #include "util-hash-lookup3.h"
 #include "util-hyperscan.h"
+#include "rust.h"
 
 #ifdef BUILD_HYPERSCAN
 
@@ -58,6 +60,12 @@ int SCHSAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCHSPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PrefilterRuleStore *pmq, const uint8_t *buf, const uint32_t buflen);
+uint32_t SCHSStreamSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmStream **mpm_stream, const uint8_t *buf,
+        const uint32_t buflen, const uint64_t offset);
+void SCHSStreamCompress(MpmStream *mpm_stream);
+void SCHSStreamFree(MpmStream *mpm_stream);
+uint32_t SCHSStreamStateSize(const MpmCtx *mpm_ctx);
 void SCHSPrintInfo(MpmCtx *mpm_ctx);
 void SCHSPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCHSRegisterTests(void);
@@ -79,6 +87,13 @@ static SCMutex g_scratch_proto_mutex = SCMUTEX_INITIALIZER;
 static HashTable *g_db_table = NULL;
 static SCMutex g_db_table_mutex = SCMUTEX_INITIALIZER;
 
+/* Global hash table of compiled databases, keyed by the compiler input. Access
+ * is serialised via g_compiled_table_mutex. g_compiled_table_cond is signalled
+ * when a pending database is ready. */
+static HashTable *g_compiled_table = NULL;
+static SCMutex g_compiled_table_mutex = SCMUTEX_INITIALIZER;
+static SCCondT g_compiled_table_cond = PTHREAD_COND_INITIALIZER;
+
 /**
  * \internal
  * \brief Wraps SCMalloc (which is a macro) so that it can be passed to
@@ -443,11 +458,81 @@ static void SCHSFreeCompileData(SCHSCompileData *cd)
     SCFree(cd);
 }
 
+/**
+ * \internal
+ * \brief Compute the on disk cache key of a database.
+ *
+ * The key covers all input of the compiler, including the Hyperscan
+ * version and the CPU features the database is built for.
+ */
+static void SCHSCompileDataCacheKey(
+        const SCHSCompileData *cd, const unsigned int mode, char *key, const size_t key_len)
+{
+    SCSha256 *hasher = SCSha256New();
+
+    const char *version = hs_version();
+    SCSha256Update(hasher, (const uint8_t *)version, (uint32_t)strlen(version));
+    SCSha256Update(hasher, (const uint8_t *)&mode, sizeof(mode));
+    hs_platform_info_t platform;
+    if (hs_populate_platform(&platform) == HS_SUCCESS) {
+        SCSha256Update(hasher, (const uint8_t *)&platform.tune, sizeof(platform.tune));
+        SCSha256Update(hasher, (const uint8_t *)&platform.cpu_features,
+                sizeof(platform.cpu_features));
+    }
+
+    for (unsigned int i = 0; i < cd->pattern_cnt; i++) {
+        /* no padding in here, so it can be hashed as is */
+        const uint64_t vals[5] = {
+            cd->ids[i],
+            cd->flags[i],
+            cd->ext[i] ? cd->ext[i]->flags : 0,
+            cd->ext[i] ? cd->ext[i]->min_offset : 0,
+            cd->ext[i] ? cd->ext[i]->max_offset : 0,
+        };
+        SCSha256Update(hasher, (const uint8_t *)vals, sizeof(vals));
+        /* include the terminating NUL to separate the expressions */
+        SCSha256Update(hasher, (const uint8_t *)cd->expressions[i],
+                (uint32_t)strlen(cd->expressions[i]) + 1);
+    }
+
+    SCSha256FinalizeToHex(hasher, key, (uint32_t)key_len);
+}
+
+/**
+ * A compiled database. It only depends on the compiler input, not on the
+ * signatures the patterns belong to, so it is shared by all pattern
+ * databases with the same patterns. When rules are added or removed, the
+ * internal signature ids of most rules change, but groups the change didn't
+ * touch still have the same patterns. A reload then only compiles the
+ * databases of the groups whose patterns changed, and shares the others
+ * with the running engine. Only the compiled databases are shared, the
+ * pattern databases and everything above them are built per engine.
+ */
+typedef struct SCHSCompiledDb_ {
+    char key[HS_CACHE_KEY_LEN];
+    hs_database_t *db;
+    /* false while the database is loaded or compiled, db is NULL if that
+     * failed */
+    bool ready;
+    /* Reference count: number of pattern databases using this database. */
+    uint32_t ref_cnt;
+} SCHSCompiledDb;
+
 typedef struct PatternDatabase_ {
     SCHSPattern **parray;
     hs_database_t *hs_db;
+    /* streaming mode database, only built for MPMCTX_FLAGS_STREAMING ctxs */
+    hs_database_t *hs_stream_db;
+    /* compiled databases the above point to */
+    SCHSCompiledDb *hs_db_ref;
+    SCHSCompiledDb *hs_stream_db_ref;
+    /* size of a hs_stream_t opened against hs_stream_db */
+    uint32_t hs_stream_state_size;
     uint32_t pattern_cnt;
 
+    /* unique id, used to detect streams opened against an older database */
+    uint32_t id;
+
     /* Reference count: number of MPM contexts using this pattern database. */
     uint32_t ref_cnt;
 } PatternDatabase;
@@ -521,6 +606,125 @@ static char PatternDatabaseCompare(void *data1, uint16_t len1, void *data2,
     return 1;
 }
 
+static uint32_t SCHSCompiledDbHash(HashTable *ht, void *data, uint16_t len)
+{
+    const SCHSCompiledDb *c = data;
+    return hashlittle_safe(c->key, strlen(c->key), 0) % ht->array_size;
+}
+
+static char SCHSCompiledDbCompare(void *data1, uint16_t len1, void *data2, uint16_t len2)
+{
+    const SCHSCompiledDb *c1 = data1;
+    const SCHSCompiledDb *c2 = data2;
+    return strcmp(c1->key, c2->key) == 0;
+}
+
+static void SCHSCompiledDbFree(void *data)
+{
+    SCHSCompiledDb *c = data;
+    hs_free_database(c->db);
+    SCFree(c);
+}
+
+static void SCHSCompiledDbRelease(SCHSCompiledDb *c)
+{
+    if (c == NULL)
+        return;
+    SCMutexLock(&g_compiled_table_mutex);
+    BUG_ON(c->ref_cnt == 0);
+    if (--c->ref_cnt == 0) {
+        HashTableRemove(g_compiled_table, c, 0);
+    }
+    SCMutexUnlock(&g_compiled_table_mutex);
+}
+
+/**
+ * \internal
+ * \brief Get a compiled database for the compile data.
+ *
+ * The database is taken from a pattern database in use, loaded from the on
+ * disk cache or compiled, in that order. The compile happens without holding
+ * a lock. A pending entry is added first, so that other contexts needing the
+ * same database wait for it instead of compiling it as well.
+ *
+ * \retval c compiled database with a reference for the caller, or NULL
+ */
+static SCHSCompiledDb *SCHSCompiledDbGet(const SCHSCompileData *cd, const unsigned int mode)
+{
+    SCHSCompiledDb *c = SCCalloc(1, sizeof(*c));
+    if (c == NULL)
+        return NULL;
+    SCHSCompileDataCacheKey(cd, mode, c->key, sizeof(c->key));
+
+    SCMutexLock(&g_compiled_table_mutex);
+    if (g_compiled_table == NULL) {
+        g_compiled_table = HashTableInit(INIT_DB_HASH_SIZE, SCHSCompiledDbHash,
+                SCHSCompiledDbCompare, SCHSCompiledDbFree);
+        if (g_compiled_table == NULL) {
+            SCMutexUnlock(&g_compiled_table_mutex);
+            SCFree(c);
+            return NULL;
+        }
+    }
+    SCHSCompiledDb *found = HashTableLookup(g_compiled_table, c, 0);
+    if (found != NULL) {
+        SCFree(c);
+        found->ref_cnt++;
+        while (!found->ready) {
+            SCCondWait(&g_compiled_table_cond, &g_compiled_table_mutex);
+        }
+        SCMutexUnlock(&g_compiled_table_mutex);
+        if (found->db == NULL) {
+            SCHSCompiledDbRelease(found);
+            return NULL;
+        }
+        SCLogDebug("reusing compiled database %s", found->key);
+        return found;
+    }
+    c->ref_cnt = 1;
+    if (HashTableAdd(g_compiled_table, c, 0) != 0) {
+        SCMutexUnlock(&g_compiled_table_mutex);
+        SCFree(c);
+        return NULL;
+    }
+    SCMutexUnlock(&g_compiled_table_mutex);
+
+    hs_database_t *db = NULL;
+    const bool use_cache = MpmHSCacheEnabled();
+    if (use_cache) {
+        db = MpmHSCacheLoad(c->key);
+    }
+    if (db == NULL) {
+        hs_compile_error_t *compile_err = NULL;
+        hs_error_t err = hs_compile_ext_multi((const char *const *)cd->expressions, cd->flags,
+                cd->ids, (const hs_expr_ext_t *const *)cd->ext, cd->pattern_cnt, mode, NULL,
+                &db, &compile_err);
+        if (err != HS_SUCCESS) {
+            SCLogError("failed to compile hyperscan %sdatabase",
+                    mode == HS_MODE_STREAM ? "streaming " : "");
+            if (compile_err) {
+                SCLogError("compile error: %s", compile_err->message);
+            }
+            hs_free_compile_error(compile_err);
+            db = NULL;
+        } else if (use_cache) {
+            MpmHSCacheSave(c->key, db);
+        }
+    }
+
+    SCMutexLock(&g_compiled_table_mutex);
+    c->db = db;
+    c->ready = true;
+    pthread_cond_broadcast(&g_compiled_table_cond);
+    SCMutexUnlock(&g_compiled_table_mutex);
+
+    if (db == NULL) {
+        SCHSCompiledDbRelease(c);
+        return NULL;
+    }
+    return c;
+}
+
 static void PatternDatabaseFree(PatternDatabase *pd)
 {
     BUG_ON(pd->ref_cnt != 0);
@@ -537,7 +741,8 @@ static void PatternDatabaseFree(PatternDatabase *pd)
         SCFree(pd->parray);
     }
 
-    hs_free_database(pd->hs_db);
+    SCHSCompiledDbRelease(pd->hs_db_ref);
+    SCHSCompiledDbRelease(pd->hs_stream_db_ref);
 
     SCFree(pd);
 }
@@ -568,9 +773,88 @@ static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt)
     return pd;
 }
 
+/* last id handed out to a pattern database, protected by g_db_table_mutex */
+static uint32_t g_db_id = 0;
+
+/**
+ * \internal
+ * \brief Compile the streaming mode database for a pattern database.
+ *
+ * Offset and depth are not used here, as for stream data they are relative to
+ * the chunk that is inspected and not to the start of the stream. Patterns are
+ * not compiled as single match either, as that would report a pattern only once
+ * for the whole lifetime of a stream. Both only lead to more prefilter matches.
+ *
+ * Only called for pattern databases that are not in g_db_table (yet), so
+ * without holding g_db_table_mutex.
+ *
+ * \retval size of the database or 0 on error
+ */
+static size_t PatternDatabaseCompileStream(PatternDatabase *pd)
+{
+    size_t size = 0;
+    SCHSCompileData *cd = SCHSAllocCompileData(pd->pattern_cnt);
+    if (cd == NULL)
+        return 0;
+
+    for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
+        const SCHSPattern *p = pd->parray[i];
+
+        cd->ids[i] = i;
+        cd->flags[i] = 0;
+        if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+            cd->flags[i] |= HS_FLAG_CASELESS;
+        }
+        cd->expressions[i] = HSRenderPattern(p->original_pat, p->len);
+    }
+
+    pd->hs_stream_db_ref = SCHSCompiledDbGet(cd, HS_MODE_STREAM);
+    if (pd->hs_stream_db_ref == NULL)
+        goto end;
+    pd->hs_stream_db = pd->hs_stream_db_ref->db;
+
+    SCMutexLock(&g_scratch_proto_mutex);
+    hs_error_t err = hs_alloc_scratch(pd->hs_stream_db, &g_scratch_proto);
+    SCMutexUnlock(&g_scratch_proto_mutex);
+    if (err != HS_SUCCESS) {
+        SCLogError("failed to allocate scratch");
+        goto error;
+    }
+
+    if (hs_database_size(pd->hs_stream_db, &size) != HS_SUCCESS) {
+        SCLogError("failed to query database size");
+        goto error;
+    }
+    size_t state_size = 0;
+    if (hs_stream_size(pd->hs_stream_db, &state_size) != HS_SUCCESS) {
+        SCLogError("failed to query stream state size");
+        goto error;
+    }
+    pd->hs_stream_state_size = (uint32_t)state_size;
+
+    SCLogDebug("Built %" PRIu32 " patterns into a streaming database of size %" PRIuMAX
+               " bytes",
+            pd->pattern_cnt, (uintmax_t)size);
+    goto end;
+
+error:
+    SCHSCompiledDbRelease(pd->hs_stream_db_ref);
+    pd->hs_stream_db_ref = NULL;
+    pd->hs_stream_db = NULL;
+    pd->hs_stream_state_size = 0;
+    size = 0;
+end:
+    SCHSFreeCompileData(cd);
+    return size;
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
+ * Can be called for different mpm contexts at the same time. The database
+ * is compiled without holding g_db_table_mutex, if another context built
+ * the same database in the meantime that one is used instead.
+ *
  * \param mpm_ctx Pointer to the mpm context.
  */
 int SCHSPreparePatterns(MpmCtx *mpm_ctx)
@@ -583,7 +867,6 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     }
 
     hs_error_t err;
-    hs_compile_error_t *compile_err = NULL;
     SCHSCompileData *cd = NULL;
     PatternDatabase *pd = NULL;
 
@@ -612,8 +895,6 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     SCFree(ctx->init_hash);
     ctx->init_hash = NULL;
 
-    /* Serialise whole database compilation as a relatively easy way to ensure
-     * dedupe is safe. */
     SCMutexLock(&g_db_table_mutex);
 
     /* Init global pattern database hash if necessary. */
@@ -638,11 +919,34 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
                    pd_cached->ref_cnt);
         pd_cached->ref_cnt++;
         ctx->pattern_db = pd_cached;
+        const bool need_stream =
+                (mpm_ctx->flags & MPMCTX_FLAGS_STREAMING) && pd_cached->hs_stream_db == NULL;
         SCMutexUnlock(&g_db_table_mutex);
+
+        if (need_stream) {
+            /* compile the streaming database for our copy of the patterns
+             * and hand it over, unless another context was faster. The
+             * reference taken above is released when the ctx is destroyed. */
+            size_t size = PatternDatabaseCompileStream(pd);
+            if (size == 0) {
+                goto error;
+            }
+            SCMutexLock(&g_db_table_mutex);
+            if (pd_cached->hs_stream_db == NULL) {
+                pd_cached->hs_stream_db = pd->hs_stream_db;
+                pd_cached->hs_stream_db_ref = pd->hs_stream_db_ref;
+                pd_cached->hs_stream_state_size = pd->hs_stream_state_size;
+                pd->hs_stream_db = NULL;
+                pd->hs_stream_db_ref = NULL;
+                mpm_ctx->memory_size += size;
+            }
+            SCMutexUnlock(&g_db_table_mutex);
+        }
         PatternDatabaseFree(pd);
         SCHSFreeCompileData(cd);
         return 0;
     }
+    SCMutexUnlock(&g_db_table_mutex);
 
     BUG_ON(ctx->pattern_db != NULL); /* already built? */
 
@@ -660,7 +964,6 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         if (p->flags & (MPM_PATTERN_FLAG_OFFSET | MPM_PATTERN_FLAG_DEPTH)) {
             cd->ext[i] = SCCalloc(1, sizeof(hs_expr_ext_t));
             if (cd->ext[i] == NULL) {
-                SCMutexUnlock(&g_db_table_mutex);
                 goto error;
             }
 
@@ -677,51 +980,76 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
 
     BUG_ON(mpm_ctx->pattern_cnt == 0);
 
-    err = hs_compile_ext_multi((const char *const *)cd->expressions, cd->flags,
-                               cd->ids, (const hs_expr_ext_t *const *)cd->ext,
-                               cd->pattern_cnt, HS_MODE_BLOCK, NULL, &pd->hs_db,
-                               &compile_err);
-
-    if (err != HS_SUCCESS) {
-        SCLogError("failed to compile hyperscan database");
-        if (compile_err) {
-            SCLogError("compile error: %s", compile_err->message);
-        }
-        hs_free_compile_error(compile_err);
-        SCMutexUnlock(&g_db_table_mutex);
+    pd->hs_db_ref = SCHSCompiledDbGet(cd, HS_MODE_BLOCK);
+    if (pd->hs_db_ref == NULL) {
         goto error;
     }
-
-    ctx->pattern_db = pd;
+    pd->hs_db = pd->hs_db_ref->db;
 
     SCMutexLock(&g_scratch_proto_mutex);
     err = hs_alloc_scratch(pd->hs_db, &g_scratch_proto);
     SCMutexUnlock(&g_scratch_proto_mutex);
     if (err != HS_SUCCESS) {
         SCLogError("failed to allocate scratch");
-        SCMutexUnlock(&g_db_table_mutex);
         goto error;
     }
 
-    err = hs_database_size(pd->hs_db, &ctx->hs_db_size);
+    size_t db_size = 0;
+    err = hs_database_size(pd->hs_db, &db_size);
     if (err != HS_SUCCESS) {
         SCLogError("failed to query database size");
-        SCMutexUnlock(&g_db_table_mutex);
         goto error;
     }
 
-    mpm_ctx->memory_cnt++;
-    mpm_ctx->memory_size += ctx->hs_db_size;
+    size_t stream_db_size = 0;
+    if (mpm_ctx->flags & MPMCTX_FLAGS_STREAMING) {
+        stream_db_size = PatternDatabaseCompileStream(pd);
+        if (stream_db_size == 0) {
+            goto error;
+        }
+        db_size += stream_db_size;
+    }
 
-    SCLogDebug("Built %" PRIu32 " patterns into a database of size %" PRIuMAX
-               " bytes", mpm_ctx->pattern_cnt, (uintmax_t)ctx->hs_db_size);
+    SCMutexLock(&g_db_table_mutex);
+    /* another context may have built the same database meanwhile */
+    pd_cached = HashTableLookup(g_db_table, pd, 1);
+    if (pd_cached != NULL) {
+        SCLogDebug("database %p with %" PRIu32 " patterns was built concurrently", pd_cached->hs_db,
+                pd_cached->pattern_cnt);
+        if (pd_cached->hs_stream_db == NULL && pd->hs_stream_db != NULL) {
+            pd_cached->hs_stream_db = pd->hs_stream_db;
+            pd_cached->hs_stream_db_ref = pd->hs_stream_db_ref;
+            pd_cached->hs_stream_state_size = pd->hs_stream_state_size;
+            pd->hs_stream_db = NULL;
+            pd->hs_stream_db_ref = NULL;
+            mpm_ctx->memory_size += stream_db_size;
+        }
+        pd_cached->ref_cnt++;
+        ctx->pattern_db = pd_cached;
+        SCMutexUnlock(&g_db_table_mutex);
+        PatternDatabaseFree(pd);
+        SCHSFreeCompileData(cd);
+        return 0;
+    }
 
+    pd->id = ++g_db_id;
     /* Cache this database globally for later. */
     pd->ref_cnt = 1;
     int r = HashTableAdd(g_db_table, pd, 1);
-    SCMutexUnlock(&g_db_table_mutex);
-    if (r < 0)
+    if (r < 0) {
+        pd->ref_cnt = 0;
+        SCMutexUnlock(&g_db_table_mutex);
         goto error;
+    }
+    ctx->pattern_db = pd;
+    ctx->hs_db_size = db_size;
+    SCMutexUnlock(&g_db_table_mutex);
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += ctx->hs_db_size;
+
+    SCLogDebug("Built %" PRIu32 " patterns into a database of size %" PRIuMAX
+               " bytes", mpm_ctx->pattern_cnt, (uintmax_t)ctx->hs_db_size);
 
     SCHSFreeCompileData(cd);
     return 0;
@@ -947,6 +1275,232 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     return ret;
 }
 
+/** per stream state of the streaming search */
+typedef struct SCHSStream_ {
+    MpmStream mpm;
+    /* id of the pattern database the stream was opened for */
+    uint32_t db_id;
+    hs_stream_t *stream;
+    /* absolute stream offset the Hyperscan stream started at */
+    uint64_t base_offset;
+    /* absolute stream offset of the next data we expect */
+    uint64_t next_offset;
+#ifdef HAVE_HS_COMPRESS_STREAM
+    /* compressed stream state of an idle stream, 'stream' is NULL then */
+    char *compressed;
+    size_t compressed_len;
+#endif
+} SCHSStream;
+
+typedef struct SCHSStreamCallbackCtx_ {
+    const PatternDatabase *pd;
+    PrefilterRuleStore *pmq;
+    uint8_t *bitarray;
+    uint64_t base_offset;
+    uint32_t match_count;
+} SCHSStreamCallbackCtx;
+
+/* Hyperscan MPM streaming match event handler. The patterns are not single
+ * match in the streaming database, so dedup the matches per scan here. */
+static int SCHSStreamMatchEvent(unsigned int id, unsigned long long from, unsigned long long to,
+        unsigned int flags, void *ctx)
+{
+    SCHSStreamCallbackCtx *cctx = ctx;
+
+    if (cctx->bitarray[id / 8] & (1 << (id % 8)))
+        return 0;
+    cctx->bitarray[id / 8] |= (1 << (id % 8));
+
+    const SCHSPattern *pat = cctx->pd->parray[id];
+    SCLogDebug("Hyperscan Stream Match %" PRIu32 ": id=%" PRIu32 " @ %" PRIu64
+               " (pat id=%" PRIu32 ")",
+            cctx->match_count, (uint32_t)id, cctx->base_offset + (uint64_t)to, pat->id);
+
+    PrefilterAddSids(cctx->pmq, pat->sids, pat->sids_size);
+
+    cctx->match_count++;
+    return 0;
+}
+
+static void SCHSStreamReset(SCHSStream *s)
+{
+    s->mpm.size = sizeof(*s);
+    if (s->stream != NULL) {
+        /* no scratch: don't report matches at end of stream */
+        hs_close_stream(s->stream, NULL, NULL, NULL);
+        s->stream = NULL;
+    }
+#ifdef HAVE_HS_COMPRESS_STREAM
+    if (s->compressed != NULL) {
+        SCFree(s->compressed);
+        s->compressed = NULL;
+        s->compressed_len = 0;
+    }
+#endif
+}
+
+/**
+ * \internal
+ * \brief Get the stream ready to scan data at 'offset'
+ *
+ * The existing Hyperscan stream is used if it belongs to the current database
+ * and the data continues where the last scan ended. Otherwise, e.g. after a
+ * rule reload or a gap in the data, a new stream is opened.
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+static int SCHSStreamSetup(SCHSStream *s, const PatternDatabase *pd, const uint64_t offset)
+{
+    if (s->db_id == pd->id && s->next_offset == offset) {
+        if (s->stream != NULL)
+            return 0;
+#ifdef HAVE_HS_COMPRESS_STREAM
+        if (s->compressed != NULL) {
+            hs_error_t err = hs_expand_stream(
+                    pd->hs_stream_db, &s->stream, s->compressed, s->compressed_len);
+            SCFree(s->compressed);
+            s->compressed = NULL;
+            s->compressed_len = 0;
+            if (err == HS_SUCCESS) {
+                s->mpm.size = sizeof(*s) + pd->hs_stream_state_size;
+                return 0;
+            }
+            s->stream = NULL;
+        }
+#endif
+    }
+
+    SCHSStreamReset(s);
+    if (hs_open_stream(pd->hs_stream_db, 0, &s->stream) != HS_SUCCESS) {
+        s->stream = NULL;
+        return -1;
+    }
+    s->mpm.size = sizeof(*s) + pd->hs_stream_state_size;
+    s->db_id = pd->id;
+    s->base_offset = offset;
+    s->next_offset = offset;
+    return 0;
+}
+
+/**
+ * \brief The Hyperscan streaming search function.
+ *
+ * Only the data that wasn't scanned before is passed in. Matches that straddle
+ * the previous data are found by Hyperscan from its stream state. If the ctx
+ * has no streaming database, this falls back to a block mode scan of the data.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param mpm_stream     Pointer to the stream state, opened on first use.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ * \param offset         Absolute stream offset of buf.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCHSStreamSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmStream **mpm_stream, const uint8_t *buf,
+        const uint32_t buflen, const uint64_t offset)
+{
+    SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+    SCHSThreadCtx *hs_thread_ctx = (SCHSThreadCtx *)(mpm_thread_ctx->ctx);
+    const PatternDatabase *pd = ctx->pattern_db;
+
+    if (unlikely(buflen == 0)) {
+        return 0;
+    }
+    if (pd->hs_stream_db == NULL) {
+        return SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, buf, buflen);
+    }
+
+    SCHSStream *s = (SCHSStream *)*mpm_stream;
+    if (s == NULL) {
+        s = SCCalloc(1, sizeof(*s));
+        if (unlikely(s == NULL)) {
+            return SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, buf, buflen);
+        }
+        s->mpm.mpm_type = MPM_HS;
+        s->mpm.size = sizeof(*s);
+        *mpm_stream = &s->mpm;
+    }
+    if (SCHSStreamSetup(s, pd, offset) < 0) {
+        return SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, buf, buflen);
+    }
+
+    uint8_t bitarray[(pd->pattern_cnt / 8) + 1];
+    memset(bitarray, 0, sizeof(bitarray));
+    SCHSStreamCallbackCtx cctx = { .pd = pd,
+        .pmq = pmq,
+        .bitarray = bitarray,
+        .base_offset = s->base_offset,
+        .match_count = 0 };
+
+    hs_scratch_t *scratch = hs_thread_ctx->scratch;
+    BUG_ON(scratch == NULL);
+
+    hs_error_t err = hs_scan_stream(
+            s->stream, (const char *)buf, buflen, 0, scratch, SCHSStreamMatchEvent, &cctx);
+    if (err != HS_SUCCESS) {
+        /* see SCHSSearch */
+        SCLogError("Hyperscan returned error %d", err);
+        exit(EXIT_FAILURE);
+    }
+    s->next_offset = offset + buflen;
+    return cctx.match_count;
+}
+
+/**
+ * \brief Compress the state of a stream that is expected to be idle for a
+ *        while. It is expanded again by the next SCHSStreamSearch call.
+ */
+void SCHSStreamCompress(MpmStream *mpm_stream)
+{
+#ifdef HAVE_HS_COMPRESS_STREAM
+    SCHSStream *s = (SCHSStream *)mpm_stream;
+    if (s->stream == NULL)
+        return;
+
+    size_t used = 0;
+    if (hs_compress_stream(s->stream, NULL, 0, &used) != HS_INSUFFICIENT_SPACE || used == 0)
+        return;
+    char *buf = SCMalloc(used);
+    if (unlikely(buf == NULL))
+        return;
+    if (hs_compress_stream(s->stream, buf, used, &used) != HS_SUCCESS) {
+        SCFree(buf);
+        return;
+    }
+    hs_close_stream(s->stream, NULL, NULL, NULL);
+    s->stream = NULL;
+    s->compressed = buf;
+    s->compressed_len = used;
+    s->mpm.size = (uint32_t)(sizeof(*s) + used);
+#endif
+}
+
+/**
+ * \brief Memory a stream of the ctx uses while it is open, 0 if the ctx has
+ *        no streaming database.
+ */
+uint32_t SCHSStreamStateSize(const MpmCtx *mpm_ctx)
+{
+    const SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+    const PatternDatabase *pd = ctx->pattern_db;
+    if (pd == NULL || pd->hs_stream_db == NULL)
+        return 0;
+    return (uint32_t)sizeof(SCHSStream) + pd->hs_stream_state_size;
+}
+
+void SCHSStreamFree(MpmStream *mpm_stream)
+{
+    SCHSStream *s = (SCHSStream *)mpm_stream;
+    SCHSStreamReset(s);
+    SCFree(s);
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1047,6 +1601,10 @@ void MpmHSRegister(void)
     mpm_table[MPM_HS].AddPatternNocase = SCHSAddPatternCI;
     mpm_table[MPM_HS].Prepare = SCHSPreparePatterns;
     mpm_table[MPM_HS].Search = SCHSSearch;
+    mpm_table[MPM_HS].StreamSearch = SCHSStreamSearch;
+    mpm_table[MPM_HS].StreamCompress = SCHSStreamCompress;
+    mpm_table[MPM_HS].StreamFree = SCHSStreamFree;
+    mpm_table[MPM_HS].StreamStateSize = SCHSStreamStateSize;
     mpm_table[MPM_HS].PrintCtx = SCHSPrintInfo;
     mpm_table[MPM_HS].PrintThreadCtx = SCHSPrintSearchStats;
     mpm_table[MPM_HS].RegisterUnittests = SCHSRegisterTests;
@@ -1058,7 +1616,7 @@ void MpmHSRegister(void)
 /**
  * \brief Clean up global memory used by all Hyperscan MPM instances.
  *
- * Currently, this is just the global scratch prototype.
+ * This is the global scratch prototype and the database tables.
  */
 void MpmHSGlobalCleanup(void)
 {
@@ -1077,6 +1635,13 @@ void MpmHSGlobalCleanup(void)
         g_db_table = NULL;
     }
     SCMutexUnlock(&g_db_table_mutex);
+
+    SCMutexLock(&g_compiled_table_mutex);
+    if (g_compiled_table != NULL) {
+        HashTableFree(g_compiled_table);
+        g_compiled_table = NULL;
+    }
+    SCMutexUnlock(&g_compiled_table_mutex);
 }
 
 /*************************************Unittests********************************/
@@ -2132,6 +2697,84 @@ end:
     return result;
 }
 
+/** \test streaming search: match split over two scans, gap resets the stream */
+static int SCHSTest30(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+    MpmStream *mpm_stream = NULL;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+    mpm_ctx.flags |= MPMCTX_FLAGS_STREAMING;
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    uint32_t cnt = SCHSStreamSearch(
+            &mpm_ctx, &mpm_thread_ctx, &pmq, &mpm_stream, (uint8_t *)"xxab", 4, 0);
+    FAIL_IF_NOT(cnt == 0);
+    FAIL_IF_NULL(mpm_stream);
+    /* size accounted by the caller */
+    const uint32_t open_size = SCHSStreamStateSize(&mpm_ctx);
+    FAIL_IF_NOT(open_size > sizeof(MpmStream));
+    FAIL_IF_NOT(mpm_stream->size == open_size);
+    cnt = SCHSStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &mpm_stream, (uint8_t *)"cdxx", 4, 4);
+    FAIL_IF_NOT(cnt == 1);
+
+    /* compressed state is restored on the next scan */
+    SCHSStreamCompress(mpm_stream);
+#ifdef HAVE_HS_COMPRESS_STREAM
+    FAIL_IF_NOT(mpm_stream->size < open_size);
+#endif
+    cnt = SCHSStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &mpm_stream, (uint8_t *)"ab", 2, 8);
+    FAIL_IF_NOT(cnt == 0);
+
+    /* gap: 'ab' must not combine with 'cd' */
+    cnt = SCHSStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &mpm_stream, (uint8_t *)"cdxx", 4, 20);
+    FAIL_IF_NOT(cnt == 0);
+
+    SCHSStreamFree(mpm_stream);
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test same patterns for other signatures share the compiled database */
+static int SCHSTest31(void)
+{
+    MpmCtx mpm_ctx1, mpm_ctx2;
+    memset(&mpm_ctx1, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx2, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx1, MPM_HS);
+    MpmInitCtx(&mpm_ctx2, MPM_HS);
+
+    MpmAddPatternCS(&mpm_ctx1, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx1, (uint8_t *)"efgh", 4, 0, 0, 1, 1, 0);
+    MpmAddPatternCS(&mpm_ctx2, (uint8_t *)"abcd", 4, 0, 0, 0, 5, 0);
+    MpmAddPatternCS(&mpm_ctx2, (uint8_t *)"efgh", 4, 0, 0, 1, 6, 0);
+
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx1) != 0);
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx2) != 0);
+
+    const PatternDatabase *pd1 = ((SCHSCtx *)mpm_ctx1.ctx)->pattern_db;
+    const PatternDatabase *pd2 = ((SCHSCtx *)mpm_ctx2.ctx)->pattern_db;
+    FAIL_IF(pd1 == pd2);
+    FAIL_IF_NOT(pd1->hs_db == pd2->hs_db);
+    FAIL_IF_NOT(pd1->hs_db_ref->ref_cnt == 2);
+
+    SCHSDestroyCtx(&mpm_ctx1);
+    FAIL_IF_NOT(pd2->hs_db_ref->ref_cnt == 1);
+    SCHSDestroyCtx(&mpm_ctx2);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCHSRegisterTests(void)
@@ -2166,6 +2809,10 @@ void SCHSRegisterTests(void)
     UtRegisterTest("SCHSTest27", SCHSTest27);
     UtRegisterTest("SCHSTest28", SCHSTest28);
     UtRegisterTest("SCHSTest29", SCHSTest29);
+    UtRegisterTest("SCHSTest30", SCHSTest30);
+    UtRegisterTest("SCHSTest31", SCHSTest31);
+
+    MpmHSCacheRegisterTests();
 #endif
 
     return;
@@ -207,6 +207,28 @@ void MpmDestroyThreadCtx(MpmThreadCtx *mpm_thread_ctx, const uint16_t matcher)
     }
 }
 
+void MpmStreamCompress(MpmStream *s)
+{
+    if (s != NULL && mpm_table[s->mpm_type].StreamCompress != NULL) {
+        mpm_table[s->mpm_type].StreamCompress(s);
+    }
+}
+
+void MpmStreamFree(MpmStream *s)
+{
+    if (s != NULL) {
+        mpm_table[s->mpm_type].StreamFree(s);
+    }
+}
+
+uint32_t MpmStreamStateSize(const MpmCtx *mpm_ctx)
+{
+    if (mpm_table[mpm_ctx->mpm_type].StreamStateSize != NULL) {
+        return mpm_table[mpm_ctx->mpm_type].StreamStateSize(mpm_ctx);
+    }
+    return 0;
+}
+
 void MpmInitCtx(MpmCtx *mpm_ctx, uint8_t matcher)
 {
     mpm_ctx->mpm_type = matcher;
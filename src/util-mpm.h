@@ -51,6 +51,15 @@ typedef struct MpmThreadCtx_ {
 
 } MpmThreadCtx;
 
+/* Per stream (e.g. flow direction) state of a streaming search. Matchers
+ * implementing StreamSearch embed this as the first member of their own
+ * stream state. */
+typedef struct MpmStream_ {
+    uint8_t mpm_type;
+    /** memory used by the stream state, kept up to date by the matcher */
+    uint32_t size;
+} MpmStream;
+
 typedef struct MpmPattern_ {
     /* length of the pattern */
     uint16_t len;
@@ -84,6 +93,9 @@ typedef struct MpmPattern_ {
  * one per sgh. */
 #define MPMCTX_FLAGS_GLOBAL     BIT_U8(0)
 #define MPMCTX_FLAGS_NODEPTH    BIT_U8(1)
+/* ctx is used for stream data: also prepare streaming search if the
+ * matcher supports it */
+#define MPMCTX_FLAGS_STREAMING  BIT_U8(2)
 
 typedef struct MpmCtx_ {
     void *ctx;
@@ -161,6 +173,24 @@ typedef struct MpmTableElmt_ {
     int  (*Prepare)(struct MpmCtx_ *);
     /** \retval cnt number of patterns that matches: once per pattern max. */
     uint32_t (*Search)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PrefilterRuleStore *, const uint8_t *, uint32_t);
+    /** optional: continue a search from offset with the state of an earlier search.
+     *  \retval cnt number of patterns that matches: once per pattern max. */
+    uint32_t (*SearchStateful)(const struct MpmCtx_ *, struct MpmThreadCtx_ *,
+            PrefilterRuleStore *, const uint8_t *, uint32_t, uint32_t, uint32_t *);
+    /** optional: streaming search for ctxs with MPMCTX_FLAGS_STREAMING. Only
+     *  new data is passed in, matches straddling earlier data are found
+     *  through the state in *stream, which is created on first use.
+     *  \param offset absolute stream offset of the data
+     *  \retval cnt number of patterns that matches */
+    uint32_t (*StreamSearch)(const struct MpmCtx_ *, struct MpmThreadCtx_ *,
+            PrefilterRuleStore *, MpmStream **, const uint8_t *, uint32_t, uint64_t);
+    /** optional: reduce the memory use of a stream that is expected to be
+     *  idle. Next StreamSearch call restores it. */
+    void (*StreamCompress)(MpmStream *);
+    void (*StreamFree)(MpmStream *);
+    /** optional: memory a stream of the ctx uses while it is scanned, so
+     *  callers can check their memcap before StreamSearch opens one */
+    uint32_t (*StreamStateSize)(const struct MpmCtx_ *);
     void (*PrintCtx)(struct MpmCtx_ *);
     void (*PrintThreadCtx)(struct MpmThreadCtx_ *);
     void (*RegisterUnittests)(void);
@@ -195,6 +225,10 @@ int MpmAddPatternCI(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
 
 void MpmFreePattern(MpmCtx *mpm_ctx, MpmPattern *p);
 
+void MpmStreamCompress(MpmStream *s);
+void MpmStreamFree(MpmStream *s);
+uint32_t MpmStreamStateSize(const MpmCtx *mpm_ctx);
+
 int MpmAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
                             uint16_t offset, uint16_t depth, uint32_t pid,
                             SigIntId sid, uint8_t flags);
@@ -36,6 +36,16 @@
 #endif
 #endif
 
+/** hint the CPU to load the cache line with addr for reading, no-op on
+ *  compilers w/o __builtin_prefetch */
+#if CPPCHECK==1
+#define PREFETCH(addr)
+#elif defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+#else
+#define PREFETCH(addr)
+#endif
+
 /** from http://en.wikipedia.org/wiki/Memory_ordering
  *
  *  C Compiler memory barrier
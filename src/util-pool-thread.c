@@ -189,6 +189,26 @@ void *PoolThreadGetById(PoolThread *pt, uint16_t id)
     return data;
 }
 
+uint32_t PoolThreadGetBatchById(PoolThread *pt, uint16_t id, void **out, const uint32_t n)
+{
+    if (pt == NULL || id >= pt->size)
+        return 0;
+
+    uint32_t cnt = 0;
+    PoolThreadElement *e = &pt->array[id];
+    SCMutexLock(&e->lock);
+    for ( ; cnt < n; cnt++) {
+        void *data = PoolGet(e->pool);
+        if (data == NULL)
+            break;
+        PoolThreadId *did = data;
+        *did = id;
+        out[cnt] = data;
+    }
+    SCMutexUnlock(&e->lock);
+    return cnt;
+}
+
 void PoolThreadReturn(PoolThread *pt, void *data)
 {
     PoolThreadId *id = data;
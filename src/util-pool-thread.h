@@ -85,6 +85,15 @@ void PoolThreadFree(PoolThread *pt);
  *  \retval ptr data or NULL */
 void *PoolThreadGetById(PoolThread *pt, uint16_t id);
 
+/** \brief get multiple items from thread pool by thread id
+ *  \note takes the lock once for all items
+ *  \param pt thread pool
+ *  \param id thread id
+ *  \param out array of at least \a n pointers to store the items in
+ *  \param n max number of items to get
+ *  \retval cnt number of items stored in \a out */
+uint32_t PoolThreadGetBatchById(PoolThread *pt, uint16_t id, void **out, const uint32_t n);
+
 /** \brief return data to thread pool
  *  \note wrapper around PoolReturn()
  *  \param pt thread pool
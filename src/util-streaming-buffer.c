@@ -289,6 +289,7 @@ void StreamingBufferClear(StreamingBuffer *sb, const StreamingBufferConfig *cfg)
         }
         sb->region.next = NULL;
         sb->regions = sb->max_regions = 1;
+        sb->reallocs = 0;
     }
 }
 
@@ -699,6 +700,17 @@ static inline uint32_t ToNextMultipleOf(const uint32_t in, const uint32_t m)
     return r;
 }
 
+/** cap on the extra space added by the geometric growth of the main region */
+#define SB_GROW_MAX_STEP BIT_U32(20)
+/** shrink the main region once it is this many times larger than needed */
+#define SB_SHRINK_FACTOR 4
+
+static inline void CountRealloc(StreamingBuffer *sb)
+{
+    if (sb->reallocs < UINT16_MAX)
+        sb->reallocs++;
+}
+
 static thread_local bool g2s_warn_once = false;
 
 static inline int WARN_UNUSED GrowRegionToSize(StreamingBuffer *sb,
@@ -723,6 +735,7 @@ static inline int WARN_UNUSED GrowRegionToSize(StreamingBuffer *sb,
     if (ptr == NULL) {
         return sc_errno;
     }
+    CountRealloc(sb);
     /* for safe printing and general caution, lets memset the
      * new data to 0 */
     size_t diff = grow - region->buf_size;
@@ -740,12 +753,68 @@ static inline int WARN_UNUSED GrowRegionToSize(StreamingBuffer *sb,
     return SC_OK;
 }
 
+/** \internal
+ *  \brief grow the main region to at least \a size
+ *
+ *  In order appends grow the main region a little at a time. With
+ *  cfg->grow_geometric set, growing it by half its size (capped to
+ *  SB_GROW_MAX_STEP) instead of to the next cfg->buf_size multiple keeps the
+ *  number of realloc+copy cycles logarithmic. The excess is given back by
+ *  ShrinkMainRegion when the buffer slides. If the extra room doesn't fit in
+ *  the memcap, only the required size is allocated. */
 static int WARN_UNUSED GrowToSize(
-        StreamingBuffer *sb, const StreamingBufferConfig *cfg, uint32_t size)
+        StreamingBuffer *sb, const StreamingBufferConfig *cfg, const uint32_t size)
 {
+    if (!cfg->grow_geometric)
+        return GrowRegionToSize(sb, cfg, &sb->region, size);
+
+    const uint32_t step = MIN(sb->region.buf_size / 2, SB_GROW_MAX_STEP);
+    const uint64_t geometric = (uint64_t)sb->region.buf_size + step;
+    if (size < geometric && geometric <= BIT_U32(30)) {
+        const int r = GrowRegionToSize(sb, cfg, &sb->region, (uint32_t)geometric);
+        if (r != SC_ELIMIT)
+            return r;
+    }
     return GrowRegionToSize(sb, cfg, &sb->region, size);
 }
 
+/** \internal
+ *  \brief give back memory of an oversized main region after a slide
+ *
+ *  Only the single region case is handled here, the multi region slide
+ *  already sizes the main region to its data. The region is halved, but not
+ *  below twice the size needed for the data (incl. data tracked by the SBB
+ *  tree), so that a stream with a steady window doesn't alternate between
+ *  shrinking and growing. If the realloc fails we keep the old buffer.
+ */
+static void ShrinkMainRegion(StreamingBuffer *sb, const StreamingBufferConfig *cfg)
+{
+    if (!cfg->grow_geometric || sb->region.buf == NULL || cfg->buf_size == 0)
+        return;
+
+    uint64_t used = sb->region.buf_offset;
+    const StreamingBufferBlock *last = RB_MAX(SBB, &sb->sbb_tree);
+    if (last != NULL && last->offset + last->len > sb->region.stream_offset) {
+        used = MAX(used, last->offset + last->len - sb->region.stream_offset);
+    }
+    if (used > sb->region.buf_size)
+        return;
+
+    const uint32_t need = ToNextMultipleOf((uint32_t)used + cfg->buf_size, cfg->buf_size);
+    if ((uint64_t)need * SB_SHRINK_FACTOR > sb->region.buf_size)
+        return;
+
+    const uint32_t new_size =
+            MAX(need * 2, ToNextMultipleOf(sb->region.buf_size / 2, cfg->buf_size));
+    void *ptr = REALLOC(cfg, sb->region.buf, sb->region.buf_size, new_size);
+    if (ptr == NULL)
+        return;
+    SCLogDebug("shrunk main region from %u to %u", sb->region.buf_size, new_size);
+    sb->region.buf = ptr;
+    sb->region.buf_size = new_size;
+    CountRealloc(sb);
+}
+
 static inline bool RegionBeforeOffset(const StreamingBufferRegion *r, const uint64_t o)
 {
     return (r->stream_offset + r->buf_size <= o);
@@ -974,6 +1043,7 @@ static inline void StreamingBufferSlideToOffsetWithRegions(
             if (ptr != NULL) {
                 to_shift->buf = ptr;
                 to_shift->buf_size = new_mem_size;
+                CountRealloc(sb);
                 SCLogDebug("new buf_size %u", to_shift->buf_size);
             }
             if (s < to_shift->buf_offset)
@@ -1054,6 +1124,7 @@ void StreamingBufferSlideToOffset(
             }
         }
         SBBPrune(sb, cfg);
+        ShrinkMainRegion(sb, cfg);
     }
 #ifdef DEBUG
     SBBPrintList(sb);
@@ -2317,6 +2388,115 @@ static int StreamingBufferTest10(void)
     PASS;
 }
 
+/** \test geometric growth on append and shrinking of the main region when
+ *        the data is consumed */
+static int StreamingBufferTest11(void)
+{
+    StreamingBufferConfig cfg = {
+        16, 1, STREAMING_BUFFER_REGION_GAP_DEFAULT, NULL, NULL, NULL, true
+    };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        const uint8_t c = (uint8_t)i;
+        FAIL_IF(StreamingBufferAppendNoTrack(sb, &cfg, &c, 1) != 0);
+    }
+    FAIL_IF(sb->region.buf_offset != 1024);
+    FAIL_IF(sb->region.buf_size < 1024);
+    /* growing in buf_size steps would take 63 reallocs */
+    FAIL_IF(sb->reallocs > 16);
+    const uint16_t grow_reallocs = sb->reallocs;
+
+    StreamingBufferSlideToOffset(sb, &cfg, 1020);
+    FAIL_IF(sb->region.stream_offset != 1020);
+    FAIL_IF(sb->region.buf_offset != 4);
+    FAIL_IF(sb->reallocs != grow_reallocs + 1);
+    const uint32_t shrunk = sb->region.buf_size;
+    FAIL_IF(shrunk > 1024);
+
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    uint64_t offset = 0;
+    FAIL_IF_NOT(StreamingBufferGetData(sb, &data, &data_len, &offset));
+    FAIL_IF(offset != 1020);
+    FAIL_IF(data_len != 4);
+    FAIL_IF(data[0] != (uint8_t)1020 || data[3] != (uint8_t)1023);
+
+    /* halved on each slide for as long as it is SB_SHRINK_FACTOR times
+     * larger than what the data needs (32 bytes here) */
+    StreamingBufferSlideToOffset(sb, &cfg, 1021);
+    FAIL_IF(sb->region.buf_size >= shrunk);
+    for (uint32_t i = 0; i < 8; i++) {
+        const uint8_t c = (uint8_t)(1024 + i);
+        FAIL_IF(StreamingBufferAppendNoTrack(sb, &cfg, &c, 1) != 0);
+        StreamingBufferSlideToOffset(sb, &cfg, 1022 + i);
+    }
+    FAIL_IF(sb->region.buf_offset != 3);
+    FAIL_IF(sb->region.buf_size != 96);
+
+    StreamingBufferClear(sb, &cfg);
+    FAIL_IF(sb->reallocs != 0);
+    StreamingBufferFree(sb, &cfg);
+    PASS;
+}
+
+static void *StreamingBufferTest12Realloc(void *ptr, size_t orig_size, size_t size)
+{
+    if (size > 1024) {
+        sc_errno = SC_ELIMIT;
+        return NULL;
+    }
+    return SCRealloc(ptr, size);
+}
+
+/** \test geometric growth falls back to the required size at the limit */
+static int StreamingBufferTest12(void)
+{
+    StreamingBufferConfig cfg = { 16, 1, STREAMING_BUFFER_REGION_GAP_DEFAULT, NULL,
+        StreamingBufferTest12Realloc, NULL, true };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        const uint8_t c = (uint8_t)i;
+        FAIL_IF(StreamingBufferAppendNoTrack(sb, &cfg, &c, 1) != 0);
+    }
+    FAIL_IF(sb->region.buf_offset != 1024);
+    FAIL_IF(sb->region.buf_size != 1024);
+
+    /* over the limit for real */
+    const uint8_t c = 0;
+    FAIL_IF(StreamingBufferAppendNoTrack(sb, &cfg, &c, 1) == 0);
+    FAIL_IF(sb->region.buf_offset != 1024);
+
+    StreamingBufferFree(sb, &cfg);
+    PASS;
+}
+
+/** \test without grow_geometric the main region grows in buf_size steps and
+ *        is not shrunk on slides */
+static int StreamingBufferTest13(void)
+{
+    StreamingBufferConfig cfg = { 16, 1, STREAMING_BUFFER_REGION_GAP_DEFAULT, NULL, NULL, NULL };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        const uint8_t c = (uint8_t)i;
+        FAIL_IF(StreamingBufferAppendNoTrack(sb, &cfg, &c, 1) != 0);
+    }
+    FAIL_IF(sb->region.buf_offset != 1024);
+    FAIL_IF(sb->region.buf_size != 1024);
+
+    StreamingBufferSlideToOffset(sb, &cfg, 1020);
+    FAIL_IF(sb->region.buf_offset != 4);
+    FAIL_IF(sb->region.buf_size != 1024);
+
+    StreamingBufferFree(sb, &cfg);
+    PASS;
+}
+
 #endif
 
 void StreamingBufferRegisterTests(void)
@@ -2330,5 +2510,8 @@ void StreamingBufferRegisterTests(void)
     UtRegisterTest("StreamingBufferTest08", StreamingBufferTest08);
     UtRegisterTest("StreamingBufferTest09", StreamingBufferTest09);
     UtRegisterTest("StreamingBufferTest10", StreamingBufferTest10);
+    UtRegisterTest("StreamingBufferTest11", StreamingBufferTest11);
+    UtRegisterTest("StreamingBufferTest12", StreamingBufferTest12);
+    UtRegisterTest("StreamingBufferTest13", StreamingBufferTest13);
 #endif
 }
@@ -70,6 +70,9 @@ typedef struct StreamingBufferConfig_ {
     void *(*Calloc)(size_t n, size_t size);
     void *(*Realloc)(void *ptr, size_t orig_size, size_t size);
     void (*Free)(void *ptr, size_t size);
+    /** grow the main region by half its size on appends and shrink it again
+     *  on slides. For buffers that slide regularly, like TCP streams. */
+    bool grow_geometric;
 } StreamingBufferConfig;
 
 #define STREAMING_BUFFER_CONFIG_INITIALIZER                                                        \
@@ -113,6 +116,7 @@ typedef struct StreamingBuffer_ {
     uint32_t sbb_size;          /**< data size covered by sbbs */
     uint16_t regions;
     uint16_t max_regions;
+    uint16_t reallocs; /**< number of times a region was resized, saturates */
 #ifdef DEBUG
     uint32_t buf_size_max;
 #endif
@@ -143,9 +147,10 @@ static inline uint64_t StreamingBufferGetOffset(const StreamingBuffer *sb)
         0,                                                                                         \
         1,                                                                                         \
         1,                                                                                         \
+        0,                                                                                         \
     };
 #else
-#define STREAMING_BUFFER_INITIALIZER { STREAMING_BUFFER_REGION_INIT, { NULL }, NULL, 0, 1, 1, 0 };
+#define STREAMING_BUFFER_INITIALIZER { STREAMING_BUFFER_REGION_INIT, { NULL }, NULL, 0, 1, 1, 0, 0 };
 #endif
 
 typedef struct StreamingBufferSegment_ {
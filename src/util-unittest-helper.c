@@ -505,6 +505,7 @@ Flow *UTHBuildFlow(int family, const char *src, const char *dst, Port sp, Port d
 void UTHFreeFlow(Flow *flow)
 {
     if (flow != NULL) {
+        FlowColdFree(flow);
         SCFree(flow);//FlowFree(flow);
     }
 }